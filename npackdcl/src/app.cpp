@@ -6,17 +6,24 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QTextStream>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
 
 #include "app.h"
 #include "wpmutils.h"
 #include "commandline.h"
 #include "downloader.h"
+#include "downloadscheduler.h"
 #include "installedpackages.h"
 #include "installedpackageversion.h"
 #include "abstractrepository.h"
 #include "dbrepository.h"
+#include "planexplanation.h"
+#include "dependencysolver.h"
+#include "downloadcache.h"
 #include "hrtimer.h"
 #include "controlpanelthirdpartypm.h"
+#include "downloadstatistics.h"
 
 static bool compareByPackageTitle(const QPair<PackageVersion*, QString>& e1,
         const QPair<PackageVersion*, QString>& e2) {
@@ -71,7 +78,7 @@ int App::process()
 {
     // alphabetically sorted options by the short name
     cl.add("bare-format", 'b', "bare format (no heading or summary)",
-            "", false, "list,list-repos,search,install-dir,which,where,info,path");
+            "", false, "list,list-repos,search,install-dir,which,where,info,path,cache,stats");
     cl.add("cmd", 'c', "output a .cmd script",
             "", false, "path");
     cl.add("debug", 'd', "turn on the debug output", "", false);
@@ -81,9 +88,10 @@ int App::process()
     cl.add("file", 'f', "file or directory", "file", false,
             "add,place,set-install-dir,update,where,which,path");
     cl.add("install", 'i',
-            "install a package if it was not installed", "", false, "update");
+            "install a package if it was not installed", "", false,
+            "update,prefetch");
     cl.add("json", 'j', "json format for the output",
-            "", false, "list,list-repos,search,install-dir,which,where,info,path");
+            "", false, "list,list-repos,search,install-dir,which,where,info,path,cache,prefetch,stats");
     cl.add("keep-directories", 'k',
             "use the same directories for updated packages", "", false,
            "update");
@@ -94,11 +102,11 @@ int App::process()
             "assume that there is no user and do not ask for input", "", false);
     cl.add("package", 'p',
             "internal package name (e.g. com.example.Editor or just Editor)",
-            "package", true, "add,info,path,place,remove,update,rm,build");
+            "package", true, "add,info,path,place,remove,update,rm,build,cache,prefetch");
     cl.add("query", 'q', "search terms (e.g. editor)",
             "search terms", false, "search");
     cl.add("versions", 'r', "versions range (e.g. [1.5,2))",
-            "range", true, "add,path,update");
+            "range", true, "add,path,update,cache,prefetch");
 
     // --status for the command "list" is supported for compatibility reasons
     cl.add("status", 's', "filters packages by status",
@@ -109,17 +117,44 @@ int App::process()
     cl.add("url", 'u', "repository URL (e.g. https://www.example.com/Rep.xml)",
             "repository", false, "add-repo,remove-repo,set-repo");
     cl.add("version", 'v', "version number (e.g. 1.5.12)",
-            "version", false, "add,info,path,place,rm,remove");
+            "version", false, "add,info,path,place,rm,remove,cache,prefetch");
 
     cl.add("user", 0, "user name for the HTTP authentication",
-            "user name", false, "add,update,detect");
+            "user name", false, "add,update,detect,cache,prefetch");
     cl.add("password", 0, "password for the HTTP authentication",
-            "password", false, "add,update,detect");
+            "password", false, "add,update,detect,cache,prefetch");
 
     cl.add("proxy-user", 0, "user name for the HTTP proxy authentication",
-            "user name", false, "add,update,detect");
+            "user name", false, "add,update,detect,cache,prefetch");
     cl.add("proxy-password", 0, "password for the HTTP proxy authentication",
-            "password", false, "add,update,detect");
+            "password", false, "add,update,detect,cache,prefetch");
+
+    cl.add("parallel-downloads", 0,
+            "maximum number of binaries downloaded in parallel (default: 3)",
+            "number", false, "add,update,cache,prefetch");
+
+    cl.add("segments", 0,
+            "maximum number of connections for downloading one large binary. .zip files that are extracted during the download use one connection (default: 4)",
+            "number", false, "add,update,cache,prefetch");
+
+    cl.add("max-bandwidth", 0,
+            "maximum download bandwidth for all connections in KiB/s (default: unlimited)",
+            "KiB/s", false, "add,update,cache,prefetch");
+
+    cl.add("parallel-installs", 0,
+            "maximum number of independent packages installed or removed in parallel (default: 1)",
+            "number", false, "add,remove,rm,update");
+
+    cl.add("explain-plan", 0,
+            "print the planning decisions and times in JSON format instead of changing packages",
+            "", false, "add,remove,rm,update");
+
+    cl.add("prune", 0,
+            "remove the least recently used files from the download cache",
+            "", false, "cache");
+    cl.add("max-size", 0,
+            "maximum size of the download cache in MiB (default: 2048)",
+            "MiB", false, "cache");
 
     cl.add("title", 0, "package title or a regular expression in JavaScript syntax. Example: /PDF/i",
             "title", false, "remove-scp");
@@ -158,8 +193,9 @@ int App::process()
         Job* job = new Job();
         usage(job);
         delete job;
-    } else if (fr.count() > 1) {
-        err = QStringLiteral("Unexpected argument: ") + fr.at(1);
+    } else if (fr.count() > 2 || (fr.count() == 2 && fr.at(0) != "stats")) {
+        // only "stats" has a sub-command
+        err = QStringLiteral("Unexpected argument: ") + fr.at(fr.count() - 1);
     } else {
         const QString cmd = fr.at(0);
 
@@ -200,6 +236,65 @@ int App::process()
             }
         }
 
+        QString parallelDownloads = cl.get("parallel-downloads");
+        if (err.isEmpty() && !parallelDownloads.isNull()) {
+            bool ok;
+            int parallelDownloads_ = parallelDownloads.toInt(&ok);
+            if (ok) {
+                if (parallelDownloads_ > 0)
+                    AbstractRepository::setMaxParallelDownloads(
+                            parallelDownloads_);
+                else
+                    err = "The value for --parallel-downloads should be positive";
+            } else {
+                err = "The value for --parallel-downloads is not a valid number";
+            }
+        }
+
+        QString segments = cl.get("segments");
+        if (err.isEmpty() && !segments.isNull()) {
+            bool ok;
+            int segments_ = segments.toInt(&ok);
+            if (ok) {
+                if (segments_ > 0)
+                    PackageVersion::setDownloadSegments(segments_);
+                else
+                    err = "The value for --segments should be positive";
+            } else {
+                err = "The value for --segments is not a valid number";
+            }
+        }
+
+        QString maxBandwidth = cl.get("max-bandwidth");
+        if (err.isEmpty() && !maxBandwidth.isNull()) {
+            bool ok;
+            int maxBandwidth_ = maxBandwidth.toInt(&ok);
+            if (ok) {
+                if (maxBandwidth_ > 0)
+                    DownloadScheduler::setMaxBandwidth(
+                            static_cast<int64_t>(maxBandwidth_) * 1024);
+                else
+                    err = "The value for --max-bandwidth should be positive";
+            } else {
+                err = "The value for --max-bandwidth is not a valid number";
+            }
+        }
+
+        QString parallelInstalls = cl.get("parallel-installs");
+        if (err.isEmpty() && !parallelInstalls.isNull()) {
+            bool ok;
+            int parallelInstalls_ = parallelInstalls.toInt(&ok);
+            if (ok) {
+                if (parallelInstalls_ > 0)
+                    AbstractRepository::setMaxParallelInstalls(
+                            parallelInstalls_);
+                else
+                    err = "The value for --parallel-installs should be positive";
+            } else {
+                err = "The value for --parallel-installs is not a valid number";
+            }
+        }
+
         if (!err.isEmpty()) {
             job->setErrorMessage(err);
         } else if (cmd == "help") {
@@ -244,6 +339,12 @@ int App::process()
             getInstallPath(job);
         } else if (cmd == "build") {
             build(job);
+        } else if (cmd == "cache") {
+            cache(job);
+        } else if (cmd == "prefetch") {
+            prefetch(job);
+        } else if (cmd == "stats") {
+            stats(job, fr.value(1));
         } else {
             job->setErrorMessage(QStringLiteral("Wrong command: ") + cmd +
                     QStringLiteral(". Try \"ncl help\""));
@@ -253,6 +354,8 @@ int App::process()
 
         this->currentJob = nullptr;
 
+        DownloadStatistics::flush();
+
         delete job;
     }
 
@@ -327,6 +430,9 @@ void App::usage(Job* job)
         "            [--file <installation directory>]",
         "            [--user <user name>] [--password <password>]",
         "            [--proxy-user <proxy user name>] [--proxy-password <proxy password>]",
+        "            [--parallel-downloads <number>] [--parallel-installs <number>]",
+        "            [--segments <number>] [--max-bandwidth <KiB/s>]",
+        "            [--explain-plan]",
         "        installs packages. The newest available version will be ",
         "        installed, if none is specified.",
         "    ncl add-repo --url <repository>",
@@ -334,6 +440,17 @@ void App::usage(Job* job)
         "    ncl build --package <package> [--version <version> | --versions <versions>])",
         "            --output-package <package>",
         "        build a package from another one (e.g. a binary from source code)",
+        "    ncl cache [--bare-format | --json]",
+        "            [--prune [--max-size <MiB>]]",
+        "            [(--package <package>",
+        "            [--version <version> | --versions <versions>])+]",
+        "            [--user <user name>] [--password <password>]",
+        "            [--proxy-user <proxy user name>] [--proxy-password <proxy password>]",
+        "            [--parallel-downloads <number>] [--segments <number>]",
+        "            [--max-bandwidth <KiB/s>]",
+        "        lists the downloaded package binaries in the cache, removes",
+        "        the least recently used ones or downloads the specified",
+        "        package versions into the cache",
         "    ncl check",
         "        checks the installed packages for missing dependencies",
         "    ncl detect [--user <user name>] [--password <password>]",
@@ -355,12 +472,23 @@ void App::usage(Job* job)
         "            [--version <version> | --versions <versions>])+ ",
         "            [--cmd | --json]",
         "        searches for installed packages and prints their locations",
+        "    ncl prefetch (--package <package>",
+        "            [--version <version> | --versions <versions>])+",
+        "            [--install] [--json]",
+        "            [--user <user name>] [--password <password>]",
+        "            [--proxy-user <proxy user name>] [--proxy-password <proxy password>]",
+        "            [--parallel-downloads <number>] [--segments <number>]",
+        "            [--max-bandwidth <KiB/s>]",
+        "        downloads and verifies the binaries that \"ncl update\" (or",
+        "        \"ncl add\" if --version is used) would need into the download",
+        "        cache. Nothing is installed or removed.",
         "    ncl place --package <package>",
         "            --version <version> --file <directory>",
         "            [--bare-format | --json]",
         "        registers a package version installed without Npackd",
         "    ncl remove|rm (--package <package> [--version <version>])+",
-        "           [--end-process <types>]",
+        "           [--end-process <types>] [--parallel-installs <number>]",
+        "           [--explain-plan]",
         "        removes packages. The version number may be omitted, ",
         "        if only one is installed.",
         "    ncl remove-scp --title <title>",
@@ -378,12 +506,18 @@ void App::usage(Job* job)
         "        changes the directory where packages will be installed. The",
         "        default directory for program files is used if the --file",
         "        parameter is missing.",
+        "    ncl stats downloads [--bare-format | --json]",
+        "        shows the percentiles and histograms for the HTTP transfers",
+        "        of the last 30 days for each host",
         "    ncl update (--package <package> [--versions <versions>])+",
         "            [--end-process <types>]",
         "            [--install] [--keep-directories]",
         "            [--file <installation directory>]",
         "            [--user <user name>] [--password <password>]",
         "            [--proxy-user <proxy user name>] [--proxy-password <proxy password>]",
+        "            [--parallel-downloads <number>] [--parallel-installs <number>]",
+        "            [--segments <number>] [--max-bandwidth <KiB/s>]",
+        "            [--explain-plan]",
         "        updates packages by uninstalling the currently installed",
         "        and installing the newest version. ",
         "    ncl where --file <relative path> [--bare-format | --json]",
@@ -1038,66 +1172,94 @@ void App::removeRepo(Job* job)
 #undef max
 #endif
 
-void App::path(Job* job)
+bool App::findPathsFast(QStringList* paths)
 {
-    if (job->shouldProceed()) {
-        QString err = DBRepository::getDefault()->openDefault();
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-    }
-
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.1,
-                "Reading list of installed packages from the registry");
-        InstalledPackages* ip = InstalledPackages::getDefault();
-        QString err = ip->readRegistryDatabase();
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-        else
-            sub->completeWithProgress();
-    }
+    bool ok = true;
+    QList<CommandLine::ParsedOption *> pos = cl.getParsedOptions();
+    InstalledPackages* ip = InstalledPackages::getDefault();
 
-    QString err;
-    QList<InstalledPackageVersion*> ipvs =
-            PackageVersion::getPathPackageVersionOptions(cl, &err);
-    if (!err.isEmpty())
-        job->setErrorMessage(err);
+    for (int i = 0; i < pos.size() && ok; i++) {
+        CommandLine::ParsedOption* po = pos.at(i);
+        if (po->opt->nameMathes("package")) {
+            CommandLine::ParsedOption* ponext = nullptr;
+            if (i + 1 < pos.size())
+                ponext = pos.at(i + 1);
 
-/*
-    QString path;
-    if (job->shouldProceed()) {
-        // no long-running operation can be done here.
-        // "npackdcl path" must be fast.
-        path = InstalledPackages::getDefault()->findPath_npackdcl(d);
-    }
+            Dependency d;
+            d.package = po->value;
+            if (!d.package.contains('.') || !Package::isValidName(d.package))
+                ok = false;
 
-    if (job->shouldProceed() && path.isEmpty() && !package.contains('.')) {
-        QString err = DBRepository::getDefault()->openDefault("default", true);
-        if (err.isEmpty()) {
-            Package* p = AbstractRepository::findOnePackage(package, &err);
-            if (!err.isEmpty()) {
-                delete p;
-                p = 0;
+            if (ok) {
+                if (ponext != nullptr && ponext->opt->nameMathes("versions")) {
+                    i++;
+                    ok = d.setVersions(ponext->value);
+                } else if (ponext != nullptr &&
+                        ponext->opt->nameMathes("version")) {
+                    i++;
+                    Version v;
+                    ok = v.setVersion(ponext->value);
+                    if (ok)
+                        d.setExactVersion(v);
+                } else {
+                    d.setUnboundedVersions();
+                }
             }
 
-            if (p) {
-                d.package = p->name;
-                path = InstalledPackages::getDefault()->findPath_npackdcl(d);
+            if (ok) {
+                QString path = ip->findPath_npackdcl(d);
+                if (path.isEmpty())
+                    ok = false;
+                else
+                    paths->append(path.replace('/', '\\'));
             }
-
-            delete p;
-        } else {
-            job->setErrorMessage(err);
         }
     }
-    */
 
-    if (err.isEmpty()) {
-        QStringList paths;
+    return ok;
+}
+
+void App::path(Job* job)
+{
+    // no long-running operation can be done here. "npackdcl path" must be
+    // fast. The package database is only used if the index of installed
+    // packages is not sufficient.
+    QStringList paths;
+    bool fast = findPathsFast(&paths);
+
+    QString err;
+    if (!fast) {
+        paths.clear();
+
+        if (job->shouldProceed()) {
+            QString err = DBRepository::getDefault()->openDefault();
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        }
+
+        if (job->shouldProceed()) {
+            Job* sub = job->newSubJob(0.1,
+                    "Reading list of installed packages from the registry");
+            InstalledPackages* ip = InstalledPackages::getDefault();
+            QString err = ip->readRegistryDatabase();
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+            else
+                sub->completeWithProgress();
+        }
+
+        QList<InstalledPackageVersion*> ipvs =
+                PackageVersion::getPathPackageVersionOptions(cl, &err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+
         for (int i = 0; i < ipvs.size(); i++) {
             paths.append(ipvs.at(i)->getDirectory().replace('/', '\\'));
         }
+        qDeleteAll(ipvs);
+    }
 
+    if (err.isEmpty()) {
         if (cl.isPresent("json")) {
             QJsonObject top;
             QJsonArray path;
@@ -1248,41 +1410,9 @@ void App::place(Job* job)
     job->complete();
 }
 
-void App::update(Job* job)
+void App::planUpdate(Job* job, InstalledPackages& installed,
+        QList<InstallOperation*>& ops, PlanExplanation* explanation)
 {
-    DBRepository* rep = DBRepository::getDefault();
-    job->setTitle("Updating packages");
-
-    if (job->shouldProceed()) {
-        QString err = DBRepository::getDefault()->openDefault();
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-    }
-
-    if (job->shouldProceed()) {
-        QString err = InstalledPackages::getDefault()->readRegistryDatabase();
-        if (!err.isEmpty()) {
-            job->setErrorMessage(err);
-        } else {
-            job->setProgress(0.05);
-        }
-    }
-
-    QString user = cl.get("user");
-    QString password = cl.get("password");
-
-    QString proxyUser = cl.get("proxy-user");
-    QString proxyPassword = cl.get("proxy-password");
-
-    DWORD programCloseType = WPMUtils::CLOSE_WINDOW;
-    if (job->shouldProceed()) {
-        QString err;
-        programCloseType = WPMUtils::getProgramCloseType(cl, &err);
-        if (!err.isEmpty()) {
-            job->setErrorMessage(err);
-        }
-    }
-
     QStringList packages_;
     QStringList versions_;
 
@@ -1388,26 +1518,79 @@ void App::update(Job* job)
     bool keepDirectories = cl.isPresent("keep-directories");
     bool install = cl.isPresent("install");
 
-    QList<InstallOperation*> ops;
-    InstalledPackages installed(*InstalledPackages::getDefault());
-
     if (job->shouldProceed()) {
+        if (explanation)
+            explanation->startPhase("missing dependencies");
+
         QString err = DBRepository::getDefault()->planAddMissingDeps(
                 installed, ops);
         if (!err.isEmpty())
             job->setErrorMessage(err);
+
+        if (explanation)
+            explanation->endPhase();
     }
 
-    bool up2date = false;
     if (job->shouldProceed()) {
         qCDebug(npackd) << "planning updates for" << toUpdate.size() <<
                 "packages and " << toUpdate2.size() << "version ranges";
 
-        QString err = rep->planUpdates(installed, toUpdate, toUpdate2, ops,
-                keepDirectories, install, file);
+        QString err = DBRepository::getDefault()->planUpdates(installed,
+                toUpdate, toUpdate2, ops, keepDirectories, install, file,
+                true, explanation);
         if (!err.isEmpty())
             job->setErrorMessage(err);
-        else {
+    }
+
+    qDeleteAll(toUpdate);
+    qDeleteAll(toUpdate2);
+}
+
+void App::update(Job* job)
+{
+    job->setTitle("Updating packages");
+
+    if (job->shouldProceed()) {
+        QString err = DBRepository::getDefault()->openDefault();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        QString err = InstalledPackages::getDefault()->readRegistryDatabase();
+        if (!err.isEmpty()) {
+            job->setErrorMessage(err);
+        } else {
+            job->setProgress(0.05);
+        }
+    }
+
+    QString user = cl.get("user");
+    QString password = cl.get("password");
+
+    QString proxyUser = cl.get("proxy-user");
+    QString proxyPassword = cl.get("proxy-password");
+
+    DWORD programCloseType = WPMUtils::CLOSE_WINDOW;
+    if (job->shouldProceed()) {
+        QString err;
+        programCloseType = WPMUtils::getProgramCloseType(cl, &err);
+        if (!err.isEmpty()) {
+            job->setErrorMessage(err);
+        }
+    }
+
+    bool explain = cl.isPresent("explain-plan");
+
+    QList<InstallOperation*> ops;
+    InstalledPackages installed(*InstalledPackages::getDefault());
+
+    PlanExplanation explanation;
+
+    bool up2date = false;
+    if (job->shouldProceed()) {
+        planUpdate(job, installed, ops, explain ? &explanation : nullptr);
+        if (job->shouldProceed()) {
             qCDebug(npackd) << "the update plan contains" << ops.size() <<
                     "operations";
 
@@ -1416,6 +1599,13 @@ void App::update(Job* job)
         }
     }
 
+    if (explain) {
+        printPlanExplanation(job, explanation, ops);
+
+        // the plan is only printed
+        up2date = true;
+    }
+
     /**
      *confirmation. This is not yet enabled in order to maintain the
      * compatibility.
@@ -1440,7 +1630,7 @@ void App::update(Job* job)
     }
     qDeleteAll(ops);
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !explain) {
         if (up2date) {
             WPMUtils::writeln("The packages are already up-to-date");
         } else if (job->getErrorMessage().isEmpty()) {
@@ -1449,12 +1639,31 @@ void App::update(Job* job)
         }
     }
 
-    qDeleteAll(toUpdate);
-    qDeleteAll(toUpdate2);
-
     job->complete();
 }
 
+void App::printPlanExplanation(Job* job,
+        const PlanExplanation& explanation,
+        const QList<InstallOperation*>& ops)
+{
+    QJsonObject top = explanation.toJSON();
+    QJsonArray operations;
+    for (int i = 0; i < ops.size(); i++) {
+        InstallOperation* op = ops.at(i);
+        QJsonObject o;
+        o["install"] = op->install;
+        o["package"] = op->package;
+        o["version"] = op->version.getVersionString();
+        if (!op->where.isEmpty())
+            o["where"] = op->where;
+        operations.append(o);
+    }
+    top["operations"] = operations;
+    if (!job->getErrorMessage().isEmpty())
+        top["error"] = job->getErrorMessage();
+    printJSON(top);
+}
+
 void App::processInstallOperations(Job *job,
         const QList<InstallOperation *> &ops, DWORD programCloseType,
         bool interactive, const QString user, const QString password,
@@ -1692,44 +1901,138 @@ void App::build(Job* job)
     job->complete();
 }
 
-void App::add(Job* job)
+void App::cache(Job* job)
 {
-    job->setTitle("Installing packages");
+    bool bare = cl.isPresent("bare-format");
+    bool json = cl.isPresent("json");
 
-    if (job->shouldProceed()) {
+    DownloadCache* dc = DownloadCache::getDefault();
+
+    qint64 maxSize = dc->getMaxSize();
+    QString maxSize_ = cl.get("max-size");
+    if (job->shouldProceed() && !maxSize_.isNull()) {
+        bool ok;
+        qint64 v = maxSize_.toLongLong(&ok);
+        if (!ok)
+            job->setErrorMessage("The value for --max-size is not a valid number");
+        else if (v < 0)
+            job->setErrorMessage("The value for --max-size should not be negative");
+        else if (!cl.isPresent("prune"))
+            job->setErrorMessage("The option --max-size can only be used together with --prune");
+        else
+            maxSize = v * 1024 * 1024;
+    }
+
+    QList<PackageVersion*> toDownload;
+    if (job->shouldProceed() && cl.isPresent("package")) {
         QString err = DBRepository::getDefault()->openDefault();
+        if (err.isEmpty())
+            toDownload = PackageVersion::getAddPackageVersionOptions(cl, &err);
         if (!err.isEmpty())
             job->setErrorMessage(err);
     }
 
-    if (job->shouldProceed()) {
-        /* we ignore the returned error as it should also work for non-admins */
-        addNpackdCL();
+    if (job->shouldProceed() && toDownload.size() > 0) {
+        job->setTitle("Downloading package binaries into the cache");
+
+        QString user = cl.get("user");
+        QString password = cl.get("password");
+        QString proxyUser = cl.get("proxy-user");
+        QString proxyPassword = cl.get("proxy-password");
+
+        // only binaries with a hash sum can be cached
+        QList<PackageVersion*> withHashSum;
+        for (int i = 0; i < toDownload.size(); i++) {
+            PackageVersion* pv = toDownload.at(i);
+            if (pv->sha1.isEmpty())
+                qCWarning(npackd).noquote() << QString(
+                        "%1 cannot be cached as it has no hash sum").
+                        arg(pv->toString());
+            else
+                withHashSum.append(pv);
+        }
+
+        Downloader::Request credentials = QUrl();
+        credentials.interactive = interactive;
+        credentials.user = user;
+        credentials.password = password;
+        credentials.proxyUser = proxyUser;
+        credentials.proxyPassword = proxyPassword;
+
+        Job* sub = job->newSubJob(0.9, "Downloading");
+        qint64 bytes;
+        AbstractRepository::prefetch(sub, withHashSum, credentials, &bytes);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
     }
+    qDeleteAll(toDownload);
 
-    InstalledPackages* ip = InstalledPackages::getDefault();
+    if (job->shouldProceed() && cl.isPresent("prune")) {
+        QString err = dc->prune(maxSize);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
 
     if (job->shouldProceed()) {
-        QString err = ip->readRegistryDatabase();
-        if (!err.isEmpty()) {
-            job->setErrorMessage(err);
+        QList<DownloadCache::Entry> entries = dc->list();
+
+        qint64 total = 0;
+        for (int i = 0; i < entries.size(); i++) {
+            total += entries.at(i).size;
+        }
+
+        if (json) {
+            QJsonObject top;
+            top["directory"] = dc->getDirectory();
+            top["size"] = total;
+            top["maxSize"] = maxSize;
+            QJsonArray files;
+            for (int i = 0; i < entries.size(); i++) {
+                const DownloadCache::Entry& e = entries.at(i);
+                QJsonObject file;
+                file["hashSumType"] = e.alg == QCryptographicHash::Sha1 ?
+                        "SHA-1" : "SHA-256";
+                file["hashSum"] = e.hashSum;
+                file["size"] = e.size;
+                file["lastUsed"] = e.lastUsed.toString(Qt::ISODate);
+                files.append(file);
+            }
+            top["files"] = files;
+
+            printJSON(top);
         } else {
-            job->setProgress(0.1);
+            if (!bare) {
+                WPMUtils::writeln(QString("%1 files (%2 MiB of %3 MiB) in %4:").
+                        arg(entries.size()).
+                        arg(total / (1024 * 1024)).
+                        arg(maxSize / (1024 * 1024)).
+                        arg(dc->getDirectory()));
+                WPMUtils::writeln("");
+            }
+            for (int i = 0; i < entries.size(); i++) {
+                const DownloadCache::Entry& e = entries.at(i);
+                WPMUtils::writeln(QString("%1 %2 %3").
+                        arg(e.lastUsed.toString(Qt::ISODate)).
+                        arg(e.size, 12).
+                        arg(e.hashSum));
+            }
         }
     }
 
+    job->complete();
+}
+
+void App::planAdd(Job* job, InstalledPackages& installed,
+        QList<InstallOperation*>& ops, PlanExplanation* explanation)
+{
+    InstalledPackages* ip = InstalledPackages::getDefault();
+
     QString err;
     QList<PackageVersion*> toInstall =
             PackageVersion::getAddPackageVersionOptions(cl, &err);
     if (!err.isEmpty())
         job->setErrorMessage(err);
 
-    QString user = cl.get("user");
-    QString password = cl.get("password");
-
-    QString proxyUser = cl.get("proxy-user");
-    QString proxyPassword = cl.get("proxy-password");
-
     QString file = cl.get("file");
     if (job->shouldProceed()) {
         if (!file.isNull()) {
@@ -1753,32 +2056,389 @@ void App::add(Job* job)
     }
 
     // debug: WPMUtils::outputTextConsole << "Versions: " << d.toString()) << std::endl;
-    QList<InstallOperation*> ops;
-    InstalledPackages installed(*ip);
-
     if (job->shouldProceed()) {
+        if (explanation)
+            explanation->startPhase("missing dependencies");
+
         err = DBRepository::getDefault()->planAddMissingDeps(installed, ops);
         if (!err.isEmpty())
             job->setErrorMessage(err);
     }
 
     if (job->shouldProceed()) {
+        if (explanation)
+            explanation->startPhase("installations");
+
+        // the same as PackageVersion::planInstallation, but the data from the
+        // repository is read only once for all packages
+        DependencySolver solver(DBRepository::getDefault());
+        solver.setExplanation(explanation);
+
         QString err;
 
         QList<PackageVersion*> avoid;
         for (int i = 0; i < toInstall.size(); i++) {
             PackageVersion* pv = toInstall.at(i);
-            if (job->shouldProceed())
-                err = pv->planInstallation(installed, ops, avoid, file);
+            if (job->shouldProceed()) {
+                int oldSize = ops.size();
+                if (explanation)
+                    explanation->begin("install", pv->package, pv->version);
+
+                err = solver.planInstallation(pv, installed, ops, avoid, file);
+
+                if (explanation) {
+                    explanation->set("operations", ops.size() - oldSize);
+                    explanation->end(err.isEmpty() ? "ok" : "failed", err);
+                }
+            }
             if (!err.isEmpty()) {
                 job->setErrorMessage(err);
             }
         }
     }
 
+    if (explanation)
+        explanation->endPhase();
+
+    qDeleteAll(toInstall);
+}
+
+void App::prefetch(Job* job)
+{
+    job->setTitle("Downloading package binaries into the cache");
+
+    bool json = cl.isPresent("json");
+
+    if (job->shouldProceed()) {
+        QString err = DBRepository::getDefault()->openDefault();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        QString err = InstalledPackages::getDefault()->readRegistryDatabase();
+        if (!err.isEmpty()) {
+            job->setErrorMessage(err);
+        } else {
+            job->setProgress(0.05);
+        }
+    }
+
+    // the same plan as for "ncl add" or "ncl update". Nothing is executed.
+    QList<InstallOperation*> ops;
+    InstalledPackages installed(*InstalledPackages::getDefault());
+    if (job->shouldProceed()) {
+        if (cl.isPresent("version"))
+            planAdd(job, installed, ops);
+        else
+            planUpdate(job, installed, ops, nullptr);
+    }
+
+    // only the installations need binaries
+    QList<PackageVersion*> pvs;
+    QList<PackageVersion*> withHashSum;
+    if (job->shouldProceed()) {
+        for (int i = 0; i < ops.size(); i++) {
+            InstallOperation* op = ops.at(i);
+            if (!op->install)
+                continue;
+
+            QString err;
+            PackageVersion* pv = op->findPackageVersion(&err);
+            if (!pv) {
+                if (err.isEmpty())
+                    err = QString("Cannot find the package version %1 %2").
+                            arg(op->package, op->version.getVersionString());
+                job->setErrorMessage(err);
+                break;
+            }
+
+            pvs.append(pv);
+            if (pv->sha1.isEmpty())
+                qCWarning(npackd).noquote() << QString(
+                        "%1 cannot be downloaded in advance as it has no hash sum").
+                        arg(pv->toString());
+            else
+                withHashSum.append(pv);
+        }
+
+        job->setProgress(0.1);
+    }
+
+    DownloadCache* dc = DownloadCache::getDefault();
+
+    int alreadyCached = 0;
+    for (int i = 0; i < withHashSum.size(); i++) {
+        PackageVersion* pv = withHashSum.at(i);
+        if (dc->contains(pv->hashSumType, pv->sha1))
+            alreadyCached++;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 bytes = 0;
+    if (job->shouldProceed() && withHashSum.size() > 0) {
+        Downloader::Request credentials = QUrl();
+        credentials.interactive = interactive;
+        credentials.user = cl.get("user");
+        credentials.password = cl.get("password");
+        credentials.proxyUser = cl.get("proxy-user");
+        credentials.proxyPassword = cl.get("proxy-password");
+
+        Job* sub = job->newSubJob(0.9, "Downloading");
+        AbstractRepository::prefetch(sub, withHashSum, credentials, &bytes);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    double seconds = timer.elapsed() / 1000.0;
+
+    if (job->shouldProceed()) {
+        qint64 total = 0;
+        for (int i = 0; i < withHashSum.size(); i++) {
+            PackageVersion* pv = withHashSum.at(i);
+            qint64 size = dc->getSize(pv->hashSumType, pv->sha1);
+            if (size > 0)
+                total += size;
+        }
+
+        // the least recently used files are removed if the cache is full
+        if (total > dc->getMaxSize())
+            qCWarning(npackd).noquote() << QString(
+                    "The binaries (%L1 bytes) are larger than the maximum size of the download cache (%L2 bytes)").
+                    arg(total).arg(dc->getMaxSize());
+
+        int downloaded = withHashSum.size() - alreadyCached;
+        if (json) {
+            QJsonObject top;
+            top["binaries"] = withHashSum.size();
+            top["alreadyCached"] = alreadyCached;
+            top["downloaded"] = downloaded;
+            top["downloadedBytes"] = bytes;
+            top["totalBytes"] = total;
+            top["seconds"] = seconds;
+            top["withoutHashSum"] = pvs.size() - withHashSum.size();
+            printJSON(top);
+        } else if (pvs.size() == 0) {
+            WPMUtils::writeln("The packages are already up-to-date");
+        } else {
+            WPMUtils::writeln(QString(
+                    "%1 binaries (%L2 bytes) are in the download cache").
+                    arg(withHashSum.size()).arg(total));
+            WPMUtils::writeln(QString(
+                    "%1 binaries (%L2 bytes) were downloaded in %3 seconds, %4 were already available").
+                    arg(downloaded).arg(bytes).
+                    arg(seconds, 0, 'f', 1).arg(alreadyCached));
+        }
+    }
+
+    qDeleteAll(pvs);
+    qDeleteAll(ops);
+
+    job->complete();
+}
+
+QJsonObject App::percentilesToJSON(QList<double> values)
+{
+    QJsonObject r;
+    r["p50"] = DownloadStatistics::percentile(&values, 50);
+    r["p90"] = DownloadStatistics::percentile(&values, 90);
+    r["p99"] = DownloadStatistics::percentile(&values, 99);
+    return r;
+}
+
+void App::stats(Job* job, const QString& subCommand)
+{
+    bool bare = cl.isPresent("bare-format");
+    bool json = cl.isPresent("json");
+
+    if (job->shouldProceed() && subCommand != "downloads") {
+        if (subCommand.isEmpty())
+            job->setErrorMessage("Missing sub-command. Try \"ncl stats downloads\"");
+        else
+            job->setErrorMessage("Wrong sub-command: " + subCommand);
+    }
+
+    if (job->shouldProceed()) {
+        QString err = DBRepository::getDefault()->openDefault();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    QList<TransferStats> stats;
+    if (job->shouldProceed()) {
+        QString err;
+        stats = DBRepository::getDefault()->findTransferStats(
+                time(nullptr) - 30 * 24 * 60 * 60, &err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        // host -> transfers. QMap sorts the hosts by name.
+        QMap<QString, QList<TransferStats> > byHost;
+        for (int i = 0; i < stats.count(); i++) {
+            byHost[stats.at(i).host].append(stats.at(i));
+        }
+
+        QJsonArray hosts;
+        if (!json && !bare) {
+            WPMUtils::writeln(QString("%1 transfers to %2 hosts in the last 30 days:").
+                    arg(stats.count()).arg(byHost.count()));
+            WPMUtils::writeln("");
+            WPMUtils::writeln(QString("%1 %2 %3 %4 %5 %6 %7").
+                    arg("host", -30).arg("count", 6).arg("errors", 6).
+                    arg("cached", 6).arg("ttfb p50/p90 ms", 16).
+                    arg("KiB/s p50", 10).arg("KiB/s p10", 10));
+        }
+
+        QList<QString> keys = byHost.keys();
+        for (int i = 0; i < keys.count(); i++) {
+            const QList<TransferStats>& ts = byHost[keys.at(i)];
+
+            int errors = 0, cacheHits = 0, retries = 0;
+            qint64 bytes = 0;
+            QList<double> queueTimes, dnsTimes, connectTimes, ttfbs,
+                    transferTimes, throughputs;
+            for (int j = 0; j < ts.count(); j++) {
+                const TransferStats& s = ts.at(j);
+                if (!s.error.isEmpty())
+                    errors++;
+                if (s.cacheHit)
+                    cacheHits++;
+                retries += s.retries;
+                bytes += s.bytes;
+                if (s.queueTime >= 0)
+                    queueTimes.append(s.queueTime);
+                if (s.dnsTime >= 0)
+                    dnsTimes.append(s.dnsTime);
+                if (s.connectTime >= 0)
+                    connectTimes.append(s.connectTime);
+                if (s.ttfb >= 0)
+                    ttfbs.append(s.ttfb);
+                if (s.transferTime >= 0)
+                    transferTimes.append(s.transferTime);
+                double t = s.getThroughput();
+                if (t >= 0)
+                    throughputs.append(t / 1024);
+            }
+
+            if (json) {
+                QJsonObject host;
+                host["host"] = keys.at(i);
+                host["transfers"] = ts.count();
+                host["errors"] = errors;
+                host["cacheHits"] = cacheHits;
+                host["retries"] = retries;
+                host["bytes"] = bytes;
+                host["queueTime"] = percentilesToJSON(queueTimes);
+                host["dnsTime"] = percentilesToJSON(dnsTimes);
+                host["connectTime"] = percentilesToJSON(connectTimes);
+                host["ttfb"] = percentilesToJSON(ttfbs);
+                host["transferTime"] = percentilesToJSON(transferTimes);
+
+                // the slow transfers are the interesting ones
+                QJsonObject throughput = percentilesToJSON(throughputs);
+                QList<double> v = throughputs;
+                throughput["p10"] = DownloadStatistics::percentile(&v, 10);
+                QList<int> h = DownloadStatistics::histogram(throughputs,
+                        DownloadStatistics::THROUGHPUT_BINS);
+                QJsonArray bins;
+                for (int j = 0; j < h.count(); j++) {
+                    QJsonObject bin;
+                    if (j < DownloadStatistics::THROUGHPUT_BINS.count())
+                        bin["max"] = DownloadStatistics::THROUGHPUT_BINS.at(j);
+                    bin["count"] = h.at(j);
+                    bins.append(bin);
+                }
+                throughput["histogram"] = bins;
+                host["throughputKiBps"] = throughput;
+
+                hosts.append(host);
+            } else {
+                QList<double> v = throughputs;
+                double p50 = DownloadStatistics::percentile(&v, 50);
+                double p10 = DownloadStatistics::percentile(&v, 10);
+                v = ttfbs;
+                double ttfb50 = DownloadStatistics::percentile(&v, 50);
+                double ttfb90 = DownloadStatistics::percentile(&v, 90);
+
+                if (bare)
+                    WPMUtils::writeln(QString("%1\t%2\t%3\t%4\t%5\t%6\t%7\t%8").
+                            arg(keys.at(i)).arg(ts.count()).arg(errors).
+                            arg(cacheHits).arg(ttfb50).arg(ttfb90).
+                            arg(p50, 0, 'f', 0).arg(p10, 0, 'f', 0));
+                else
+                    WPMUtils::writeln(QString("%1 %2 %3 %4 %5 %6 %7").
+                            arg(keys.at(i), -30).arg(ts.count(), 6).
+                            arg(errors, 6).arg(cacheHits, 6).
+                            arg(QString("%1/%2").arg(ttfb50).arg(ttfb90), 16).
+                            arg(p50, 10, 'f', 0).arg(p10, 10, 'f', 0));
+            }
+        }
+
+        if (json) {
+            QJsonObject top;
+            top["days"] = 30;
+            top["transfers"] = stats.count();
+            top["hosts"] = hosts;
+            printJSON(top);
+        }
+    }
+
+    job->complete();
+}
+
+void App::add(Job* job)
+{
+    job->setTitle("Installing packages");
+
+    if (job->shouldProceed()) {
+        QString err = DBRepository::getDefault()->openDefault();
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    if (job->shouldProceed()) {
+        /* we ignore the returned error as it should also work for non-admins */
+        addNpackdCL();
+    }
+
+    InstalledPackages* ip = InstalledPackages::getDefault();
+
+    if (job->shouldProceed()) {
+        QString err = ip->readRegistryDatabase();
+        if (!err.isEmpty()) {
+            job->setErrorMessage(err);
+        } else {
+            job->setProgress(0.1);
+        }
+    }
+
+    QString user = cl.get("user");
+    QString password = cl.get("password");
+
+    QString proxyUser = cl.get("proxy-user");
+    QString proxyPassword = cl.get("proxy-password");
+
+    bool explain = cl.isPresent("explain-plan");
+
+    QList<InstallOperation*> ops;
+    InstalledPackages installed(*ip);
+
+    PlanExplanation explanation;
+
+    if (job->shouldProceed())
+        planAdd(job, installed, ops, explain ? &explanation : nullptr);
+
     // debug: WPMUtils::outputTextConsole(QString("%1\r\n").arg(ops.size()));
 
-    if (job->shouldProceed() && ops.size() > 0) {
+    // the plan is only printed
+    if (explain)
+        printPlanExplanation(job, explanation, ops);
+
+    if (job->shouldProceed() && ops.size() > 0 && !explain) {
         Job* ijob = job->newSubJob(0.9, "Installing");
         processInstallOperations(ijob, ops, WPMUtils::CLOSE_WINDOW,
                 interactive, user, password, proxyUser, proxyPassword);
@@ -1787,12 +2447,11 @@ void App::add(Job* job)
                     arg(ijob->getErrorMessage()));
     }
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !explain) {
         qCInfo(npackdImportant()).noquote() << "The packages were installed successfully";
     }
 
     qDeleteAll(ops);
-    qDeleteAll(toInstall);
 
     job->complete();
 }
@@ -1951,10 +2610,17 @@ void App::remove(Job *job)
     if (!err.isEmpty())
         job->setErrorMessage(err);
 
+    bool explain = cl.isPresent("explain-plan");
+
     QList<InstallOperation*> ops;
     InstalledPackages installed(*InstalledPackages::getDefault());
 
+    PlanExplanation explanation;
+
     if (job->shouldProceed()) {
+        if (explain)
+            explanation.startPhase("missing dependencies");
+
         err = DBRepository::getDefault()->planAddMissingDeps(installed, ops);
         if (!err.isEmpty())
             job->setErrorMessage(err);
@@ -1965,11 +2631,25 @@ void App::remove(Job *job)
         if (!err.isEmpty())
             job->setErrorMessage(err);
 
+        if (explain)
+            explanation.startPhase("removals");
+
         if (job->shouldProceed()) {
             for (int i = 0; i < toRemove.size(); i++) {
                 PackageVersion* pv = toRemove.at(i);
+                int oldSize = ops.size();
+                if (explain)
+                    explanation.begin("uninstall", pv->package, pv->version);
+
                 err = DBRepository::getDefault()->planUninstallation(installed,
                         pv->package, pv->version, ops);
+
+                if (explain) {
+                    // the dependent packages are removed too
+                    explanation.set("operations", ops.size() - oldSize);
+                    explanation.end(err.isEmpty() ? "ok" : "failed", err);
+                }
+
                 if (!err.isEmpty()) {
                     job->setErrorMessage(err);
                     break;
@@ -1978,6 +2658,13 @@ void App::remove(Job *job)
         }
     }
 
+    if (explain) {
+        explanation.endPhase();
+
+        // the plan is only printed
+        printPlanExplanation(job, explanation, ops);
+    }
+
     /**
      *confirmation. This is not yet enabled in order to maintain the
      * compatibility.
@@ -1991,7 +2678,7 @@ void App::remove(Job *job)
     }
     */
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !explain) {
         Job* removeJob = job->newSubJob(0.9,
                 "Removing");
         processInstallOperations(removeJob, ops, programCloseType,
@@ -2001,7 +2688,7 @@ void App::remove(Job *job)
                     arg(removeJob->getErrorMessage()));
     }
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !explain) {
         qCInfo(npackdImportant()).noquote() << "The packages were removed successfully";
     }
 
@@ -10,6 +10,8 @@
 #include "commandline.h"
 #include "job.h"
 #include "clprogress.h"
+#include "installedpackages.h"
+#include "planexplanation.h"
 
 /**
  * NpackdCL
@@ -33,6 +35,15 @@ private:
      */
     QString addNpackdCL();
 
+    /**
+     * @brief searches for the paths for "ncl path" using only the index of
+     *     installed packages. The package database is not opened.
+     * @param paths the found directories will be appended here
+     * @return true if all --package options could be resolved. Short package
+     *     names and not installed packages need the package database.
+     */
+    bool findPathsFast(QStringList* paths);
+
     void usage(Job *job);
     void path(Job* job);
     void place(Job *job);
@@ -54,6 +65,51 @@ private:
     void setInstallPath(Job *job);
     void removeSCP(Job *job);
     void build(Job *job);
+    void cache(Job *job);
+    void prefetch(Job *job);
+
+    /**
+     * @brief "ncl stats"
+     * @param job job
+     * @param subCommand the second free argument (e.g. "downloads")
+     */
+    void stats(Job *job, const QString& subCommand);
+
+    /**
+     * @param values values
+     * @return the percentiles 50, 90 and 99 or -1 if there are no values
+     */
+    static QJsonObject percentilesToJSON(QList<double> values);
+
+    /**
+     * @brief plans the operations for "ncl update" using the command line
+     * @param job errors will be reported here
+     * @param installed installed packages. Will be changed by the plan.
+     * @param ops [ownership:caller] the operations will be appended here
+     * @param explanation the planning decisions will be recorded here or 0
+     */
+    void planUpdate(Job* job, InstalledPackages& installed,
+            QList<InstallOperation*>& ops, PlanExplanation* explanation);
+
+    /**
+     * @brief plans the operations for "ncl add" using the command line
+     * @param job errors will be reported here
+     * @param installed installed packages. Will be changed by the plan.
+     * @param ops [ownership:caller] the operations will be appended here
+     * @param explanation the planning decisions will be recorded here or 0
+     */
+    void planAdd(Job* job, InstalledPackages& installed,
+            QList<InstallOperation*>& ops,
+            PlanExplanation* explanation=nullptr);
+
+    /**
+     * @brief prints the result of "--explain-plan"
+     * @param job errors from this job will be included
+     * @param explanation the planning decisions
+     * @param ops the planned operations
+     */
+    void printPlanExplanation(Job* job, const PlanExplanation& explanation,
+            const QList<InstallOperation*>& ops);
 
     bool confirm(const QList<InstallOperation *> ops, QString *title,
             QString *err);
@@ -1,9 +1,24 @@
 #include <limits>
 #include <math.h>
+#include <string.h>
 #include <memory>
 
 #include <QRegExp>
 #include <QProcess>
+#include <QTemporaryFile>
+#include <QTemporaryDir>
+#include <QDirIterator>
+#include <QXmlSimpleReader>
+#include <QXmlInputSource>
+#include <QElapsedTimer>
+#include <QDataStream>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <zlib.h>
+
+#include <quazip.h>
+#include <quazipfile.h>
 
 #include "app.h"
 #include "wpmutils.h"
@@ -14,6 +29,169 @@
 #include "abstractrepository.h"
 #include "dbrepository.h"
 #include "hrtimer.h"
+#include "dependencysolver.h"
+#include "planexplanation.h"
+#include "installscheduler.h"
+#include "downloadcache.h"
+#include "testhttpserver.h"
+#include "zipstreamextractor.h"
+#include "hashengine.h"
+#include "mirrorselector.h"
+#include "repository.h"
+#include "repositoryxmlhandler.h"
+#include "downloadscheduler.h"
+#include "deltaupdate.h"
+#include "qtnetworktransport.h"
+#include "downloadengine.h"
+#include "downloadstatistics.h"
+#include "installedpackagesindex.h"
+
+/**
+ * @brief the original recursive implementation of
+ *     PackageVersion::planInstallation without any caching. It is used as the
+ *     reference for DependencySolver.
+ */
+static QString planInstallationReference(AbstractRepository* rep,
+        PackageVersion* pv, InstalledPackages &installed,
+        QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid)
+{
+    QString res;
+
+    avoid.append(pv->clone());
+
+    for (int i = 0; i < pv->dependencies.count(); i++) {
+        Dependency* d = pv->dependencies.at(i);
+        if (!installed.isInstalled(*d)) {
+            QString err;
+            QList<PackageVersion*> pvs = rep->findAllMatchesToInstall(
+                    *d, avoid, &err);
+            if (!err.isEmpty()) {
+                res = QString(QObject::tr("Error searching for the dependency matches: %1")).
+                           arg(err);
+                qDeleteAll(pvs);
+                break;
+            }
+            if (pvs.count() == 0) {
+                res = QString(QObject::tr("Unsatisfied dependency: %1")).
+                           arg(rep->toString(*d));
+                break;
+            } else {
+                bool found = false;
+                for (int j = 0; j < pvs.count(); j++) {
+                    InstalledPackages installed2(installed);
+                    int opsCount = ops.count();
+                    int avoidCount = avoid.count();
+
+                    res = planInstallationReference(rep, pvs.at(j),
+                            installed2, ops, avoid);
+                    if (!res.isEmpty()) {
+                        while (ops.count() > opsCount) {
+                            delete ops.takeLast();
+                        }
+                        while (avoid.count() > avoidCount) {
+                            delete avoid.takeLast();
+                        }
+                    } else {
+                        found = true;
+                        installed = installed2;
+                        break;
+                    }
+                }
+                if (!found) {
+                    res = QString(QObject::tr("Unsatisfied dependency: %1")).
+                               arg(rep->toString(*d));
+                }
+            }
+            qDeleteAll(pvs);
+        }
+    }
+
+    if (res.isEmpty()) {
+        if (!installed.isInstalled(pv->package, pv->version)) {
+            InstallOperation* io = new InstallOperation();
+            io->install = true;
+            io->package = pv->package;
+            io->version = pv->version;
+            ops.append(io);
+
+            QString where = WPMUtils::findNonExistingFile(
+                    pv->getIdealInstallationDirectory(), "");
+            installed.setPackageVersionPath(pv->package, pv->version,
+                    where, false);
+        }
+    }
+
+    return res;
+}
+
+/**
+ * @brief generates a repository with "levels" levels of "width" packages each.
+ *     Every version of a package depends on all packages from the next level.
+ *     Versions above 1.0 of the packages on the last level depend on a
+ *     package that cannot be installed.
+ * @param r repository
+ * @param prefix prefix for the package names
+ * @param levels number of levels
+ * @param width number of packages on each level
+ * @param versions number of versions for each package
+ * @param leafOK true = version 1.0 of the packages on the last level have no
+ *     dependencies
+ * @return error message
+ */
+static QString generateSolverRepository(DBRepository* r, const QString& prefix,
+        int levels, int width, int versions, bool leafOK)
+{
+    QString err;
+
+    QList<PackageVersion*> pvs;
+
+    // "broken" can be downloaded, but depends on a missing package
+    PackageVersion* broken = new PackageVersion(prefix + ".Broken",
+            Version(1, 0));
+    broken->download = QUrl("https://example.com/broken.zip");
+    Dependency* missing = new Dependency();
+    missing->package = prefix + ".Missing";
+    missing->setUnboundedVersions();
+    broken->dependencies.append(missing);
+    pvs.append(broken);
+
+    for (int l = 0; l < levels; l++) {
+        for (int p = 0; p < width; p++) {
+            for (int v = 1; v <= versions; v++) {
+                PackageVersion* pv = new PackageVersion(
+                        QString("%1.L%2.P%3").arg(prefix).arg(l).arg(p),
+                        Version(v, 0));
+                pv->download = QUrl(QString(
+                        "https://example.com/%1.zip").arg(pv->getStringId()));
+                if (l < levels - 1) {
+                    for (int n = 0; n < width; n++) {
+                        Dependency* d = new Dependency();
+                        d->package = QString("%1.L%2.P%3").arg(prefix).
+                                arg(l + 1).arg(n);
+                        d->setUnboundedVersions();
+                        pv->dependencies.append(d);
+                    }
+                } else if (v > 1 || !leafOK) {
+                    Dependency* d = new Dependency();
+                    d->package = broken->package;
+                    d->setUnboundedVersions();
+                    pv->dependencies.append(d);
+                }
+                pvs.append(pv);
+            }
+        }
+    }
+
+    for (int i = 0; i < pvs.count(); i++) {
+        err = r->savePackageVersion(pvs.at(i), true);
+        if (!err.isEmpty())
+            break;
+    }
+
+    qDeleteAll(pvs);
+
+    return err;
+}
 
 void App::test()
 {
@@ -126,6 +304,39 @@ void App::testInstalledPackages()
     d.package = "test";
     d.setVersions("[1, 2)");
     QVERIFY(ip->isInstalled(d));
+
+    // copies share the data and are independent
+    InstalledPackages copy(*ip);
+    QVERIFY(copy.isInstalled("test", Version(1, 2)));
+    err = copy.setPackageVersionPath("test", Version(1, 2), "C:\\test2",
+            false);
+    QVERIFY(err == "");
+    err = copy.setPackageVersionPath("test2", Version(3, 0), "C:\\test3",
+            false);
+    QVERIFY(err == "");
+    QVERIFY(ip->getPath("test", Version(1, 2)) == "C:\\test");
+    QVERIFY(!ip->isInstalled("test2", Version(3, 0)));
+    QVERIFY(copy.getPath("test", Version(1, 2)) == "C:\\test2");
+
+    *ip = copy;
+    QVERIFY(ip->getPath("test", Version(1, 2)) == "C:\\test2");
+    QVERIFY(ip->getPath("test2", Version(3, 0)) == "C:\\test3");
+
+    copy.clear();
+    QVERIFY(ip->isInstalled("test2", Version(3, 0)));
+
+    // the original was changed after the copy was created: all entries are
+    // compared
+    InstalledPackages copy2(*ip);
+    err = copy2.setPackageVersionPath("test2", Version(3, 0), "C:\\test4",
+            false);
+    QVERIFY(err == "");
+    err = ip->setPackageVersionPath("test", Version(1, 2), "C:\\test5",
+            false);
+    QVERIFY(err == "");
+    *ip = copy2;
+    QVERIFY(ip->getPath("test", Version(1, 2)) == "C:\\test2");
+    QVERIFY(ip->getPath("test2", Version(3, 0)) == "C:\\test4");
 }
 
 void App::testCommandLine()
@@ -198,3 +409,1871 @@ void App::testNormalizePath()
 {
     QCOMPARE(WPMUtils::normalizePath("../", false), "..");
 }
+
+void App::testDependencySolver()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("solvertest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // regression corpus: the results should be the same as from the
+    // original recursive implementation
+    struct Scenario {
+        const char* prefix;
+        int levels, width, versions;
+        bool leafOK;
+    };
+    const Scenario scenarios[] = {
+        {"test.solver.chain", 6, 1, 3, true},
+        {"test.solver.chainfail", 6, 1, 3, false},
+        {"test.solver.diamond", 3, 3, 2, true},
+        {"test.solver.diamondfail", 3, 2, 2, false},
+        {"test.solver.single", 1, 1, 1, true},
+    };
+
+    for (size_t k = 0; k < sizeof(scenarios) / sizeof(scenarios[0]); k++) {
+        const Scenario& s = scenarios[k];
+        err = generateSolverRepository(&r, s.prefix, s.levels, s.width,
+                s.versions, s.leafOK);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+
+        std::unique_ptr<PackageVersion> pv(r.findPackageVersion_(
+                QString("%1.L0.P0").arg(s.prefix), Version(s.versions, 0),
+                &err));
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        QVERIFY(pv.get() != nullptr);
+
+        InstalledPackages installed1;
+        QList<InstallOperation*> ops1;
+        QList<PackageVersion*> avoid1;
+        QString err1 = planInstallationReference(&r, pv.get(), installed1,
+                ops1, avoid1);
+
+        InstalledPackages installed2;
+        QList<InstallOperation*> ops2;
+        QList<PackageVersion*> avoid2;
+        DependencySolver solver(&r);
+        QString err2 = solver.planInstallation(pv.get(), installed2, ops2,
+                avoid2);
+
+        QCOMPARE(err2, err1);
+        QCOMPARE(ops2.count(), ops1.count());
+        for (int i = 0; i < ops1.count(); i++) {
+            QCOMPARE(ops2.at(i)->install, ops1.at(i)->install);
+            QCOMPARE(ops2.at(i)->package, ops1.at(i)->package);
+            QVERIFY(ops2.at(i)->version == ops1.at(i)->version);
+        }
+        QCOMPARE(installed2.getInstalledStringIds(installed2.getPackages()),
+                installed1.getInstalledStringIds(installed1.getPackages()));
+
+        qDeleteAll(ops1);
+        qDeleteAll(avoid1);
+        qDeleteAll(ops2);
+        qDeleteAll(avoid2);
+    }
+
+    // benchmark: the original implementation needs 4^30 attempts here
+    err = generateSolverRepository(&r, "test.solver.deep", 30, 2, 4, false);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    err = generateSolverRepository(&r, "test.solver.wide", 5, 20, 3, true);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    const char* prefixes[] = {"test.solver.deep", "test.solver.wide"};
+    const int versions[] = {4, 3};
+    for (int i = 0; i < 2; i++) {
+        std::unique_ptr<PackageVersion> pv(r.findPackageVersion_(
+                QString("%1.L0.P0").arg(prefixes[i]), Version(versions[i], 0),
+                &err));
+        QVERIFY(pv.get() != nullptr);
+
+        HRTimer timer(2);
+        timer.time(0);
+
+        InstalledPackages installed;
+        QList<InstallOperation*> ops;
+        QList<PackageVersion*> avoid;
+        DependencySolver solver(&r);
+        err = solver.planInstallation(pv.get(), installed, ops, avoid);
+
+        timer.time(1);
+
+        qCDebug(npackd) << prefixes[i] << "planned" << ops.count() <<
+                "operations in" << timer.getTime(1) << "s" << err;
+        QVERIFY(timer.getTime(1) < 60);
+
+        qDeleteAll(ops);
+        qDeleteAll(avoid);
+    }
+}
+
+void App::testPlanUninstallation()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("uninstalltest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // c -> b -> a, e -> a, d is independent
+    const char* defs[][2] = {
+        {"test.uninstall.a", ""},
+        {"test.uninstall.b", "test.uninstall.a"},
+        {"test.uninstall.c", "test.uninstall.b"},
+        {"test.uninstall.d", ""},
+        {"test.uninstall.e", "test.uninstall.a"},
+    };
+    InstalledPackages installed;
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        PackageVersion pv(defs[i][0], Version(1, 0));
+        pv.download = QUrl("https://example.com/test.zip");
+        if (strlen(defs[i][1]) > 0) {
+            Dependency* d = new Dependency();
+            d->package = defs[i][1];
+            d->setUnboundedVersions();
+            pv.dependencies.append(d);
+        }
+        err = r.savePackageVersion(&pv, true);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+
+        err = installed.setPackageVersionPath(pv.package, pv.version,
+                QString("C:\\test\\%1").arg(i), false);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+    }
+
+    // another version of "a" satisfies all dependencies
+    InstalledPackages copy(installed);
+    err = copy.setPackageVersionPath("test.uninstall.a", Version(2, 0),
+            "C:\\test\\a2", false);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QList<InstallOperation*> ops;
+    err = r.planUninstallation(copy, "test.uninstall.a", Version(1, 0), ops);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(ops.count(), 1);
+    qDeleteAll(ops);
+    ops.clear();
+
+    err = r.planUninstallation(installed, "test.uninstall.a", Version(1, 0),
+            ops);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QStringList res;
+    for (int i = 0; i < ops.count(); i++) {
+        QVERIFY(!ops.at(i)->install);
+        res.append(ops.at(i)->package);
+    }
+    QCOMPARE(res.join(' '), QString("test.uninstall.c test.uninstall.b "
+            "test.uninstall.e test.uninstall.a"));
+    QVERIFY(installed.isInstalled("test.uninstall.d", Version(1, 0)));
+    QVERIFY(!installed.isInstalled("test.uninstall.e", Version(1, 0)));
+
+    qDeleteAll(ops);
+}
+
+void App::testPlanUpdates()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("updatestest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // app1 and app2 depend on lib. The new versions also depend on util,
+    // which is not yet installed.
+    const char* defs[][4] = {
+        {"test.updates.util", "1", "", ""},
+        {"test.updates.lib", "1", "", ""},
+        {"test.updates.lib", "2", "", ""},
+        {"test.updates.app1", "1", "test.updates.lib", ""},
+        {"test.updates.app1", "2", "test.updates.lib", "test.updates.util"},
+        {"test.updates.app2", "1", "test.updates.lib", ""},
+        {"test.updates.app2", "2", "test.updates.lib", "test.updates.util"},
+    };
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        PackageVersion pv(defs[i][0], Version(QString(defs[i][1]).toInt(), 0));
+        pv.download = QUrl("https://example.com/test.zip");
+        for (int j = 2; j < 4; j++) {
+            if (strlen(defs[i][j]) > 0) {
+                Dependency* d = new Dependency();
+                d->package = defs[i][j];
+                d->setUnboundedVersions();
+                pv.dependencies.append(d);
+            }
+        }
+        err = r.savePackageVersion(&pv, true);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+    }
+
+    InstalledPackages installed;
+    const char* installedDefs[] = {
+        "test.updates.lib", "test.updates.app1", "test.updates.app2"
+    };
+    QList<Package*> packages;
+    for (size_t i = 0; i < sizeof(installedDefs) / sizeof(installedDefs[0]);
+            i++) {
+        err = installed.setPackageVersionPath(installedDefs[i], Version(1, 0),
+                QString("C:\\test\\%1").arg(i), false);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+        packages.append(new Package(installedDefs[i], installedDefs[i]));
+    }
+
+    QList<InstallOperation*> ops;
+    PlanExplanation explanation;
+    err = r.planUpdates(installed, packages, QList<Dependency*>(), ops,
+            false, false, "", false, &explanation);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // util is shared by both applications and installed only once
+    QStringList res;
+    for (int i = 0; i < ops.count(); i++) {
+        InstallOperation* op = ops.at(i);
+        res.append(QString(op->install ? "i:" : "u:") +
+                PackageVersion::getStringId(op->package, op->version));
+    }
+    QCOMPARE(res.join(' '), QString(
+            "i:test.updates.lib/2 i:test.updates.util/1 "
+            "i:test.updates.app1/2 i:test.updates.app2/2 "
+            "u:test.updates.lib/1 u:test.updates.app1/1 "
+            "u:test.updates.app2/1"));
+
+    QCOMPARE(installed.getInstalledStringIds(installed.getPackages()),
+            QStringList() << "test.updates.app1/2" << "test.updates.app2/2" <<
+            "test.updates.lib/2" << "test.updates.util/1");
+
+    // "uninstall first" is rejected for all packages
+    QJsonArray phases = explanation.toJSON().value("phases").toArray();
+    QStringList names;
+    for (int i = 0; i < phases.count(); i++) {
+        names.append(phases.at(i).toObject().value("name").toString());
+    }
+    QCOMPARE(names.join(','), QString(
+            "targets,uninstall first,updates,remove old versions,simplify"));
+
+    qDeleteAll(ops);
+    qDeleteAll(packages);
+}
+
+void App::testSimplifyOperations()
+{
+    // u = uninstall, i = install
+    const char* defs[][3] = {
+        {"u", "test.simplify.a", "1"},
+        {"u", "test.simplify.b", "1"},
+        {"i", "test.simplify.c", "1"},
+        {"u", "test.simplify.a", "1"},
+        {"i", "test.simplify.a", "1"},
+        {"i", "test.simplify.b", "2"},
+        {"i", "test.simplify.a", "1"},
+        {"i", "test.simplify.b", "1"},
+    };
+    QList<InstallOperation*> ops;
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        InstallOperation* op = new InstallOperation();
+        op->install = strcmp(defs[i][0], "i") == 0;
+        op->package = defs[i][1];
+        op->version = Version(QString(defs[i][2]).toInt(), 0);
+        ops.append(op);
+    }
+
+    InstallOperation::simplify(ops);
+
+    QStringList res;
+    for (int i = 0; i < ops.count(); i++) {
+        InstallOperation* op = ops.at(i);
+        res.append(QString(op->install ? "i" : "u") + ":" + op->package);
+    }
+    QCOMPARE(res.join(' '), QString("i:test.simplify.c i:test.simplify.b"));
+    QVERIFY(ops.at(1)->version == Version(2, 0));
+
+    qDeleteAll(ops);
+}
+
+void App::testPlanExplanation()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("explaintest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // x 1 -> y; y 2 -> z; z 1 -> w (not available); y 1 has no dependencies
+    const char* defs[][3] = {
+        {"test.explain.x", "1", "test.explain.y"},
+        {"test.explain.y", "2", "test.explain.z"},
+        {"test.explain.y", "1", ""},
+        {"test.explain.z", "1", "test.explain.w"},
+    };
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        PackageVersion pv(defs[i][0], Version(QString(defs[i][1]).toInt(), 0));
+        pv.download = QUrl("https://example.com/test.zip");
+        if (strlen(defs[i][2]) > 0) {
+            Dependency* d = new Dependency();
+            d->package = defs[i][2];
+            d->setUnboundedVersions();
+            pv.dependencies.append(d);
+        }
+        err = r.savePackageVersion(&pv, true);
+        QVERIFY2(err.isEmpty(), qPrintable(err));
+    }
+
+    PackageVersion* x = r.findPackageVersion_("test.explain.x", Version(1, 0),
+            &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(x != nullptr);
+
+    PlanExplanation explanation;
+    explanation.startPhase("install");
+    explanation.begin("install", x->package, x->version);
+
+    DependencySolver solver(&r);
+    solver.setExplanation(&explanation);
+    InstalledPackages installed;
+    QList<InstallOperation*> ops;
+    QList<PackageVersion*> avoid;
+    err = solver.planInstallation(x, installed, ops, avoid);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    explanation.end("ok");
+    explanation.endPhase();
+
+    QCOMPARE(ops.count(), 2);
+    QVERIFY(ops.at(0)->version == Version(1, 0));
+
+    QJsonObject json = explanation.toJSON();
+    QCOMPARE(json.value("rollbacks").toInt(), 1);
+    QCOMPARE(json.value("candidates").toInt(), 2);
+    QCOMPARE(json.value("phases").toArray().count(), 1);
+
+    // install x -> dependency y -> candidates y 2 (rollback) and y 1 (ok)
+    QJsonArray decisions = json.value("decisions").toArray();
+    QCOMPARE(decisions.count(), 1);
+    QJsonArray deps = decisions.at(0).toObject().value("children").toArray();
+    QCOMPARE(deps.count(), 1);
+    QJsonArray cands = deps.at(0).toObject().value("children").toArray();
+    QCOMPARE(cands.count(), 2);
+    QCOMPARE(cands.at(0).toObject().value("result").toString(),
+            QString("rollback"));
+    QCOMPARE(cands.at(1).toObject().value("result").toString(),
+            QString("ok"));
+
+    qDeleteAll(ops);
+    qDeleteAll(avoid);
+    delete x;
+}
+
+void App::testInstallScheduler()
+{
+    // b depends on a, d runs exclusively
+    const char* defs[][3] = {
+        {"test.scheduler.a", "", ""},
+        {"test.scheduler.b", "test.scheduler.a", ""},
+        {"test.scheduler.c", "", ""},
+        {"test.scheduler.d", "", "exclusive"},
+        {"test.scheduler.e", "", ""},
+    };
+    QList<InstallOperation*> ops;
+    QList<PackageVersion*> pvs;
+    for (size_t i = 0; i < sizeof(defs) / sizeof(defs[0]); i++) {
+        PackageVersion* pv = new PackageVersion(defs[i][0], Version(1, 0));
+        if (strlen(defs[i][1]) > 0) {
+            Dependency* d = new Dependency();
+            d->package = defs[i][1];
+            d->setUnboundedVersions();
+            pv->dependencies.append(d);
+        }
+        pv->exclusive = strlen(defs[i][2]) > 0;
+        pvs.append(pv);
+
+        InstallOperation* op = new InstallOperation();
+        op->package = pv->package;
+        op->version = pv->version;
+        op->where = QString("C:\\test\\%1").arg(i);
+        ops.append(op);
+    }
+
+    InstallScheduler s(ops, pvs, 3);
+    QCOMPARE(s.getPredecessors(1), QList<int>() << 0);
+    QVERIFY(s.getPredecessors(2).isEmpty());
+    QCOMPARE(s.getPredecessors(3), QList<int>() << 0 << 1 << 2);
+    QCOMPARE(s.getPredecessors(4), QList<int>() << 3);
+
+    QCOMPARE(s.takeNext(), 0);
+    QCOMPARE(s.takeNext(), 2);
+    QCOMPARE(s.takeNext(), -1);
+    s.finished(0);
+    QCOMPARE(s.takeNext(), 1);
+    s.finished(1);
+    s.finished(2);
+    QCOMPARE(s.takeNext(), 3);
+    QCOMPARE(s.takeNext(), -1);
+    s.finished(3);
+    QCOMPARE(s.takeNext(), 4);
+    QVERIFY(s.allStarted());
+    s.finished(4);
+    QCOMPARE(s.getRunningCount(), 0);
+
+    // one operation after another
+    InstallScheduler s1(ops, pvs, 1);
+    QCOMPARE(s1.takeNext(), 0);
+    QCOMPARE(s1.takeNext(), -1);
+    s1.finished(0);
+    QCOMPARE(s1.takeNext(), 1);
+
+    qDeleteAll(ops);
+    qDeleteAll(pvs);
+}
+
+void App::testDownloadCache()
+{
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+
+    DownloadCache dc;
+    dc.setDirectory(tmp.path() + "/cache");
+
+    QString file = tmp.path() + "/file.bin";
+    QFile f(file);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    f.write("0123456789");
+    f.close();
+
+    QString sha1 = "87acec17cd9dcd20a716cc2cf67417b71c8a7016";
+    QVERIFY(!dc.contains(QCryptographicHash::Sha1, sha1));
+    QVERIFY(!dc.copyTo(QCryptographicHash::Sha1, sha1,
+            tmp.path() + "/copy.bin", false));
+
+    // unsupported hash sums are not stored
+    QVERIFY(!dc.add(QCryptographicHash::Md5, sha1, file, false).isEmpty());
+    QVERIFY(!dc.add(QCryptographicHash::Sha1, "../x", file, false).isEmpty());
+
+    QCOMPARE(dc.add(QCryptographicHash::Sha1, sha1.toUpper(), file, false),
+            QString());
+    QVERIFY(dc.contains(QCryptographicHash::Sha1, sha1));
+
+    QList<DownloadCache::Entry> entries = dc.list();
+    QCOMPARE(entries.size(), 1);
+    QCOMPARE(entries.at(0).hashSum, sha1);
+    QCOMPARE(entries.at(0).size, static_cast<qint64>(10));
+
+    QString copy = tmp.path() + "/copy.bin";
+    QVERIFY(dc.copyTo(QCryptographicHash::Sha1, sha1, copy, true));
+    QVERIFY(dc.copyTo(QCryptographicHash::Sha1, sha1, copy, false));
+    QCOMPARE(QFileInfo(copy).size(), static_cast<qint64>(10));
+
+    QString cached = dc.getFile(QCryptographicHash::Sha1, sha1);
+    QVERIFY(!cached.isEmpty());
+    QCOMPARE(QFileInfo(cached).size(), static_cast<qint64>(10));
+    QCOMPARE(dc.getFile(QCryptographicHash::Sha1, sha1.replace('8', '9')),
+            QString());
+
+    // the content of a file is checked, not only its name
+    QString forgedSha1 = "0000000000000000000000000000000000000000";
+    QString forged = tmp.path() + "/cache/sha1-" + forgedSha1;
+    QFile ff(forged);
+    QVERIFY(ff.open(QIODevice::WriteOnly));
+    ff.write("forged");
+    ff.close();
+    QVERIFY(!dc.copyTo(QCryptographicHash::Sha1, forgedSha1, copy, false));
+    QVERIFY(!QFileInfo(copy).exists());
+    QVERIFY(!QFileInfo(forged).exists());
+
+    QCOMPARE(dc.prune(10), QString());
+    QCOMPARE(dc.list().size(), 1);
+    QCOMPARE(dc.prune(0), QString());
+    QCOMPARE(dc.list().size(), 0);
+}
+
+void App::testDownloadResume()
+{
+    QByteArray content;
+    for (int i = 0; i < 3 * 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 7 + i / 1024) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+
+    QTemporaryFile f;
+    QVERIFY(f.open());
+
+    // the connection is dropped after 1 MiB
+    server.setDropAfter(1024 * 1024);
+    Downloader::Request request(server.getURL());
+    request.file = &f;
+    request.hashSum = true;
+    request.interactive = false;
+    request.useCache = false;
+    Job* job = new Job();
+    Downloader::Response response = Downloader::download(job, request);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    QCOMPARE(response.validator, QString("\"npackd-test-1\""));
+    QVERIFY(!response.resumed);
+    QVERIFY(f.size() > 0);
+    QVERIFY(f.size() <= 1024 * 1024);
+    delete job;
+
+    // only the rest is transferred and the hash sum covers the whole file
+    request.ifRange = response.validator;
+    job = new Job();
+    response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(response.resumed);
+    QCOMPARE(response.hashSum, expected);
+    QCOMPARE(server.getRangeRequestCount(), 1);
+    QVERIFY(server.getBytesSent() <= content.size() + 1024 * 1024);
+    QVERIFY(f.seek(0));
+    QVERIFY(f.readAll() == content);
+    delete job;
+
+    // the file on the server has changed: everything is downloaded again
+    QVERIFY(f.resize(1000));
+    server.setETag("\"npackd-test-2\"");
+    job = new Job();
+    response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(!response.resumed);
+    QCOMPARE(response.hashSum, expected);
+    QCOMPARE(server.getRangeRequestCount(), 1);
+    QCOMPARE(f.size(), static_cast<qint64>(content.size()));
+    delete job;
+
+    server.stopServer();
+}
+
+void App::testSegmentedDownload()
+{
+    QByteArray content;
+    for (int i = 0; i < 16 * 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 13 + i / 4096) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+
+    // benchmark: one connection is limited to 64 KiB per 5 ms
+    server.setLatency(5);
+
+    const int segments[] = {1, 4};
+    for (int i = 0; i < 2; i++) {
+        QTemporaryFile f;
+        QVERIFY(f.open());
+
+        int rangeRequests = server.getRangeRequestCount();
+
+        HRTimer timer(2);
+        timer.time(0);
+
+        Downloader::Request request(server.getURL());
+        request.file = &f;
+        request.hashSum = true;
+        request.interactive = false;
+        request.useCache = false;
+        request.segments = segments[i];
+        Job* job = new Job();
+        Downloader::Response response = Downloader::download(job, request);
+
+        timer.time(1);
+
+        qCDebug(npackd) << segments[i] << "connection(s):" <<
+                content.size() / timer.getTime(1) / (1024 * 1024) << "MiB/s";
+
+        QCOMPARE(job->getErrorMessage(), QString());
+        QCOMPARE(response.hashSum, expected);
+        QCOMPARE(server.getRangeRequestCount() - rangeRequests,
+                segments[i] == 1 ? 0 : segments[i]);
+        QVERIFY(f.seek(0));
+        QVERIFY(f.readAll() == content);
+        delete job;
+    }
+
+    // a known size avoids the HEAD request. One connection is used for
+    // small files.
+    server.setLatency(0);
+    for (int i = 0; i < 2; i++) {
+        QTemporaryFile f;
+        QVERIFY(f.open());
+
+        int requests = server.getRequestCount();
+
+        Downloader::Request request(server.getURL());
+        request.file = &f;
+        request.hashSum = true;
+        request.interactive = false;
+        request.useCache = false;
+        request.segments = 4;
+        request.size = i == 0 ? content.size() : 1024;
+        Job* job = new Job();
+        Downloader::Response response = Downloader::download(job, request);
+
+        QCOMPARE(job->getErrorMessage(), QString());
+        QCOMPARE(response.hashSum, expected);
+        QCOMPARE(server.getRequestCount() - requests, i == 0 ? 4 : 1);
+        delete job;
+    }
+
+    // the file behind the URL has changed since the size was stored
+    {
+        QTemporaryFile f;
+        QVERIFY(f.open());
+        Downloader::Request request(server.getURL());
+        request.file = &f;
+        request.hashSum = true;
+        request.interactive = false;
+        request.useCache = false;
+        request.segments = 4;
+        request.size = content.size() - 4096;
+        Job* job = new Job();
+        Downloader::download(job, request);
+        QVERIFY(!job->getErrorMessage().isEmpty());
+        delete job;
+    }
+
+    // a weak ETag cannot be used for ranges: one connection is used
+    server.setETag("W/\"weak\"");
+    server.setLatency(0);
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    int rangeRequests = server.getRangeRequestCount();
+    Downloader::Request request(server.getURL());
+    request.file = &f;
+    request.hashSum = true;
+    request.interactive = false;
+    request.useCache = false;
+    request.segments = 4;
+    Job* job = new Job();
+    Downloader::Response response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(response.hashSum, expected);
+    QCOMPARE(server.getRangeRequestCount(), rangeRequests);
+    delete job;
+
+    server.stopServer();
+}
+
+void App::testZipStreamExtractor()
+{
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+
+    // a stored and a deflated entry, an empty file and a directory
+    QString zipFile = tmp.path() + "/test.zip";
+    QuaZip zip(zipFile);
+    QVERIFY(zip.open(QuaZip::mdCreate));
+    QuaZipFile zf(&zip);
+    QByteArray big;
+    for (int i = 0; i < 1000000; i++) {
+        big.append(static_cast<char>('a' + (i % 7) + (i / 100000)));
+    }
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("data/big.txt")));
+    zf.write(big);
+    zf.close();
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("stored.txt"),
+            nullptr, 0, 0, 0));
+    zf.write("stored data");
+    zf.close();
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("data/empty.txt")));
+    zf.close();
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("dir/")));
+    zf.close();
+    zip.close();
+
+    QFile f(zipFile);
+    QVERIFY(f.open(QIODevice::ReadOnly));
+    QByteArray data = f.readAll();
+    f.close();
+
+    // the data is written in small blocks like during a download
+    ZipStreamExtractor e(tmp.path() + "/staging");
+    for (int i = 0; i < data.size(); i += 1000) {
+        e.write(data.constData() + i, qMin(1000, data.size() - i));
+    }
+    QCOMPARE(e.finish(), QString());
+    QCOMPARE(e.commit(tmp.path() + "/out"), QString());
+    e.discard();
+
+    QFile big2(tmp.path() + "/out/data/big.txt");
+    QVERIFY(big2.open(QIODevice::ReadOnly));
+    QVERIFY(big2.readAll() == big);
+    big2.close();
+    QFile stored(tmp.path() + "/out/stored.txt");
+    QVERIFY(stored.open(QIODevice::ReadOnly));
+    QCOMPARE(stored.readAll(), QByteArray("stored data"));
+    stored.close();
+    QCOMPARE(QFileInfo(tmp.path() + "/out/data/empty.txt").size(),
+            static_cast<qint64>(0));
+    QVERIFY(QFileInfo(tmp.path() + "/out/dir").isDir());
+    QVERIFY(!QFileInfo(tmp.path() + "/staging").exists());
+
+    // incomplete data
+    ZipStreamExtractor e2(tmp.path() + "/staging2");
+    e2.write(data.constData(), data.size() / 2);
+    QVERIFY(!e2.finish().isEmpty());
+    QVERIFY(!e2.commit(tmp.path() + "/out2").isEmpty());
+    e2.discard();
+
+    // changed data in the stored entry
+    QByteArray changed = data;
+    int index = changed.indexOf("stored data");
+    QVERIFY(index > 0);
+    changed[index] = 'S';
+    ZipStreamExtractor e3(tmp.path() + "/staging3");
+    e3.write(changed);
+    QVERIFY(!e3.finish().isEmpty());
+    e3.discard();
+}
+
+void App::testUnzip()
+{
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+
+    // many small files like in a JDK or Node.js
+    QString zipFile = tmp.path() + "/many.zip";
+    QuaZip zip(zipFile);
+    QVERIFY(zip.open(QuaZip::mdCreate));
+    QuaZipFile zf(&zip);
+    const int n = 10000;
+    for (int i = 0; i < n; i++) {
+        QByteArray content;
+        for (int j = 0; j < 100 + (i % 50) * 40; j++) {
+            content.append(static_cast<char>('a' + (i + j * 7) % 26));
+        }
+        QString name = QString("lib/d%1/e%2/f%3.txt").arg(i % 17).
+                arg(i % 5).arg(i);
+        QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo(name)));
+        zf.write(content);
+        zf.close();
+    }
+    QVERIFY(zf.open(QIODevice::WriteOnly, QuaZipNewInfo("empty/")));
+    zf.close();
+    zip.close();
+
+    // benchmark: one thread and the default number of threads
+    const int threads[] = {1, 0};
+    for (int i = 0; i < 2; i++) {
+        QString out = tmp.path() + QString("/out%1").arg(i);
+
+        HRTimer timer(2);
+        timer.time(0);
+
+        Job* job = new Job();
+        WPMUtils::unzip(job, zipFile, out, threads[i]);
+
+        timer.time(1);
+
+        qCDebug(npackd) << "unzip with" << threads[i] << "thread(s):" <<
+                n / timer.getTime(1) << "files/s";
+
+        QCOMPARE(job->getErrorMessage(), QString());
+        QVERIFY(job->isCompleted());
+        QVERIFY(job->getProgress() > 0.99);
+        delete job;
+
+        QVERIFY(QFileInfo(out + "/empty").isDir());
+        QCOMPARE(QFileInfo(out + "/lib/d0/e0/f0.txt").size(),
+                static_cast<qint64>(100));
+        QCOMPARE(QFileInfo(out + QString("/lib/d%1/e%2/f%3.txt").
+                arg((n - 1) % 17).arg((n - 1) % 5).arg(n - 1)).size(),
+                static_cast<qint64>(100 + ((n - 1) % 50) * 40));
+
+        int count = 0;
+        QDirIterator it(out, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            count++;
+        }
+        QCOMPARE(count, n);
+    }
+
+    // a missing file
+    Job* job = new Job();
+    WPMUtils::unzip(job, tmp.path() + "/missing.zip", tmp.path() + "/out3");
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    delete job;
+}
+
+void App::testHashEngine()
+{
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+
+    // 256 MiB
+    QString fileName = tmp.path() + "/big.bin";
+    QFile f(fileName);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QByteArray block;
+    for (int i = 0; i < 1024 * 1024; i++) {
+        block.append(static_cast<char>((i * 31 + i / 1000) & 0xff));
+    }
+    for (int i = 0; i < 256; i++) {
+        block[0] = static_cast<char>(i);
+        QCOMPARE(f.write(block), static_cast<qint64>(block.size()));
+    }
+    f.close();
+    double gb = 256.0 / 1024;
+
+    const QCryptographicHash::Algorithm algs[] = {QCryptographicHash::Sha1,
+            QCryptographicHash::Sha256, QCryptographicHash::Md5};
+    for (int i = 0; i < 3; i++) {
+        QCryptographicHash::Algorithm alg = algs[i];
+
+        // benchmark: QCryptographicHash without overlapping reads
+        HRTimer timer(2);
+        timer.time(0);
+        QVERIFY(f.open(QIODevice::ReadOnly));
+        QCryptographicHash expected(alg);
+        QVERIFY(expected.addData(&f));
+        f.close();
+        QString e = expected.result().toHex().toLower();
+        timer.time(1);
+        double old = gb / timer.getTime(1);
+
+        HRTimer timer2(2);
+        timer2.time(0);
+        QString r = WPMUtils::hashSum(fileName, alg);
+        timer2.time(1);
+
+        HashEngine::Hash h(alg);
+        qCDebug(npackd) << "hash sum algorithm" << static_cast<int>(alg) << "CNG:" <<
+                h.isNative() << "QCryptographicHash:" << old <<
+                "GB/s, HashEngine:" << gb / timer2.getTime(1) << "GB/s";
+
+        QCOMPARE(r, e);
+    }
+
+    // incremental computation
+    HashEngine::Hash h(QCryptographicHash::Sha256);
+    h.addData("abc", 1);
+    h.addData("bc", 2);
+    QCOMPARE(QString(h.result().toHex()), QString(
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"));
+
+    // the current position is used
+    QVERIFY(f.open(QIODevice::ReadOnly));
+    QVERIFY(f.seek(f.size() - block.size()));
+    Job* job = new Job();
+    QString r = WPMUtils::fileCheckSum(job, &f, QCryptographicHash::Sha1);
+    f.close();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(r, QString(QCryptographicHash::hash(block,
+            QCryptographicHash::Sha1).toHex()));
+    delete job;
+
+    // many files
+    QStringList files;
+    QStringList expected;
+    for (int i = 0; i < 500; i++) {
+        QByteArray content = block.left(1000 + i * 1000);
+        content[0] = static_cast<char>(i);
+        QString name = tmp.path() + QString("/f%1.bin").arg(i);
+        QFile small(name);
+        QVERIFY(small.open(QIODevice::WriteOnly));
+        small.write(content);
+        small.close();
+        files.append(name);
+        expected.append(QCryptographicHash::hash(content,
+                QCryptographicHash::Sha256).toHex());
+    }
+    files.append(tmp.path() + "/missing.bin");
+    expected.append("");
+
+    HRTimer timer(2);
+    timer.time(0);
+    job = new Job();
+    QStringList sums = HashEngine::hashFiles(job, files,
+            QCryptographicHash::Sha256);
+    timer.time(1);
+    qCDebug(npackd) << "hashing" << files.count() << "files:" <<
+            timer.getTime(1) << "s";
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(sums, expected);
+    delete job;
+}
+
+void App::testLocalDownload()
+{
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+
+    // 128 MiB
+    QString source = tmp.path() + "/source.bin";
+    QFile f(source);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QByteArray block;
+    for (int i = 0; i < 1024 * 1024; i++) {
+        block.append(static_cast<char>((i * 17 + i / 333) & 0xff));
+    }
+    QCryptographicHash expected(QCryptographicHash::Sha256);
+    for (int i = 0; i < 128; i++) {
+        block[0] = static_cast<char>(i);
+        QCOMPARE(f.write(block), static_cast<qint64>(block.size()));
+        expected.addData(block);
+    }
+    f.close();
+    QString e = expected.result().toHex().toLower();
+    double mib = 128;
+
+    // benchmark: the previous implementation with 8 KiB blocks
+    HRTimer timer(2);
+    timer.time(0);
+    QFile src(source);
+    QVERIFY(src.open(QIODevice::ReadOnly));
+    QFile dest(tmp.path() + "/old.bin");
+    QVERIFY(dest.open(QIODevice::WriteOnly));
+    QCryptographicHash crypto(QCryptographicHash::Sha256);
+    char data[8192];
+    while (true) {
+        qint64 c = src.read(data, sizeof(data));
+        if (c <= 0)
+            break;
+        crypto.addData(data, static_cast<int>(c));
+        dest.write(data, c);
+    }
+    dest.close();
+    src.close();
+    QCOMPARE(QString(crypto.result().toHex().toLower()), e);
+    timer.time(1);
+
+    HRTimer timer2(2);
+    timer2.time(0);
+    QTemporaryFile target;
+    QVERIFY(target.open());
+    Downloader::Request request(QUrl::fromLocalFile(source));
+    request.file = &target;
+    request.hashSum = true;
+    request.alg = QCryptographicHash::Sha256;
+    Job* job = new Job();
+    Downloader::Response response = Downloader::download(job, request);
+    timer2.time(1);
+
+    qCDebug(npackd) << "copying a local file, 8 KiB blocks:" <<
+            mib / timer.getTime(1) << "MiB/s, Downloader:" <<
+            mib / timer2.getTime(1) << "MiB/s";
+
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(job->isCompleted());
+    QCOMPARE(response.hashSum, e);
+    QCOMPARE(target.size(), static_cast<qint64>(128 * block.size()));
+    QVERIFY(target.seek(target.size() - block.size()));
+    QVERIFY(target.read(block.size()) == block);
+    delete job;
+
+    // a missing file
+    job = new Job();
+    request.url = QUrl::fromLocalFile(tmp.path() + "/missing.bin");
+    Downloader::download(job, request);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    delete job;
+}
+
+void App::testMirrors()
+{
+    // a mirror for the whole repository and one for the version
+    QByteArray xml(
+            "<root>"
+            "<spec-version>3.5</spec-version>"
+            "<mirror prefix=\"https://downloads.example.com/\">"
+            "https://mirror.example.local/example/</mirror>"
+            "<version package=\"com.example.Test\" name=\"1.0\" "
+            "type=\"one-file\">"
+            "<url>https://downloads.example.com/test/t.exe</url>"
+            "<mirror>https://other.example.org/t.exe</mirror>"
+            "</version>"
+            "<version package=\"com.example.Test2\" name=\"1.0\" "
+            "type=\"one-file\">"
+            "<url>https://www.example.org/t2.exe</url>"
+            "</version>"
+            "</root>");
+    Repository rep;
+    RepositoryXMLHandler handler(&rep, QUrl("https://example.com/Rep.xml"));
+    QXmlSimpleReader reader;
+    reader.setContentHandler(&handler);
+    reader.setErrorHandler(&handler);
+    QXmlInputSource inputSource;
+    inputSource.setData(xml);
+    QVERIFY2(reader.parse(inputSource), qPrintable(handler.errorString()));
+    QCOMPARE(rep.packageVersions.count(), 2);
+    PackageVersion* pv = rep.packageVersions.at(0);
+    QCOMPARE(pv->mirrors.count(), 2);
+    QCOMPARE(pv->mirrors.at(0), QUrl("https://other.example.org/t.exe"));
+    QCOMPARE(pv->mirrors.at(1),
+            QUrl("https://mirror.example.local/example/test/t.exe"));
+    QCOMPARE(rep.packageVersions.at(1)->mirrors.count(), 0);
+
+    // the mirrors are stored in the database as XML
+    QString txt;
+    QXmlStreamWriter w(&txt);
+    pv->toXML(&w);
+    QString err;
+    PackageVersion* pv2 = PackageVersion::parse(txt.toUtf8(), &err);
+    QCOMPARE(err, QString());
+    QVERIFY(pv2 != nullptr);
+    QCOMPARE(pv2->mirrors, pv->mirrors);
+    delete pv2;
+
+    QByteArray content;
+    for (int i = 0; i < 3 * 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 11 + i / 512) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer fast(content);
+    QCOMPARE(fast.startServer(), QString());
+    TestHTTPServer slow(content);
+    QCOMPARE(slow.startServer(), QString());
+
+    // the hosts are probed and the fastest one is the first
+    slow.setLatency(200);
+    QList<QUrl> urls;
+    urls.append(slow.getURL("/t.exe"));
+    urls.append(fast.getURL("/t.exe"));
+    Job* job = new Job();
+    QList<QUrl> ordered = MirrorSelector::order(job, urls);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(ordered.count(), 2);
+    QCOMPARE(ordered.at(0), fast.getURL("/t.exe"));
+    QCOMPARE(ordered.at(1), slow.getURL("/t.exe"));
+    QVERIFY(MirrorSelector::getStats(fast.getURL()).getScore() <
+            MirrorSelector::getStats(slow.getURL()).getScore());
+    delete job;
+    slow.setLatency(0);
+
+    // the fastest mirror fails after 1 MiB and the download continues on
+    // the other one
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+    DownloadCache* cache = DownloadCache::getDefault();
+    QString cacheDir = cache->getDirectory();
+    cache->setDirectory(tmp.path() + "/cache");
+
+    PackageVersion p("com.example.Mirrors");
+    p.type = 1;
+    p.download = slow.getURL("/t.exe");
+    p.mirrors.append(fast.getURL("/t.exe"));
+    p.sha1 = expected;
+    p.hashSumType = QCryptographicHash::Sha256;
+    int fastRequests = fast.getRequestCount();
+    int slowRangeRequests = slow.getRangeRequestCount();
+    fast.setDropAfter(1024 * 1024);
+    PackageVersion::setDownloadSegments(1);
+    job = new Job();
+    QString binary = p.download_(job, tmp.path() + "/p", false, "", "",
+            "", "");
+    PackageVersion::setDownloadSegments(4);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(fast.getRequestCount(), fastRequests + 1);
+    QCOMPARE(slow.getRangeRequestCount(), slowRangeRequests + 1);
+    QFile f(binary);
+    QVERIFY(f.open(QIODevice::ReadOnly));
+    QVERIFY(f.readAll() == content);
+    f.close();
+    QCOMPARE(MirrorSelector::getStats(fast.getURL()).failures, 1);
+    delete job;
+
+    cache->setDirectory(cacheDir);
+
+    fast.stopServer();
+    slow.stopServer();
+}
+
+void App::testDownloadScheduler()
+{
+    QByteArray content;
+    for (int i = 0; i < 2 * 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 7 + i / 1024) & 0xff));
+    }
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+
+    // a request waits while the only connection to the host is used
+    DownloadScheduler::setMaxConnectionsPerHost(1);
+    Job* holder = new Job();
+    QVERIFY(DownloadScheduler::acquire(holder, server.getURL(),
+            DownloadScheduler::FOREGROUND));
+    QCOMPARE(DownloadScheduler::getActiveConnections(), 1);
+
+    int requests = server.getRequestCount();
+    Downloader::Request request(server.getURL("/icon.png"));
+    request.useCache = false;
+    request.priority = DownloadScheduler::ICON;
+    Job* job = new Job();
+    QFuture<Downloader::Response> future = QtConcurrent::run(
+            &Downloader::download, job, request);
+    QThread::msleep(300);
+    QCOMPARE(server.getRequestCount(), requests);
+    QVERIFY(!future.isFinished());
+
+    // a cancelled request does not get a connection
+    Job* cancelled = new Job();
+    cancelled->cancel();
+    QVERIFY(!DownloadScheduler::acquire(cancelled, server.getURL(),
+            DownloadScheduler::FOREGROUND));
+    delete cancelled;
+
+    DownloadScheduler::release(server.getURL(), DownloadScheduler::FOREGROUND);
+    future.waitForFinished();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(server.getRequestCount(), requests + 1);
+    QCOMPARE(DownloadScheduler::getActiveConnections(), 0);
+    delete job;
+    delete holder;
+    DownloadScheduler::setMaxConnectionsPerHost(6);
+
+    // 2 MiB with 512 KiB/s take at least 3 seconds as only a burst of one
+    // second is allowed
+    DownloadScheduler::setMaxBandwidth(512 * 1024);
+    QElapsedTimer timer;
+    timer.start();
+    request.priority = DownloadScheduler::FOREGROUND;
+    job = new Job();
+    Downloader::download(job, request);
+    qint64 ms = timer.elapsed();
+    DownloadScheduler::setMaxBandwidth(0);
+    qCDebug(npackd) << "2 MiB with 512 KiB/s:" << ms << "ms";
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(ms >= 2500);
+    QVERIFY(DownloadScheduler::getConnectionLimit() >= 1);
+    delete job;
+
+    server.stopServer();
+}
+
+void App::testPrefetch()
+{
+    // the default value from the "--parallel-downloads" help text
+    QCOMPARE(AbstractRepository::getMaxParallelDownloads(), 3);
+
+    QByteArray content;
+    for (int i = 0; i < 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 13 + i / 4096) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+    DownloadCache* cache = DownloadCache::getDefault();
+    QString cacheDir = cache->getDirectory();
+    cache->setDirectory(tmp.path() + "/cache");
+
+    // both versions have the same binary that is only downloaded once
+    QList<PackageVersion*> pvs;
+    for (int i = 0; i < 2; i++) {
+        PackageVersion* pv = new PackageVersion(
+                QString("com.example.Prefetch%1").arg(i));
+        pv->type = 1;
+        pv->download = server.getURL(QString("/p%1.exe").arg(i));
+        pv->sha1 = expected;
+        pv->hashSumType = QCryptographicHash::Sha256;
+        pvs.append(pv);
+    }
+
+    Downloader::Request credentials = QUrl();
+    credentials.interactive = false;
+
+    Job* job = new Job();
+    qint64 bytes = 0;
+    AbstractRepository::prefetch(job, pvs, credentials, &bytes);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(job->isCompleted());
+    QCOMPARE(bytes, static_cast<qint64>(content.size()));
+    QCOMPARE(cache->getSize(QCryptographicHash::Sha256, expected),
+            static_cast<qint64>(content.size()));
+    delete job;
+
+    // nothing is downloaded again
+    int requests = server.getRequestCount();
+    job = new Job();
+    AbstractRepository::prefetch(job, pvs, credentials, &bytes);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(bytes, static_cast<qint64>(0));
+    QCOMPARE(server.getRequestCount(), requests);
+    delete job;
+
+    // a wrong hash sum is reported and nothing is cached
+    PackageVersion wrong("com.example.PrefetchWrong");
+    wrong.type = 1;
+    wrong.download = server.getURL("/wrong.exe");
+    wrong.sha1 = QString(64, '0');
+    wrong.hashSumType = QCryptographicHash::Sha256;
+    QList<PackageVersion*> wrongs;
+    wrongs.append(&wrong);
+    job = new Job();
+    AbstractRepository::prefetch(job, wrongs, credentials, &bytes);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    QVERIFY(!cache->contains(QCryptographicHash::Sha256, wrong.sha1));
+    delete job;
+
+    // the failed download cancels the slow one
+    QByteArray content2 = content;
+    content2[0] = static_cast<char>(content2.at(0) + 1);
+    QString expected2 = QCryptographicHash::hash(content2,
+            QCryptographicHash::Sha256).toHex().toLower();
+    TestHTTPServer slow(content2);
+    QCOMPARE(slow.startServer(), QString());
+    slow.setLatency(200);
+    PackageVersion slowPv("com.example.PrefetchSlow");
+    slowPv.type = 1;
+    slowPv.download = slow.getURL("/slow.exe");
+    slowPv.sha1 = expected2;
+    slowPv.hashSumType = QCryptographicHash::Sha256;
+    wrongs.append(&slowPv);
+    job = new Job();
+    AbstractRepository::prefetch(job, wrongs, credentials, &bytes);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    QCOMPARE(bytes, static_cast<qint64>(0));
+    QVERIFY(!cache->contains(QCryptographicHash::Sha256, expected2));
+    delete job;
+    slow.stopServer();
+
+    qDeleteAll(pvs);
+    cache->setDirectory(cacheDir);
+
+    server.stopServer();
+}
+
+/**
+ * @brief adds a "stored" entry to a ZIP file and a line to a delta manifest
+ * @param zip ZIP file without the central directory
+ * @param manifest delta manifest
+ * @param name file name
+ * @param data content
+ */
+static void addStoredEntry(QByteArray* zip, QByteArray* manifest,
+        const QString& name, const QByteArray& data)
+{
+    QByteArray n = name.toUtf8();
+    quint32 crc = static_cast<quint32>(::crc32(0L,
+            reinterpret_cast<const Bytef*>(data.constData()),
+            static_cast<uInt>(data.size())));
+    quint32 size = static_cast<quint32>(data.size());
+
+    // local file header with the UTF-8 flag
+    QByteArray h;
+    QDataStream ds(&h, QIODevice::WriteOnly);
+    ds.setByteOrder(QDataStream::LittleEndian);
+    ds << static_cast<quint32>(0x04034b50) << static_cast<quint16>(20) <<
+            static_cast<quint16>(0x800) << static_cast<quint16>(0) <<
+            static_cast<quint16>(0) << static_cast<quint16>(0) << crc <<
+            size << size << static_cast<quint16>(n.size()) <<
+            static_cast<quint16>(0);
+
+    int offset = zip->size();
+    zip->append(h).append(n).append(data);
+
+    manifest->append(QCryptographicHash::hash(data,
+            QCryptographicHash::Sha256).toHex().toLower());
+    manifest->append(QString(" %1 %2 %3 ").arg(data.size()).arg(offset).
+            arg(zip->size() - offset).toLatin1());
+    manifest->append(n).append('\n');
+}
+
+void App::testDeltaUpdate()
+{
+    QByteArray unchanged;
+    for (int i = 0; i < 512 * 1024; i++) {
+        unchanged.append(static_cast<char>((i * 11 + i / 512) & 0xff));
+    }
+
+    QByteArray zip, manifest;
+    addStoredEntry(&zip, &manifest, "a.bin", unchanged);
+    addStoredEntry(&zip, &manifest, "b.txt", "new content");
+    addStoredEntry(&zip, &manifest, "c/d e.txt", "new file");
+    manifest.append("- 0 0 0 empty/\n");
+
+    // a file without a record is invalid
+    QString err;
+    QList<DeltaUpdate::Entry> entries = DeltaUpdate::parseManifest(
+            QString(64, '0').toLatin1() + " 1 0 0 x.txt\n", &err);
+    QVERIFY(!err.isEmpty());
+    entries = DeltaUpdate::parseManifest(manifest, &err);
+    QCOMPARE(err, QString());
+    QCOMPARE(entries.count(), 4);
+    QCOMPARE(entries.at(2).path, QString("c/d e.txt"));
+
+    TestHTTPServer archive(zip);
+    QCOMPARE(archive.startServer(), QString());
+    TestHTTPServer manifestServer(manifest);
+    QCOMPARE(manifestServer.startServer(), QString());
+
+    QTemporaryDir tmp;
+    QVERIFY(tmp.isValid());
+    QString oldDir = tmp.path() + "/old";
+    QVERIFY(QDir().mkpath(oldDir));
+    QFile a(oldDir + "/a.bin");
+    QVERIFY(a.open(QIODevice::WriteOnly));
+    a.write(unchanged);
+    a.close();
+    QFile b(oldDir + "/b.txt");
+    QVERIFY(b.open(QIODevice::WriteOnly));
+    b.write("old content");
+    b.close();
+
+    QString sha256 = QCryptographicHash::hash(manifest,
+            QCryptographicHash::Sha256).toHex().toLower();
+    Downloader::Request request(archive.getURL("/p.zip"));
+    request.interactive = false;
+    request.useCache = false;
+
+    // only the records for b.txt and "c/d e.txt" are downloaded with one
+    // request
+    int ranges = archive.getRangeRequestCount();
+    qint64 sent = archive.getBytesSent();
+    Job* job = new Job();
+    int64_t downloaded = 0;
+    QStringList changed;
+    DeltaUpdate::apply(job, manifestServer.getURL("/p.txt"), sha256, request,
+            oldDir, tmp.path() + "/staging", tmp.path() + "/download",
+            tmp.path() + "/new", &downloaded, &changed);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(changed, QStringList() << "b.txt" << "c/d e.txt");
+    QCOMPARE(archive.getRangeRequestCount(), ranges + 1);
+    QVERIFY(archive.getBytesSent() - sent < unchanged.size());
+    QVERIFY(downloaded > 0 && downloaded < unchanged.size());
+    QVERIFY(!QFileInfo(tmp.path() + "/staging").exists());
+    QVERIFY(!QFileInfo(tmp.path() + "/download").exists());
+    QVERIFY(QFileInfo(tmp.path() + "/new/empty").isDir());
+    QCOMPARE(HashEngine::hashFile(tmp.path() + "/new/a.bin",
+            QCryptographicHash::Sha256),
+            QString(QCryptographicHash::hash(unchanged,
+            QCryptographicHash::Sha256).toHex().toLower()));
+    QFile d(tmp.path() + "/new/c/d e.txt");
+    QVERIFY(d.open(QIODevice::ReadOnly));
+    QCOMPARE(d.readAll(), QByteArray("new file"));
+    d.close();
+    delete job;
+
+    // a wrong hash sum for the manifest is an error and nothing is changed
+    job = new Job();
+    DeltaUpdate::apply(job, manifestServer.getURL("/p.txt"), QString(64, '0'),
+            request, oldDir, tmp.path() + "/staging",
+            tmp.path() + "/download", tmp.path() + "/new2");
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    QVERIFY(!QFileInfo(tmp.path() + "/new2").exists());
+    delete job;
+
+    manifestServer.stopServer();
+    archive.stopServer();
+}
+
+void App::testQtNetworkTransport()
+{
+    QByteArray content;
+    for (int i = 0; i < 1024 * 1024; i++) {
+        content.append(static_cast<char>((i * 5 + i / 2048) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+    server.setETag("\"v1\"");
+
+    QtNetworkTransport transport;
+    Downloader::setTransport(&transport);
+
+    // the whole file with the hash sum
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    Downloader::Request request(server.getURL());
+    request.file = &f;
+    request.hashSum = true;
+    request.interactive = false;
+    int requests = server.getRequestCount();
+    Job* job = new Job();
+    Downloader::Response response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(response.hashSum, expected);
+    QCOMPARE(response.validator, QString("\"v1\""));
+    QVERIFY(response.acceptRanges);
+    QCOMPARE(f.size(), static_cast<qint64>(content.size()));
+    QCOMPARE(server.getRequestCount(), requests + 1);
+    delete job;
+
+    // a range is written at its position
+    QVERIFY(f.resize(0));
+    request.hashSum = false;
+    request.rangeFrom = 1000;
+    request.rangeTo = 1999;
+    int ranges = server.getRangeRequestCount();
+    job = new Job();
+    Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(server.getRangeRequestCount(), ranges + 1);
+    QCOMPARE(f.size(), static_cast<qint64>(2000));
+    QVERIFY(f.seek(1000));
+    QVERIFY(f.read(1000) == content.mid(1000, 1000));
+    delete job;
+
+    // an interrupted download is resumed and the hash sum covers the whole
+    // file
+    QVERIFY(f.resize(0));
+    QVERIFY(f.seek(0));
+    request.rangeFrom = -1;
+    request.rangeTo = -1;
+    request.hashSum = true;
+    server.setDropAfter(300 * 1024);
+    job = new Job();
+    Downloader::download(job, request);
+    QVERIFY(!job->getErrorMessage().isEmpty());
+    QVERIFY(f.size() > 0 && f.size() < content.size());
+    delete job;
+
+    request.ifRange = "\"v1\"";
+    ranges = server.getRangeRequestCount();
+    job = new Job();
+    response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(response.resumed);
+    QCOMPARE(response.hashSum, expected);
+    QCOMPARE(server.getRangeRequestCount(), ranges + 1);
+    delete job;
+
+    // the size from a HEAD request
+    job = new Job();
+    QCOMPARE(Downloader::getContentLength(job, server.getURL(), nullptr),
+            static_cast<int64_t>(content.size()));
+    QCOMPARE(job->getErrorMessage(), QString());
+    delete job;
+
+    Downloader::setTransport(nullptr);
+
+    server.stopServer();
+}
+
+void App::testDownloadEngine()
+{
+    QByteArray content;
+    for (int i = 0; i < 256 * 1024; i++) {
+        content.append(static_cast<char>((i * 3 + i / 1024) & 0xff));
+    }
+    QString expected = QCryptographicHash::hash(content,
+            QCryptographicHash::Sha256).toHex().toLower();
+
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+    server.setLatency(50);
+
+    DownloadEngine* engine = DownloadEngine::getDefault();
+
+    // many parallel downloads do not need a thread each
+    const int n = 40;
+    QList<QTemporaryFile*> files;
+    QList<Job*> jobs;
+    QList<QFuture<Downloader::Response> > futures;
+    int requests = server.getRequestCount();
+    for (int i = 0; i < n; i++) {
+        QTemporaryFile* f = new QTemporaryFile();
+        QVERIFY(f->open());
+        Downloader::Request request(server.getURL(
+                QString("/file%1").arg(i)));
+        request.file = f;
+        request.hashSum = true;
+        request.interactive = false;
+        request.priority = DownloadScheduler::ICON;
+        Job* job = new Job();
+        futures.append(engine->start(job, request));
+        files.append(f);
+        jobs.append(job);
+    }
+    for (int i = 0; i < n; i++) {
+        futures[i].waitForFinished();
+        QCOMPARE(jobs.at(i)->getErrorMessage(), QString());
+        QVERIFY(jobs.at(i)->isCompleted());
+        QCOMPARE(futures[i].result().hashSum, expected);
+        QCOMPARE(files.at(i)->size(), static_cast<qint64>(content.size()));
+    }
+    QCOMPARE(server.getRequestCount(), requests + n);
+    qDeleteAll(files);
+    qDeleteAll(jobs);
+
+    // the size from a HEAD request
+    Downloader::Request head(server.getURL());
+    head.httpMethod = "HEAD";
+    head.interactive = false;
+    Job* job = new Job();
+    Downloader::Response response = engine->start(job, head).result();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(response.contentLength, static_cast<int64_t>(content.size()));
+    delete job;
+
+    // ranges are downloaded by Downloader on a worker thread
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    Downloader::Request range(server.getURL());
+    range.file = &f;
+    range.interactive = false;
+    range.rangeFrom = 100;
+    range.rangeTo = 199;
+    QtNetworkTransport transport;
+    Downloader::setTransport(&transport);
+    int ranges = server.getRangeRequestCount();
+    job = new Job();
+    engine->start(job, range).waitForFinished();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QCOMPARE(server.getRangeRequestCount(), ranges + 1);
+    QVERIFY(f.seek(100));
+    QVERIFY(f.read(100) == content.mid(100, 100));
+    delete job;
+    Downloader::setTransport(nullptr);
+
+    // a cancelled download is reported
+    QVERIFY(f.resize(0));
+    QVERIFY(f.seek(0));
+    server.setLatency(2000);
+    Downloader::Request slow(server.getURL());
+    slow.file = &f;
+    slow.interactive = false;
+    job = new Job();
+    QFuture<Downloader::Response> future = engine->start(job, slow);
+    job->cancel();
+    future.waitForFinished();
+    QVERIFY(job->isCancelled());
+    QVERIFY(job->isCompleted());
+    delete job;
+
+    server.stopServer();
+}
+
+void App::testConditionalGET()
+{
+    QByteArray content("<root><spec-version>3</spec-version></root>");
+    TestHTTPServer server(content);
+    QCOMPARE(server.startServer(), QString());
+    server.setETag("\"r1\"");
+
+    QtNetworkTransport transport;
+    Downloader::setTransport(&transport);
+
+    // the first download returns the validators
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    Downloader::Request request(server.getURL("/Rep.xml"));
+    request.file = &f;
+    request.hashSum = true;
+    request.interactive = false;
+    Job* job = new Job();
+    Downloader::Response response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(!response.notModified);
+    QCOMPARE(response.etag, QString("\"r1\""));
+    QCOMPARE(f.size(), static_cast<qint64>(content.size()));
+    delete job;
+
+    // "304 Not Modified" is not an error and the file is not changed
+    QVERIFY(f.resize(0));
+    QVERIFY(f.seek(0));
+    request.ifNoneMatch = response.etag;
+    int notModified = server.getNotModifiedCount();
+    job = new Job();
+    response = Downloader::download(job, request);
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(response.notModified);
+    QCOMPARE(f.size(), static_cast<qint64>(0));
+    QCOMPARE(server.getNotModifiedCount(), notModified + 1);
+    delete job;
+
+    // the same using the DownloadEngine
+    job = new Job();
+    response = DownloadEngine::getDefault()->start(job, request).result();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(response.notModified);
+    QCOMPARE(f.size(), static_cast<qint64>(0));
+    QCOMPARE(server.getNotModifiedCount(), notModified + 2);
+    delete job;
+
+    // a changed repository is downloaded completely
+    QByteArray content2("<root><spec-version>3.1</spec-version></root>");
+    server.setContent(content2);
+    server.setETag("\"r2\"");
+    job = new Job();
+    response = DownloadEngine::getDefault()->start(job, request).result();
+    QCOMPARE(job->getErrorMessage(), QString());
+    QVERIFY(!response.notModified);
+    QCOMPARE(response.etag, QString("\"r2\""));
+    QCOMPARE(response.hashSum, QString(QCryptographicHash::hash(content2,
+            QCryptographicHash::Sha256).toHex().toLower()));
+    QVERIFY(f.seek(0));
+    QVERIFY(f.readAll() == content2);
+    delete job;
+
+    Downloader::setTransport(nullptr);
+    server.stopServer();
+
+    // the metadata is stored in the database
+    QTemporaryFile dbf;
+    QVERIFY(dbf.open());
+    dbf.close();
+
+    DBRepository r;
+    QString err = r.open("conditionalgettest", dbf.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    RepositoryCacheInfo info = r.findRepositoryCacheInfo(
+            "http://example.com/Rep.xml", &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(static_cast<qlonglong>(info.modified), 0LL);
+    QVERIFY(!info.isValid());
+
+    info.etag = response.etag;
+    info.lastModified = "Tue, 15 Nov 1994 12:45:26 GMT";
+    info.sha256 = response.hashSum;
+    info.modified = time(nullptr);
+    err = r.saveRepositoryCacheInfo(info);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    RepositoryCacheInfo info2 = r.findRepositoryCacheInfo(
+            "http://example.com/Rep.xml", &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QVERIFY(info2.isValid());
+    QCOMPARE(info2.etag, info.etag);
+    QCOMPARE(info2.lastModified, info.lastModified);
+    QCOMPARE(info2.sha256, info.sha256);
+}
+
+void App::testIconCacheInfo()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("iconcachetest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QString url("http://example.com/icon.png");
+    IconCacheInfo info = r.findIconCacheInfo(url, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(info.url, url);
+    QVERIFY(info.sha256.isEmpty());
+    QCOMPARE(static_cast<qlonglong>(info.modified), 0LL);
+
+    info.etag = "\"abc\"";
+    info.lastModified = "Wed, 21 Oct 2015 07:28:00 GMT";
+    info.sha256 = "0a1b";
+    info.mimeType = "image/png";
+    info.modified = 1000000;
+    err = r.saveIconCacheInfo(info);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // existing entries are replaced
+    info.modified = 2000000;
+    err = r.saveIconCacheInfo(info);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    IconCacheInfo info2 = r.findIconCacheInfo(url, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(info2.etag, info.etag);
+    QCOMPARE(info2.lastModified, info.lastModified);
+    QCOMPARE(info2.sha256, info.sha256);
+    QCOMPARE(info2.mimeType, info.mimeType);
+    QCOMPARE(static_cast<qlonglong>(info2.modified), 2000000LL);
+}
+
+void App::testSaveURLSizes()
+{
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("urlsizestest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QList<URLInfo> infos;
+    for (int i = 0; i < 100; i++) {
+        URLInfo info(QString("http://example.com/file%1.zip").arg(i));
+        info.size = i % 10 == 0 ? -2 : i * 1000;
+        info.sizeModified = 1000000 + i;
+        infos.append(info);
+    }
+    err = r.saveURLSizes(infos);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // existing entries are replaced
+    infos.clear();
+    URLInfo info("http://example.com/file1.zip");
+    info.size = 5;
+    info.sizeModified = 2000000;
+    infos.append(info);
+    err = r.saveURLSizes(infos);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QMap<QString, URLInfo*> sizes = r.findURLInfos(&err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(sizes.count(), 100);
+    QCOMPARE(sizes.value("http://example.com/file1.zip")->size,
+            static_cast<int64_t>(5));
+    QCOMPARE(static_cast<qlonglong>(
+            sizes.value("http://example.com/file1.zip")->sizeModified),
+            2000000LL);
+    QCOMPARE(sizes.value("http://example.com/file20.zip")->size,
+            static_cast<int64_t>(-2));
+    QCOMPARE(sizes.value("http://example.com/file21.zip")->size,
+            static_cast<int64_t>(21000));
+    qDeleteAll(sizes);
+}
+
+void App::testDownloadStatistics()
+{
+    QList<double> values;
+    QCOMPARE(DownloadStatistics::percentile(&values, 50), -1.0);
+    for (int i = 100; i > 0; i--) {
+        values.append(i);
+    }
+    QCOMPARE(DownloadStatistics::percentile(&values, 50), 50.0);
+    QCOMPARE(DownloadStatistics::percentile(&values, 99), 99.0);
+    QCOMPARE(DownloadStatistics::percentile(&values, 100), 100.0);
+    QCOMPARE(DownloadStatistics::percentile(&values, 0), 1.0);
+
+    QList<double> bounds;
+    bounds << 10 << 50;
+    QList<int> h = DownloadStatistics::histogram(values, bounds);
+    QCOMPARE(h.count(), 3);
+    QCOMPARE(h.at(0), 10);
+    QCOMPARE(h.at(1), 40);
+    QCOMPARE(h.at(2), 50);
+
+    QCOMPARE(DownloadStatistics::getHost(QUrl("https://Example.com/a")),
+            QString("example.com"));
+    QCOMPARE(DownloadStatistics::getHost(QUrl("http://example.com:8080/a")),
+            QString("example.com:8080"));
+
+    TransferStats ts("http://example.com/file.zip");
+    ts.bytes = 1024 * 1024;
+    ts.transferTime = 2000;
+    QCOMPARE(ts.getThroughput(), 512.0 * 1024);
+    ts.cacheHit = true;
+    QCOMPARE(ts.getThroughput(), -1.0);
+
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    f.close();
+
+    DBRepository r;
+    QString err = r.open("transferstatstest", f.fileName());
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QList<TransferStats> stats;
+    for (int i = 0; i < 10; i++) {
+        TransferStats s(QString("http://example.com/file%1.zip").arg(i));
+        s.host = "example.com";
+        s.started = 1000000 + i * 1000;
+        s.ttfb = i * 10;
+        s.bytes = i * 1000;
+        s.retries = i % 2;
+        s.cacheHit = i == 3;
+        if (i == 5)
+            s.error = "HTTP status code 500";
+        stats.append(s);
+    }
+    err = r.saveTransferStats(stats);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    err = r.deleteTransferStats(1005000);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    QList<TransferStats> found = r.findTransferStats(1006000, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(found.count(), 4);
+
+    found = r.findTransferStats(0, &err);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(found.count(), 5);
+    QCOMPARE(found.at(0).url, QString("http://example.com/file5.zip"));
+    QCOMPARE(found.at(0).host, QString("example.com"));
+    QCOMPARE(found.at(0).ttfb, static_cast<qint64>(50));
+    QCOMPARE(found.at(0).bytes, static_cast<int64_t>(5000));
+    QCOMPARE(found.at(0).retries, 1);
+    QCOMPARE(found.at(0).error, QString("HTTP status code 500"));
+    QCOMPARE(found.at(0).dnsTime, static_cast<qint64>(-1));
+    QVERIFY(!found.at(0).cacheHit);
+}
+
+void App::testInstalledPackagesIndex()
+{
+    QCOMPARE(InstalledPackagesIndex::hash(""), 14695981039346656037ULL);
+    QVERIFY(InstalledPackagesIndex::hash("com.example.A") !=
+            InstalledPackagesIndex::hash("com.example.B"));
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString filename = dir.path() + "/InstalledPackages.idx";
+
+    InstalledPackagesIndex index;
+    QVERIFY(!index.open(filename).isEmpty());
+    QCOMPARE(index.getStamp(), static_cast<qint64>(-1));
+
+    QList<InstalledPackageVersion*> ipvs;
+    ipvs.append(new InstalledPackageVersion("com.example.Tool",
+            Version(1, 10), "C:\\Tool-1.10"));
+    ipvs.append(new InstalledPackageVersion("com.example.Tool",
+            Version(1, 2), "C:\\Tool-1.2"));
+    ipvs.append(new InstalledPackageVersion("com.example.Tool",
+            Version(2, 0), ""));
+    ipvs.append(new InstalledPackageVersion("org.example.Lib",
+            Version(3, 0), QString::fromWCharArray(L"C:\\Bibliothek-\u00e4")));
+
+    QString err = InstalledPackagesIndex::write(filename, 12345, ipvs);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+
+    // an existing index is replaced
+    err = InstalledPackagesIndex::write(filename, 123456789012345LL, ipvs);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    qDeleteAll(ipvs);
+
+    err = index.open(filename);
+    QVERIFY2(err.isEmpty(), qPrintable(err));
+    QCOMPARE(index.getStamp(), 123456789012345LL);
+    QCOMPARE(index.count(), 3);
+
+    QList<InstalledPackageVersion*> found = index.find("com.example.Tool");
+    QCOMPARE(found.count(), 2);
+    QCOMPARE(found.at(0)->package, QString("com.example.Tool"));
+    QCOMPARE(found.at(0)->version.getVersionString(), QString("1.2"));
+    QCOMPARE(found.at(0)->directory, QString("C:\\Tool-1.2"));
+    QCOMPARE(found.at(1)->version.getVersionString(), QString("1.10"));
+    QCOMPARE(found.at(1)->directory, QString("C:\\Tool-1.10"));
+    qDeleteAll(found);
+
+    found = index.find("org.example.Lib");
+    QCOMPARE(found.count(), 1);
+    QCOMPARE(found.at(0)->directory,
+            QString::fromWCharArray(L"C:\\Bibliothek-\u00e4"));
+    qDeleteAll(found);
+
+    found = index.find("com.example.Unknown");
+    QCOMPARE(found.count(), 0);
+
+    found = index.getAll();
+    QCOMPARE(found.count(), 3);
+    qDeleteAll(found);
+
+    index.close();
+    QCOMPARE(index.getStamp(), static_cast<qint64>(-1));
+
+    // a damaged file is rejected
+    QFile f(filename);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    f.write("NPKI");
+    f.close();
+    QVERIFY(!index.open(filename).isEmpty());
+}
@@ -45,6 +45,126 @@ private slots:
      * Tests for WPMUtils::normalizePath
      */
     void testNormalizePath();
+
+    /**
+     * Tests for DependencySolver
+     */
+    void testDependencySolver();
+
+    /**
+     * Tests for AbstractRepository::planUninstallation
+     */
+    void testPlanUninstallation();
+
+    /**
+     * Tests for AbstractRepository::planUpdates
+     */
+    void testPlanUpdates();
+
+    /**
+     * Tests for InstallOperation::simplify
+     */
+    void testSimplifyOperations();
+
+    /**
+     * Tests for PlanExplanation
+     */
+    void testPlanExplanation();
+
+    /**
+     * Tests for InstallScheduler
+     */
+    void testInstallScheduler();
+
+    /**
+     * Tests for DownloadCache
+     */
+    void testDownloadCache();
+
+    /**
+     * Tests for resuming an interrupted download in Downloader
+     */
+    void testDownloadResume();
+
+    /**
+     * Tests for the segmented download in Downloader
+     */
+    void testSegmentedDownload();
+
+    /**
+     * Tests for ZipStreamExtractor
+     */
+    void testZipStreamExtractor();
+
+    /**
+     * Tests for WPMUtils::unzip
+     */
+    void testUnzip();
+
+    /**
+     * Tests for HashEngine
+     */
+    void testHashEngine();
+
+    /**
+     * Tests for downloading file:// URLs
+     */
+    void testLocalDownload();
+
+    /**
+     * Tests for mirrors and MirrorSelector
+     */
+    void testMirrors();
+
+    /**
+     * Tests for DownloadScheduler
+     */
+    void testDownloadScheduler();
+
+    /**
+     * Tests for AbstractRepository::prefetch
+     */
+    void testPrefetch();
+
+    /**
+     * Tests for DeltaUpdate
+     */
+    void testDeltaUpdate();
+
+    /**
+     * Tests for QtNetworkTransport
+     */
+    void testQtNetworkTransport();
+
+    /**
+     * Tests for DownloadEngine
+     */
+    void testDownloadEngine();
+
+    /**
+     * Tests for conditional HTTP requests and RepositoryCacheInfo
+     */
+    void testConditionalGET();
+
+    /**
+     * Tests for DBRepository::saveIconCacheInfo
+     */
+    void testIconCacheInfo();
+
+    /**
+     * Tests for DBRepository::saveURLSizes
+     */
+    void testSaveURLSizes();
+
+    /**
+     * Tests for DownloadStatistics and DBRepository::saveTransferStats
+     */
+    void testDownloadStatistics();
+
+    /**
+     * Tests for InstalledPackagesIndex
+     */
+    void testInstalledPackagesIndex();
 };
 
 #endif // APP_H
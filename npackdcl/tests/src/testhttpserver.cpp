@@ -0,0 +1,255 @@
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QStringList>
+
+#include "testhttpserver.h"
+
+TestHTTPServer::TestHTTPServer(const QByteArray &content):
+        listenSocket(INVALID_SOCKET), port(0), content(content),
+        etag("\"npackd-test-1\""), dropAfter(-1), latency(0)
+{
+    pool.setMaxThreadCount(16);
+}
+
+TestHTTPServer::~TestHTTPServer()
+{
+    stopServer();
+}
+
+QString TestHTTPServer::startServer()
+{
+    QString err;
+
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+        err = "WSAStartup failed";
+
+    SOCKET s = INVALID_SOCKET;
+    if (err.isEmpty()) {
+        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (s == INVALID_SOCKET)
+            err = QString("socket failed: %1").arg(WSAGetLastError());
+    }
+
+    if (err.isEmpty()) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        int len = sizeof(addr);
+        if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+                listen(s, SOMAXCONN) != 0 ||
+                getsockname(s, reinterpret_cast<sockaddr*>(&addr), &len) != 0)
+            err = QString("bind/listen failed: %1").arg(WSAGetLastError());
+        else
+            port = ntohs(addr.sin_port);
+    }
+
+    if (err.isEmpty()) {
+        listenSocket = s;
+        start();
+    } else if (s != INVALID_SOCKET) {
+        closesocket(s);
+    }
+
+    return err;
+}
+
+void TestHTTPServer::stopServer()
+{
+    if (listenSocket != INVALID_SOCKET) {
+        // accept() fails after the socket is closed
+        closesocket(listenSocket);
+        wait();
+        pool.waitForDone();
+        listenSocket = INVALID_SOCKET;
+        WSACleanup();
+    }
+}
+
+QUrl TestHTTPServer::getURL(const QString &path) const
+{
+    return QUrl(QString("http://127.0.0.1:%1%2").arg(port).arg(path));
+}
+
+void TestHTTPServer::setETag(const QString &etag)
+{
+    QMutexLocker ml(&mutex);
+    this->etag = etag;
+}
+
+void TestHTTPServer::setDropAfter(qint64 bytes)
+{
+    QMutexLocker ml(&mutex);
+    this->dropAfter = bytes;
+}
+
+void TestHTTPServer::setLatency(int ms)
+{
+    QMutexLocker ml(&mutex);
+    this->latency = ms;
+}
+
+int TestHTTPServer::getRequestCount() const
+{
+    return requests.load();
+}
+
+int TestHTTPServer::getRangeRequestCount() const
+{
+    return rangeRequests.load();
+}
+
+int TestHTTPServer::getNotModifiedCount() const
+{
+    return notModifiedRequests.load();
+}
+
+void TestHTTPServer::setContent(const QByteArray &content)
+{
+    QMutexLocker ml(&mutex);
+    this->content = content;
+}
+
+int TestHTTPServer::getBytesSent() const
+{
+    return bytesSent.load();
+}
+
+void TestHTTPServer::run()
+{
+    while (true) {
+        SOCKET s = accept(listenSocket, nullptr, nullptr);
+        if (s == INVALID_SOCKET)
+            break;
+
+        QtConcurrent::run(&pool, this, &TestHTTPServer::handle,
+                static_cast<quintptr>(s));
+    }
+}
+
+void TestHTTPServer::handle(quintptr s_)
+{
+    SOCKET s = static_cast<SOCKET>(s_);
+
+    // request headers
+    QByteArray request;
+    char buffer[4096];
+    while (!request.contains("\r\n\r\n")) {
+        int n = recv(s, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            break;
+        request.append(buffer, n);
+    }
+
+    QMutexLocker ml(&mutex);
+    QByteArray content_ = content;
+    QString etag_ = etag;
+    qint64 dropAfter_ = dropAfter;
+    dropAfter = -1;
+    int latency_ = latency;
+    ml.unlock();
+
+    requests.ref();
+
+    QStringList lines = QString::fromLatin1(request).split("\r\n");
+    QString method = lines.value(0).section(' ', 0, 0);
+    QString range, ifRange, ifNoneMatch;
+    for (int i = 1; i < lines.count(); i++) {
+        QString line = lines.at(i);
+        QString name = line.section(':', 0, 0).trimmed().toLower();
+        QString value = line.section(':', 1).trimmed();
+        if (name == "range")
+            range = value;
+        else if (name == "if-range")
+            ifRange = value;
+        else if (name == "if-none-match")
+            ifNoneMatch = value;
+    }
+
+    if (latency_ > 0)
+        Sleep(static_cast<DWORD>(latency_));
+
+    qint64 from = 0;
+    qint64 to = content_.size() - 1;
+    bool partial = false;
+    if (range.startsWith("bytes=") &&
+            (ifRange.isEmpty() || ifRange == etag_)) {
+        QString r = range.mid(6);
+        bool ok;
+        qint64 f = r.section('-', 0, 0).toLongLong(&ok);
+        if (ok) {
+            QString t = r.section('-', 1, 1);
+            qint64 t_ = t.isEmpty() ? to : t.toLongLong(&ok);
+            if (ok && f <= t_ && t_ <= to) {
+                from = f;
+                to = t_;
+                partial = true;
+            }
+        }
+    }
+
+    if (!etag_.isEmpty() && ifNoneMatch == etag_ && range.isEmpty()) {
+        notModifiedRequests.ref();
+        QByteArray h = QString("HTTP/1.1 304 Not Modified\r\n"
+                "ETag: %1\r\n"
+                "Connection: close\r\n\r\n").arg(etag_).toLatin1();
+        send(s, h.constData(), h.size(), 0);
+        shutdown(s, SD_BOTH);
+        closesocket(s);
+        return;
+    }
+
+    QString headers;
+    if (partial) {
+        rangeRequests.ref();
+        headers = QString("HTTP/1.1 206 Partial Content\r\n"
+                "Content-Range: bytes %1-%2/%3\r\n").
+                arg(from).arg(to).arg(content_.size());
+    } else {
+        headers = "HTTP/1.1 200 OK\r\n";
+    }
+    headers.append(QString("Content-Type: application/octet-stream\r\n"
+            "Content-Length: %1\r\n"
+            "Accept-Ranges: bytes\r\n"
+            "ETag: %2\r\n"
+            "Connection: close\r\n\r\n").arg(to - from + 1).arg(etag_));
+    QByteArray h = headers.toLatin1();
+    send(s, h.constData(), h.size(), 0);
+
+    if (method != "HEAD") {
+        qint64 end = to + 1;
+        if (dropAfter_ >= 0 && from + dropAfter_ < end)
+            end = from + dropAfter_;
+
+        qint64 pos = from;
+        while (pos < end) {
+            int n = static_cast<int>(qMin(static_cast<qint64>(64 * 1024),
+                    end - pos));
+            int sent = send(s, content_.constData() + pos, n, 0);
+            if (sent <= 0)
+                break;
+            pos += sent;
+            bytesSent.fetchAndAddOrdered(sent);
+
+            if (latency_ > 0)
+                Sleep(static_cast<DWORD>(latency_));
+        }
+
+        if (end <= to) {
+            // reset the connection instead of a graceful shutdown
+            linger l;
+            l.l_onoff = 1;
+            l.l_linger = 0;
+            setsockopt(s, SOL_SOCKET, SO_LINGER,
+                    reinterpret_cast<const char*>(&l), sizeof(l));
+        }
+    }
+
+    shutdown(s, SD_BOTH);
+    closesocket(s);
+}
@@ -0,0 +1,126 @@
+#ifndef TESTHTTPSERVER_H
+#define TESTHTTPSERVER_H
+
+#include <QThread>
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThreadPool>
+
+/**
+ * @brief minimal HTTP/1.1 server on 127.0.0.1 for the tests of the
+ *     Downloader. It serves the same content for all paths and supports GET,
+ *     HEAD, "Range" and "If-Range". Every connection is closed after the
+ *     response.
+ */
+class TestHTTPServer: public QThread
+{
+private:
+    mutable QMutex mutex;
+
+    /** listening socket (SOCKET) */
+    quintptr listenSocket;
+
+    quint16 port;
+
+    QByteArray content;
+
+    QString etag;
+
+    qint64 dropAfter;
+
+    int latency;
+
+    QAtomicInt requests;
+
+    QAtomicInt rangeRequests;
+
+    QAtomicInt notModifiedRequests;
+
+    QAtomicInt bytesSent;
+
+    /** connections are processed in parallel */
+    QThreadPool pool;
+
+    /**
+     * @brief processes one request
+     * @param s connected socket (SOCKET)
+     */
+    void handle(quintptr s);
+protected:
+    void run() override;
+public:
+    /**
+     * @param content data for all requests
+     */
+    explicit TestHTTPServer(const QByteArray& content);
+
+    ~TestHTTPServer() override;
+
+    /**
+     * @brief starts listening on a free port and starts the thread
+     * @return error message or ""
+     */
+    QString startServer();
+
+    /**
+     * @brief stops the thread
+     */
+    void stopServer();
+
+    /**
+     * @param path path part of the URL
+     * @return URL for this server
+     */
+    QUrl getURL(const QString& path="/file.bin") const;
+
+    /**
+     * @brief changes the ETag. This simulates a changed file on the server.
+     * @param etag new ETag including the quotes
+     */
+    void setETag(const QString& etag);
+
+    /**
+     * @brief changes the data for all requests
+     * @param content new data
+     */
+    void setContent(const QByteArray& content);
+
+    /**
+     * @brief the next response will be interrupted
+     * @param bytes the connection will be closed after sending this number
+     *     of bytes of the body. -1 = do not interrupt.
+     */
+    void setDropAfter(qint64 bytes);
+
+    /**
+     * @param ms delay in milliseconds before each response and after each
+     *     64 KiB of the body. This limits the throughput of one connection
+     *     like a high round trip time.
+     */
+    void setLatency(int ms);
+
+    /**
+     * @return number of processed requests
+     */
+    int getRequestCount() const;
+
+    /**
+     * @return number of requests answered with "206 Partial Content"
+     */
+    int getRangeRequestCount() const;
+
+    /**
+     * @return number of requests answered with "304 Not Modified"
+     */
+    int getNotModifiedCount() const;
+
+    /**
+     * @return number of sent bytes of the body for all requests
+     */
+    int getBytesSent() const;
+};
+
+#endif // TESTHTTPSERVER_H
@@ -1,12 +1,285 @@
 #include "QLoggingCategory"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QFuture>
+#include <QTemporaryDir>
+#include <QThread>
 
 #include "abstractrepository.h"
 #include "wpmutils.h"
 #include "windowsregistry.h"
 #include "installedpackages.h"
 #include "downloader.h"
+#include "dependencysolver.h"
+#include "installscheduler.h"
+#include "downloadcache.h"
 
 QSemaphore AbstractRepository::installationScripts(1);
+QThreadPool AbstractRepository::downloadThreadPool;
+QThreadPool AbstractRepository::installThreadPool;
+int AbstractRepository::maxParallelInstalls = 1;
+int AbstractRepository::maxParallelDownloads = 3;
+
+/**
+ * @brief installation or removal of one package version in
+ *     AbstractRepository::process
+ */
+class OperationTask
+{
+public:
+    /** job for this operation */
+    Job* job;
+
+    /** operation */
+    InstallOperation* op;
+
+    /** package version */
+    PackageVersion* pv;
+
+    /** directory with the downloaded binary or "" for uninstallations */
+    QString dir;
+
+    /** name of the binary relative to "dir" or "" */
+    QString binary;
+
+    bool printScriptOutput;
+
+    DWORD programCloseType;
+
+    /** stopped services will be stored here */
+    QStringList stoppedServices;
+
+    /** will be released after the operation */
+    QSemaphore* done;
+
+    /** true if the result was already processed */
+    bool finished = false;
+};
+
+/**
+ * @brief installs or removes one package version. Calls
+ *     CoInitialize/CoUninitialize.
+ * @param t operation
+ */
+static void processOperation(OperationTask* t)
+{
+    CoInitialize(nullptr);
+
+    QDir d;
+    Job* sub = t->job;
+    InstallOperation* op = t->op;
+    PackageVersion* pv = t->pv;
+
+    if (op->install) {
+        QString dir = t->dir;
+        bool ok = true;
+
+        if (op->where.isEmpty()) {
+            // if we are not forced to install in a particular
+            // directory, we try to use the ideal location
+            QString try_ = pv->getIdealInstallationDirectory();
+            if (WPMUtils::pathEquals(try_, dir) ||
+                    (!d.exists(try_) && d.rename(dir, try_))) {
+                dir = try_;
+            } else {
+                qCWarning(npackdImportant()).noquote() << QObject::tr(
+                        "The preferred installation directory \"%1\" is not available").arg(try_);
+
+                try_ = pv->getSecondaryInstallationDirectory();
+                if (WPMUtils::pathEquals(try_, dir) ||
+                        (!d.exists(try_) && d.rename(dir, try_))) {
+                    dir = try_;
+                } else {
+                    try_ = WPMUtils::findNonExistingFile(try_, "");
+                    if (WPMUtils::pathEquals(try_, dir) ||
+                            (!d.exists(try_) && d.rename(dir, try_))) {
+                        dir = try_;
+                    }
+                }
+            }
+        } else {
+            if (d.exists(op->where)) {
+                if (!WPMUtils::pathEquals(op->where, dir) &&
+                        op->exactLocation) {
+                    // we should install in a particular directory, but it
+                    // exists.
+                    Job* djob = sub->newSubJob(1,
+                            QObject::tr("Deleting temporary directory %1").
+                            arg(dir));
+                    WPMUtils::removeDirectory(djob, dir);
+                    sub->setErrorMessage(QObject::tr(
+                            "Cannot install %1 into %2. The directory already exists.").
+                            arg(pv->toString(true)).arg(op->where));
+                    ok = false;
+                }
+            } else {
+                Job* moveJob = sub->newSubJob(0.01, QObject::tr("Renaming directory"), true, true);
+                WPMUtils::renameDirectory(moveJob, dir, op->where);
+                if (moveJob->getErrorMessage().isEmpty())
+                    dir = op->where;
+                else if (op->exactLocation) {
+                    // we should install in a particular directory, but it
+                    // exists.
+                    Job* djob = sub->newSubJob(1,
+                            QObject::tr("Deleting temporary directory %1").
+                            arg(dir));
+                    WPMUtils::removeDirectory(djob, dir);
+                    sub->setErrorMessage(QObject::tr(
+                            "Cannot install %1 into %2. Cannot rename %3.").
+                            arg(pv->toString(true), op->where, dir));
+                    ok = false;
+                }
+            }
+        }
+
+        if (ok)
+            pv->install(sub, dir, t->binary, t->printScriptOutput,
+                    t->programCloseType, &t->stoppedServices);
+    } else
+        pv->uninstall(sub, t->printScriptOutput, t->programCloseType,
+                &t->stoppedServices);
+
+    CoUninitialize();
+
+    t->done->release();
+}
+
+void AbstractRepository::setMaxParallelInstalls(int n)
+{
+    if (n < 1)
+        n = 1;
+
+    maxParallelInstalls = n;
+    installThreadPool.setMaxThreadCount(n);
+}
+
+void AbstractRepository::setMaxParallelDownloads(int n)
+{
+    if (n < 1)
+        n = 1;
+
+    maxParallelDownloads = n;
+    downloadThreadPool.setMaxThreadCount(n);
+}
+
+int AbstractRepository::getMaxParallelDownloads()
+{
+    return maxParallelDownloads;
+}
+
+QString AbstractRepository::downloadWithCoInitialize(Job *job,
+        PackageVersion *pv, const QString &where,
+        const Downloader::Request &credentials, bool binaryOnly)
+{
+    CoInitialize(nullptr);
+    QString r = pv->download_(job, where, credentials.interactive,
+            credentials.user, credentials.password,
+            credentials.proxyUser, credentials.proxyPassword, binaryOnly);
+    CoUninitialize();
+
+    return r;
+}
+
+void AbstractRepository::prefetch(Job* job,
+        const QList<PackageVersion*>& pvs,
+        const Downloader::Request& credentials, qint64* bytes)
+{
+    *bytes = 0;
+
+    DownloadCache* dc = DownloadCache::getDefault();
+
+    QTemporaryDir tmp;
+    if (!tmp.isValid())
+        job->setErrorMessage(QObject::tr("Cannot create a temporary directory"));
+
+    int n = pvs.count();
+
+    // the binaries are downloaded in sub-directories that are deleted
+    // afterwards. The same indexes as in "pvs". Empty futures are used for
+    // the binaries that are already in the cache or downloaded for another
+    // package version with the same hash sum.
+    QList<QFuture<QString> > downloads;
+    QList<Job*> jobs;
+    QStringList dirs;
+    QStringList keys;
+    if (job->shouldProceed()) {
+        // QThreadPool uses the number of CPU cores by default
+        downloadThreadPool.setMaxThreadCount(maxParallelDownloads);
+
+        for (int i = 0; i < n; i++) {
+            PackageVersion* pv = pvs.at(i);
+
+            // the progress of the parent job is updated when the download is
+            // finished as the downloads run in parallel
+            Job* sub = job->newSubJob(1.0 / n, QObject::tr("Downloading %1").
+                    arg(pv->toString()), false, true);
+            jobs.append(sub);
+
+            QString key = QString::number(pv->hashSumType) + ":" +
+                    pv->sha1.trimmed().toLower();
+            if (keys.contains(key) ||
+                    dc->contains(pv->hashSumType, pv->sha1)) {
+                sub->completeWithProgress();
+                downloads.append(QFuture<QString>());
+                dirs.append("");
+            } else {
+                QString dir = tmp.path() + "\\" + QString::number(i);
+                dir.replace('/', '\\');
+                downloads.append(QtConcurrent::run(&downloadThreadPool,
+                        downloadWithCoInitialize, sub, pv, dir, credentials,
+                        true));
+                dirs.append(dir);
+            }
+            keys.append(key);
+        }
+    }
+
+    // the first failed download cancels the others
+    QList<bool> finished;
+    for (int i = 0; i < downloads.count(); i++) {
+        finished.append(false);
+    }
+    int nfinished = 0;
+    while (nfinished < downloads.count()) {
+        bool failed = false;
+        for (int i = 0; i < downloads.count(); i++) {
+            if (finished.at(i) || (!dirs.at(i).isEmpty() &&
+                    !downloads.at(i).isFinished()))
+                continue;
+
+            finished[i] = true;
+            nfinished++;
+
+            Job* sub = jobs.at(i);
+            if (!dirs.at(i).isEmpty()) {
+                if (sub->getErrorMessage().isEmpty() && !sub->isCancelled()) {
+                    PackageVersion* pv = pvs.at(i);
+                    qint64 size = dc->getSize(pv->hashSumType, pv->sha1);
+                    if (size >= 0)
+                        *bytes += size;
+                } else if (!sub->getErrorMessage().isEmpty()) {
+                    failed = true;
+                }
+
+                // only the temporary download file is stored here
+                QDir(dirs.at(i)).removeRecursively();
+            }
+
+            job->setProgress(static_cast<double>(nfinished) / n);
+        }
+
+        if (failed || job->isCancelled()) {
+            for (int i = 0; i < jobs.count(); i++) {
+                if (!finished.at(i))
+                    jobs.at(i)->cancel();
+            }
+        }
+
+        if (nfinished < downloads.count())
+            QThread::msleep(100);
+    }
+
+    job->complete();
+}
 
 QStringList AbstractRepository::getRepositoryURLs(HKEY hk, const QString& path,
         QString* err, bool* keyExists)
@@ -434,12 +707,26 @@ void AbstractRepository::process(Job *job,
     // where the binary was downloaded
     QStringList dirs;
 
-    // names of the binaries relative to the directory
-    QStringList binaries;
+    // running downloads. The same indexes as in "install". Empty futures are
+    // used for uninstallations.
+    QList<QFuture<QString> > downloads;
+
+    // jobs for the downloads or 0
+    QList<Job*> downloadJobs;
 
     // 70% for downloading the binaries
     if (job->shouldProceed()) {
-        // downloading packages
+        Downloader::Request credentials = QUrl();
+        credentials.interactive = interactive;
+        credentials.user = user;
+        credentials.password = password;
+        credentials.proxyUser = proxyUser;
+        credentials.proxyPassword = proxyPassword;
+
+        // QThreadPool uses the number of CPU cores by default
+        downloadThreadPool.setMaxThreadCount(maxParallelDownloads);
+
+        // starting the downloads
         for (int i = 0; i < install.count(); i++) {
             InstallOperation* op = install.at(i);
             PackageVersion* pv = pvs.at(i);
@@ -447,7 +734,9 @@ void AbstractRepository::process(Job *job,
                 QString txt = QObject::tr("Downloading %1").arg(
                         pv->toString());
 
-                Job* sub = job->newSubJob(0.7 / n, txt, true, true);
+                // the progress of the parent job is updated when the
+                // download is finished as the downloads run in parallel
+                Job* sub = job->newSubJob(0.7 / n, txt, false, true);
 
                 // dir is not the final installation directory. It can be
                 // changed later during the installation.
@@ -462,20 +751,27 @@ void AbstractRepository::process(Job *job,
                             QObject::tr("Directory %1 already exists").
                             arg(dir));
                     dirs.append("");
-                    binaries.append("");
+                } else if (!d.mkpath(dir)) {
+                    // the directory is created here so that the next
+                    // download cannot choose the same one
+                    sub->setErrorMessage(
+                            QObject::tr("Cannot create directory: %0").
+                            arg(dir));
+                    dirs.append("");
                 } else {
                     dirs.append(dir);
-
-                    QString binary = pv->download_(sub, dir, interactive,
-                            user, password, proxyUser, proxyPassword);
-                    binaries.append(QFileInfo(binary).fileName());
-                    if (sub->isCancelled())
-                        job->cancel();
+                    downloads.append(QtConcurrent::run(&downloadThreadPool,
+                            downloadWithCoInitialize, sub, pv, dir,
+                            credentials, false));
+                    downloadJobs.append(sub);
                 }
             } else {
                 dirs.append("");
-                binaries.append("");
-                job->setProgress(job->getProgress() + 0.7 / n);
+            }
+
+            if (downloads.count() < dirs.count()) {
+                downloads.append(QFuture<QString>());
+                downloadJobs.append(nullptr);
             }
 
             if (!job->shouldProceed())
@@ -483,6 +779,43 @@ void AbstractRepository::process(Job *job,
         }
     }
 
+    // all binaries are downloaded before the installation scripts of other
+    // processes are blocked and the packages are stopped. A failed download
+    // cancels the others.
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Downloading"));
+    }
+    QList<bool> downloaded;
+    for (int i = 0; i < downloads.count(); i++) {
+        downloaded.append(downloadJobs.at(i) == nullptr);
+        if (downloaded.at(i))
+            job->setProgress(job->getProgress() + 0.7 / n);
+    }
+    while (true) {
+        bool finished = true;
+        for (int i = 0; i < downloads.count(); i++) {
+            if (!downloaded.at(i)) {
+                if (downloads.at(i).isFinished()) {
+                    downloaded[i] = true;
+                    job->setProgress(job->getProgress() + 0.7 / n);
+                    if (downloadJobs.at(i)->isCancelled())
+                        job->cancel();
+                } else {
+                    finished = false;
+                    if (!job->shouldProceed())
+                        downloadJobs.at(i)->cancel();
+                }
+            }
+        }
+
+        if (finished)
+            break;
+
+        QThread::msleep(100);
+    }
+    job->setTitle(initialTitle);
+
     bool installationScriptAcquired = false;
 
     if (job->shouldProceed()) {
@@ -529,103 +862,97 @@ void AbstractRepository::process(Job *job,
         }
     }
 
-    int processed = 0;
+    // true = the operation was successfully executed
+    QList<bool> processed;
+    for (int i = 0; i < dirs.count(); i++)
+        processed.append(false);
 
-    // 19% for removing/installing the packages
+    // 18% for removing/installing the packages
     if (job->shouldProceed()) {
-        // installing/removing packages
+        InstallScheduler scheduler(install, pvs, maxParallelInstalls);
+
+        // released after each operation
+        QSemaphore done;
+
+        QList<OperationTask*> tasks;
+        QList<QFuture<void> > futures;
         for (int i = 0; i < install.count(); i++) {
-            InstallOperation* op = install.at(i);
-            PackageVersion* pv = pvs.at(i);
-            QString txt;
-            if (op->install)
-                txt = QString(QObject::tr("Installing %1")).arg(
-                        pv->toString());
-            else
-                txt = QString(QObject::tr("Uninstalling %1")).arg(
-                        pv->toString());
+            tasks.append(nullptr);
+            futures.append(QFuture<void>());
+        }
 
-            Job* sub = job->newSubJob(0.18 / n, txt, true, true);
-            if (op->install) {
-                QString dir = dirs.at(i);
-                QString binary = binaries.at(i);
+        while (true) {
+            if (job->shouldProceed()) {
+                // the binaries were already downloaded
+                while (job->shouldProceed()) {
+                    int i = scheduler.takeNext();
+                    if (i < 0)
+                        break;
 
-                if (op->where.isEmpty()) {
-                    // if we are not forced to install in a particular
-                    // directory, we try to use the ideal location
-                    QString try_ = pv->getIdealInstallationDirectory();
-                    if (WPMUtils::pathEquals(try_, dir) ||
-                            (!d.exists(try_) && d.rename(dir, try_))) {
-                        dir = try_;
-                    } else {
-                        qCWarning(npackdImportant()).noquote() << QObject::tr(
-                                "The preferred installation directory \"%1\" is not available").arg(try_);
-
-                        try_ = pv->getSecondaryInstallationDirectory();
-                        if (WPMUtils::pathEquals(try_, dir) ||
-                                (!d.exists(try_) && d.rename(dir, try_))) {
-                            dir = try_;
-                        } else {
-                            try_ = WPMUtils::findNonExistingFile(try_, "");
-                            if (WPMUtils::pathEquals(try_, dir) ||
-                                    (!d.exists(try_) && d.rename(dir, try_))) {
-                                dir = try_;
-                            }
-                        }
-                    }
-                } else {
-                    if (d.exists(op->where)) {
-                        if (!WPMUtils::pathEquals(op->where, dir) &&
-                                op->exactLocation) {
-                            // we should install in a particular directory, but it
-                            // exists.
-                            Job* djob = sub->newSubJob(1,
-                                    QObject::tr("Deleting temporary directory %1").
-                                    arg(dir));
-                            WPMUtils::removeDirectory(djob, dir);
-                            job->setErrorMessage(QObject::tr(
-                                    "Cannot install %1 into %2. The directory already exists.").
-                                    arg(pv->toString(true)).arg(op->where));
-                            break;
-                        }
-                    } else {
-                        Job* moveJob = sub->newSubJob(0.01, QObject::tr("Renaming directory"), true, true);
-                        WPMUtils::renameDirectory(moveJob, dir, op->where);
-                        if (moveJob->getErrorMessage().isEmpty())
-                            dir = op->where;
-                        else if (op->exactLocation) {
-                            // we should install in a particular directory, but it
-                            // exists.
-                            Job* djob = sub->newSubJob(1,
-                                    QObject::tr("Deleting temporary directory %1").
-                                    arg(dir));
-                            WPMUtils::removeDirectory(djob, dir);
-                            job->setErrorMessage(QObject::tr(
-                                    "Cannot install %1 into %2. Cannot rename %3.").
-                                    arg(pv->toString(true), op->where, dir));
-                            break;
-                        }
-                    }
+                    InstallOperation* op = install.at(i);
+                    PackageVersion* pv = pvs.at(i);
+
+                    QString txt;
+                    if (op->install)
+                        txt = QString(QObject::tr("Installing %1")).arg(
+                                pv->toString());
+                    else
+                        txt = QString(QObject::tr("Uninstalling %1")).arg(
+                                pv->toString());
+
+                    OperationTask* t = new OperationTask();
+                    t->job = job->newSubJob(0.18 / n, txt, false, true);
+                    t->op = op;
+                    t->pv = pv;
+                    t->dir = dirs.at(i);
+                    if (op->install)
+                        t->binary = QFileInfo(downloads.at(i).result()).
+                                fileName();
+                    t->printScriptOutput = printScriptOutput;
+                    t->programCloseType = programCloseType;
+                    t->done = &done;
+                    tasks[i] = t;
+                    futures[i] = QtConcurrent::run(&installThreadPool,
+                            processOperation, t);
                 }
+            }
 
-                pv->install(sub, dir, binary, printScriptOutput,
-                        programCloseType, &stoppedServices);
-            } else
-                pv->uninstall(sub, printScriptOutput, programCloseType,
-                        &stoppedServices);
-
-            if (!job->shouldProceed())
+            if (scheduler.getRunningCount() == 0 &&
+                    (scheduler.allStarted() || !job->shouldProceed()))
                 break;
 
-            processed = i + 1;
+            // wait for a finished operation
+            (void) done.tryAcquire(1, 100);
+
+            for (int i = 0; i < tasks.count(); i++) {
+                OperationTask* t = tasks.at(i);
+                if (t && !t->finished && futures.at(i).isFinished()) {
+                    t->finished = true;
+                    scheduler.finished(i);
+                    processed[i] = t->job->getErrorMessage().isEmpty() &&
+                            !t->job->isCancelled();
+                    stoppedServices.append(t->stoppedServices);
+                    job->setProgress(job->getProgress() + 0.18 / n);
+                }
+            }
         }
+
+        qDeleteAll(tasks);
+    }
+
+    // stopping the remaining downloads
+    for (int i = 0; i < downloads.count(); i++) {
+        Job* djob = downloadJobs.at(i);
+        if (djob && !job->shouldProceed())
+            djob->cancel();
+        downloads[i].waitForFinished();
     }
 
     // removing the binaries if we should not proceed
     if (!job->shouldProceed()) {
-        for (int i = processed; i < dirs.count(); i++) {
+        for (int i = 0; i < dirs.count(); i++) {
             QString dir = dirs.at(i);
-            if (!dir.isEmpty()) {
+            if (!dir.isEmpty() && !processed.at(i)) {
                 QString txt = QObject::tr("Deleting %1").arg(dir);
 
                 Job* sub = job->newSubJob(0.01 / dirs.count(), txt, true, false);
@@ -737,23 +1064,31 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
         const QList<Package*> packages,
         QList<Dependency*> ranges,
         QList<InstallOperation*>& ops, bool keepDirectories,
-        bool install, const QString &where_, bool exactLocation)
+        bool install, const QString &where_, bool exactLocation,
+        PlanExplanation* explanation)
 {
     QString err;
 
     QList<PackageVersion*> newest, newesti;
     QList<bool> used;
 
-    // get the list of installed packages
-    QSet<QString> before;
+    if (explanation)
+        explanation->startPhase("targets");
+
+    // the data from the repository is read only once for the whole plan. The
+    // index of reverse dependencies is updated incrementally.
+    DependencySolver solver(this);
+    solver.setExplanation(explanation);
+    ReverseDependencies rd;
+    rd.build(solver, installed);
 
     // packages first
     if (err.isEmpty()) {
         for (int i = 0; i < packages.count(); i++) {
             Package* p = packages.at(i);
 
-            PackageVersion* a = findNewestInstallablePackageVersion_(p->name,
-                    &err);
+            PackageVersion* a = solver.findNewestInstallablePackageVersion(
+                    p->name, &err);
             if (!err.isEmpty())
                 break;
 
@@ -766,7 +1101,7 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
             InstalledPackageVersion* ib = installed.getNewestInstalled(p->name);
             PackageVersion* b = nullptr;
             if (ib) {
-                b = this->findPackageVersion_(p->name, ib->version, &err);
+                b = solver.findPackageVersion(p->name, ib->version, &err);
                 delete ib;
             }
 
@@ -790,8 +1125,8 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                     a->version.getVersionString();
 
             if (b == nullptr || a->version.compare(b->version) > 0) {
-                newest.append(a);
-                newesti.append(b);
+                newest.append(a->clone());
+                newesti.append(b ? b->clone() : nullptr);
                 used.append(false);
             }
         }
@@ -808,8 +1143,7 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                 break;
             }
 
-            PackageVersion* a = findBestMatchToInstall(*d,
-                    QList<PackageVersion*>(), &err);
+            PackageVersion* a = solver.findBestMatchToInstall(*d, &err);
             if (!err.isEmpty())
                 break;
 
@@ -822,7 +1156,9 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
             InstalledPackageVersion* ipv = findHighestInstalledMatch(*d);
             PackageVersion* b = nullptr;
             if (ipv) {
-                b = findPackageVersion_(ipv->package, ipv->version, &err);
+                b = solver.findPackageVersion(ipv->package, ipv->version,
+                        &err);
+                delete ipv;
                 if (!err.isEmpty()) {
                     err = QString(QObject::tr("Cannot find the newest installed version for %1: %2")).
                             arg(p->title).arg(err);
@@ -844,8 +1180,8 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                     a->version.getVersionString();
 
             if (b == nullptr || a->version.compare(b->version) > 0) {
-                newest.append(a);
-                newesti.append(b);
+                newest.append(a->clone());
+                newesti.append(b ? b->clone() : nullptr);
                 used.append(false);
             }
         }
@@ -854,6 +1190,9 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
     if (err.isEmpty()) {
         qCDebug(npackd) << "planUpdates: searching install/uninstall pairs";
 
+        if (explanation)
+            explanation->startPhase("uninstall first");
+
         // many packages cannot be installed side-by-side and overwrite for
         // example
         // the shortcuts of the old version in the start menu. We try to find
@@ -866,11 +1205,19 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
             QList<PackageVersion*> avoid;
             QList<InstallOperation*> ops2;
             InstalledPackages installedCopy(installed);
+            ReverseDependencies rdCopy(rd);
 
             PackageVersion* b = newesti.at(i);
             if (b) {
+                if (explanation) {
+                    explanation->begin("uninstall first",
+                            newest.at(i)->package, newest.at(i)->version);
+                    explanation->set("installed",
+                            b->version.getVersionString());
+                }
+
                 QString err = planUninstallation(
-                        installedCopy, b->package, b->version, ops2);
+                        installedCopy, rdCopy, b->package, b->version, ops2);
 
                 qCDebug(npackd) << "planUpdates: 1st uninstall" <<
                         b->package << "resulted in" << ops2.count() <<
@@ -883,8 +1230,8 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                     else if (keepDirectories)
                         where = b->getPath();
 
-                    err = newest.at(i)->planInstallation(installedCopy, ops2,
-                            avoid, where);
+                    err = solver.planInstallation(newest.at(i),
+                            installedCopy, ops2, avoid, where);
 
                     qCDebug(npackd) << "planUpdates: 1st install and uninstall" <<
                             b->package << "resulted in" << ops2.count() <<
@@ -894,28 +1241,45 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                         if (ops2.count() == 2) {
                             used[i] = true;
                             installed = installedCopy;
+                            rdCopy.installed(solver, ops2[1]->package,
+                                    ops2[1]->version);
+                            rd = rdCopy;
                             ops.append(ops2[0]);
                             ops.append(ops2[1]);
                             ops2.clear();
                         }
                     }
                 }
+
+                if (explanation) {
+                    if (!err.isEmpty())
+                        explanation->end("failed", err);
+                    else if (used[i])
+                        explanation->end("ok");
+                    else
+                        explanation->end("rejected",
+                                "other packages would be changed");
+                }
             }
 
             qDeleteAll(ops2);
+            qDeleteAll(avoid);
         }
     }
 
+    // the remaining updates are planned together: all new versions are
+    // installed first and the dependencies are resolved for the combined
+    // graph. A dependency shared by several packages is therefore only
+    // resolved once. The old versions are removed afterwards with the same
+    // index of reverse dependencies.
     if (err.isEmpty()) {
         qCDebug(npackd) << "planUpdates:" << newest.count() << "packages";
 
+        if (explanation)
+            explanation->startPhase("updates");
+
         for (int i = 0; i < newest.count(); i++) {
             if (!used[i]) {
-                bool undo = false;
-
-                // another package should not be completely uninstalled
-                InstalledPackages installedCopy(installed);
-
                 int oldSize = ops.size();
 
                 QString where;
@@ -923,31 +1287,61 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
                 if (keepDirectories && a)
                     where = a->getPath();
 
+                if (explanation) {
+                    explanation->begin("update", newest.at(i)->package,
+                            newest.at(i)->version);
+                    if (a)
+                        explanation->set("installed",
+                                a->version.getVersionString());
+                }
+
                 QList<PackageVersion*> avoid;
-                err = newest.at(i)->planInstallation(installedCopy, ops, avoid,
-                        where);
+                err = solver.planInstallation(newest.at(i), installed, ops,
+                        avoid, where);
+                qDeleteAll(avoid);
+
+                for (int j = oldSize; j < ops.size(); j++) {
+                    InstallOperation* op = ops.at(j);
+                    rd.installed(solver, op->package, op->version);
+                }
+
+                if (explanation) {
+                    explanation->set("operations", ops.size() - oldSize);
+                    explanation->end(err.isEmpty() ? "ok" : "failed", err);
+                }
+
                 if (!err.isEmpty())
                     break;
+            }
+        }
+    }
 
-                PackageVersion* b = newesti.at(i);
-                if (b) {
-                    err = planUninstallation(installedCopy, b->package,
-                            b->version, ops);
+    if (err.isEmpty()) {
+        if (explanation)
+            explanation->startPhase("remove old versions");
 
-                    qCDebug(npackd) << "planUpdates: 2nd uninstall" <<
-                            b->package << "resulted in" << ops.count() <<
-                            "operations with result:" << err;
+        for (int i = 0; i < newest.count(); i++) {
+            PackageVersion* b = newesti.at(i);
+            if (!used[i] && b) {
+                int oldSize = ops.size();
 
-                    if (!err.isEmpty())
-                        break;
-                }
+                if (explanation)
+                    explanation->begin("uninstall", b->package, b->version);
 
-                if (undo) {
-                    while (ops.size() > oldSize)
-                        delete ops.takeLast();
-                } else {
-                    installed = installedCopy;
+                err = planUninstallation(installed, rd, b->package,
+                        b->version, ops);
+
+                qCDebug(npackd) << "planUpdates: 2nd uninstall" <<
+                        b->package << "resulted in" << ops.count() <<
+                        "operations with result:" << err;
+
+                if (explanation) {
+                    explanation->set("operations", ops.size() - oldSize);
+                    explanation->end(err.isEmpty() ? "ok" : "failed", err);
                 }
+
+                if (!err.isEmpty())
+                    break;
             }
         }
     }
@@ -956,9 +1350,15 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
         qCDebug(npackd) << "planUpdates: simplifying" << ops.count() <<
                 "operations";
 
+        if (explanation)
+            explanation->startPhase("simplify");
+
         InstallOperation::simplify(ops);
     }
 
+    if (explanation)
+        explanation->endPhase();
+
     for (int i = 0; i < ops.count(); i++) {
         InstallOperation* op = ops.at(i);
         if (op->install && !op->where.isEmpty())
@@ -980,28 +1380,41 @@ QString AbstractRepository::planUpdates(InstalledPackages& installed,
 QString AbstractRepository::planUninstallation(InstalledPackages &installed,
         const QString &package, const Version &version,
         QList<InstallOperation *> &ops)
+{
+    if (!installed.isInstalled(package, version))
+        return "";
+
+    DependencySolver solver(this);
+    ReverseDependencies rd;
+    rd.build(solver, installed);
+
+    return planUninstallation(installed, rd, package, version, ops);
+}
+
+QString AbstractRepository::planUninstallation(InstalledPackages &installed,
+        ReverseDependencies &rd,
+        const QString &package, const Version &version,
+        QList<InstallOperation *> &ops)
 {
     // qCDebug(npackd) << "PackageVersion::planUninstallation()" << this->toString();
     QString res;
 
-    if (!installed.isInstalled(package, version))
+    if (!installed.isInstalled(package, version)) {
+        rd.uninstalled(package, version);
         return res;
+    }
 
     installed.setPackageVersionPath(package, version, "", false);
+    rd.uninstalled(package, version);
 
     // this loop ensures that all the items in "installed" are processed
     // even if changes in the list were done in nested calls to
     // "planUninstallation"
     while (true) {
-        std::unique_ptr<InstalledPackageVersion> ipv(installed.
-                findFirstWithMissingDependency());
-        if (ipv.get()) {
-            std::unique_ptr<PackageVersion> pv(findPackageVersion_(
-                    ipv.get()->package, ipv.get()->version, &res));
-            if (!res.isEmpty())
-                break;
-
-            res = planUninstallation(installed, pv->package, pv->version, ops);
+        PackageVersion* pv = rd.findFirstWithMissingDependency();
+        if (pv) {
+            res = planUninstallation(installed, rd, pv->package, pv->version,
+                    ops);
             if (!res.isEmpty())
                 break;
         } else {
@@ -3,10 +3,15 @@
 
 #include "stable.h"
 
+#include <QThreadPool>
+
 #include "packageversion.h"
 #include "package.h"
 #include "license.h"
 #include "installoperation.h"
+#include "reversedependencies.h"
+#include "planexplanation.h"
+#include "downloader.h"
 
 /**
  * @brief basis for repositories
@@ -16,6 +21,37 @@ class AbstractRepository
 private:
     static QSemaphore installationScripts;
 
+    /** thread pool for downloading the binaries in process() */
+    static QThreadPool downloadThreadPool;
+
+    /** thread pool for the installation operations in process() */
+    static QThreadPool installThreadPool;
+
+    /** maximum number of installation operations running in parallel */
+    static int maxParallelInstalls;
+
+    /**
+     * maximum number of binaries downloaded in parallel. This value is
+     * applied to downloadThreadPool before the downloads are started.
+     */
+    static int maxParallelDownloads;
+
+    /**
+     * @brief downloads the binary of a package version. Calls
+     *     CoInitialize/CoUninitialize.
+     * @param job job
+     * @param pv [ownership:caller] package version
+     * @param where target directory
+     * @param credentials interaction and authentication settings. The URL is
+     *     not used.
+     * @param binaryOnly true = only download the binary into the
+     *     DownloadCache
+     * @return the same as PackageVersion::download_
+     */
+    static QString downloadWithCoInitialize(Job* job, PackageVersion* pv,
+            const QString& where, const Downloader::Request& credentials,
+            bool binaryOnly);
+
     /**
      * @param hk root key
      * @param path registry path
@@ -25,6 +61,22 @@ private:
      */
     static QStringList getRepositoryURLs(HKEY hk, const QString &path,
                                          QString *err, bool* keyExists);
+
+    /**
+     * Plans un-installation of a package version and all the dependent
+     * recursively.
+     *
+     * @param installed list of installed packages
+     * @param rd index for the installed packages. It will be updated.
+     * @param package full package name
+     * @param version version number to be uninstalled
+     * @param op necessary operations will be added here
+     * @return error message or ""
+     */
+    QString planUninstallation(InstalledPackages& installed,
+            ReverseDependencies& rd,
+            const QString& package, const Version& version,
+            QList<InstallOperation*>& ops);
 public:
     /**
      * @param err error message will be stored here
@@ -156,7 +208,54 @@ public:
     QString updateNpackdCLEnvVar();
 
     /**
-     * @brief processes the given operations
+     * @brief changes the maximum number of binaries downloaded in parallel by
+     *     process(). The HTTP connections are limited by the
+     *     DownloadScheduler. This function should be called before any
+     *     download is started.
+     * @param n maximum number of parallel downloads (at least 1). The default
+     *     value is 3.
+     */
+    static void setMaxParallelDownloads(int n);
+
+    /**
+     * @return maximum number of binaries downloaded in parallel by process()
+     *     and prefetch(). See setMaxParallelDownloads().
+     */
+    static int getMaxParallelDownloads();
+
+    /**
+     * @brief downloads the binaries of package versions into the
+     *     DownloadCache in parallel (see setMaxParallelDownloads). The hash
+     *     sums are verified. Nothing is installed or removed. Binaries that
+     *     are already in the cache are not downloaded again and binaries
+     *     with the same hash sum are only downloaded once. The first failed
+     *     download cancels the others.
+     * @param job job
+     * @param pvs [ownership:caller] package versions. All of them should
+     *     have a hash sum.
+     * @param credentials interaction and authentication settings. The URL is
+     *     not used.
+     * @param bytes the size of the downloaded binaries will be stored here.
+     *     Binaries from the cache are not counted.
+     */
+    static void prefetch(Job* job, const QList<PackageVersion*>& pvs,
+            const Downloader::Request& credentials, qint64* bytes);
+
+    /**
+     * @brief changes the maximum number of installation operations executed
+     *     in parallel by process(). See InstallScheduler.
+     * @param n maximum number of parallel operations (at least 1). The
+     *     default value 1 means that the operations are executed one after
+     *     another.
+     */
+    static void setMaxParallelInstalls(int n);
+
+    /**
+     * @brief processes the given operations. The binaries are downloaded in
+     *     parallel (see setMaxParallelDownloads). The installation scripts of
+     *     other processes are only blocked and the packages are only stopped
+     *     after all downloads succeeded. Independent operations may run in
+     *     parallel (see setMaxParallelInstalls).
      * @param job job
      * @param install operations that should be performed
      * @param programCloseType how to close running applications
@@ -183,7 +282,12 @@ public:
     QList<PackageVersion*> getInstalled_(QString* err);
 
     /**
-     * Plans updates for the given packages.
+     * Plans updates for the given packages. All target versions are computed
+     * in one pass and the package versions are read from the repository only
+     * once for the whole plan (see DependencySolver). The updates that cannot
+     * be done as "uninstall, then install" are planned together: the new
+     * versions are installed for the combined dependency graph and the old
+     * versions are removed afterwards.
      *
      * @param installed list of installed packages. This object will be modified
      * @param packages these packages should be updated. No duplicates are
@@ -205,13 +309,16 @@ public:
      *     true = fail if a package cannot be updated in the exact same location
      *     false = choose a similar location like "Notepad_2.81" instead of
      *     "Notepad"
+     * @param explanation [ownership:caller] the planning phases and decisions
+     *     will be stored here or 0
      * @return error message or ""
      */
     QString planUpdates(InstalledPackages &installed, const QList<Package*> packages,
                         QList<Dependency *> ranges,
                         QList<InstallOperation*>& ops, bool keepDirectories=false,
                         bool install=false, const QString& where_="",
-                        bool exactLocation=true);
+                        bool exactLocation=true,
+                        PlanExplanation* explanation=nullptr);
 
     /**
      * Plans un-installation of a package version and all the dependent
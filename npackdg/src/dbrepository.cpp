@@ -14,7 +14,6 @@
 #include <QXmlStreamWriter>
 #include <QSqlRecord>
 #include <QTemporaryDir>
-#include <QtConcurrent/QtConcurrentRun>
 #include <QFuture>
 #include <QSqlResult>
 #include <QtPlugin>
@@ -29,6 +28,8 @@
 #include "mysqlquery.h"
 #include "repositoryxmlhandler.h"
 #include "downloader.h"
+#include "downloadengine.h"
+#include "downloadcache.h"
 
 // this is necessary in Qt 5.11 and earlier versions for the static build
 Q_IMPORT_PLUGIN(QSQLiteDriverPlugin)
@@ -163,6 +164,374 @@ QString DBRepository::saveURLSize(const QString& url, int64_t size)
     return err;
 }
 
+QString DBRepository::deleteURLSize(const QString& url)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    MySQLQuery q(db);
+    if (!q.prepare("DELETE FROM URL WHERE ADDRESS = :ADDRESS"))
+        err = getErrorString(q);
+
+    if (err.isEmpty()) {
+        q.bindValue(QStringLiteral(":ADDRESS"), url);
+        if (!q.exec())
+            err = getErrorString(q);
+    }
+
+    return err;
+}
+
+QString DBRepository::saveURLSizes(const QList<URLInfo>& infos)
+{
+    QString err = exec(QStringLiteral("BEGIN TRANSACTION"));
+    bool transactionStarted = err.isEmpty();
+
+    if (err.isEmpty()) {
+        QMutexLocker ml(&this->mutex);
+
+        MySQLQuery q(db);
+        if (!q.prepare("INSERT OR REPLACE INTO URL"
+                "(ADDRESS, SIZE, SIZE_MODIFIED) "
+                "VALUES(:ADDRESS, :SIZE, :SIZE_MODIFIED)"))
+            err = getErrorString(q);
+
+        for (int i = 0; i < infos.count() && err.isEmpty(); i++) {
+            const URLInfo& info = infos.at(i);
+            q.bindValue(QStringLiteral(":ADDRESS"), info.address);
+            q.bindValue(QStringLiteral(":SIZE"),
+                    static_cast<qlonglong>(info.size));
+            q.bindValue(QStringLiteral(":SIZE_MODIFIED"),
+                    static_cast<qlonglong>(info.sizeModified));
+            if (!q.exec())
+                err = getErrorString(q);
+        }
+    }
+
+    if (err.isEmpty())
+        err = exec(QStringLiteral("COMMIT"));
+    else if (transactionStarted)
+        exec(QStringLiteral("ROLLBACK"));
+
+    return err;
+}
+
+QString DBRepository::saveHostStats(const HostStats& stats)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    MySQLQuery q(db);
+    if (!q.prepare("INSERT OR REPLACE INTO HOST_STATS"
+            "(HOST, LATENCY, THROUGHPUT, FAILURES, MODIFIED) "
+            "VALUES(:HOST, :LATENCY, :THROUGHPUT, :FAILURES, :MODIFIED)"))
+        err = getErrorString(q);
+
+    if (err.isEmpty()) {
+        q.bindValue(QStringLiteral(":HOST"), stats.host);
+        q.bindValue(QStringLiteral(":LATENCY"), stats.latency);
+        q.bindValue(QStringLiteral(":THROUGHPUT"), stats.throughput);
+        q.bindValue(QStringLiteral(":FAILURES"), stats.failures);
+        q.bindValue(QStringLiteral(":MODIFIED"),
+                static_cast<qlonglong>(stats.modified));
+        if (!q.exec())
+            err = getErrorString(q);
+    }
+
+    return err;
+}
+
+HostStats DBRepository::findHostStats(const QString& host, QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    *err = "";
+
+    HostStats r(host);
+
+    MySQLQuery q(db);
+    if (!q.prepare("SELECT LATENCY, THROUGHPUT, FAILURES, MODIFIED "
+            "FROM HOST_STATS WHERE HOST = :HOST"))
+        *err = getErrorString(q);
+
+    if (err->isEmpty()) {
+        q.bindValue(QStringLiteral(":HOST"), host);
+        if (!q.exec())
+            *err = getErrorString(q);
+    }
+
+    if (err->isEmpty()) {
+        if (q.next()) {
+            r.latency = q.value(0).toDouble();
+            r.throughput = q.value(1).toDouble();
+            r.failures = q.value(2).toInt();
+            r.modified = q.value(3).toLongLong();
+        }
+    }
+
+    return r;
+}
+
+int64_t DBRepository::findURLSize(const QString& url, QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    *err = "";
+
+    int64_t r = -1;
+
+    MySQLQuery q(db);
+    if (!q.prepare("SELECT SIZE FROM URL WHERE ADDRESS = :ADDRESS"))
+        *err = getErrorString(q);
+
+    if (err->isEmpty()) {
+        q.bindValue(QStringLiteral(":ADDRESS"), url);
+        if (!q.exec())
+            *err = getErrorString(q);
+    }
+
+    if (err->isEmpty()) {
+        if (q.next())
+            r = q.value(0).toLongLong();
+    }
+
+    return r;
+}
+
+QString DBRepository::saveRepositoryCacheInfo(const RepositoryCacheInfo& info)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    MySQLQuery q(db);
+    if (!q.prepare("INSERT OR REPLACE INTO REPOSITORY_CACHE"
+            "(URL, ETAG, LAST_MODIFIED, SHA256, MODIFIED) "
+            "VALUES(:URL, :ETAG, :LAST_MODIFIED, :SHA256, :MODIFIED)"))
+        err = getErrorString(q);
+
+    if (err.isEmpty()) {
+        q.bindValue(QStringLiteral(":URL"), info.url);
+        q.bindValue(QStringLiteral(":ETAG"), info.etag);
+        q.bindValue(QStringLiteral(":LAST_MODIFIED"), info.lastModified);
+        q.bindValue(QStringLiteral(":SHA256"), info.sha256);
+        q.bindValue(QStringLiteral(":MODIFIED"),
+                static_cast<qlonglong>(info.modified));
+        if (!q.exec())
+            err = getErrorString(q);
+    }
+
+    return err;
+}
+
+RepositoryCacheInfo DBRepository::findRepositoryCacheInfo(const QString& url,
+        QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    *err = "";
+
+    RepositoryCacheInfo r(url);
+
+    MySQLQuery q(db);
+    if (!q.prepare("SELECT ETAG, LAST_MODIFIED, SHA256, MODIFIED "
+            "FROM REPOSITORY_CACHE WHERE URL = :URL"))
+        *err = getErrorString(q);
+
+    if (err->isEmpty()) {
+        q.bindValue(QStringLiteral(":URL"), url);
+        if (!q.exec())
+            *err = getErrorString(q);
+    }
+
+    if (err->isEmpty()) {
+        if (q.next()) {
+            r.etag = q.value(0).toString();
+            r.lastModified = q.value(1).toString();
+            r.sha256 = q.value(2).toString();
+            r.modified = q.value(3).toLongLong();
+        }
+    }
+
+    return r;
+}
+
+QString DBRepository::saveTransferStats(const QList<TransferStats>& stats)
+{
+    QString err = exec(QStringLiteral("BEGIN TRANSACTION"));
+    bool transactionStarted = err.isEmpty();
+
+    if (err.isEmpty()) {
+        QMutexLocker ml(&this->mutex);
+
+        MySQLQuery q(db);
+        if (!q.prepare("INSERT INTO TRANSFER_STATS"
+                "(URL, HOST, STARTED, QUEUE_TIME, DNS_TIME, CONNECT_TIME, "
+                "TTFB, TRANSFER_TIME, TOTAL_TIME, BYTES, RETRIES, CACHE_HIT, "
+                "ERROR) "
+                "VALUES(:URL, :HOST, :STARTED, :QUEUE_TIME, :DNS_TIME, "
+                ":CONNECT_TIME, :TTFB, :TRANSFER_TIME, :TOTAL_TIME, :BYTES, "
+                ":RETRIES, :CACHE_HIT, :ERROR)"))
+            err = getErrorString(q);
+
+        for (int i = 0; i < stats.count() && err.isEmpty(); i++) {
+            const TransferStats& s = stats.at(i);
+            q.bindValue(QStringLiteral(":URL"), s.url);
+            q.bindValue(QStringLiteral(":HOST"), s.host);
+            q.bindValue(QStringLiteral(":STARTED"),
+                    static_cast<qlonglong>(s.started));
+            q.bindValue(QStringLiteral(":QUEUE_TIME"), s.queueTime);
+            q.bindValue(QStringLiteral(":DNS_TIME"), s.dnsTime);
+            q.bindValue(QStringLiteral(":CONNECT_TIME"), s.connectTime);
+            q.bindValue(QStringLiteral(":TTFB"), s.ttfb);
+            q.bindValue(QStringLiteral(":TRANSFER_TIME"), s.transferTime);
+            q.bindValue(QStringLiteral(":TOTAL_TIME"), s.totalTime);
+            q.bindValue(QStringLiteral(":BYTES"),
+                    static_cast<qlonglong>(s.bytes));
+            q.bindValue(QStringLiteral(":RETRIES"), s.retries);
+            q.bindValue(QStringLiteral(":CACHE_HIT"), s.cacheHit ? 1 : 0);
+            q.bindValue(QStringLiteral(":ERROR"), s.error);
+            if (!q.exec())
+                err = getErrorString(q);
+        }
+    }
+
+    if (err.isEmpty())
+        err = exec(QStringLiteral("COMMIT"));
+    else if (transactionStarted)
+        exec(QStringLiteral("ROLLBACK"));
+
+    return err;
+}
+
+QString DBRepository::deleteTransferStats(time_t before)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    MySQLQuery q(db);
+    if (!q.prepare("DELETE FROM TRANSFER_STATS WHERE STARTED < :STARTED"))
+        err = getErrorString(q);
+
+    if (err.isEmpty()) {
+        q.bindValue(QStringLiteral(":STARTED"),
+                static_cast<qlonglong>(before));
+        if (!q.exec())
+            err = getErrorString(q);
+    }
+
+    return err;
+}
+
+QList<TransferStats> DBRepository::findTransferStats(time_t since,
+        QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    *err = "";
+
+    QList<TransferStats> r;
+
+    MySQLQuery q(db);
+    if (!q.prepare("SELECT URL, HOST, STARTED, QUEUE_TIME, DNS_TIME, "
+            "CONNECT_TIME, TTFB, TRANSFER_TIME, TOTAL_TIME, BYTES, RETRIES, "
+            "CACHE_HIT, ERROR "
+            "FROM TRANSFER_STATS WHERE STARTED >= :STARTED ORDER BY ID"))
+        *err = getErrorString(q);
+
+    if (err->isEmpty()) {
+        q.bindValue(QStringLiteral(":STARTED"),
+                static_cast<qlonglong>(since));
+        if (!q.exec())
+            *err = getErrorString(q);
+    }
+
+    if (err->isEmpty()) {
+        while (q.next()) {
+            TransferStats s(q.value(0).toString());
+            s.host = q.value(1).toString();
+            s.started = q.value(2).toLongLong();
+            s.queueTime = q.value(3).toLongLong();
+            s.dnsTime = q.value(4).toLongLong();
+            s.connectTime = q.value(5).toLongLong();
+            s.ttfb = q.value(6).toLongLong();
+            s.transferTime = q.value(7).toLongLong();
+            s.totalTime = q.value(8).toLongLong();
+            s.bytes = q.value(9).toLongLong();
+            s.retries = q.value(10).toInt();
+            s.cacheHit = q.value(11).toInt() != 0;
+            s.error = q.value(12).toString();
+            r.append(s);
+        }
+    }
+
+    return r;
+}
+
+QString DBRepository::saveIconCacheInfo(const IconCacheInfo& info)
+{
+    QMutexLocker ml(&this->mutex);
+
+    QString err;
+
+    MySQLQuery q(db);
+    if (!q.prepare("INSERT OR REPLACE INTO ICON_CACHE"
+            "(URL, ETAG, LAST_MODIFIED, SHA256, MIME_TYPE, MODIFIED) "
+            "VALUES(:URL, :ETAG, :LAST_MODIFIED, :SHA256, :MIME_TYPE, "
+            ":MODIFIED)"))
+        err = getErrorString(q);
+
+    if (err.isEmpty()) {
+        q.bindValue(QStringLiteral(":URL"), info.url);
+        q.bindValue(QStringLiteral(":ETAG"), info.etag);
+        q.bindValue(QStringLiteral(":LAST_MODIFIED"), info.lastModified);
+        q.bindValue(QStringLiteral(":SHA256"), info.sha256);
+        q.bindValue(QStringLiteral(":MIME_TYPE"), info.mimeType);
+        q.bindValue(QStringLiteral(":MODIFIED"),
+                static_cast<qlonglong>(info.modified));
+        if (!q.exec())
+            err = getErrorString(q);
+    }
+
+    return err;
+}
+
+IconCacheInfo DBRepository::findIconCacheInfo(const QString& url,
+        QString* err)
+{
+    QMutexLocker ml(&this->mutex);
+
+    *err = "";
+
+    IconCacheInfo r(url);
+
+    MySQLQuery q(db);
+    if (!q.prepare("SELECT ETAG, LAST_MODIFIED, SHA256, MIME_TYPE, MODIFIED "
+            "FROM ICON_CACHE WHERE URL = :URL"))
+        *err = getErrorString(q);
+
+    if (err->isEmpty()) {
+        q.bindValue(QStringLiteral(":URL"), url);
+        if (!q.exec())
+            *err = getErrorString(q);
+    }
+
+    if (err->isEmpty()) {
+        if (q.next()) {
+            r.etag = q.value(0).toString();
+            r.lastModified = q.value(1).toString();
+            r.sha256 = q.value(2).toString();
+            r.mimeType = q.value(3).toString();
+            r.modified = q.value(4).toLongLong();
+        }
+    }
+
+    return r;
+}
+
 DBRepository* DBRepository::getDefault()
 {
     return &def;
@@ -1679,6 +2048,14 @@ QString DBRepository::clear()
         }
     }
 
+    if (job->shouldProceed()) {
+        // the hash sums of the repositories are not valid without the data
+        QString err = exec(QStringLiteral(
+                "UPDATE REPOSITORY SET SHA1 = NULL"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
     job->complete();
 
     delete job;
@@ -1688,8 +2065,12 @@ QString DBRepository::clear()
 
 void DBRepository::load(Job* job, bool useCache, bool interactive,
         const QString user, const QString password,
-        const QString proxyUser, const QString proxyPassword)
+        const QString proxyUser, const QString proxyPassword,
+        bool* unchanged_)
 {
+    if (unchanged_)
+        *unchanged_ = false;
+
     QString err;
     QList<QUrl*> urls = AbstractRepository::getRepositoryURLs(&err);
     if (urls.count() > 0) {
@@ -1698,64 +2079,162 @@ void DBRepository::load(Job* job, bool useCache, bool interactive,
             reps.append(urls.at(i)->toString(QUrl::FullyEncoded));
         }
 
-        err = saveRepositories(reps);
-        if (!err.isEmpty())
-            job->setErrorMessage(
-                    QObject::tr("Error saving the list of repositories in the database: %1").arg(
-                    err));
+        // the HTTP metadata is always stored in the default database as this
+        // object may be a temporary database
+        DBRepository* def = getDefault();
+
+        // hash sums of the repositories stored in this or the default
+        // database. They are only valid for the same list of repositories.
+        DBRepository* old = unchanged_ ? def : this;
+        QStringList oldHashSums;
+        QString e;
+        if (old->readRepositories(&e) == reps) {
+            for (int i = 0; i < reps.count(); i++) {
+                e = "";
+                oldHashSums.append(old->getRepositorySHA1(reps.at(i), &e));
+            }
+        }
+        DownloadCache* cache = DownloadCache::getRepositories();
 
-        QList<QFuture<QTemporaryFile*> > files;
+        // the repositories are downloaded in parallel without blocking
+        // a thread for each download
+        QList<QTemporaryFile*> files;
+        QList<QFuture<Downloader::Response> > futures;
+        QList<Job*> downloadJobs;
+        QList<RepositoryCacheInfo> infos;
         for (int i = 0; i < urls.count(); i++) {
             QUrl* url = urls.at(i);
             Job* s = job->newSubJob(0.1,
                     QObject::tr("Downloading %1").
                     arg(url->toDisplayString()), false, true);
-
-            Downloader::Request request = *url;
-            request.user = user;
-            request.password = password;
-            request.proxyUser = proxyUser;
-            request.proxyPassword = proxyPassword;
-            request.useCache = useCache;
-            request.interactive = interactive;
-            QFuture<QTemporaryFile*> future = QtConcurrent::run(
-                    Downloader::downloadToTemporary, s, request);
-            files.append(future);
+            downloadJobs.append(s);
+
+            // a conditional request is only possible if the content from the
+            // last download is available
+            RepositoryCacheInfo info = def->findRepositoryCacheInfo(
+                    reps.at(i), &e);
+            if (!e.isEmpty() || !info.isValid() ||
+                    !cache->contains(QCryptographicHash::Sha256, info.sha256))
+                info = RepositoryCacheInfo(reps.at(i));
+            infos.append(info);
+
+            QTemporaryFile* tf = new QTemporaryFile();
+            if (!tf->open()) {
+                s->setErrorMessage(QString(QObject::tr("Error opening file: %1")).
+                        arg(tf->fileName()));
+                s->complete();
+                delete tf;
+                tf = nullptr;
+                futures.append(QFuture<Downloader::Response>());
+            } else {
+                Downloader::Request request = *url;
+                request.file = tf;
+                request.user = user;
+                request.password = password;
+                request.proxyUser = proxyUser;
+                request.proxyPassword = proxyPassword;
+                request.useCache = useCache;
+                request.interactive = interactive;
+                request.priority = DownloadScheduler::REPOSITORY;
+                request.hashSum = true;
+                request.alg = QCryptographicHash::Sha256;
+                request.ifNoneMatch = info.etag;
+                request.ifModifiedSince = info.lastModified;
+                futures.append(DownloadEngine::getDefault()->start(s,
+                        request));
+            }
+            files.append(tf);
         }
 
+        // hash sums of the downloaded repositories
+        QStringList hashSums;
         for (int i = 0; i < urls.count(); i++) {
-            files[i].waitForFinished();
+            futures[i].waitForFinished();
+
+            QTemporaryFile* tf = files.at(i);
+            QString hashSum;
+            if (tf) {
+                tf->close();
+                if (!downloadJobs.at(i)->getErrorMessage().isEmpty()) {
+                    delete tf;
+                    files[i] = nullptr;
+                } else {
+                    hashSum = processRepositoryResponse(job, infos.at(i),
+                            futures[i].result(), tf);
+                }
+            }
+            hashSums.append(hashSum);
 
             job->setProgress((i + 1.0) / urls.count() * 0.5);
         }
 
-        for (int i = 0; i < urls.count(); i++) {
-            if (!job->shouldProceed())
-                break;
+        bool unchanged = job->shouldProceed() &&
+                oldHashSums.count() == hashSums.count();
+        for (int i = 0; i < oldHashSums.count() && unchanged; i++) {
+            if (oldHashSums.at(i).isEmpty() ||
+                    oldHashSums.at(i) != hashSums.at(i))
+                unchanged = false;
+        }
 
-            QTemporaryFile* tf = files.at(i).result();
-            Job* s = job->newSubJob(0.49 / urls.count(), QString(
-                    QObject::tr("Repository %1 of %2")).arg(i + 1).
-                    arg(urls.count()));
-            this->currentRepository = i;
-            // this is currently unnecessary clearRepository(i);
-            loadOne(s, tf, *urls.at(i));
-            if (!s->getErrorMessage().isEmpty()) {
-                job->setErrorMessage(QString(
-                        QObject::tr("Error loading the repository %1: %2")).arg(
-                        urls.at(i)->toString()).arg(
-                        s->getErrorMessage()));
-                break;
+        if (unchanged) {
+            // the database already contains the same data
+            qCDebug(npackd) << "DBRepository::load the repositories have "
+                    "not changed";
+            if (unchanged_)
+                *unchanged_ = true;
+            job->setProgress(1);
+        } else {
+            if (job->shouldProceed()) {
+                Job* sub = job->newSubJob(0.01,
+                        QObject::tr("Clearing the database"));
+                err = clear();
+                if (err.isEmpty())
+                    sub->completeWithProgress();
+                else
+                    job->setErrorMessage(err);
             }
-        }
 
-        for (int i = 0; i < urls.count(); i++) {
-            if (!job->shouldProceed())
-                break;
+            if (job->shouldProceed()) {
+                err = saveRepositories(reps);
+                if (!err.isEmpty())
+                    job->setErrorMessage(
+                            QObject::tr("Error saving the list of repositories in the database: %1").arg(
+                            err));
+            }
 
-            QTemporaryFile* tf = files.at(i).result();
-            delete tf;
+            for (int i = 0; i < urls.count(); i++) {
+                if (!job->shouldProceed())
+                    break;
+
+                QTemporaryFile* tf = files.at(i);
+                Job* s = job->newSubJob(0.48 / urls.count(), QString(
+                        QObject::tr("Repository %1 of %2")).arg(i + 1).
+                        arg(urls.count()));
+                this->currentRepository = i;
+                // this is currently unnecessary clearRepository(i);
+                loadOne(s, tf, *urls.at(i));
+                if (!s->getErrorMessage().isEmpty()) {
+                    job->setErrorMessage(QString(
+                            QObject::tr("Error loading the repository %1: %2")).arg(
+                            urls.at(i)->toString()).arg(
+                            s->getErrorMessage()));
+                    break;
+                }
+            }
+
+            // the hash sums are only stored if all repositories were loaded
+            for (int i = 0; i < urls.count(); i++) {
+                if (!job->shouldProceed())
+                    break;
+
+                err = "";
+                setRepositorySHA1(reps.at(i), hashSums.at(i), &err);
+                if (!err.isEmpty())
+                    job->setErrorMessage(err);
+            }
         }
+
+        qDeleteAll(files);
     } else {
         job->setErrorMessage(QObject::tr("No repositories defined"));
         job->setProgress(1);
@@ -1769,6 +2248,49 @@ void DBRepository::load(Job* job, bool useCache, bool interactive,
     job->complete();
 }
 
+QString DBRepository::processRepositoryResponse(Job* job,
+        const RepositoryCacheInfo& info, const Downloader::Response& response,
+        QTemporaryFile* file)
+{
+    QString r;
+
+    DownloadCache* cache = DownloadCache::getRepositories();
+    if (response.notModified) {
+        // the content from the last download is used. copyTo() checks the
+        // SHA-256 of the copy and fails for a changed file.
+        qCDebug(npackd) << "DBRepository::load not modified" << info.url;
+        if (cache->copyTo(QCryptographicHash::Sha256, info.sha256,
+                file->fileName(), false))
+            r = info.sha256;
+        else
+            job->setErrorMessage(QObject::tr(
+                    "The cached copy of the repository %1 is not available").
+                    arg(info.url));
+    } else {
+        r = response.hashSum;
+
+        // without a validator the server cannot answer conditional requests
+        if (!response.etag.isEmpty() || !response.lastModified.isEmpty()) {
+            RepositoryCacheInfo info2(info.url);
+            info2.etag = response.etag;
+            info2.lastModified = response.lastModified;
+            info2.sha256 = response.hashSum;
+            info2.modified = time(nullptr);
+
+            QString err = cache->add(QCryptographicHash::Sha256,
+                    info2.sha256, file->fileName(), false);
+            if (err.isEmpty())
+                err = getDefault()->saveRepositoryCacheInfo(info2);
+            if (!err.isEmpty())
+                qCWarning(npackd).noquote() << QObject::tr(
+                        "Cannot store the repository %1 in the cache: %2").
+                        arg(info.url, err);
+        }
+    }
+
+    return r;
+}
+
 void DBRepository::loadOne(Job* job, QFile* f, const QUrl& url) {
     QTemporaryDir* dir = nullptr;
     QFile* xmlInZIP = nullptr;
@@ -1825,7 +2347,7 @@ void DBRepository::loadOne(Job* job, QFile* f, const QUrl& url) {
 
 void DBRepository::updateF5(Job* job, bool interactive, const QString user,
         const QString password, const QString proxyUser,
-        const QString proxyPassword, bool useCache)
+        const QString proxyPassword, bool useCache, bool* unchanged)
 {
     bool transactionStarted = false;
     if (job->shouldProceed()) {
@@ -1841,26 +2363,111 @@ void DBRepository::updateF5(Job* job, bool interactive, const QString user,
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.01,
-                QObject::tr("Clearing the database"));
-        QString err = clear();
-        if (err.isEmpty())
-            sub->completeWithProgress();
+        Job* sub = job->newSubJob(0.28,
+                QObject::tr("Downloading the remote repositories and filling the local database (tempdb)"));
+        load(sub, useCache, interactive, user, password, proxyUser, proxyPassword,
+                unchanged);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    // the default database is updated by the caller
+    bool skip = unchanged && *unchanged;
+
+    if (job->shouldProceed() && !skip) {
+        Job* sub = job->newSubJob(0.56,
+                QObject::tr("Refreshing the installation status (tempdb)"));
+        updateInstalledNoTransaction(sub);
+        if (!sub->getErrorMessage().isEmpty())
+            job->setErrorMessage(sub->getErrorMessage());
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.05,
+                QObject::tr("Commiting the SQL transaction (tempdb)"));
+        QString err = exec(QStringLiteral("COMMIT"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
         else
+            sub->completeWithProgress();
+    } else {
+        if (transactionStarted)
+            exec(QStringLiteral("ROLLBACK"));
+    }
+
+    /*QString error;
+    //tempFile.setAutoRemove(false);
+    qCDebug(npackd) << "packages in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE", &error);
+    qCDebug(npackd) << error;
+    qCDebug(npackd) << "package versions in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE_VERSION", &error);
+    qCDebug(npackd) << error;
+    qCDebug(npackd) << tempFile.fileName();
+    */
+
+    /*
+    qCDebug(npackd) << "packages in db" << count("SELECT COUNT(*) FROM PACKAGE", &error);
+    qCDebug(npackd) << error;
+    qCDebug(npackd) << "package versions in db" << count("SELECT COUNT(*) FROM PACKAGE_VERSION", &error);
+    qCDebug(npackd) << error;
+    qCDebug(npackd) << tempFile.fileName();
+    */
+
+    if (job->shouldProceed() && !skip) {
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Reading categories"));
+        QString err = readCategories();
+        if (err.isEmpty()) {
+            sub->completeWithProgress();
+            job->setProgress(1);
+        } else
             job->setErrorMessage(err);
+    } else if (job->shouldProceed()) {
+        job->setProgress(1);
     }
 
+    job->complete();
+}
+
+void DBRepository::updateInstalled(Job* job)
+{
+    bool transactionStarted = false;
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.27,
-                QObject::tr("Downloading the remote repositories and filling the local database (tempdb)"));
-        load(sub, useCache, interactive, user, password, proxyUser, proxyPassword);
+        QString err = exec(QStringLiteral("BEGIN TRANSACTION"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else {
+            job->setProgress(0.01);
+            transactionStarted = true;
+        }
+    }
+
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.94,
+                QObject::tr("Refreshing the installation status"));
+        updateInstalledNoTransaction(sub);
         if (!sub->getErrorMessage().isEmpty())
             job->setErrorMessage(sub->getErrorMessage());
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.4,
-                QObject::tr("Refreshing the installation status (tempdb)"));
+        QString err = exec(QStringLiteral("COMMIT"));
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        else
+            job->setProgress(1);
+    } else {
+        if (transactionStarted)
+            exec(QStringLiteral("ROLLBACK"));
+    }
+
+    job->complete();
+}
+
+void DBRepository::updateInstalledNoTransaction(Job* job)
+{
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.7,
+                QObject::tr("Refreshing the installation status"));
         InstalledPackages* def = InstalledPackages::getDefault();
         InstalledPackages ip;
         ip.refresh(this, sub);
@@ -1874,15 +2481,15 @@ void DBRepository::updateF5(Job* job, bool interactive, const QString user,
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.06,
-                QObject::tr("Updating the status for installed packages in the database (tempdb)"));
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Updating the status for installed packages in the database"));
         updateStatusForInstalled(sub);
         if (!sub->getErrorMessage().isEmpty())
             job->setErrorMessage(sub->getErrorMessage());
     }
 
     if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.05,
+        Job* sub = job->newSubJob(0.1,
                 QObject::tr("Removing packages without versions"));
         QString err = exec(QStringLiteral(
                 "DELETE FROM PACKAGE WHERE STATUS=0 AND NOT EXISTS "
@@ -1901,52 +2508,11 @@ void DBRepository::updateF5(Job* job, bool interactive, const QString user,
         if (!err.isEmpty())
             job->setErrorMessage(err);
         else
-            job->setProgress(0.85);
+            job->setProgress(1);
 
         qDeleteAll(installed);
     }
 
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.05,
-                QObject::tr("Commiting the SQL transaction (tempdb)"));
-        QString err = exec(QStringLiteral("COMMIT"));
-        if (!err.isEmpty())
-            job->setErrorMessage(err);
-        else
-            sub->completeWithProgress();
-    } else {
-        if (transactionStarted)
-            exec(QStringLiteral("ROLLBACK"));
-    }
-
-    /*QString error;
-    //tempFile.setAutoRemove(false);
-    qCDebug(npackd) << "packages in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in tempdb" << count("SELECT COUNT(*) FROM tempdb.PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
-
-    /*
-    qCDebug(npackd) << "packages in db" << count("SELECT COUNT(*) FROM PACKAGE", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << "package versions in db" << count("SELECT COUNT(*) FROM PACKAGE_VERSION", &error);
-    qCDebug(npackd) << error;
-    qCDebug(npackd) << tempFile.fileName();
-    */
-
-    if (job->shouldProceed()) {
-        Job* sub = job->newSubJob(0.1,
-                QObject::tr("Reading categories"));
-        QString err = readCategories();
-        if (err.isEmpty()) {
-            sub->completeWithProgress();
-            job->setProgress(1);
-        } else
-            job->setErrorMessage(err);
-    }
-
     job->complete();
 }
 
@@ -1984,11 +2550,14 @@ void DBRepository::updateF5Runnable(Job *job, bool useCache)
         }
     }
 
+    // true = the default database already contains the same repositories
+    bool unchanged = false;
+
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.77,
                 QObject::tr("Updating the temporary database"), true, true);
         CoInitialize(nullptr);
-        tempdb.updateF5(sub, true, "", "", "", "", useCache);
+        tempdb.updateF5(sub, true, "", "", "", "", useCache, &unchanged);
         CoUninitialize();
     }
 
@@ -2007,7 +2576,14 @@ void DBRepository::updateF5Runnable(Job *job, bool useCache)
         }
     }
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && unchanged) {
+        // the repositories are neither loaded nor transferred again
+        Job* sub = job->newSubJob(0.2,
+                QObject::tr("Refreshing the installation status"), true, true);
+        CoInitialize(nullptr);
+        dbr.updateInstalled(sub);
+        CoUninitialize();
+    } else if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.2,
                 QObject::tr("Transferring the data from the temporary database"),
                 true, true);
@@ -2219,7 +2795,7 @@ QString DBRepository::getRepositorySHA1(const QString& url, QString* err)
             *err = getErrorString(q);
         else {
             if (q.next()) {
-                r = q.value(1).toString();
+                r = q.value(0).toString();
             }
         }
     }
@@ -2448,6 +3024,12 @@ void DBRepository::transferFrom(Job* job, const QString& databaseFilename)
             err = exec(QStringLiteral(
                     "INSERT INTO CMD_FILE(PACKAGE, VERSION, PATH, NAME) "
                     "SELECT PACKAGE, VERSION, PATH, NAME FROM tempdb.CMD_FILE"));
+        if (err.isEmpty())
+            err = exec(QStringLiteral("DELETE FROM REPOSITORY"));
+        if (err.isEmpty())
+            err = exec(QStringLiteral(
+                    "INSERT INTO REPOSITORY(ID, URL, SHA1) "
+                    "SELECT ID, URL, SHA1 FROM tempdb.REPOSITORY"));
         if (err.isEmpty())
             err = exec(QStringLiteral(
                     "INSERT INTO INSTALLED(PACKAGE, VERSION, CVERSION, "
@@ -2818,6 +3400,87 @@ QString DBRepository::updateDatabase()
         }
     }
 
+    // HOST_STATS is new in 1.26
+    if (err.isEmpty()) {
+        e = tableExists(&db, "HOST_STATS", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE TABLE HOST_STATS("
+                    "HOST TEXT NOT NULL PRIMARY KEY, "
+                    "LATENCY REAL, "
+                    "THROUGHPUT REAL, "
+                    "FAILURES INTEGER, "
+                    "MODIFIED INTEGER)");
+            err = toString(db.lastError());
+        }
+    }
+
+    // REPOSITORY_CACHE is new in 1.27
+    if (err.isEmpty()) {
+        e = tableExists(&db, "REPOSITORY_CACHE", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE TABLE REPOSITORY_CACHE("
+                    "URL TEXT NOT NULL PRIMARY KEY, "
+                    "ETAG TEXT, "
+                    "LAST_MODIFIED TEXT, "
+                    "SHA256 TEXT, "
+                    "MODIFIED INTEGER)");
+            err = toString(db.lastError());
+        }
+    }
+
+    // TRANSFER_STATS is new in 1.27
+    if (err.isEmpty()) {
+        e = tableExists(&db, "TRANSFER_STATS", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE TABLE TRANSFER_STATS("
+                    "ID INTEGER PRIMARY KEY, "
+                    "URL TEXT NOT NULL, "
+                    "HOST TEXT NOT NULL, "
+                    "STARTED INTEGER NOT NULL, "
+                    "QUEUE_TIME INTEGER, "
+                    "DNS_TIME INTEGER, "
+                    "CONNECT_TIME INTEGER, "
+                    "TTFB INTEGER, "
+                    "TRANSFER_TIME INTEGER, "
+                    "TOTAL_TIME INTEGER, "
+                    "BYTES INTEGER, "
+                    "RETRIES INTEGER, "
+                    "CACHE_HIT INTEGER, "
+                    "ERROR TEXT)");
+            err = toString(db.lastError());
+        }
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE INDEX TRANSFER_STATS_STARTED ON "
+                    "TRANSFER_STATS(STARTED)");
+            err = toString(db.lastError());
+        }
+    }
+
+    // ICON_CACHE is new in 1.27
+    if (err.isEmpty()) {
+        e = tableExists(&db, "ICON_CACHE", &err);
+    }
+    if (err.isEmpty()) {
+        if (!e) {
+            db.exec("CREATE TABLE ICON_CACHE("
+                    "URL TEXT NOT NULL PRIMARY KEY, "
+                    "ETAG TEXT, "
+                    "LAST_MODIFIED TEXT, "
+                    "SHA256 TEXT, "
+                    "MIME_TYPE TEXT, "
+                    "MODIFIED INTEGER)");
+            err = toString(db.lastError());
+        }
+    }
+
     // TAG is new in 1.26
     if (err.isEmpty()) {
         e = tableExists(&db, "TAG", &err);
@@ -13,6 +13,7 @@
 #include <QCache>
 #include <QList>
 #include <QMutex>
+#include <QTemporaryFile>
 
 #include "package.h"
 #include "repository.h"
@@ -22,6 +23,11 @@
 #include "mysqlquery.h"
 #include "installedpackageversion.h"
 #include "urlinfo.h"
+#include "hoststats.h"
+#include "repositorycacheinfo.h"
+#include "iconcacheinfo.h"
+#include "transferstats.h"
+#include "downloader.h"
 
 /**
  * @brief A repository stored in an SQLite database.
@@ -120,6 +126,11 @@ private:
      * Loads the content from the URLs. None of the packages has the information
      * about installation path after this method was called.
      *
+     * The repositories are downloaded using conditional HTTP requests. The
+     * HTTP metadata is stored in the default database and the content in the
+     * DownloadCache. The database is only cleared and filled again if at
+     * least one repository has changed since the last call.
+     *
      * @param job job for this method
      * @param useCache true = cache will be used
      * @param interactive true = allow the interaction with the user
@@ -127,10 +138,36 @@ private:
      * @param password password for the HTTP authentication or ""
      * @param user user name for the HTTP proxy authentication or ""
      * @param password password for the HTTP proxy authentication or ""
+     * @param unchanged if not null, the repositories are compared with the
+     *     default database instead of this one. true will be stored here if
+     *     they have not changed. This database is not filled in this case.
      */
     void load(Job *job, bool useCache, bool interactive, const QString user,
             const QString password,
-            const QString proxyUser, const QString proxyPassword);
+            const QString proxyUser, const QString proxyPassword,
+            bool* unchanged=nullptr);
+
+    /**
+     * @brief refreshes the installation status of the packages in this
+     *     database without starting a transaction
+     * @param job job
+     */
+    void updateInstalledNoTransaction(Job* job);
+
+    /**
+     * @brief processes the response for a repository download and updates
+     *     the HTTP metadata
+     * @param job errors will be reported here
+     * @param info metadata used for the request
+     * @param response HTTP response
+     * @param file the downloaded data. The content from the DownloadCache
+     *     will be copied here if the repository has not changed. The file
+     *     should be closed.
+     * @return SHA-256 of the repository content or "" if an error occured
+     */
+    QString processRepositoryResponse(Job* job,
+            const RepositoryCacheInfo& info,
+            const Downloader::Response& response, QTemporaryFile* file);
 
     /**
      * @brief loadOne
@@ -192,6 +229,100 @@ public:
      */
     QString saveURLSize(const QString& url, int64_t size);
 
+    /**
+     * @brief removes the stored download size for an URL
+     * @param url URL
+     * @return error message
+     */
+    QString deleteURLSize(const QString& url);
+
+    /**
+     * @brief saves the download sizes for many URLs in one transaction
+     * @param infos URLs, sizes and the times when the sizes were determined
+     * @return error message
+     */
+    QString saveURLSizes(const QList<URLInfo>& infos);
+
+    /**
+     * @brief saves the download statistics for a host
+     * @param stats statistics
+     * @return error message
+     */
+    QString saveHostStats(const HostStats& stats);
+
+    /**
+     * @brief reads the download statistics for a host
+     * @param host host name
+     * @param err error message will be stored here
+     * @return statistics. HostStats::modified is 0 if nothing is known about
+     *     the host.
+     */
+    HostStats findHostStats(const QString& host, QString* err);
+
+    /**
+     * @brief reads the download size for an URL
+     * @param url URL
+     * @param err error message will be stored here
+     * @return size of the URL or -1 if unknown or -2 if an error occured
+     */
+    int64_t findURLSize(const QString& url, QString* err);
+
+    /**
+     * @brief saves the HTTP metadata for a repository
+     * @param info metadata
+     * @return error message
+     */
+    QString saveRepositoryCacheInfo(const RepositoryCacheInfo& info);
+
+    /**
+     * @brief reads the HTTP metadata for a repository
+     * @param url URL of the repository
+     * @param err error message will be stored here
+     * @return metadata. RepositoryCacheInfo::modified is 0 if nothing is
+     *     known about the repository.
+     */
+    RepositoryCacheInfo findRepositoryCacheInfo(const QString& url,
+            QString* err);
+
+    /**
+     * @brief appends the metrics for HTTP transfers in one transaction
+     * @param stats metrics
+     * @return error message
+     */
+    QString saveTransferStats(const QList<TransferStats>& stats);
+
+    /**
+     * @brief removes old metrics for HTTP transfers
+     * @param before entries started before this date/time will be removed
+     * @return error message
+     */
+    QString deleteTransferStats(time_t before);
+
+    /**
+     * @brief reads the metrics for HTTP transfers
+     * @param since only entries started at or after this date/time will be
+     *     returned
+     * @param err error message will be stored here
+     * @return metrics in the order they were stored
+     */
+    QList<TransferStats> findTransferStats(time_t since, QString* err);
+
+    /**
+     * @brief saves the HTTP metadata for an icon or a screenshot
+     * @param info metadata
+     * @return error message
+     */
+    QString saveIconCacheInfo(const IconCacheInfo& info);
+
+    /**
+     * @brief reads the HTTP metadata for an icon or a screenshot
+     * @param url URL of the image
+     * @param err error message will be stored here
+     * @return metadata. IconCacheInfo::modified is 0 if nothing is known
+     *     about the image.
+     */
+    IconCacheInfo findIconCacheInfo(const QString& url, QString* err);
+
     QString saveLicense(License* p, bool replace);
 
     QString savePackageVersion(PackageVersion *p, bool replace);
@@ -294,11 +425,21 @@ public:
      * @param proxyUser user name for the HTTP proxy authentication or ""
      * @param proxyPassword password for the HTTP proxy authentication or ""
      * @param useCache true = use the HTTP cache
+     * @param unchanged if not null, the repositories are compared with the
+     *     default database. true will be stored here if they have not
+     *     changed. Nothing else is updated in this case.
      */
     void updateF5(Job *job, bool interactive, const QString user,
             const QString password,
             const QString proxyUser, const QString proxyPassword,
-            bool useCache);
+            bool useCache, bool* unchanged=nullptr);
+
+    /**
+     * @brief refreshes the installation status of the packages without
+     *     loading the repositories again
+     * @param job job
+     */
+    void updateInstalled(Job* job);
 
     /**
      * @brief updateF5() that can be used with QtConcurrent::Run
@@ -0,0 +1,444 @@
+#include "deltaupdate.h"
+
+#include <algorithm>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QSet>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+#include "hashengine.h"
+#include "zipstreamextractor.h"
+
+static bool entryOffsetLessThan(const DeltaUpdate::Entry& a,
+        const DeltaUpdate::Entry& b)
+{
+    return a.offset < b.offset;
+}
+
+bool DeltaUpdate::Entry::isDirectory() const
+{
+    return path.endsWith('/');
+}
+
+QList<DeltaUpdate::Entry> DeltaUpdate::parseManifest(const QByteArray &data,
+        QString *err)
+{
+    err->clear();
+
+    QList<Entry> r;
+    QSet<QString> paths;
+
+    QList<QByteArray> lines = data.split('\n');
+    for (int i = 0; i < lines.count(); i++) {
+        QString line = QString::fromUtf8(lines.at(i)).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        // the path may contain spaces
+        QStringList parts = line.split(' ', QString::SkipEmptyParts);
+        if (parts.count() < 5) {
+            *err = QObject::tr("Invalid line %1 in the delta manifest").
+                    arg(i + 1);
+            break;
+        }
+
+        Entry e;
+        bool ok1, ok2, ok3;
+        e.size = parts.at(1).toLongLong(&ok1);
+        e.offset = parts.at(2).toLongLong(&ok2);
+        e.length = parts.at(3).toLongLong(&ok3);
+        e.path = QStringList(parts.mid(4)).join(' ');
+        if (!ok1 || !ok2 || !ok3 || e.size < 0 || e.offset < 0 ||
+                e.length < 0 || (e.length == 0 && !e.isDirectory())) {
+            *err = QObject::tr("Invalid line %1 in the delta manifest").
+                    arg(i + 1);
+            break;
+        }
+
+        if (e.path.startsWith('/') || e.path.contains(':') ||
+                e.path.contains('\\') || e.path.split('/').contains("..")) {
+            *err = QObject::tr("Invalid path in the delta manifest: %1").
+                    arg(e.path);
+            break;
+        }
+
+        if (e.isDirectory()) {
+            if (parts.at(0) != "-") {
+                *err = QObject::tr("Invalid line %1 in the delta manifest").
+                        arg(i + 1);
+                break;
+            }
+        } else {
+            e.sha256 = parts.at(0).toLower();
+            *err = WPMUtils::validateSHA256(e.sha256);
+            if (!err->isEmpty()) {
+                *err = QObject::tr("Invalid SHA-256 in line %1 in the delta manifest: %2").
+                        arg(i + 1).arg(*err);
+                break;
+            }
+        }
+
+        if (paths.contains(e.path.toLower())) {
+            *err = QObject::tr("Duplicate path in the delta manifest: %1").
+                    arg(e.path);
+            break;
+        }
+        paths.insert(e.path.toLower());
+
+        r.append(e);
+    }
+
+    if (err->isEmpty() && r.isEmpty())
+        *err = QObject::tr("Empty delta manifest");
+
+    if (!err->isEmpty())
+        r.clear();
+
+    std::sort(r.begin(), r.end(), entryOffsetLessThan);
+
+    // directories do not need a record
+    int prev = -1;
+    for (int i = 0; i < r.count(); i++) {
+        const Entry& e = r.at(i);
+        if (e.isDirectory())
+            continue;
+
+        if (prev >= 0 && r.at(prev).offset + r.at(prev).length > e.offset) {
+            *err = QObject::tr("Overlapping records in the delta manifest: %1 and %2").
+                    arg(r.at(prev).path, e.path);
+            r.clear();
+            break;
+        }
+        prev = i;
+    }
+
+    return r;
+}
+
+QString DeltaUpdate::copyRange(QFile *file, int64_t offset, int64_t length,
+        QIODevice *to)
+{
+    QString r;
+
+    if (!file->seek(offset))
+        r = file->errorString();
+
+    QByteArray buffer;
+    while (r.isEmpty() && length > 0) {
+        buffer = file->read(qMin(length, static_cast<int64_t>(512 * 1024)));
+        if (buffer.isEmpty()) {
+            r = QObject::tr("Error reading the file %1: %2").arg(
+                    file->fileName(), file->errorString());
+            break;
+        }
+        to->write(buffer);
+        length -= buffer.size();
+    }
+
+    return r;
+}
+
+void DeltaUpdate::apply(Job *job, const QUrl &manifest,
+        const QString &manifestSha256, const Downloader::Request &archive,
+        const QString &oldDir, const QString &stagingDir,
+        const QString &fileName, const QString &target, int64_t *downloaded,
+        QStringList *changedPaths)
+{
+    QString initialTitle = job->getTitle();
+
+    if (downloaded)
+        *downloaded = 0;
+    if (changedPaths)
+        changedPaths->clear();
+
+    // the manifest
+    QByteArray data;
+    if (job->shouldProceed()) {
+        Job* sub = job->newSubJob(0.05,
+                QObject::tr("Downloading the delta manifest"), true, true);
+
+        Downloader::Request request(archive);
+        request.url = manifest;
+        request.hashSum = true;
+        request.alg = QCryptographicHash::Sha256;
+        request.segments = 1;
+        request.tee = nullptr;
+        request.rangeFrom = -1;
+        request.rangeTo = -1;
+        QTemporaryFile mf;
+        if (!mf.open()) {
+            job->setErrorMessage(QObject::tr("Error opening file: %1").
+                    arg(mf.fileName()));
+        } else {
+            request.file = &mf;
+            Downloader::Response response = Downloader::download(sub, request);
+            if (job->shouldProceed()) {
+                if (response.hashSum.toLower() != manifestSha256.toLower()) {
+                    job->setErrorMessage(QObject::tr(
+                            "Hash sum %1 found for the delta manifest, but %2 was expected").
+                            arg(response.hashSum, manifestSha256));
+                } else {
+                    mf.seek(0);
+                    data = mf.readAll();
+                }
+            }
+        }
+    }
+
+    QList<Entry> entries;
+    if (job->shouldProceed()) {
+        QString err;
+        entries = parseManifest(data, &err);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+    }
+
+    // unchanged files are only hashed if the size is the same
+    QList<Entry> copied;
+    QList<Entry> changed;
+    if (job->shouldProceed()) {
+        QStringList candidates;
+        QList<Entry> candidateEntries;
+        for (int i = 0; i < entries.count(); i++) {
+            const Entry& e = entries.at(i);
+            if (e.isDirectory())
+                continue;
+
+            QFileInfo fi(oldDir + '/' + e.path);
+            if (fi.isFile() && fi.size() == e.size) {
+                candidates.append(fi.absoluteFilePath());
+                candidateEntries.append(e);
+            } else {
+                changed.append(e);
+            }
+        }
+
+        Job* sub = job->newSubJob(0.1,
+                QObject::tr("Comparing the installed files"), true, true);
+        QStringList hashes = HashEngine::hashFiles(sub, candidates,
+                QCryptographicHash::Sha256);
+        if (job->shouldProceed()) {
+            for (int i = 0; i < candidateEntries.count(); i++) {
+                const Entry& e = candidateEntries.at(i);
+                if (hashes.at(i) == e.sha256)
+                    copied.append(e);
+                else
+                    changed.append(e);
+            }
+            std::sort(changed.begin(), changed.end(), entryOffsetLessThan);
+        }
+    }
+
+    // the records for the changed files are downloaded. Close ranges are
+    // merged into one request. The ranges are stored one after another so
+    // that the file is not larger than the downloaded data.
+    QFile file(fileName);
+    QList<int64_t> from;
+    QList<int64_t> positions;
+    if (job->shouldProceed()) {
+        if (!file.open(QIODevice::ReadWrite | QIODevice::Truncate))
+            job->setErrorMessage(QObject::tr("Cannot open the file: %0").
+                    arg(fileName));
+    }
+
+    if (job->shouldProceed()) {
+        QList<int64_t> to;
+        int64_t total = 0;
+        for (int i = 0; i < changed.count(); i++) {
+            const Entry& e = changed.at(i);
+            if (!to.isEmpty() && e.offset - to.last() - 1 < MAX_GAP) {
+                to.last() = e.offset + e.length - 1;
+            } else {
+                from.append(e.offset);
+                to.append(e.offset + e.length - 1);
+            }
+        }
+        for (int i = 0; i < from.count(); i++)
+            total += to.at(i) - from.at(i) + 1;
+
+        qCDebug(npackd) << "DeltaUpdate::apply" << changed.count() <<
+                "changed files," << copied.count() << "unchanged files," <<
+                from.count() << "ranges," << total << "bytes";
+
+        Job* sub = job->newSubJob(0.6,
+                QObject::tr("Downloading the changed files"), true, true);
+        int64_t done = 0;
+        for (int i = 0; i < from.count(); i++) {
+            int64_t length = to.at(i) - from.at(i) + 1;
+            Job* rjob = sub->newSubJob(total > 0 ?
+                    static_cast<double>(length) / total : 1,
+                    QObject::tr("Downloading %L1 bytes").arg(length),
+                    true, true);
+
+            // the data of the range is appended to the file
+            int64_t position = file.size();
+            positions.append(position);
+            Downloader::Request request(archive);
+            request.file = nullptr;
+            request.hashSum = false;
+            request.segments = 1;
+            request.tee = &file;
+            request.ifRange.clear();
+            request.resume = false;
+            request.rangeFrom = from.at(i);
+            request.rangeTo = to.at(i);
+            Downloader::download(rjob, request);
+
+            if (!sub->shouldProceed())
+                break;
+
+            if (!file.flush() || file.size() - position < length) {
+                sub->setErrorMessage(QObject::tr(
+                        "The server sent less data than requested"));
+                break;
+            }
+
+            done += length;
+        }
+        sub->complete();
+
+        if (downloaded)
+            *downloaded = done;
+    }
+
+    // the downloaded records and the unchanged files are combined in the
+    // staging directory
+    ZipStreamExtractor* extractor = nullptr;
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Extracting the changed files"));
+        QDir(stagingDir).removeRecursively();
+        extractor = new ZipStreamExtractor(stagingDir);
+        int range = 0;
+        for (int i = 0; i < changed.count(); i++) {
+            const Entry& e = changed.at(i);
+
+            // the entries and the ranges are sorted by the offset
+            while (range + 1 < from.count() && from.at(range + 1) <= e.offset)
+                range++;
+
+            QString err = copyRange(&file,
+                    positions.at(range) + e.offset - from.at(range),
+                    e.length, extractor);
+            if (!err.isEmpty()) {
+                job->setErrorMessage(err);
+                break;
+            }
+        }
+
+        if (job->shouldProceed()) {
+            QString err = extractor->finishRecords();
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        }
+        job->setTitle(initialTitle);
+    }
+
+    file.close();
+    file.remove();
+
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Copying the unchanged files"));
+        for (int i = 0; i < entries.count(); i++) {
+            const Entry& e = entries.at(i);
+            if (e.isDirectory()) {
+                QString p = stagingDir + '/' + e.path;
+                if (!QDir().mkpath(p)) {
+                    job->setErrorMessage(QObject::tr(
+                            "Cannot create directory: %0").arg(p));
+                    break;
+                }
+            }
+        }
+
+        for (int i = 0; i < copied.count() && job->shouldProceed(); i++) {
+            const Entry& e = copied.at(i);
+            QString to = stagingDir + '/' + e.path;
+            QString dir = QFileInfo(to).absolutePath();
+            if (!QDir().mkpath(dir)) {
+                job->setErrorMessage(QObject::tr(
+                        "Cannot create directory: %0").arg(dir));
+            } else if (!QFile::copy(oldDir + '/' + e.path, to)) {
+                job->setErrorMessage(QObject::tr(
+                        "Cannot copy %1 to %2").arg(oldDir + '/' + e.path, to));
+            }
+        }
+        if (job->shouldProceed())
+            job->setProgress(0.8);
+        job->setTitle(initialTitle);
+    }
+
+    // every file is verified against the manifest. There should be no other
+    // files.
+    if (job->shouldProceed()) {
+        QStringList files;
+        QList<Entry> fileEntries;
+        for (int i = 0; i < entries.count(); i++) {
+            const Entry& e = entries.at(i);
+            if (!e.isDirectory()) {
+                files.append(stagingDir + '/' + e.path);
+                fileEntries.append(e);
+            }
+        }
+
+        int found = 0;
+        QDirIterator it(stagingDir, QDir::Files | QDir::Hidden | QDir::System,
+                QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            found++;
+        }
+
+        if (found != files.count()) {
+            job->setErrorMessage(QObject::tr(
+                    "%1 files were created, but the delta manifest contains %2").
+                    arg(found).arg(files.count()));
+        } else {
+            Job* sub = job->newSubJob(0.15,
+                    QObject::tr("Verifying the files"), true, true);
+            QStringList hashes = HashEngine::hashFiles(sub, files,
+                    QCryptographicHash::Sha256);
+            for (int i = 0; i < fileEntries.count() &&
+                    job->shouldProceed(); i++) {
+                const Entry& e = fileEntries.at(i);
+                if (hashes.at(i) != e.sha256 ||
+                        QFileInfo(files.at(i)).size() != e.size)
+                    job->setErrorMessage(QObject::tr(
+                            "Hash sum %1 found for %2, but %3 was expected").
+                            arg(hashes.at(i), e.path, e.sha256));
+            }
+        }
+    }
+
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Moving the files"));
+        QString err = extractor->commit(target);
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+        job->setTitle(initialTitle);
+    }
+
+    if (job->shouldProceed() && changedPaths) {
+        for (int i = 0; i < changed.count(); i++) {
+            changedPaths->append(changed.at(i).path);
+        }
+    }
+
+    if (extractor) {
+        extractor->discard();
+        delete extractor;
+    } else {
+        QDir(stagingDir).removeRecursively();
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->complete();
+}
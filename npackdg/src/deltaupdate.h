@@ -0,0 +1,119 @@
+#ifndef DELTAUPDATE_H
+#define DELTAUPDATE_H
+
+#include <stdint.h>
+
+#include <QString>
+#include <QList>
+#include <QStringList>
+#include <QUrl>
+#include <QByteArray>
+#include <QFile>
+
+#include "job.h"
+#include "downloader.h"
+
+/**
+ * @brief updates a package from a .zip file by only downloading the changed
+ *     entries.
+ *
+ * The repository publishes a manifest for the .zip file. Every line describes
+ * one entry:
+ *
+ * <SHA-256> <size> <offset> <length> <path>
+ *
+ * SHA-256 and size are the values for the extracted file. offset and length
+ * define the local file record (header and compressed data) in the .zip
+ * file. Directories are listed with "-" instead of the SHA-256, a path
+ * ending with "/" and the length 0. Empty lines and lines starting with # are ignored.
+ *
+ * A file with the same size and SHA-256 in the directory of the installed
+ * version is copied. The records for all other files are downloaded using
+ * HTTP ranges and extracted. All files are verified against the manifest
+ * afterwards.
+ */
+class DeltaUpdate
+{
+public:
+    /** one entry from the manifest */
+    class Entry
+    {
+    public:
+        /** SHA-256 in lower case or "" for a directory */
+        QString sha256;
+
+        /** size of the extracted file */
+        int64_t size;
+
+        /** position of the local file record in the .zip file */
+        int64_t offset;
+
+        /** length of the local file record */
+        int64_t length;
+
+        /** relative path with / as separator */
+        QString path;
+
+        Entry(): size(0), offset(0), length(0) {
+        }
+
+        /**
+         * @return true if this entry is a directory
+         */
+        bool isDirectory() const;
+    };
+private:
+    /**
+     * ranges with a gap smaller than this value are downloaded with one
+     * request
+     */
+    static const int64_t MAX_GAP = 64 * 1024;
+
+    /**
+     * @brief copies a part of a file to a device
+     * @param file open file
+     * @param offset position in the file
+     * @param length number of bytes
+     * @param to target
+     * @return error message or ""
+     */
+    static QString copyRange(QFile* file, int64_t offset, int64_t length,
+            QIODevice* to);
+public:
+    /**
+     * @brief parses a manifest
+     * @param data content of the manifest
+     * @param err error message will be stored here
+     * @return entries sorted by the offset
+     */
+    static QList<Entry> parseManifest(const QByteArray& data, QString* err);
+
+    /**
+     * @brief creates a new version of a package from the installed one
+     * @param job job. An error means that the whole .zip file should be
+     *     downloaded.
+     * @param manifest URL of the manifest
+     * @param manifestSha256 expected SHA-256 of the manifest
+     * @param archive request for the .zip file. The URL and the credentials
+     *     are used.
+     * @param oldDir directory of the installed version
+     * @param stagingDir a non-existing directory for the new files. It will
+     *     be deleted at the end.
+     * @param fileName temporary file for the downloaded ranges. The ranges
+     *     are stored one after another and the file is only as large as the
+     *     downloaded data.
+     * @param target the new files will be moved here if everything was
+     *     successful
+     * @param downloaded the number of downloaded bytes will be stored here
+     *     or 0
+     * @param changed the relative paths of the files that were downloaded
+     *     (not copied from oldDir) will be stored here or 0
+     */
+    static void apply(Job* job, const QUrl& manifest,
+            const QString& manifestSha256, const Downloader::Request& archive,
+            const QString& oldDir, const QString& stagingDir,
+            const QString& fileName, const QString& target,
+            int64_t* downloaded=nullptr, QStringList* changed=nullptr);
+};
+
+#endif // DELTAUPDATE_H
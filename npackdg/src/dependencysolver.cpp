@@ -0,0 +1,333 @@
+#include "dependencysolver.h"
+
+#include <algorithm>
+
+#include <QCryptographicHash>
+#include <QObject>
+#include <QLoggingCategory>
+
+#include "abstractrepository.h"
+#include "installedpackages.h"
+#include "wpmutils.h"
+
+DependencySolver::Candidates::~Candidates()
+{
+    qDeleteAll(all);
+}
+
+DependencySolver::DependencySolver(AbstractRepository *rep): rep(rep),
+        explanation(nullptr)
+{
+}
+
+void DependencySolver::setExplanation(PlanExplanation *explanation)
+{
+    this->explanation = explanation;
+}
+
+DependencySolver::~DependencySolver()
+{
+    qDeleteAll(candidates);
+}
+
+DependencySolver::Candidates* DependencySolver::getCandidates(
+        const QString &package)
+{
+    Candidates* r = candidates.value(package);
+    if (!r) {
+        r = new Candidates();
+        r->all = rep->getPackageVersions_(package, &r->err);
+        if (r->err.isEmpty()) {
+            for (int i = 0; i < r->all.count(); i++) {
+                PackageVersion* pv = r->all.at(i);
+                if (pv->download.isValid())
+                    r->versions.append(pv);
+            }
+        } else {
+            qDeleteAll(r->all);
+            r->all.clear();
+        }
+        candidates.insert(package, r);
+    }
+    return r;
+}
+
+PackageVersion* DependencySolver::findPackageVersion(const QString &package,
+        const Version &version, QString *err)
+{
+    PackageVersion* r = nullptr;
+
+    Candidates* c = getCandidates(package);
+    *err = c->err;
+    if (err->isEmpty()) {
+        for (int i = 0; i < c->all.count(); i++) {
+            PackageVersion* pv = c->all.at(i);
+            if (pv->version == version) {
+                r = pv;
+                break;
+            }
+        }
+    }
+
+    return r;
+}
+
+PackageVersion* DependencySolver::findNewestInstallablePackageVersion(
+        const QString &package, QString *err)
+{
+    Candidates* c = getCandidates(package);
+    *err = c->err;
+
+    return c->versions.isEmpty() ? nullptr : c->versions.at(0);
+}
+
+PackageVersion* DependencySolver::findBestMatchToInstall(const Dependency &dep,
+        QString *err)
+{
+    PackageVersion* r = nullptr;
+
+    Candidates* c = getCandidates(dep.package);
+    *err = c->err;
+    if (err->isEmpty()) {
+        for (int i = 0; i < c->versions.count(); i++) {
+            PackageVersion* pv = c->versions.at(i);
+            if (dep.test(pv->version)) {
+                r = pv;
+                break;
+            }
+        }
+    }
+
+    return r;
+}
+
+const QSet<QString>& DependencySolver::getReachable(const QString &package)
+{
+    if (!reachable.contains(package)) {
+        QSet<QString> r;
+        QStringList queue;
+        queue.append(package);
+        r.insert(package);
+        while (!queue.isEmpty()) {
+            QString p = queue.takeFirst();
+            Candidates* c = getCandidates(p);
+            for (int i = 0; i < c->versions.count(); i++) {
+                PackageVersion* pv = c->versions.at(i);
+                for (int j = 0; j < pv->dependencies.count(); j++) {
+                    const QString& dp = pv->dependencies.at(j)->package;
+                    if (!r.contains(dp)) {
+                        r.insert(dp);
+                        queue.append(dp);
+                    }
+                }
+            }
+        }
+        reachable.insert(package, r);
+    }
+    return reachable[package];
+}
+
+QList<PackageVersion*> DependencySolver::findAllMatchesToInstall(
+        const Dependency &dep, const QList<PackageVersion*> &avoid,
+        QString *err)
+{
+    QList<PackageVersion*> res;
+
+    Candidates* c = getCandidates(dep.package);
+    *err = c->err;
+    if (err->isEmpty()) {
+        for (int i = 0; i < c->versions.count(); i++) {
+            PackageVersion* pv = c->versions.at(i);
+            if (dep.test(pv->version) &&
+                    PackageVersion::indexOf(avoid, pv) < 0) {
+                res.append(pv->clone());
+            }
+        }
+    }
+
+    return res;
+}
+
+bool DependencySolver::hasUnsatisfiableDependency(
+        const InstalledPackages &installed, const PackageVersion &pv)
+{
+    // installed package versions are only added during the planning. Every
+    // added package version is an installable match for some dependency.
+    bool r = false;
+    for (int i = 0; i < pv.dependencies.count(); i++) {
+        Dependency* d = pv.dependencies.at(i);
+        Candidates* c = getCandidates(d->package);
+        if (!c->err.isEmpty())
+            continue;
+
+        bool found = false;
+        for (int j = 0; j < c->versions.count(); j++) {
+            if (d->test(c->versions.at(j)->version)) {
+                found = true;
+                break;
+            }
+        }
+
+        if (!found && !installed.isInstalled(*d)) {
+            r = true;
+            break;
+        }
+    }
+    return r;
+}
+
+QByteArray DependencySolver::getStateKey(const PackageVersion &pv,
+        const InstalledPackages &installed,
+        const QList<PackageVersion *> &avoid)
+{
+    QSet<QString> packages;
+    packages.insert(pv.package);
+    for (int i = 0; i < pv.dependencies.count(); i++) {
+        packages.unite(getReachable(pv.dependencies.at(i)->package));
+    }
+
+    // installed versions that are also in the "avoid" list do not change the
+    // result as the corresponding dependencies are already satisfied
+    QStringList avoided;
+    for (int i = 0; i < avoid.count(); i++) {
+        PackageVersion* a = avoid.at(i);
+        if (packages.contains(a->package) &&
+                !installed.isInstalled(a->package, a->version))
+            avoided.append(a->getStringId());
+    }
+    std::sort(avoided.begin(), avoided.end());
+    avoided.erase(std::unique(avoided.begin(), avoided.end()), avoided.end());
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(pv.getStringId().toUtf8());
+    hash.addData("\n", 1);
+    hash.addData(installed.getInstalledStringIds(packages).join('\t').toUtf8());
+    hash.addData("\n", 1);
+    hash.addData(avoided.join('\t').toUtf8());
+
+    return hash.result();
+}
+
+QString DependencySolver::planInstallation(PackageVersion *pv,
+        InstalledPackages &installed, QList<InstallOperation *> &ops,
+        QList<PackageVersion *> &avoid, const QString &where)
+{
+    QString res;
+
+    avoid.append(pv->clone());
+
+    for (int i = 0; i < pv->dependencies.count(); i++) {
+        Dependency* d = pv->dependencies.at(i);
+        bool depok = installed.isInstalled(*d);
+        if (explanation) {
+            explanation->begin("dependency", rep->toString(*d));
+            if (depok)
+                explanation->end("installed");
+        }
+        if (!depok) {
+            // we cannot just use the best match here as
+            // it is possible that the highest match cannot be installed because
+            // of unsatisfied dependencies. Example: the newest version depends
+            // on Windows Vista, but the current operating system is XP.
+            QString err;
+            QList<PackageVersion*> pvs = findAllMatchesToInstall(
+                    *d, avoid, &err);
+            if (!err.isEmpty()) {
+                res = QString(QObject::tr("Error searching for the dependency matches: %1")).
+                           arg(err);
+                qDeleteAll(pvs);
+                if (explanation)
+                    explanation->end("error", res);
+                break;
+            }
+            if (pvs.count() == 0) {
+                res = QString(QObject::tr("Unsatisfied dependency: %1")).
+                           arg(rep->toString(*d));
+                if (explanation)
+                    explanation->end("unsatisfied", res);
+                break;
+            } else {
+                bool found = false;
+                for (int j = 0; j < pvs.count(); j++) {
+                    PackageVersion* c = pvs.at(j);
+
+                    if (explanation)
+                        explanation->begin("candidate", c->package,
+                                c->version);
+
+                    // a failed attempt does not change anything and can be
+                    // skipped
+                    if (hasUnsatisfiableDependency(installed, *c)) {
+                        if (explanation)
+                            explanation->end("unsatisfiable");
+                        continue;
+                    }
+
+                    QByteArray key = getStateKey(*c, installed, avoid);
+                    if (failures.contains(key)) {
+                        if (explanation)
+                            explanation->end("failed before");
+                        continue;
+                    }
+
+                    if (explanation)
+                        explanation->candidateTried();
+
+                    InstalledPackages installed2(installed);
+                    int opsCount = ops.count();
+                    int avoidCount = avoid.count();
+
+                    res = planInstallation(c, installed2, ops, avoid);
+                    if (!res.isEmpty()) {
+                        // rollback
+                        while (ops.count() > opsCount) {
+                            delete ops.takeLast();
+                        }
+                        while (avoid.count() > avoidCount) {
+                            delete avoid.takeLast();
+                        }
+                        failures.insert(key);
+                        if (explanation) {
+                            explanation->rolledBack();
+                            explanation->end("rollback", res);
+                        }
+                    } else {
+                        found = true;
+                        installed = installed2;
+                        if (explanation)
+                            explanation->end("ok");
+                        break;
+                    }
+                }
+                if (!found) {
+                    res = QString(QObject::tr("Unsatisfied dependency: %1")).
+                               arg(rep->toString(*d));
+                }
+                if (explanation)
+                    explanation->end(found ? "ok" : "unsatisfied", res);
+            }
+            qDeleteAll(pvs);
+        }
+    }
+
+    if (res.isEmpty()) {
+        if (!installed.isInstalled(pv->package, pv->version)) {
+            InstallOperation* io = new InstallOperation();
+            io->install = true;
+            io->package = pv->package;
+            io->version = pv->version;
+            io->where = where;
+            ops.append(io);
+
+            QString where2 = where;
+            if (where2.isEmpty()) {
+                where2 = pv->getIdealInstallationDirectory();
+                where2 = WPMUtils::findNonExistingFile(where2, "");
+            }
+            installed.setPackageVersionPath(pv->package, pv->version,
+                    where2, false);
+        }
+    }
+
+    return res;
+}
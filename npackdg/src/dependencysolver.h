@@ -0,0 +1,200 @@
+#ifndef DEPENDENCYSOLVER_H
+#define DEPENDENCYSOLVER_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QByteArray>
+
+#include "packageversion.h"
+#include "installoperation.h"
+#include "dependency.h"
+#include "planexplanation.h"
+
+class AbstractRepository;
+class InstalledPackages;
+
+/**
+ * @brief plans the installation of a package version together with all its
+ *     dependencies.
+ *
+ * The search is the same depth-first search as it was implemented directly in
+ * PackageVersion::planInstallation: the dependencies are processed in the
+ * order of definition and for each unsatisfied dependency the matching
+ * package versions are tried from the highest version to the lowest. The
+ * produced list of operations is therefore the same. The following
+ * optimizations avoid the exponential running time for deep dependency graphs:
+ *
+ * - the installable versions of a package are read from the repository only
+ *     once
+ * - a candidate that has a dependency that can never be satisfied (not
+ *     installed and no installable version available) is rejected without
+ *     recursion
+ * - a failed attempt to plan a candidate is remembered. The result of an
+ *     attempt only depends on the installed versions and the avoided versions
+ *     of the packages reachable from the candidate. Another attempt
+ *     for the same candidate in the same state is rejected immediately.
+ *
+ * An object of this class should only be used for one planning session as
+ * the data from the repository is cached. The same object can be used for
+ * planning the installation of several package versions. The remembered
+ * failures remain valid as they only depend on the state.
+ */
+class DependencySolver
+{
+private:
+    /**
+     * @brief versions of one package
+     */
+    class Candidates
+    {
+    public:
+        /** error message from the repository */
+        QString err;
+
+        /**
+         * [ownership:this] all versions. The first object has the highest
+         * version number.
+         */
+        QList<PackageVersion*> all;
+
+        /**
+         * versions from "all" with a valid download URL. The first
+         * object has the highest version number.
+         */
+        QList<PackageVersion*> versions;
+
+        ~Candidates();
+    };
+
+    /** [ownership:caller] repository */
+    AbstractRepository* rep;
+
+    /** [ownership:this] full package name -> versions */
+    QHash<QString, Candidates*> candidates;
+
+    /**
+     * full package name -> all packages (including this one) that can be
+     * reached from this package following the dependencies of the
+     * installable versions
+     */
+    QHash<QString, QSet<QString> > reachable;
+
+    /** state keys for the failed attempts */
+    QSet<QByteArray> failures;
+
+    /** [ownership:caller] decisions will be stored here or 0 */
+    PlanExplanation* explanation;
+
+    /**
+     * @brief returns the cached versions of a package
+     * @param package full package name
+     * @return [ownership:this] versions
+     */
+    Candidates* getCandidates(const QString& package);
+
+    /**
+     * @param package full package name
+     * @return all packages reachable from the specified one
+     */
+    const QSet<QString>& getReachable(const QString& package);
+
+    /**
+     * @brief searches for all installable matches of a dependency
+     * @param dep a dependency
+     * @param avoid package versions that cannot be used
+     * @param err error message will be stored here
+     * @return [ownership:caller] the same as
+     *     AbstractRepository::findAllMatchesToInstall
+     */
+    QList<PackageVersion*> findAllMatchesToInstall(const Dependency& dep,
+            const QList<PackageVersion*>& avoid, QString* err);
+
+    /**
+     * @param installed installed package versions
+     * @param pv a package version
+     * @return true if the package version has a dependency that is not
+     *     installed and for which no installable version exists
+     */
+    bool hasUnsatisfiableDependency(const InstalledPackages& installed,
+            const PackageVersion& pv);
+
+    /**
+     * @brief computes the key for memoizing the results of planning a package
+     *     version
+     * @param pv a package version
+     * @param installed installed package versions
+     * @param avoid package versions that cannot be used
+     * @return SHA1 of the state relevant for the package version
+     */
+    QByteArray getStateKey(const PackageVersion& pv,
+            const InstalledPackages& installed,
+            const QList<PackageVersion*>& avoid);
+public:
+    /**
+     * @param rep [ownership:caller] repository with the package versions
+     */
+    explicit DependencySolver(AbstractRepository* rep);
+
+    ~DependencySolver();
+
+    /**
+     * @brief enables recording of the planning decisions. The dependencies,
+     *     tried candidates and rollbacks are added as children of the current
+     *     node.
+     * @param explanation [ownership:caller] decisions will be stored here or 0
+     */
+    void setExplanation(PlanExplanation* explanation);
+
+    /**
+     * @brief searches for a package version using the cached data
+     * @param package full package name
+     * @param version version number
+     * @param err error message will be stored here
+     * @return [ownership:this] found package version or 0
+     */
+    PackageVersion* findPackageVersion(const QString& package,
+            const Version& version, QString* err);
+
+    /**
+     * @brief searches for the newest installable package version using the
+     *     cached data
+     * @param package full package name
+     * @param err error message will be stored here
+     * @return [ownership:this] found package version or 0
+     */
+    PackageVersion* findNewestInstallablePackageVersion(
+            const QString& package, QString* err);
+
+    /**
+     * @param dep a dependency
+     * @param err error message will be stored here
+     * @return [ownership:this] the newest installable package version that
+     *     matches the dependency or 0
+     */
+    PackageVersion* findBestMatchToInstall(const Dependency& dep,
+            QString* err);
+
+    /**
+     * Plans installation of a package version and all the dependencies
+     * recursively. See PackageVersion::planInstallation for the description
+     * of the parameters.
+     *
+     * @param pv [ownership:caller] this package version should be installed
+     * @param installed [ownership:caller] list of installed packages
+     * @param ops [ownership:caller] necessary operations will be appended here
+     * @param avoid [ownership:caller] list of package versions that cannot be
+     *     installed
+     * @param where target directory for the installation or "" if the
+     *     directory should be chosen automatically
+     * @return error message or ""
+     */
+    QString planInstallation(PackageVersion* pv,
+            InstalledPackages& installed,
+            QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
+            const QString& where="");
+};
+
+#endif // DEPENDENCYSOLVER_H
@@ -0,0 +1,355 @@
+#include "downloadcache.h"
+
+#include <algorithm>
+
+#include <windows.h>
+#include <shlobj.h>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+
+DownloadCache DownloadCache::def;
+
+// the scaled images are not stored under the hash sum of their content
+DownloadCache DownloadCache::icons(QStringLiteral("Icons"),
+        64LL * 1024 * 1024, false);
+DownloadCache DownloadCache::repositories(QStringLiteral("Repositories"),
+        256LL * 1024 * 1024);
+
+static bool entryLessThan(const DownloadCache::Entry& a,
+        const DownloadCache::Entry& b)
+{
+    return a.lastUsed > b.lastUsed;
+}
+
+DownloadCache *DownloadCache::getDefault()
+{
+    return &def;
+}
+
+DownloadCache *DownloadCache::getIcons()
+{
+    return &icons;
+}
+
+DownloadCache *DownloadCache::getRepositories()
+{
+    return &repositories;
+}
+
+DownloadCache::DownloadCache(const QString &name, qint64 maxSize,
+        bool verify): name(name), maxSize(maxSize), verify(verify)
+{
+}
+
+bool DownloadCache::isValid(const QString &file,
+        QCryptographicHash::Algorithm alg, const QString &hashSum) const
+{
+    bool r = true;
+    if (verify) {
+        QString h = WPMUtils::hashSum(file, alg);
+        r = !h.isEmpty() && h == hashSum.trimmed().toLower();
+    }
+    return r;
+}
+
+QString DownloadCache::createDirectoryNoLock(const QString &d)
+{
+    QString err;
+
+    // the directory in the common application data is writable for all
+    // users by default
+    if (WPMUtils::adminMode) {
+        if (secured != d) {
+            err = WPMUtils::createSecureDirectory(d);
+            if (err.isEmpty())
+                secured = d;
+        }
+    } else {
+        QDir qd;
+        if (!qd.mkpath(d))
+            err = QObject::tr("Cannot create directory: %0").arg(d);
+    }
+
+    return err;
+}
+
+void DownloadCache::touch(const QString &file)
+{
+    QFile f(file);
+    if (f.open(QIODevice::ReadWrite)) {
+        f.setFileTime(QDateTime::currentDateTimeUtc(),
+                QFileDevice::FileModificationTime);
+        f.close();
+    }
+}
+
+QString DownloadCache::getKey(QCryptographicHash::Algorithm alg,
+        const QString &hashSum)
+{
+    QString r;
+    if (alg == QCryptographicHash::Sha1)
+        r = "sha1-";
+    else if (alg == QCryptographicHash::Sha256)
+        r = "sha256-";
+
+    if (!r.isEmpty()) {
+        QString h = hashSum.trimmed().toLower();
+        bool valid = !h.isEmpty();
+        for (int i = 0; i < h.length(); i++) {
+            QChar c = h.at(i);
+            if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+                valid = false;
+                break;
+            }
+        }
+        if (valid)
+            r.append(h);
+        else
+            r.clear();
+    }
+
+    return r;
+}
+
+bool DownloadCache::linkOrCopy(const QString &from, const QString &to,
+        bool link)
+{
+    bool r = false;
+    if (link) {
+        r = CreateHardLinkW(WPMUtils::toLPWSTR(to),
+                WPMUtils::toLPWSTR(from), nullptr);
+    }
+    if (!r)
+        r = QFile::copy(from, to);
+    return r;
+}
+
+QString DownloadCache::getDirectory() const
+{
+    QMutexLocker ml(&mutex);
+    return getDirectoryNoLock();
+}
+
+QString DownloadCache::getDirectoryNoLock() const
+{
+    // the directory depends on WPMUtils::adminMode and is computed on each call
+    QString r = dir;
+    if (r.isEmpty())
+        r = WPMUtils::getShellDir(WPMUtils::adminMode ?
+                CSIDL_COMMON_APPDATA : CSIDL_APPDATA) +
+                QStringLiteral("\\Npackd\\Cache\\") + name;
+    return r;
+}
+
+void DownloadCache::setDirectory(const QString &dir)
+{
+    QMutexLocker ml(&mutex);
+    this->dir = dir;
+}
+
+qint64 DownloadCache::getMaxSize() const
+{
+    QMutexLocker ml(&mutex);
+    return maxSize;
+}
+
+void DownloadCache::setMaxSize(qint64 maxSize)
+{
+    QMutexLocker ml(&mutex);
+    this->maxSize = maxSize;
+}
+
+bool DownloadCache::copyTo(QCryptographicHash::Algorithm alg,
+        const QString &hashSum, const QString &target, bool link)
+{
+    QString key = getKey(alg, hashSum);
+    if (key.isEmpty())
+        return false;
+
+    QMutexLocker ml(&mutex);
+
+    QString file = getDirectoryNoLock() + "\\" + key;
+
+    bool r = false;
+    if (QFileInfo(file).exists()) {
+        if (QFileInfo(target).exists())
+            QFile::remove(target);
+
+        // the shared directory in the admin mode is not linked so that the
+        // target cannot be changed via the cache
+        r = linkOrCopy(file, target, link && !WPMUtils::adminMode);
+        if (r) {
+            // last use for the LRU eviction
+            touch(file);
+        }
+    }
+
+    ml.unlock();
+
+    // the name of a file does not guarantee its content. The copy is
+    // checked as the file in the cache may be changed in the meantime.
+    if (r && !isValid(target, alg, hashSum)) {
+        qCWarning(npackd).noquote() << QObject::tr(
+                "The file %1 in the download cache has a wrong hash sum and will be deleted").
+                arg(file);
+        QFile::remove(target);
+        QFile::remove(file);
+        r = false;
+    }
+
+    qCDebug(npackd) << "DownloadCache::copyTo" << key << r;
+
+    return r;
+}
+
+QString DownloadCache::add(QCryptographicHash::Algorithm alg,
+        const QString &hashSum, const QString &file, bool link)
+{
+    QString key = getKey(alg, hashSum);
+    if (key.isEmpty())
+        return QObject::tr("Unsupported hash sum: %1").arg(hashSum);
+
+    QMutexLocker ml(&mutex);
+
+    QString d = getDirectoryNoLock();
+
+    QString err = createDirectoryNoLock(d);
+
+    QString target = d + "\\" + key;
+    if (err.isEmpty() && !QFileInfo(target).exists()) {
+        // the file is only visible under the final name if it is complete
+        QString tmp = target + ".tmp";
+        QFile::remove(tmp);
+        if (!linkOrCopy(file, tmp, link && !WPMUtils::adminMode)) {
+            err = QObject::tr("Cannot copy %1 to %2").arg(file, tmp);
+        } else if (!QFile::rename(tmp, target)) {
+            QFile::remove(tmp);
+            err = QObject::tr("Cannot rename %0 to %1").arg(tmp, target);
+        }
+    }
+
+    if (err.isEmpty())
+        err = pruneNoLock(maxSize);
+
+    return err;
+}
+
+QString DownloadCache::getFile(QCryptographicHash::Algorithm alg,
+        const QString &hashSum)
+{
+    QString key = getKey(alg, hashSum);
+    if (key.isEmpty())
+        return QString();
+
+    QMutexLocker ml(&mutex);
+
+    QString file = getDirectoryNoLock() + "\\" + key;
+    if (QFileInfo(file).exists())
+        touch(file);
+    else
+        file.clear();
+
+    ml.unlock();
+
+    if (!file.isEmpty() && !isValid(file, alg, hashSum)) {
+        qCWarning(npackd).noquote() << QObject::tr(
+                "The file %1 in the download cache has a wrong hash sum and will be deleted").
+                arg(file);
+        QFile::remove(file);
+        file.clear();
+    }
+
+    return file;
+}
+
+bool DownloadCache::contains(QCryptographicHash::Algorithm alg,
+        const QString &hashSum) const
+{
+    QString key = getKey(alg, hashSum);
+    if (key.isEmpty())
+        return false;
+
+    return QFileInfo(getDirectory() + "\\" + key).exists();
+}
+
+qint64 DownloadCache::getSize(QCryptographicHash::Algorithm alg,
+        const QString &hashSum) const
+{
+    QString key = getKey(alg, hashSum);
+    if (key.isEmpty())
+        return -1;
+
+    QFileInfo fi(getDirectory() + "\\" + key);
+    return fi.exists() ? fi.size() : -1;
+}
+
+QList<DownloadCache::Entry> DownloadCache::list() const
+{
+    QList<Entry> r;
+
+    QDir d(getDirectory());
+    QFileInfoList fis = d.entryInfoList(QDir::Files);
+    for (int i = 0; i < fis.count(); i++) {
+        const QFileInfo& fi = fis.at(i);
+        QString name = fi.fileName();
+
+        Entry e;
+        if (name.startsWith("sha1-")) {
+            e.alg = QCryptographicHash::Sha1;
+            e.hashSum = name.mid(5);
+        } else if (name.startsWith("sha256-")) {
+            e.alg = QCryptographicHash::Sha256;
+            e.hashSum = name.mid(7);
+        } else {
+            continue;
+        }
+
+        if (getKey(e.alg, e.hashSum) != name)
+            continue;
+
+        e.size = fi.size();
+        e.lastUsed = fi.lastModified();
+        r.append(e);
+    }
+
+    std::sort(r.begin(), r.end(), entryLessThan);
+
+    return r;
+}
+
+QString DownloadCache::prune(qint64 maxSize)
+{
+    QMutexLocker ml(&mutex);
+    return pruneNoLock(maxSize);
+}
+
+QString DownloadCache::pruneNoLock(qint64 maxSize)
+{
+    QString err;
+
+    QFileInfoList fis = QDir(getDirectoryNoLock()).entryInfoList(
+            QDir::Files, QDir::Time);
+
+    qint64 total = 0;
+    for (int i = 0; i < fis.count(); i++) {
+        total += fis.at(i).size();
+    }
+
+    // QDir::Time sorts the newest files first
+    for (int i = fis.count() - 1; i >= 0 && total > maxSize; i--) {
+        const QFileInfo& fi = fis.at(i);
+        if (QFile::remove(fi.absoluteFilePath())) {
+            total -= fi.size();
+        } else if (err.isEmpty()) {
+            err = QObject::tr("Cannot delete the file %1").arg(
+                    fi.absoluteFilePath());
+        }
+    }
+
+    return err;
+}
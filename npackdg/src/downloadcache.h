@@ -0,0 +1,245 @@
+#ifndef DOWNLOADCACHE_H
+#define DOWNLOADCACHE_H
+
+#include <QString>
+#include <QList>
+#include <QMutex>
+#include <QDateTime>
+#include <QCryptographicHash>
+
+/**
+ * @brief content-addressed cache for the downloaded package binaries.
+ *
+ * The files are stored in one directory. The name of a file is the hash sum
+ * algorithm and the hash sum provided by the repository (e.g.
+ * "sha256-0a1b..."). Only files with a verified hash sum are added. The
+ * modification time of a file is updated on each use and the least recently
+ * used files are removed if the total size exceeds the limit.
+ *
+ * The name of a file is not trusted: the content is checked against the hash
+ * sum each time a file is taken from the cache. In the admin mode the
+ * directory can only be changed by the administrators.
+ *
+ * @threadsafe
+ */
+class DownloadCache
+{
+public:
+    /**
+     * @brief one file in the cache
+     */
+    class Entry
+    {
+    public:
+        /** hash sum algorithm */
+        QCryptographicHash::Algorithm alg;
+
+        /** hash sum in lower case */
+        QString hashSum;
+
+        /** size of the file in bytes */
+        qint64 size;
+
+        /** last use */
+        QDateTime lastUsed;
+    };
+private:
+    static DownloadCache def;
+
+    static DownloadCache icons;
+
+    static DownloadCache repositories;
+
+    mutable QMutex mutex;
+
+    /** name of the default directory */
+    QString name;
+
+    /** directory for the files */
+    QString dir;
+
+    /** maximum size of all files in bytes */
+    qint64 maxSize;
+
+    /** true = check the hash sum of a file each time it is used */
+    bool verify;
+
+    /** directory with the changed permissions or "" */
+    QString secured;
+
+    /**
+     * @param file a file
+     * @param alg hash sum algorithm
+     * @param hashSum expected hash sum
+     * @return true if the hash sum of the file is correct or the files are
+     *     not checked
+     */
+    bool isValid(const QString& file, QCryptographicHash::Algorithm alg,
+            const QString& hashSum) const;
+
+    /**
+     * @brief creates the directory for the files. In the admin mode only the
+     *     administrators can change the directory. The mutex should be
+     *     locked.
+     * @param d the directory
+     * @return error message or ""
+     */
+    QString createDirectoryNoLock(const QString& d);
+
+    /**
+     * @param alg hash sum algorithm
+     * @param hashSum hash sum
+     * @return file name (without the directory) or "" if the algorithm is
+     *     not supported
+     */
+    static QString getKey(QCryptographicHash::Algorithm alg,
+            const QString& hashSum);
+
+    /**
+     * @brief updates the last use of a file for the LRU eviction
+     * @param file a file in the cache
+     */
+    static void touch(const QString& file);
+
+    /**
+     * @brief hard links or copies a file
+     * @param from source file
+     * @param to target file. The file must not exist.
+     * @param link true = try to create a hard link first
+     * @return true if the operation succeeded
+     */
+    static bool linkOrCopy(const QString& from, const QString& to, bool link);
+
+    /**
+     * @return directory for the files. The mutex should be locked.
+     */
+    QString getDirectoryNoLock() const;
+
+    /**
+     * @brief removes the least recently used files. The mutex should be
+     *     locked.
+     * @param maxSize maximum size of all files in bytes
+     * @return error message or ""
+     */
+    QString pruneNoLock(qint64 maxSize);
+public:
+    /**
+     * @return default cache in the Npackd data directory
+     */
+    static DownloadCache* getDefault();
+
+    /**
+     * @return cache for the icons and screenshots in the Npackd data
+     *     directory with a limit of 64 MiB
+     */
+    static DownloadCache* getIcons();
+
+    /**
+     * @return cache for the repository files from the last download (see
+     *     RepositoryCacheInfo) in the Npackd data directory with a limit of
+     *     256 MiB. The files are not stored together with the package
+     *     binaries so that they are not removed by the pruning of the
+     *     binaries.
+     */
+    static DownloadCache* getRepositories();
+
+    /**
+     * @param name name of the default directory under "Npackd\Cache"
+     * @param maxSize maximum size of all files in bytes
+     * @param verify true = the file names are hash sums of the content and
+     *     the content is checked each time a file is used
+     */
+    explicit DownloadCache(const QString& name=QStringLiteral("Downloads"),
+            qint64 maxSize=2LL * 1024 * 1024 * 1024, bool verify=true);
+
+    /**
+     * @return directory for the files. The default directory is
+     *     "Npackd\Cache\<name>" in the application data directory.
+     */
+    QString getDirectory() const;
+
+    /**
+     * @brief changes the directory for the files
+     * @param dir new directory
+     */
+    void setDirectory(const QString& dir);
+
+    /**
+     * @return maximum size of all files in bytes. The default value is 2 GiB.
+     */
+    qint64 getMaxSize() const;
+
+    /**
+     * @brief changes the maximum size of all files. The files are not removed
+     *     immediately.
+     * @param maxSize new maximum size in bytes
+     */
+    void setMaxSize(qint64 maxSize);
+
+    /**
+     * @brief copies a file from the cache
+     * @param alg hash sum algorithm
+     * @param hashSum hash sum
+     * @param target target file. An existing file will be overwritten.
+     * @param link true = create a hard link if possible. The target file
+     *     should not be changed in this case. Hard links are not used in the
+     *     admin mode.
+     * @return true if the file was found in the cache and copied. A file
+     *     with a wrong hash sum is deleted and false is returned.
+     */
+    bool copyTo(QCryptographicHash::Algorithm alg, const QString& hashSum,
+            const QString& target, bool link);
+
+    /**
+     * @brief returns the file in the cache and updates its last use
+     * @param alg hash sum algorithm
+     * @param hashSum hash sum
+     * @return full file name or "" if the file is not in the cache or has a
+     *     wrong hash sum. The file should not be changed.
+     */
+    QString getFile(QCryptographicHash::Algorithm alg, const QString& hashSum);
+
+    /**
+     * @brief adds a file to the cache and removes the least recently used
+     *     files if necessary
+     * @param alg hash sum algorithm
+     * @param hashSum the verified hash sum of the file
+     * @param file this file will be hard linked or copied into the cache
+     * @param link true = create a hard link if possible. The file should not
+     *     be changed afterwards in this case.
+     * @return error message or ""
+     */
+    QString add(QCryptographicHash::Algorithm alg, const QString& hashSum,
+            const QString& file, bool link);
+
+    /**
+     * @param alg hash sum algorithm
+     * @param hashSum hash sum
+     * @return true if the file is in the cache
+     */
+    bool contains(QCryptographicHash::Algorithm alg,
+            const QString& hashSum) const;
+
+    /**
+     * @param alg hash sum algorithm
+     * @param hashSum hash sum
+     * @return size of the file in the cache or -1 if it is not in the cache
+     */
+    qint64 getSize(QCryptographicHash::Algorithm alg,
+            const QString& hashSum) const;
+
+    /**
+     * @return all files in the cache sorted by the last use (the most
+     *     recently used first)
+     */
+    QList<Entry> list() const;
+
+    /**
+     * @brief removes the least recently used files
+     * @param maxSize maximum size of all files in bytes
+     * @return error message or ""
+     */
+    QString prune(qint64 maxSize);
+};
+
+#endif // DOWNLOADCACHE_H
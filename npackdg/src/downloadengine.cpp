@@ -0,0 +1,461 @@
+#include "downloadengine.h"
+
+#include <QMutexLocker>
+#include <QNetworkRequest>
+#include <QNetworkProxyFactory>
+#include <QLoggingCategory>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "wpmutils.h"
+#include "hashengine.h"
+#include "downloadscheduler.h"
+#include "qtnetworktransport.h"
+#include "downloadstatistics.h"
+
+QMutex DownloadEngine::defaultMutex;
+
+DownloadEngine* DownloadEngine::defaultEngine = nullptr;
+
+QThreadPool DownloadEngine::workerThreadPool;
+
+DownloadEngine::Transfer::Transfer(Job *job,
+        const Downloader::Request &request): job(job), request(request),
+        reply(nullptr), headers(false), received(0), lastActivity(0),
+        resumeAt(0), title(job->getTitle()), fallback(false), sent(0)
+{
+    timer.start();
+}
+
+DownloadEngine::DownloadEngine(): manager(nullptr), timer(nullptr)
+{
+    thread.start();
+    moveToThread(&thread);
+
+    // the objects for the network thread are created there
+    QMetaObject::invokeMethod(this, "init", Qt::QueuedConnection);
+}
+
+DownloadEngine::~DownloadEngine()
+{
+    thread.quit();
+    thread.wait();
+
+    qDeleteAll(incoming);
+    qDeleteAll(waiting);
+    qDeleteAll(running);
+}
+
+DownloadEngine *DownloadEngine::getDefault()
+{
+    QMutexLocker ml(&defaultMutex);
+
+    if (!defaultEngine) {
+        if (workerThreadPool.maxThreadCount() < 10)
+            workerThreadPool.setMaxThreadCount(10);
+        defaultEngine = new DownloadEngine();
+    }
+
+    return defaultEngine;
+}
+
+void DownloadEngine::init()
+{
+    // the same proxy as for WinINet (Internet settings in the control panel)
+    QNetworkProxyFactory::setUseSystemConfiguration(true);
+
+    manager = new QNetworkAccessManager(this);
+    connect(manager, SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)),
+            this, SLOT(authenticate(QNetworkReply*,QAuthenticator*)));
+    connect(manager, SIGNAL(proxyAuthenticationRequired(QNetworkProxy,QAuthenticator*)),
+            this, SLOT(authenticateProxy(QNetworkProxy,QAuthenticator*)));
+
+    timer = new QTimer(this);
+    connect(timer, SIGNAL(timeout()), this, SLOT(tick()));
+    timer->start(100);
+
+    clock.start();
+}
+
+bool DownloadEngine::isSupported(const Downloader::Request &request)
+{
+    return (request.url.scheme() == "http" ||
+            request.url.scheme() == "https") &&
+            request.rangeFrom < 0 && request.ifRange.isEmpty() &&
+            !request.resume &&
+            !(request.segments > 1 && request.file &&
+            request.httpMethod == "GET");
+}
+
+QFuture<Downloader::Response> DownloadEngine::start(Job *job,
+        const Downloader::Request &request)
+{
+    Transfer* t = new Transfer(job, request);
+    t->result.reportStarted();
+    QFuture<Downloader::Response> r = t->result.future();
+
+    if (!isSupported(request)) {
+        QtConcurrent::run(&workerThreadPool, &DownloadEngine::runBlocking, t);
+    } else {
+        mutex.lock();
+        incoming.append(t);
+        mutex.unlock();
+
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    }
+
+    return r;
+}
+
+void DownloadEngine::runBlocking(Transfer *t)
+{
+    t->response = Downloader::download(t->job, t->request);
+    report(t);
+    delete t;
+}
+
+void DownloadEngine::computeHashSum(Transfer *t)
+{
+    t->response.hashSum = HashEngine::hashFile(t->request.file->fileName(),
+            t->request.alg);
+    if (t->response.hashSum.isEmpty())
+        t->job->setErrorMessage(QObject::tr("Error computing the hash sum"));
+    report(t);
+    delete t;
+}
+
+void DownloadEngine::report(Transfer *t)
+{
+    t->job->setTitle(t->title);
+    if (t->job->shouldProceed())
+        t->job->setProgress(1);
+    t->job->complete();
+
+    t->result.reportResult(t->response);
+    t->result.reportFinished();
+}
+
+void DownloadEngine::schedule()
+{
+    mutex.lock();
+    QList<Transfer*> ts = incoming;
+    incoming.clear();
+    mutex.unlock();
+
+    // the waiting transfers are ordered by the priority
+    for (int i = 0; i < ts.count(); i++) {
+        Transfer* t = ts.at(i);
+        int index = waiting.count();
+        while (index > 0 && waiting.at(index - 1)->request.priority >
+                t->request.priority)
+            index--;
+        waiting.insert(index, t);
+    }
+
+    startWaiting();
+}
+
+void DownloadEngine::startWaiting()
+{
+    int i = 0;
+    while (i < waiting.count()) {
+        Transfer* t = waiting.at(i);
+        if (t->job->isCancelled()) {
+            finish(t);
+        } else if (DownloadScheduler::tryAcquire(t->request.url,
+                t->request.priority)) {
+            waiting.removeAt(i);
+
+            t->sent = t->timer.elapsed();
+            t->response.queueTime = t->sent;
+
+            QNetworkRequest nr = QtNetworkTransport::createRequest(
+                    t->request, 0);
+            QNetworkReply* reply;
+            if (t->request.httpMethod == "HEAD")
+                reply = manager->head(nr);
+            else
+                reply = manager->sendCustomRequest(nr,
+                        t->request.httpMethod.toLatin1(),
+                        t->request.postData);
+
+            // the connection is not read while the bandwidth limit is
+            // exceeded
+            reply->setReadBufferSize(256 * 1024);
+
+            connect(reply, SIGNAL(readyRead()), this, SLOT(replyReadyRead()));
+            connect(reply, SIGNAL(finished()), this, SLOT(replyFinished()));
+
+            t->reply = reply;
+            t->lastActivity = clock.elapsed();
+            running.insert(reply, t);
+
+            t->job->setTitle(t->title + " / " + QObject::tr("Connecting"));
+        } else {
+            i++;
+        }
+    }
+}
+
+void DownloadEngine::processHeaders(Transfer *t)
+{
+    QNetworkReply* reply = t->reply;
+    Job* job = t->job;
+
+    t->headers = true;
+    t->response.ttfb = t->timer.elapsed() - t->sent;
+    t->response.fromCache = reply->attribute(
+            QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+
+    int status = reply->attribute(
+            QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    qCDebug(npackd) << "DownloadEngine::processHeaders" << t->request.url <<
+            status;
+
+    // the password dialogs are only available in WinINet
+    if (t->request.interactive &&
+            ((status == 401 && t->request.user.isEmpty()) ||
+            (status == 407 && t->request.proxyUser.isEmpty()))) {
+        t->fallback = true;
+    } else if (status == 304 &&
+            QtNetworkTransport::isConditional(t->request, 0)) {
+        t->response.notModified = true;
+        t->response.etag = QString::fromLatin1(reply->rawHeader("ETag"));
+        t->response.lastModified = QString::fromLatin1(
+                reply->rawHeader("Last-Modified"));
+    } else if (status / 100 != 2) {
+        if (status == 0)
+            job->setErrorMessage(reply->errorString());
+        else
+            job->setErrorMessage(QString(
+                    QObject::tr("HTTP status code %1")).arg(status));
+    } else {
+        Downloader::Response* response = &t->response;
+        response->mimeType = reply->header(
+                QNetworkRequest::ContentTypeHeader).toString();
+        if (response->mimeType.isEmpty())
+            response->mimeType = "application/octet-stream";
+        response->contentDisposition = QString::fromLatin1(
+                reply->rawHeader("Content-Disposition"));
+        response->acceptRanges = QString::fromLatin1(
+                reply->rawHeader("Accept-Ranges")).trimmed().toLower() ==
+                "bytes";
+
+        // weak ETags cannot be used for ranges
+        QString etag = QString::fromLatin1(reply->rawHeader("ETag"));
+        if (!etag.isEmpty()) {
+            if (!etag.startsWith("W/"))
+                response->validator = etag;
+        } else {
+            response->validator = QString::fromLatin1(
+                    reply->rawHeader("Last-Modified"));
+        }
+
+        response->etag = etag;
+        response->lastModified = QString::fromLatin1(
+                reply->rawHeader("Last-Modified"));
+
+        QVariant cl = reply->header(QNetworkRequest::ContentLengthHeader);
+        if (cl.isValid())
+            response->contentLength = cl.toLongLong();
+
+        job->setProgress(0.03);
+        job->setTitle(t->title + " / " + QObject::tr("Downloading"));
+    }
+}
+
+bool DownloadEngine::read(Transfer *t)
+{
+    QNetworkReply* reply = t->reply;
+    Job* job = t->job;
+
+    if (!t->headers) {
+        // the status of a followed redirect is not used
+        int status = reply->attribute(
+                QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if ((status == 0 || (status / 100 == 3 && status != 304)) &&
+                !reply->isFinished())
+            return false;
+
+        processHeaders(t);
+
+        if (!job->shouldProceed() || t->fallback ||
+                t->response.notModified ||
+                t->request.ignoreContent || t->request.httpMethod == "HEAD")
+            return true;
+    }
+
+    qint64 now = clock.elapsed();
+    if (t->resumeAt > now)
+        return false;
+
+    while (reply->bytesAvailable() > 0) {
+        QByteArray data = reply->read(64 * 1024);
+        if (data.isEmpty())
+            break;
+
+        QFile* file = t->request.file;
+        if (file && file->write(data) != data.size()) {
+            job->setErrorMessage(QObject::tr(
+                    "Error writing the file %1: %2").arg(
+                    file->fileName(), file->errorString()));
+            return true;
+        }
+
+        if (t->request.tee)
+            t->request.tee->write(data);
+
+        t->received += data.size();
+        t->lastActivity = now;
+
+        int64_t total = t->response.contentLength;
+        if (total > 0) {
+            job->setProgress(0.04 + 0.95 * qMin(1.0,
+                    static_cast<double>(t->received) / total));
+            job->setTitle(t->title + " / " +
+                    QString(QObject::tr("%L0 of %L1 bytes")).
+                    arg(t->received).arg(total));
+        } else {
+            job->setTitle(t->title + " / " +
+                    QString(QObject::tr("%L0 bytes")).arg(t->received));
+        }
+
+        qint64 wait = DownloadScheduler::addTransferred(data.size());
+        if (wait > 0) {
+            t->resumeAt = now + wait;
+            break;
+        }
+    }
+
+    return false;
+}
+
+bool DownloadEngine::process(Transfer *t)
+{
+    bool done = read(t);
+
+    if (!done && t->reply->isFinished() && t->reply->bytesAvailable() == 0 &&
+            t->resumeAt <= clock.elapsed()) {
+        if (t->reply->error() != QNetworkReply::NoError &&
+                t->job->shouldProceed() && !t->fallback)
+            t->job->setErrorMessage(t->reply->errorString());
+        done = true;
+    }
+
+    return done;
+}
+
+void DownloadEngine::finish(Transfer *t)
+{
+    if (t->reply) {
+        running.remove(t->reply);
+        disconnect(t->reply, nullptr, this, nullptr);
+        if (!t->reply->isFinished())
+            t->reply->abort();
+        t->reply->deleteLater();
+        t->reply = nullptr;
+
+        DownloadScheduler::release(t->request.url, t->request.priority);
+    } else {
+        waiting.removeOne(t);
+    }
+
+    if (t->request.file)
+        t->request.file->flush();
+
+    // the transfers executed by Downloader::download are recorded there
+    t->response.bytes = t->received;
+    if (!t->fallback)
+        DownloadStatistics::record(t->job, t->request, t->response,
+                t->timer.elapsed());
+
+    if (t->fallback && !t->job->isCancelled()) {
+        qCDebug(npackd) << "DownloadEngine::finish using WinINet for" <<
+                t->request.url;
+        t->job->setTitle(t->title);
+        QtConcurrent::run(&workerThreadPool, &DownloadEngine::runBlocking, t);
+    } else if (t->job->shouldProceed() && t->request.hashSum &&
+            t->request.file && !t->response.notModified) {
+        // the hash sum is computed by another thread
+        t->job->setTitle(t->title + " / " +
+                QObject::tr("Computing hash sum"));
+        QtConcurrent::run(&workerThreadPool, &DownloadEngine::computeHashSum,
+                t);
+    } else {
+        report(t);
+        delete t;
+    }
+}
+
+void DownloadEngine::tick()
+{
+    qint64 now = clock.elapsed();
+
+    QList<Transfer*> ts = running.values();
+    for (int i = 0; i < ts.count(); i++) {
+        Transfer* t = ts.at(i);
+
+        bool done;
+        if (t->job->isCancelled()) {
+            done = true;
+        } else if (now - t->lastActivity >
+                static_cast<qint64>(t->request.timeout) * 1000) {
+            t->job->setErrorMessage(QObject::tr("Timeout"));
+            done = true;
+        } else {
+            done = process(t);
+        }
+
+        if (done)
+            finish(t);
+    }
+
+    startWaiting();
+}
+
+void DownloadEngine::replyReadyRead()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    Transfer* t = running.value(reply);
+    if (t && process(t)) {
+        finish(t);
+        startWaiting();
+    }
+}
+
+void DownloadEngine::replyFinished()
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    Transfer* t = running.value(reply);
+    if (t && process(t)) {
+        finish(t);
+        startWaiting();
+    }
+}
+
+void DownloadEngine::authenticate(QNetworkReply *reply,
+        QAuthenticator *authenticator)
+{
+    // the same credentials are not tried again
+    Transfer* t = running.value(reply);
+    if (t && !t->request.user.isEmpty() &&
+            authenticator->user() != t->request.user) {
+        authenticator->setUser(t->request.user);
+        authenticator->setPassword(t->request.password);
+    }
+}
+
+void DownloadEngine::authenticateProxy(const QNetworkProxy & /*proxy*/,
+        QAuthenticator *authenticator)
+{
+    QList<Transfer*> ts = running.values();
+    for (int i = 0; i < ts.count(); i++) {
+        Transfer* t = ts.at(i);
+        if (!t->request.proxyUser.isEmpty() &&
+                authenticator->user() != t->request.proxyUser) {
+            authenticator->setUser(t->request.proxyUser);
+            authenticator->setPassword(t->request.proxyPassword);
+            break;
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#ifndef DOWNLOADENGINE_H
+#define DOWNLOADENGINE_H
+
+#include <stdint.h>
+
+#include <QObject>
+#include <QThread>
+#include <QThreadPool>
+#include <QMutex>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkProxy>
+#include <QAuthenticator>
+
+#include "job.h"
+#include "downloader.h"
+
+/**
+ * @brief event-driven downloads.
+ *
+ * One thread with an event loop and one QNetworkAccessManager processes all
+ * transfers started by start(). A transfer does not block a thread while it
+ * is waiting for the network. This is used for many small downloads like
+ * repositories, size probes and icons.
+ *
+ * The received data is written to Request::file by the network thread.
+ * Hash sums are computed by worker threads after the transfer is completed.
+ *
+ * The connections are limited by the DownloadScheduler. Transfers that do
+ * not get a slot wait in a queue ordered by the priority. The proxy from the
+ * system configuration is used like in WinINet.
+ *
+ * Requests that cannot be processed by this engine (file: and data: URLs,
+ * ranges, resumed and segmented downloads) and requests that need a password
+ * dialog are executed using Downloader::download on a worker thread.
+ *
+ * @threadsafe
+ */
+class DownloadEngine: public QObject
+{
+    Q_OBJECT
+private:
+    /** one download */
+    class Transfer
+    {
+    public:
+        Job* job;
+
+        Downloader::Request request;
+
+        Downloader::Response response;
+
+        /** the result will be reported here */
+        QFutureInterface<Downloader::Response> result;
+
+        /** 0 = waiting for a connection slot */
+        QNetworkReply* reply;
+
+        /** true = the HTTP headers were processed */
+        bool headers;
+
+        /** number of received bytes */
+        int64_t received;
+
+        /** time of the last received data (ms) */
+        qint64 lastActivity;
+
+        /** the reading is paused until this time (ms) */
+        qint64 resumeAt;
+
+        /** initial title of the job */
+        QString title;
+
+        /**
+         * true = the request needs a password dialog and will be executed
+         * using Downloader::download
+         */
+        bool fallback;
+
+        /** started when the transfer is created */
+        QElapsedTimer timer;
+
+        /** time of sending the request (ms since the start of "timer") */
+        qint64 sent;
+
+        Transfer(Job* job, const Downloader::Request& request);
+    };
+
+    static QMutex defaultMutex;
+
+    /** [ownership:this] the default engine */
+    static DownloadEngine* defaultEngine;
+
+    /**
+     * threads for the CPU work and for the requests that cannot be processed
+     * by the engine
+     */
+    static QThreadPool workerThreadPool;
+
+    /** network thread */
+    QThread thread;
+
+    /** protects "incoming" */
+    QMutex mutex;
+
+    /**
+     * [ownership:this] transfers that were started, but not yet seen by the
+     * network thread
+     */
+    QList<Transfer*> incoming;
+
+    // the following fields are only accessed from the network thread
+
+    /** [ownership:this] created in the network thread */
+    QNetworkAccessManager* manager;
+
+    /** [ownership:this] checks cancellations, timeouts and paused reads */
+    QTimer* timer;
+
+    QElapsedTimer clock;
+
+    /** [ownership:this] transfers waiting for a connection slot */
+    QList<Transfer*> waiting;
+
+    /** [ownership:this] reply -> running transfer */
+    QHash<QNetworkReply*, Transfer*> running;
+
+    DownloadEngine();
+
+    /**
+     * @param request a request
+     * @return true if the request can be processed by this engine
+     */
+    static bool isSupported(const Downloader::Request& request);
+
+    /**
+     * @brief executes the request using Downloader::download and reports the
+     *     result
+     * @param t [ownership:this] transfer
+     */
+    static void runBlocking(Transfer* t);
+
+    /**
+     * @brief computes the hash sum for the downloaded file and reports the
+     *     result
+     * @param t [ownership:this] transfer
+     */
+    static void computeHashSum(Transfer* t);
+
+    /**
+     * @brief reports the result
+     * @param t the transfer. The object is not deleted.
+     */
+    static void report(Transfer* t);
+
+    /**
+     * @brief starts the waiting transfers if connection slots are available
+     *     and finishes the cancelled ones
+     */
+    void startWaiting();
+
+    /**
+     * @brief processes the HTTP status and headers
+     * @param t a running transfer
+     */
+    void processHeaders(Transfer* t);
+
+    /**
+     * @brief reads the available data
+     * @param t a running transfer
+     * @return true if the transfer is done
+     */
+    bool read(Transfer* t);
+
+    /**
+     * @brief processes the current state of a transfer
+     * @param t a running transfer
+     * @return true if the transfer is done and finish() should be called
+     */
+    bool process(Transfer* t);
+
+    /**
+     * @brief releases the connection and reports the result
+     * @param t [ownership:this] a waiting or running transfer
+     */
+    void finish(Transfer* t);
+private slots:
+    void init();
+
+    void schedule();
+
+    void tick();
+
+    void replyReadyRead();
+
+    void replyFinished();
+
+    void authenticate(QNetworkReply* reply, QAuthenticator* authenticator);
+
+    void authenticateProxy(const QNetworkProxy& proxy,
+            QAuthenticator* authenticator);
+public:
+    ~DownloadEngine() override;
+
+    /**
+     * @return the default engine. It is created on the first call.
+     */
+    static DownloadEngine* getDefault();
+
+    /**
+     * @brief starts a download. This function does not block.
+     * @param job job for the transfer. It is completed at the end. The
+     *     object should not be destroyed before the future is finished.
+     * @param request request. Request::file should stay open and should not
+     *     be accessed before the future is finished.
+     * @return the response will be available here
+     */
+    QFuture<Downloader::Response> start(Job* job,
+            const Downloader::Request& request);
+};
+
+#endif // DOWNLOADENGINE_H
@@ -9,22 +9,76 @@
 #include <QObject>
 #include <QWaitCondition>
 #include <QMutex>
+#include <QElapsedTimer>
 #include <QCryptographicHash>
 #include <QLoggingCategory>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include "downloader.h"
 #include "job.h"
 #include "wpmutils.h"
+#include "hashengine.h"
+#include "httptransport.h"
+#include "wininettransport.h"
+#include "downloadstatistics.h"
 
 HWND defaultPasswordWindow = nullptr;
 QMutex loginDialogMutex;
 
+QThreadPool Downloader::segmentThreadPool;
+
+HTTPTransport* Downloader::transport = nullptr;
+
+/** the default transport */
+static WinINetTransport winINetTransport;
+
+/** files smaller than this are not split in segments */
+static const int64_t MIN_SEGMENT_SIZE = 4 * 1024 * 1024;
+
 DWORD __stdcall myInternetAuthNotifyCallback(DWORD_PTR /* dwContext */,
         DWORD dwReturn, LPVOID /* lpReserved */) {
     qCDebug(npackd) << "myInternetAuthNotifyCallback" << dwReturn;
     return 0;
 }
 
+/**
+ * @brief times in milliseconds for the WinINet status callback or -1
+ */
+class WinINetTimes
+{
+public:
+    QElapsedTimer timer;
+    qint64 resolving, resolved, connecting, connected;
+
+    WinINetTimes(): resolving(-1), resolved(-1), connecting(-1),
+            connected(-1) {
+        timer.start();
+    }
+};
+
+void __stdcall winINetStatusCallback(HINTERNET /* hInternet */,
+        DWORD_PTR dwContext, DWORD dwInternetStatus,
+        LPVOID /* lpvStatusInformation */,
+        DWORD /* dwStatusInformationLength */) {
+    WinINetTimes* times = reinterpret_cast<WinINetTimes*>(dwContext);
+    if (times) {
+        switch (dwInternetStatus) {
+            case INTERNET_STATUS_RESOLVING_NAME:
+                times->resolving = times->timer.elapsed();
+                break;
+            case INTERNET_STATUS_NAME_RESOLVED:
+                times->resolved = times->timer.elapsed();
+                break;
+            case INTERNET_STATUS_CONNECTING_TO_SERVER:
+                times->connecting = times->timer.elapsed();
+                break;
+            case INTERNET_STATUS_CONNECTED_TO_SERVER:
+                times->connected = times->timer.elapsed();
+                break;
+        }
+    }
+}
+
 int64_t Downloader::downloadWin(Job* job, const Request& request,
         Downloader::Response* response)
 {
@@ -34,7 +88,8 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
     QString* mime = &response->mimeType;
     QString* contentDisposition = &response->contentDisposition;
     HWND parentWindow = defaultPasswordWindow;
-    QString* sha1 = &response->hashSum;
+    // the hash sum of a range would not be useful
+    QString* sha1 = request.rangeFrom >= 0 ? nullptr : &response->hashSum;
     bool useCache = request.useCache;
     QCryptographicHash::Algorithm alg = request.alg;
     bool keepConnection = request.keepConnection;
@@ -42,11 +97,41 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
 
     QString initialTitle = job->getTitle();
 
-    job->setTitle(initialTitle + " / " + QObject::tr("Connecting"));
-
     if (sha1)
         sha1->clear();
 
+    QElapsedTimer queue;
+    queue.start();
+
+    // every connection needs a slot from the scheduler
+    if (!DownloadScheduler::acquire(job, url, request.priority)) {
+        job->complete();
+        return -1;
+    }
+
+    response->queueTime = queue.elapsed();
+
+    // filled by the status callback for the request handle
+    WinINetTimes times;
+
+    job->setTitle(initialTitle + " / " + QObject::tr("Connecting"));
+
+    // number of bytes that are already available or the position of the
+    // requested range
+    int64_t offset = 0;
+    if (request.rangeFrom >= 0)
+        offset = request.rangeFrom;
+    else if (file && (!request.ifRange.isEmpty() || request.resume) &&
+            verb == "GET")
+        offset = file->size();
+    bool ranged = request.rangeFrom >= 0 || offset > 0;
+
+    // the WinINet cache is not used for conditional requests. The caller
+    // has its own copy of the entity.
+    bool conditional = !ranged && verb == "GET" &&
+            (!request.ifNoneMatch.isEmpty() ||
+            !request.ifModifiedSince.isEmpty());
+
     QString server = url.host();
     QString resource = url.path();
     QString encQuery = url.query(QUrl::FullyEncoded);
@@ -66,6 +151,10 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
         QString errMsg;
         WPMUtils::formatMessage(GetLastError(), &errMsg);
         job->setErrorMessage(errMsg);
+    } else {
+        // only the request handle has a context and receives the
+        // notifications
+        InternetSetStatusCallbackW(internet, winINetStatusCallback);
     }
 
     if (job->shouldProceed()) {
@@ -146,14 +235,14 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
         if (!request.useInternet)
             flags |= INTERNET_FLAG_FROM_CACHE;
         flags |= INTERNET_FLAG_RESYNCHRONIZE;
-        if (!useCache)
+        if (!useCache || ranged || conditional)
             flags |= INTERNET_FLAG_DONT_CACHE | INTERNET_FLAG_PRAGMA_NOCACHE |
                     INTERNET_FLAG_RELOAD;
         hResourceHandle = HttpOpenRequestW(hConnectHandle,
                 WPMUtils::toLPWSTR(verb),
                 WPMUtils::toLPWSTR(resource),
                 nullptr, nullptr, ppszAcceptTypes,
-                flags, 0);
+                flags, reinterpret_cast<DWORD_PTR>(&times));
         if (hResourceHandle == nullptr) {
             QString errMsg;
             WPMUtils::formatMessage(GetLastError(), &errMsg);
@@ -167,15 +256,50 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
 
     if (hResourceHandle != nullptr && hConnectHandle != nullptr) {
         if (job->shouldProceed()) {
-            // do not check for errors here
-            HttpAddRequestHeadersW(hResourceHandle,
-                    L"Accept-Encoding: gzip, deflate",
+            // a range of compressed data cannot be appended to the
+            // decompressed file
+            if (ranged) {
+                QString range = QString("Range: bytes=%1-").arg(offset);
+                if (request.rangeFrom >= 0 && request.rangeTo >= 0)
+                    range.append(QString::number(request.rangeTo));
+                if (!request.ifRange.isEmpty())
+                    range.append("\r\nIf-Range: ").append(request.ifRange);
+                if (!HttpAddRequestHeadersW(hResourceHandle,
+                        WPMUtils::toLPWSTR(range),
+                        static_cast<DWORD>(-1),
+                        HTTP_ADDREQ_FLAG_ADD | HTTP_ADDREQ_FLAG_REPLACE)) {
+                    QString errMsg;
+                    WPMUtils::formatMessage(GetLastError(), &errMsg);
+                    job->setErrorMessage(errMsg);
+                }
+            } else {
+                // do not check for errors here
+                HttpAddRequestHeadersW(hResourceHandle,
+                        L"Accept-Encoding: gzip, deflate",
+                        static_cast<DWORD>(-1),
+                        HTTP_ADDREQ_FLAG_ADD);
+            }
+        }
+
+        if (job->shouldProceed() && conditional) {
+            QStringList h;
+            if (!request.ifNoneMatch.isEmpty())
+                h.append("If-None-Match: " + request.ifNoneMatch);
+            if (!request.ifModifiedSince.isEmpty())
+                h.append("If-Modified-Since: " + request.ifModifiedSince);
+            if (!HttpAddRequestHeadersW(hResourceHandle,
+                    WPMUtils::toLPWSTR(h.join("\r\n")),
                     static_cast<DWORD>(-1),
-                    HTTP_ADDREQ_FLAG_ADD);
+                    HTTP_ADDREQ_FLAG_ADD | HTTP_ADDREQ_FLAG_REPLACE)) {
+                QString errMsg;
+                WPMUtils::formatMessage(GetLastError(), &errMsg);
+                job->setErrorMessage(errMsg);
+            }
         }
 
         // qCDebug(npackd) << "download.5";
         int callNumber = 0;
+        qint64 sent = times.timer.elapsed();
         while (job->shouldProceed()) {
             // qCDebug(npackd) << "download.5.1";
 
@@ -212,7 +336,8 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
             // 2XX
             if (sendRequestError == 0) {
                 DWORD hundreds = dwStatus / 100;
-                if (hundreds == 2 || hundreds == 5)
+                if (hundreds == 2 || hundreds == 5 ||
+                        (conditional && dwStatus == HTTP_STATUS_NOT_MODIFIED))
                     break;
             }
 
@@ -329,6 +454,20 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
         }; // while (job->shouldProceed())
 
     out:
+        response->ttfb = times.timer.elapsed() - sent;
+        response->retries = callNumber;
+        if (times.resolving >= 0 && times.resolved >= 0)
+            response->dnsTime = times.resolved - times.resolving;
+        if (times.connecting >= 0 && times.connected >= 0)
+            response->connectTime = times.connected - times.connecting;
+
+        DWORD requestFlags = 0, requestFlagsSize = sizeof(requestFlags);
+        if (InternetQueryOption(hResourceHandle,
+                INTERNET_OPTION_REQUEST_FLAGS, &requestFlags,
+                &requestFlagsSize))
+            response->fromCache = (requestFlags &
+                    INTERNET_REQFLAG_FROM_CACHE) != 0;
+
         if (job->shouldProceed()) {
             DWORD dwStatus, dwStatusSize = sizeof(dwStatus);
 
@@ -340,13 +479,46 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
                 job->setErrorMessage(errMsg);
             } else {
                 // 2XX
-                if (dwStatus / 100 != 2) {
+                if (conditional && dwStatus == HTTP_STATUS_NOT_MODIFIED) {
+                    response->notModified = true;
+                } else if (dwStatus / 100 != 2) {
                     job->setErrorMessage(QString(
                             QObject::tr("HTTP status code %1")).arg(dwStatus));
+                } else if (request.rangeFrom >= 0) {
+                    if (dwStatus != HTTP_STATUS_PARTIAL_CONTENT)
+                        job->setErrorMessage(QObject::tr(
+                                "The server does not support byte ranges"));
+                } else if (offset > 0) {
+                    if (dwStatus == HTTP_STATUS_PARTIAL_CONTENT) {
+                        response->resumed = true;
+                    } else {
+                        // the entity has changed or ranges are not supported
+                        qCDebug(npackd) << "Downloader::downloadWin "
+                                "cannot resume" << url << dwStatus;
+                        offset = 0;
+                        if (!file->resize(0) || !file->seek(0))
+                            job->setErrorMessage(file->errorString());
+                    }
                 }
             }
         }
 
+        // the ranges of a segmented download are computed from the size
+        if (job->shouldProceed() && request.rangeFrom >= 0 &&
+                request.size >= 0) {
+            WCHAR contentRangeBuffer[100];
+            DWORD bufferLength = sizeof(contentRangeBuffer);
+            DWORD index = 0;
+            QString contentRange;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_CONTENT_RANGE,
+                    contentRangeBuffer, &bufferLength, &index))
+                contentRange = QString::fromWCharArray(
+                        contentRangeBuffer, bufferLength / 2);
+            QString err = checkContentRange(request, contentRange);
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+        }
+
         if (job->shouldProceed()) {
             job->setProgress(0.03);
             job->setTitle(initialTitle + " / " + QObject::tr("Downloading"));
@@ -385,6 +557,64 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
             job->setProgress(0.04);
         }
 
+        if (job->shouldProceed() && ranged && gzip) {
+            job->setErrorMessage(QObject::tr(
+                    "Cannot resume a compressed download"));
+        }
+
+        // ETag or Last-Modified for resuming the download. Weak ETags
+        // cannot be used for ranges.
+        if (job->shouldProceed() && !gzip) {
+            WCHAR validatorBuffer[1024];
+            DWORD bufferLength = sizeof(validatorBuffer);
+            DWORD index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_ETAG,
+                    &validatorBuffer, &bufferLength, &index)) {
+                QString etag = QString::fromWCharArray(
+                        validatorBuffer, bufferLength / 2);
+                if (!etag.startsWith("W/"))
+                    response->validator = etag;
+            } else {
+                bufferLength = sizeof(validatorBuffer);
+                index = 0;
+                if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_LAST_MODIFIED,
+                        &validatorBuffer, &bufferLength, &index)) {
+                    response->validator = QString::fromWCharArray(
+                            validatorBuffer, bufferLength / 2);
+                }
+            }
+        }
+
+        // ETag and Last-Modified for conditional requests
+        if (job->shouldProceed()) {
+            WCHAR validatorBuffer[1024];
+            DWORD bufferLength = sizeof(validatorBuffer);
+            DWORD index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_ETAG,
+                    &validatorBuffer, &bufferLength, &index))
+                response->etag = QString::fromWCharArray(
+                        validatorBuffer, bufferLength / 2);
+            bufferLength = sizeof(validatorBuffer);
+            index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_LAST_MODIFIED,
+                    &validatorBuffer, &bufferLength, &index))
+                response->lastModified = QString::fromWCharArray(
+                        validatorBuffer, bufferLength / 2);
+        }
+
+        // Accept-Ranges
+        if (job->shouldProceed()) {
+            WCHAR acceptRangesBuffer[100];
+            DWORD bufferLength = sizeof(acceptRangesBuffer);
+            DWORD index = 0;
+            if (HttpQueryInfoW(hResourceHandle, HTTP_QUERY_ACCEPT_RANGES,
+                    &acceptRangesBuffer, &bufferLength, &index)) {
+                response->acceptRanges = QString::fromWCharArray(
+                        acceptRangesBuffer, bufferLength / 2).trimmed() ==
+                        "bytes";
+            }
+        }
+
         // Content-Disposition
         if (job->shouldProceed()) {
             if (contentDisposition) {
@@ -413,17 +643,34 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
                 contentLength = s.toLongLong(&ok, 10);
                 if (!ok)
                     contentLength = 0;
+                else if (offset > 0)
+                    contentLength += offset;
             }
 
             job->setProgress(0.05);
         }
 
+        // there is no content for HEAD
         if (job->shouldProceed()) {
-            if (!request.ignoreContent) {
+            if (!request.ignoreContent && verb != "HEAD" &&
+                    !response->notModified) {
+                // the end of a resumed download cannot be processed alone.
+                // A requested range is passed as it is.
+                QIODevice* tee = ranged && request.rangeFrom < 0 ?
+                        nullptr : request.tee;
+
                 Job* sub = job->newSubJob(0.95, QObject::tr("Reading the data"));
-                readData(sub, hResourceHandle, file, sha1, gzip, contentLength, alg);
+                readData(sub, hResourceHandle, file, sha1, gzip, contentLength,
+                        alg, offset, tee);
+
+                // the data is written after the offset
+                if (file)
+                    response->bytes = qMax(static_cast<int64_t>(0),
+                            file->pos() - offset);
                 if (!sub->getErrorMessage().isEmpty())
                     job->setErrorMessage(sub->getErrorMessage());
+                else if (tee && !sub->isCancelled())
+                    response->teed = true;
             } else {
                 job->setProgress(job->getProgress() + 0.95);
             }
@@ -437,6 +684,8 @@ int64_t Downloader::downloadWin(Job* job, const Request& request,
     if (internet)
         InternetCloseHandle(internet);
 
+    DownloadScheduler::release(url, request.priority);
+
     if (job->shouldProceed())
         job->setProgress(1);
 
@@ -580,12 +829,13 @@ bool Downloader::internetReadFileFully(HINTERNET resourceHandle,
 }
 
 void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
-        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
+        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg,
+        QIODevice* tee)
 {
     QString initialTitle = job->getTitle();
 
     // download/compute SHA1 loop
-    QCryptographicHash hash(alg);
+    HashEngine::Hash hash(alg);
     const int bufferSize = 512 * 1024;
     unsigned char* buffer = new unsigned char[bufferSize];
     const int buffer2Size = 512 * 1024;
@@ -609,6 +859,8 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
         if (bufferLength == 0)
             break;
 
+        DownloadScheduler::transferred(job, bufferLength);
+
         // http://www.gzip.org/zlib/rfc-gzip.html
         if (!zlibStreamInitialized) {
             unsigned int cur = 0;
@@ -727,6 +979,10 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
 
                 file->write(reinterpret_cast<char*>(buffer2),
                         buffer2Size - static_cast<int>(d_stream.avail_out));
+
+                if (tee)
+                    tee->write(reinterpret_cast<char*>(buffer2),
+                            buffer2Size - static_cast<int>(d_stream.avail_out));
             }
         } while (d_stream.avail_out == 0);
 
@@ -768,20 +1024,46 @@ void Downloader::readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
 }
 
 void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
-        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg)
+        QString* sha1, int64_t contentLength, QCryptographicHash::Algorithm alg,
+        int64_t offset, QIODevice* tee)
 {
-    qCDebug(npackd) << "Downloader::readDataFlat";
+    qCDebug(npackd) << "Downloader::readDataFlat" << offset;
 
     QString initialTitle = job->getTitle();
 
     // download/compute SHA1 loop
-    QCryptographicHash hash(alg);
+    HashEngine::Hash hash(alg);
     const int bufferSize = 512 * 1024;
     unsigned char* buffer = new unsigned char[bufferSize];
 
-    int64_t alreadyRead = 0;
-    DWORD bufferLength;
-    do {
+    // continue the hash sum over the already available data
+    if (offset > 0 && file) {
+        if (!file->seek(0)) {
+            job->setErrorMessage(file->errorString());
+        } else if (sha1) {
+            int64_t rest = offset;
+            while (rest > 0) {
+                qint64 n = file->read(reinterpret_cast<char*>(buffer),
+                        qMin(static_cast<int64_t>(bufferSize), rest));
+                if (n <= 0) {
+                    job->setErrorMessage(QObject::tr(
+                            "Error reading the file %1: %2").arg(
+                            file->fileName(), file->errorString()));
+                    break;
+                }
+                hash.addData(reinterpret_cast<char*>(buffer),
+                        static_cast<int>(n));
+                rest -= n;
+            }
+        }
+
+        if (job->shouldProceed() && !file->seek(offset))
+            job->setErrorMessage(file->errorString());
+    }
+
+    int64_t alreadyRead = offset;
+    DWORD bufferLength = 0;
+    while (job->shouldProceed()) {
         if (!InternetReadFile(hResourceHandle, buffer,
                 bufferSize, &bufferLength)) {
             QString errMsg;
@@ -797,6 +1079,8 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
         if (bufferLength == 0)
             break;
 
+        DownloadScheduler::transferred(job, bufferLength);
+
         // update SHA1 if necessary
         if (sha1)
             hash.addData(reinterpret_cast<char*>(buffer),
@@ -806,10 +1090,13 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
             // TODO: check the returned value. -1 means error
             file->write(reinterpret_cast<char*>(buffer), bufferLength);
 
+        if (tee)
+            tee->write(reinterpret_cast<char*>(buffer), bufferLength);
+
         alreadyRead += bufferLength;
-        if (contentLength > 0) {
-            job->setProgress((static_cast<double>(alreadyRead)) /
-                    contentLength);
+        if (contentLength > offset) {
+            job->setProgress((static_cast<double>(alreadyRead - offset)) /
+                    (contentLength - offset));
             job->setTitle(initialTitle + " / " +
                     QString(QObject::tr("%L0 of %L1 bytes")).
                     arg(alreadyRead).
@@ -820,7 +1107,15 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
                     QString(QObject::tr("%L0 bytes")).
                     arg(alreadyRead));
         }
-    } while (bufferLength != 0 && !job->isCancelled());
+    }
+
+    // a closed connection is not reported as an error by InternetReadFile
+    if (job->shouldProceed() && contentLength > 0 &&
+            alreadyRead < contentLength) {
+        job->setErrorMessage(QString(QObject::tr(
+                "The connection was closed after %L1 of %L2 bytes")).
+                arg(alreadyRead).arg(contentLength));
+    }
 
     if (job->shouldProceed())
         job->setProgress(1);
@@ -835,12 +1130,13 @@ void Downloader::readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
 
 void Downloader::readData(Job* job, HINTERNET hResourceHandle, QFile* file,
         QString* sha1, bool gzip, int64_t contentLength,
-        QCryptographicHash::Algorithm alg)
+        QCryptographicHash::Algorithm alg, int64_t offset, QIODevice* tee)
 {
     if (gzip && file)
-        readDataGZip(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataGZip(job, hResourceHandle, file, sha1, contentLength, alg, tee);
     else
-        readDataFlat(job, hResourceHandle, file, sha1, contentLength, alg);
+        readDataFlat(job, hResourceHandle, file, sha1, contentLength, alg,
+                offset, tee);
 }
 
 void Downloader::copyFile(Job* job, const QString& source, QFile* file,
@@ -849,34 +1145,246 @@ void Downloader::copyFile(Job* job, const QString& source, QFile* file,
     if (!srcFile.open(QFile::ReadOnly)) {
         job->setErrorMessage(QObject::tr("Error opening file: %1").
                 arg(source));
+        job->complete();
     } else {
-        qint64 srcSize = srcFile.size();
-        const int SZ = 8192;
-        char* data = new char[SZ];
-
-        qint64 progress = 0;
-        QCryptographicHash crypto(alg);
-        while(true) {
-            qint64 c = srcFile.read(data, SZ);
-            if (c <= 0)
-                break;
+        // the file is read in large blocks by another thread while the
+        // previous block is hashed and written
+        QString hash = HashEngine::hashFile(job, &srcFile, alg, file);
+        if (sha1)
+            *sha1 = hash;
+
+        srcFile.close();
+    }
+}
 
-            if (sha1)
-                crypto.addData(data, static_cast<int>(c));
-            if (file)
-                file->write(data, c);
+QString Downloader::checkContentRange(const Request& request,
+        const QString& contentRange)
+{
+    QString err;
+
+    bool ok;
+    int64_t total = contentRange.section('/', 1).trimmed().toLongLong(&ok);
+    if (request.size >= 0 && ok && total != request.size)
+        err = QObject::tr("The size of %1 has changed from %2 to %3 bytes").
+                arg(request.url.toString()).arg(request.size).arg(total);
 
-            progress += c;
-            if (srcSize != 0)
-                job->setProgress((static_cast<double>(progress)) / srcSize);
+    return err;
+}
+
+void Downloader::downloadSegment(Job* job, const Downloader::Request& request,
+        const QString& fileName, QSemaphore* done)
+{
+    QFile f(fileName);
+    if (f.open(QIODevice::ReadWrite)) {
+        Request r(request);
+        r.file = &f;
+        Response response;
+        getTransport()->execute(job, r, &response);
+        f.close();
+    } else {
+        job->setErrorMessage(QString(QObject::tr("Cannot open the file: %0")).
+                arg(fileName));
+        job->complete();
+    }
+
+    done->release();
+}
+
+/**
+ * @brief adds a part of a file to a hash sum
+ * @param file an open file
+ * @param from first byte
+ * @param to last byte (inclusive)
+ * @param hash the data is added here
+ * @return error message or ""
+ */
+static QString hashRange(QFile* file, int64_t from, int64_t to,
+        HashEngine::Hash* hash)
+{
+    QString err;
+
+    if (!file->seek(from))
+        err = file->errorString();
+
+    const int64_t BUFFER_SIZE = 1024 * 1024;
+    int64_t pos = from;
+    while (err.isEmpty() && pos <= to) {
+        QByteArray buffer = file->read(qMin(BUFFER_SIZE, to - pos + 1));
+        if (buffer.isEmpty()) {
+            err = QObject::tr("Error reading the file %1").
+                    arg(file->fileName());
+        } else {
+            hash->addData(buffer.constData(), buffer.size());
+            pos += buffer.size();
         }
+    }
 
-        if (sha1)
-            *sha1 = crypto.result().toHex().toLower();
+    return err;
+}
 
-        srcFile.close();
-        delete[] data;
+void Downloader::downloadSegmented(Job* job,
+        const Downloader::Request& request, Response *response)
+{
+    QFile* file = request.file;
+
+    // more segments than connections to one host would wait for each
+    // other
+    int segments = qMin(request.segments,
+            DownloadScheduler::getMaxConnectionsPerHost());
+
+    // the HEAD request is only necessary if the file could be downloaded in
+    // segments and the size is unknown
+    int64_t length = request.size;
+    bool head = file->size() == 0 && segments > 1 &&
+            (length < 0 || (length >= 2 * MIN_SEGMENT_SIZE &&
+            !request.hashSum));
+
+    // size and support for ranges
+    Response headResponse;
+    QString headError;
+    if (head) {
+        Request r(request);
+        r.httpMethod = "HEAD";
+        r.file = nullptr;
+        r.ifRange.clear();
+        r.segments = 1;
+        r.timeout = 15;
+        Job* sub = job->newSubJob(0.02, QObject::tr("Determining the size"),
+                true, false);
+        length = getTransport()->execute(sub, r, &headResponse);
+        headError = sub->getErrorMessage();
     }
+
+    // without the HEAD request the ranges are requested without "If-Range"
+    // and the hash sum shows whether the data is from the same entity
+    int n = 1;
+    if (file->size() == 0 && !job->isCancelled() && headError.isEmpty() &&
+            (!head || (headResponse.acceptRanges &&
+            !headResponse.validator.isEmpty()))) {
+        n = static_cast<int>(qMin(static_cast<int64_t>(segments),
+                length / MIN_SEGMENT_SIZE));
+    }
+
+    qCDebug(npackd) << "Downloader::downloadSegmented" << request.url <<
+            length << n << head;
+
+    if (n < 2) {
+        Job* djob = job->newSubJob(1 - job->getProgress(),
+                QObject::tr("Downloading"), true, true);
+        getTransport()->execute(djob, request, response);
+    } else {
+        if (head) {
+            response->mimeType = headResponse.mimeType;
+            response->contentDisposition = headResponse.contentDisposition;
+        }
+        response->acceptRanges = true;
+
+        if (!file->resize(length))
+            job->setErrorMessage(file->errorString());
+
+        if (segmentThreadPool.maxThreadCount() < 16)
+            segmentThreadPool.setMaxThreadCount(16);
+
+        QString fileName = file->fileName();
+        QSemaphore done;
+        QList<Job*> subs;
+        if (job->shouldProceed()) {
+            for (int i = 0; i < n; i++) {
+                Request segment(request);
+                segment.file = nullptr;
+                segment.tee = nullptr;
+                segment.hashSum = false;
+                segment.segments = 1;
+                segment.ifRange = headResponse.validator;
+                segment.size = length;
+                segment.rangeFrom = length * i / n;
+                segment.rangeTo = length * (i + 1) / n - 1;
+
+                Job* s = job->newSubJob(0.88 / n,
+                        QString(QObject::tr("Segment %1 of %2")).
+                        arg(i + 1).arg(n), true, false);
+                subs.append(s);
+                QtConcurrent::run(&segmentThreadPool,
+                        &Downloader::downloadSegment, s, segment, fileName,
+                        &done);
+            }
+        }
+
+        // the segments are hashed in the original order while the following
+        // segments are still being downloaded
+        HashEngine::Hash hash(request.alg);
+        QFile reader(fileName);
+        int hashed = 0;
+        QString err;
+        if (request.hashSum && !subs.isEmpty() &&
+                !reader.open(QIODevice::ReadOnly))
+            err = QString(QObject::tr("Cannot open the file: %0")).
+                    arg(fileName);
+
+        // the first failed segment cancels the others
+        int finished = 0;
+        while (finished < subs.count()) {
+            if (done.tryAcquire(1, 100))
+                finished++;
+
+            if (err.isEmpty()) {
+                for (int j = 0; j < subs.count(); j++) {
+                    Job* s = subs.at(j);
+                    if (!s->getErrorMessage().isEmpty()) {
+                        err = s->getErrorMessage();
+                        break;
+                    }
+                }
+            }
+
+            while (err.isEmpty() && request.hashSum &&
+                    !job->isCancelled() && hashed < subs.count() &&
+                    subs.at(hashed)->isCompleted()) {
+                err = hashRange(&reader, length * hashed / n,
+                        length * (hashed + 1) / n - 1, &hash);
+                hashed++;
+            }
+
+            if (job->isCancelled() || !err.isEmpty()) {
+                for (int j = 0; j < subs.count(); j++) {
+                    subs.at(j)->cancel();
+                }
+            }
+        }
+
+        while (err.isEmpty() && request.hashSum && job->shouldProceed() &&
+                hashed < subs.count()) {
+            err = hashRange(&reader, length * hashed / n,
+                    length * (hashed + 1) / n - 1, &hash);
+            hashed++;
+        }
+        reader.close();
+
+        if (!err.isEmpty())
+            job->setErrorMessage(err);
+
+        if (job->shouldProceed() && request.hashSum) {
+            QByteArray r = hash.result();
+            if (r.isEmpty())
+                job->setErrorMessage(QObject::tr(
+                        "Error computing the hash sum"));
+            else
+                response->hashSum = QString::fromLatin1(r.toHex().toLower());
+        }
+
+        if (job->shouldProceed()) {
+            response->validator = headResponse.validator;
+            if (!file->seek(length))
+                job->setErrorMessage(file->errorString());
+        } else {
+            // a partially filled file cannot be resumed
+            file->resize(0);
+        }
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
     job->complete();
 }
 
@@ -885,9 +1393,18 @@ Downloader::Response Downloader::download(Job *job,
 {
     Downloader::Response r;
 
+    QElapsedTimer timer;
+    timer.start();
+
     QString* sha1 = request.hashSum ? &r.hashSum : nullptr;
-    if (request.url.scheme() == "https" || request.url.scheme() == "http")
-        downloadWin(job, request, &r);
+    if ((request.url.scheme() == "https" || request.url.scheme() == "http") &&
+            request.segments > 1 && request.file &&
+            request.httpMethod == "GET" && request.rangeFrom < 0) {
+        int64_t size = request.file->size();
+        downloadSegmented(job, request, &r);
+        r.bytes = qMax(static_cast<int64_t>(0), request.file->size() - size);
+    } else if (request.url.scheme() == "https" || request.url.scheme() == "http")
+        r.contentLength = getTransport()->execute(job, request, &r);
     else if (request.url.toString().startsWith("data:image/png;base64,")) {
         if (request.file) {
             QString dataURL_ = request.url.toString().mid(22);
@@ -915,6 +1432,8 @@ Downloader::Response Downloader::download(Job *job,
         job->complete();
     }
 
+    DownloadStatistics::record(job, request, r, timer.elapsed());
+
     return r;
 }
 
@@ -935,6 +1454,7 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
     } else {
         Request req(url);
         req.httpMethod = "HEAD";
+        req.priority = DownloadScheduler::SIZE_PROBE;
         req.parentWindow = parentWindow;
         req.useCache = true;
         req.keepConnection = false;
@@ -942,10 +1462,11 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
 
         Job* sub = job->newSubJob(1, QObject::tr("Using the HEAD HTTP method"));
         Response resp;
-        result = downloadWin(sub, req, &resp);
+        result = getTransport()->execute(sub, req, &resp);
 
         if (!sub->getErrorMessage().isEmpty()) {
             Request req2(url);
+            req2.priority = DownloadScheduler::SIZE_PROBE;
             req2.parentWindow = parentWindow;
             req2.useCache = true;
             req2.keepConnection = false;
@@ -955,7 +1476,7 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
             Response resp2;
             Job* sub2 = job->newSubJob(1 - job->getProgress(),
                     QObject::tr("Using the GET HTTP method"));
-            result = downloadWin(sub2, req2, &resp2);
+            result = getTransport()->execute(sub2, req2, &resp2);
             if (!sub2->getErrorMessage().isEmpty())
                 job->setErrorMessage(sub2->getErrorMessage());
         }
@@ -964,6 +1485,16 @@ int64_t Downloader::getContentLength(Job* job, const QUrl &url,
     return result;
 }
 
+void Downloader::setTransport(HTTPTransport *t)
+{
+    transport = t;
+}
+
+HTTPTransport *Downloader::getTransport()
+{
+    return transport ? transport : &winINetTransport;
+}
+
 QTemporaryFile* Downloader::downloadToTemporary(Job* job,
         const Downloader::Request &request)
 {
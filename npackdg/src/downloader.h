@@ -11,8 +11,13 @@
 #include <QObject>
 #include <QWaitCondition>
 #include <QCryptographicHash>
+#include <QThreadPool>
+#include <QSemaphore>
 
 #include "job.h"
+#include "downloadscheduler.h"
+
+class HTTPTransport;
 
 extern HWND defaultPasswordWindow;
 extern QMutex loginDialogMutex;
@@ -24,6 +29,11 @@ class Downloader: public QObject
 {
     Q_OBJECT
 
+    friend class WinINetTransport;
+
+    /** [ownership:caller] transport for http: and https: or 0 */
+    static HTTPTransport* transport;
+
     /**
      * @brief readDataFlat
      * @param job
@@ -32,14 +42,18 @@ class Downloader: public QObject
      * @param sha1
      * @param contentLength
      * @param alg
+     * @param offset number of bytes already available at the beginning of
+     *     the file. The data will be written after these bytes and the hash
+     *     sum will be computed over the whole file.
+     * @param tee 0 or the data will also be written here
      */
     static void readDataFlat(Job* job, HINTERNET hResourceHandle, QFile* file,
             QString* sha1, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
+            QCryptographicHash::Algorithm alg, int64_t offset, QIODevice* tee);
 
     static void readDataGZip(Job* job, HINTERNET hResourceHandle, QFile* file,
             QString* sha1, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
+            QCryptographicHash::Algorithm alg, QIODevice* tee);
 
     /**
      * @brief readData
@@ -50,10 +64,12 @@ class Downloader: public QObject
      * @param gzip
      * @param contentLength
      * @param alg
+     * @param offset see readDataFlat. Only 0 is supported for gzip.
+     * @param tee 0 or the data will also be written here
      */
     static void readData(Job* job, HINTERNET hResourceHandle, QFile* file,
             QString* sha1, bool gzip, int64_t contentLength,
-            QCryptographicHash::Algorithm alg);
+            QCryptographicHash::Algorithm alg, int64_t offset, QIODevice* tee);
 
     static bool internetReadFileFully(HINTERNET resourceHandle,
             PVOID buffer, DWORD bufferSize, PDWORD bufferLength);
@@ -174,6 +190,97 @@ public:
          */
         bool ignoreContent;
 
+        /**
+         * @brief validator (ETag or Last-Modified) from the response to a
+         *     previous request for the same URL or "". If the file already
+         *     contains data, only the missing bytes will be requested using
+         *     the HTTP headers "Range" and "If-Range". The hash sum will be
+         *     computed over the whole file and the file should be opened for
+         *     reading and writing in this case. If the entity on the server has
+         *     changed, the file will be truncated and downloaded completely.
+         *     This is only applicable to http: and https.
+         */
+        QString ifRange;
+
+        /**
+         * @brief ETag from the response to a previous request for the same
+         *     URL or "". It is sent in the "If-None-Match" header. If the
+         *     entity has not changed, the server answers with "304 Not
+         *     Modified", Response::notModified is set and the file is not
+         *     changed. This is not an error. Conditional requests are not
+         *     used for ranges and resumed downloads. This is only applicable
+         *     to http: and https.
+         */
+        QString ifNoneMatch;
+
+        /**
+         * @brief Last-Modified from the response to a previous request for
+         *     the same URL or "". It is sent in the "If-Modified-Since"
+         *     header. See ifNoneMatch.
+         */
+        QString ifModifiedSince;
+
+        /**
+         * @brief true = only the bytes after the data already available in
+         *     the file are requested using the HTTP header "Range" without
+         *     "If-Range". This can be used to continue a download from
+         *     another mirror. The server may send different data. The hash
+         *     sum over the whole file should be checked afterwards. This is
+         *     only applicable to http: and https.
+         */
+        bool resume;
+
+        /**
+         * @brief first byte of the range that should be downloaded or -1 for
+         *     the whole entity. The data will be written at this position in
+         *     the file. The hash sum is not computed for a range. The server
+         *     must answer with "206 Partial Content". This is only applicable
+         *     to http: and https.
+         */
+        int64_t rangeFrom;
+
+        /**
+         * @brief last byte (inclusive) of the range or -1 for the end of the
+         *     entity. Only used if rangeFrom is not -1.
+         */
+        int64_t rangeTo;
+
+        /**
+         * @brief maximum number of connections. A value greater than 1 enables
+         *     the segmented download of large files: the file is preallocated
+         *     and the ranges are downloaded in parallel. The hash sum is
+         *     computed afterwards. One connection is used if the server does
+         *     not support ranges. This is only applicable to http: and https.
+         */
+        int segments;
+
+        /**
+         * @brief expected size of the entity in bytes or -1 if unknown. A
+         *     known size avoids the additional HEAD request for the
+         *     segmented download (see segments). In this case the ranges are
+         *     requested without "If-Range" if the hash sum is computed and
+         *     the hash sum should be checked afterwards. For a range (see
+         *     rangeFrom) the total size in the "Content-Range" header of the
+         *     response is compared with this value.
+         */
+        int64_t size;
+
+        /**
+         * @brief the downloaded data will also be written here in the original
+         *     order (e.g. for processing the data while it is being
+         *     downloaded). For a range (see rangeFrom) only the data of the
+         *     range is written and "file" may be 0. This is only a reference,
+         *     the object will not be freed with Request. The returned values
+         *     of QIODevice::write are ignored. See Response::teed.
+         */
+        QIODevice* tee;
+
+        /**
+         * @brief priority of the HTTP connections for this request. See
+         *     DownloadScheduler.
+         */
+        DownloadScheduler::Priority priority;
+
         /**
          * @param url http:/https:/file: URL
          */
@@ -182,7 +289,10 @@ public:
                 alg(QCryptographicHash::Sha256), useCache(true),
                 useInternet(true),
                 keepConnection(true), httpMethod("GET"),
-                timeout(600), ignoreContent(false) {
+                timeout(600), ignoreContent(false), resume(false),
+                rangeFrom(-1),
+                rangeTo(-1), segments(1), size(-1), tee(nullptr),
+                priority(DownloadScheduler::FOREGROUND) {
         }
     };
 
@@ -200,6 +310,85 @@ public:
 
         /** if not null, Content-Disposition will be stored here */
         QString contentDisposition;
+
+        /**
+         * strong ETag or Last-Modified that can be used for
+         * Request::ifRange or "" if the download cannot be resumed
+         */
+        QString validator;
+
+        /** true = the download was resumed using Request::ifRange */
+        bool resumed;
+
+        /** true = the server supports byte ranges ("Accept-Ranges: bytes") */
+        bool acceptRanges;
+
+        /**
+         * true = the server answered a conditional request with "304 Not
+         * Modified". No data was received.
+         */
+        bool notModified;
+
+        /** value of the "ETag" header (also weak ETags) or "" */
+        QString etag;
+
+        /** value of the "Last-Modified" header or "" */
+        QString lastModified;
+
+        /**
+         * true = the whole entity or the requested range was successfully
+         * downloaded and written to Request::tee. This is not possible for a
+         * resumed, segmented or local download.
+         */
+        bool teed;
+
+        /**
+         * value of the "Content-Length" header or -1 if unknown. This is only
+         * available for http: and https: downloads without segments.
+         */
+        int64_t contentLength;
+
+        /**
+         * time in milliseconds waiting for a connection slot from the
+         * DownloadScheduler or -1 if unknown
+         */
+        qint64 queueTime;
+
+        /**
+         * time in milliseconds for the DNS lookup or -1 if unknown or if an
+         * existing connection was re-used
+         */
+        qint64 dnsTime;
+
+        /**
+         * time in milliseconds for the TCP (and TLS) connection or -1 if
+         * unknown or if an existing connection was re-used
+         */
+        qint64 connectTime;
+
+        /**
+         * time in milliseconds from sending the request until the response
+         * headers were received or -1 if unknown
+         */
+        qint64 ttfb;
+
+        /** number of received bytes of the entity */
+        int64_t bytes;
+
+        /**
+         * number of times the request was sent again (e.g. for the
+         * authentication)
+         */
+        int retries;
+
+        /** true = the entity was read from the local HTTP cache */
+        bool fromCache;
+
+        Response(): resumed(false), acceptRanges(false), notModified(false),
+                teed(false), contentLength(-1), queueTime(-1), dnsTime(-1),
+                connectTime(-1), ttfb(-1), bytes(0), retries(0),
+                fromCache(false) {
+        }
     };
 
     /**
@@ -210,7 +399,8 @@ public:
     static Response download(Job* job, const Request& request);
 
     /**
-     * @brief retrieves the content-length header for an URL.
+     * @brief retrieves the content-length header for an URL. The connections
+     *     use the priority DownloadScheduler::SIZE_PROBE.
      * @param job job object
      * @param url http:, https: or file:
      * @param parentWindow window handle or 0 if not UI is required
@@ -219,6 +409,17 @@ public:
     static int64_t getContentLength(Job *job, const QUrl &url,
                                     HWND parentWindow);
 
+    /**
+     * @brief compares the total size in the "Content-Range" header of a
+     *     response with Request::size
+     * @param request HTTP request with Request::rangeFrom
+     * @param contentRange value of the "Content-Range" header, e.g.
+     *     "bytes 0-99/1000"
+     * @return error message or "" if the size is the same or unknown
+     */
+    static QString checkContentRange(const Request& request,
+            const QString& contentRange);
+
     /**
      * @brief HTTP download to a temporary file
      * @param job job
@@ -227,6 +428,19 @@ public:
      */
     static QTemporaryFile *downloadToTemporary(Job *job,
             const Downloader::Request &request);
+
+    /**
+     * @brief changes the transport for http: and https: URLs. This function
+     *     should be called before the first download.
+     * @param t [ownership:caller] new transport or 0 for the default WinINet
+     *     transport
+     */
+    static void setTransport(HTTPTransport* t);
+
+    /**
+     * @return the transport for http: and https: URLs
+     */
+    static HTTPTransport* getTransport();
 private:
     /**
      * It would be nice to handle redirects explicitely so
@@ -247,6 +461,30 @@ private:
     static QString setPassword(HINTERNET hConnectHandle, DWORD dwStatus,
                                const Request &request);
 
+    /** threads for the segments of a download */
+    static QThreadPool segmentThreadPool;
+
+    /**
+     * @brief downloads a file using several connections if possible. See
+     *     Request::segments.
+     * @param job job object
+     * @param request HTTP request
+     * @param response HTTP response
+     */
+    static void downloadSegmented(Job* job, const Downloader::Request& request,
+            Response *response);
+
+    /**
+     * @brief downloads one segment of a file
+     * @param job job object
+     * @param request HTTP request with Request::rangeFrom
+     * @param fileName the data will be written in this file. The file should
+     *     already have the final size.
+     * @param done will be released at the end
+     */
+    static void downloadSegment(Job* job, const Downloader::Request& request,
+            const QString& fileName, QSemaphore* done);
+
 protected:
     static QString setStringOption(HINTERNET hInternet, DWORD dwOption,
         const QString &value);
@@ -0,0 +1,275 @@
+#include "downloadscheduler.h"
+
+#include <QThread>
+#include <QMutexLocker>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+
+QMutex DownloadScheduler::mutex;
+
+QWaitCondition DownloadScheduler::slotReleased;
+
+int DownloadScheduler::maxConnections = 16;
+
+int DownloadScheduler::connectionLimit = 8;
+
+int DownloadScheduler::maxConnectionsPerHost = 6;
+
+int64_t DownloadScheduler::maxBandwidth = 0;
+
+int DownloadScheduler::active = 0;
+
+int DownloadScheduler::activeBackground = 0;
+
+QHash<QString, int> DownloadScheduler::activePerHost;
+
+QList<DownloadScheduler::Waiter> DownloadScheduler::waiters;
+
+QElapsedTimer DownloadScheduler::clock;
+
+qint64 DownloadScheduler::allowedAt = 0;
+
+qint64 DownloadScheduler::windowStart = 0;
+
+int64_t DownloadScheduler::windowBytes = 0;
+
+bool DownloadScheduler::windowSaturated = false;
+
+double DownloadScheduler::lastThroughput = -1;
+
+QString DownloadScheduler::getHost(const QUrl& url)
+{
+    QString r = url.host().toLower();
+    if (url.port() >= 0)
+        r.append(':').append(QString::number(url.port()));
+    return r;
+}
+
+bool DownloadScheduler::isAvailable(const QString& host, Priority priority)
+{
+    if (active >= connectionLimit)
+        return false;
+
+    if (activePerHost.value(host) >= maxConnectionsPerHost)
+        return false;
+
+    int maxBackground = qMax(1, connectionLimit / 2);
+    if (priority >= SIZE_PROBE && activeBackground >= maxBackground)
+        return false;
+
+    // a waiting request with a higher priority that could start now is
+    // served first
+    for (int i = 0; i < waiters.count(); i++) {
+        const Waiter& w = waiters.at(i);
+        if (w.priority < priority &&
+                activePerHost.value(w.host) < maxConnectionsPerHost &&
+                (w.priority < SIZE_PROBE || activeBackground < maxBackground))
+            return false;
+    }
+
+    return true;
+}
+
+void DownloadScheduler::adapt(qint64 now)
+{
+    if (now - windowStart < WINDOW)
+        return;
+
+    double throughput = windowBytes * 1000.0 / (now - windowStart);
+
+    // the limit is only changed if it was reached and more connections were
+    // requested
+    if (windowSaturated) {
+        if (lastThroughput < 0 || throughput >= lastThroughput * 1.05) {
+            if (connectionLimit < maxConnections) {
+                connectionLimit++;
+                slotReleased.wakeAll();
+            }
+        } else if (throughput < lastThroughput * 0.8 &&
+                connectionLimit > MIN_CONNECTIONS) {
+            connectionLimit--;
+        }
+
+        qCDebug(npackd) << "DownloadScheduler: throughput" << throughput <<
+                "limit" << connectionLimit;
+    }
+
+    lastThroughput = throughput;
+    windowStart = now;
+    windowBytes = 0;
+    windowSaturated = active >= connectionLimit && !waiters.isEmpty();
+}
+
+bool DownloadScheduler::acquire(Job* job, const QUrl& url, Priority priority)
+{
+    QString host = getHost(url);
+
+    QMutexLocker ml(&mutex);
+
+    bool r = isAvailable(host, priority);
+    if (!r) {
+        QString initialTitle = job->getTitle();
+        job->setTitle(initialTitle + " / " +
+                QObject::tr("Waiting for a free HTTP connection"));
+
+        waiters.append(Waiter(host, priority));
+
+        while (!job->isCancelled()) {
+            if (active >= connectionLimit)
+                windowSaturated = true;
+
+            slotReleased.wait(&mutex, 100);
+
+            if (isAvailable(host, priority)) {
+                r = true;
+                break;
+            }
+        }
+
+        for (int i = 0; i < waiters.count(); i++) {
+            const Waiter& w = waiters.at(i);
+            if (w.host == host && w.priority == priority) {
+                waiters.removeAt(i);
+                break;
+            }
+        }
+
+        // the requests with lower priorities may start now
+        slotReleased.wakeAll();
+
+        job->setTitle(initialTitle);
+    }
+
+    if (r) {
+        active++;
+        activePerHost[host]++;
+        if (priority >= SIZE_PROBE)
+            activeBackground++;
+    }
+
+    return r;
+}
+
+bool DownloadScheduler::tryAcquire(const QUrl &url, Priority priority)
+{
+    QString host = getHost(url);
+
+    QMutexLocker ml(&mutex);
+
+    bool r = isAvailable(host, priority);
+    if (r) {
+        active++;
+        activePerHost[host]++;
+        if (priority >= SIZE_PROBE)
+            activeBackground++;
+    } else if (active >= connectionLimit) {
+        windowSaturated = true;
+    }
+
+    return r;
+}
+
+void DownloadScheduler::release(const QUrl& url, Priority priority)
+{
+    QString host = getHost(url);
+
+    QMutexLocker ml(&mutex);
+
+    active--;
+    int n = activePerHost.value(host) - 1;
+    if (n > 0)
+        activePerHost.insert(host, n);
+    else
+        activePerHost.remove(host);
+    if (priority >= SIZE_PROBE)
+        activeBackground--;
+
+    slotReleased.wakeAll();
+}
+
+qint64 DownloadScheduler::addTransferred(int64_t bytes)
+{
+    qint64 wait = 0;
+
+    QMutexLocker ml(&mutex);
+
+    if (!clock.isValid())
+        clock.start();
+    qint64 now = clock.elapsed();
+
+    windowBytes += bytes;
+    adapt(now);
+
+    if (maxBandwidth > 0) {
+        // a burst of at most one second is allowed after a pause
+        if (allowedAt < now - 1000)
+            allowedAt = now - 1000;
+        allowedAt += bytes * 1000 / maxBandwidth;
+        wait = allowedAt - now;
+    }
+
+    return wait;
+}
+
+void DownloadScheduler::transferred(Job* job, int64_t bytes)
+{
+    qint64 wait = addTransferred(bytes);
+
+    while (wait > 0 && !job->isCancelled()) {
+        qint64 ms = qMin(wait, static_cast<qint64>(100));
+        QThread::msleep(static_cast<unsigned long>(ms));
+        wait -= ms;
+    }
+}
+
+void DownloadScheduler::setMaxConnections(int n)
+{
+    if (n < 1)
+        n = 1;
+
+    QMutexLocker ml(&mutex);
+
+    maxConnections = n;
+    connectionLimit = qBound(qMin(MIN_CONNECTIONS, n), connectionLimit, n);
+    slotReleased.wakeAll();
+}
+
+void DownloadScheduler::setMaxConnectionsPerHost(int n)
+{
+    if (n < 1)
+        n = 1;
+
+    QMutexLocker ml(&mutex);
+
+    maxConnectionsPerHost = n;
+    slotReleased.wakeAll();
+}
+
+int DownloadScheduler::getMaxConnectionsPerHost()
+{
+    QMutexLocker ml(&mutex);
+
+    return maxConnectionsPerHost;
+}
+
+void DownloadScheduler::setMaxBandwidth(int64_t bytesPerSecond)
+{
+    QMutexLocker ml(&mutex);
+
+    maxBandwidth = bytesPerSecond < 0 ? 0 : bytesPerSecond;
+}
+
+int DownloadScheduler::getConnectionLimit()
+{
+    QMutexLocker ml(&mutex);
+
+    return connectionLimit;
+}
+
+int DownloadScheduler::getActiveConnections()
+{
+    QMutexLocker ml(&mutex);
+
+    return active;
+}
@@ -0,0 +1,210 @@
+#ifndef DOWNLOADSCHEDULER_H
+#define DOWNLOADSCHEDULER_H
+
+#include <stdint.h>
+
+#include <QString>
+#include <QUrl>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+
+#include "job.h"
+
+/**
+ * @brief coordinates all HTTP connections of the process.
+ *
+ * Every connection opened by the Downloader needs a slot from this class.
+ * The slots are limited globally and per host. Waiting requests are served
+ * by priority: a request can only start if no request with a higher priority
+ * is waiting for a slot that could be used. Size probes and icons may only
+ * use a half of the slots so that package downloads always find a free
+ * connection.
+ *
+ * The global limit is adapted to the observed throughput: it is increased
+ * while more connections lead to a higher throughput and decreased if the
+ * throughput drops.
+ *
+ * A global bandwidth limit is applied to the data read by all connections.
+ *
+ * @threadsafe
+ */
+class DownloadScheduler
+{
+public:
+    /** priority classes from the highest to the lowest */
+    enum Priority {
+        /** package binaries for an installation or an update */
+        FOREGROUND = 0,
+
+        /** repositories */
+        REPOSITORY = 1,
+
+        /** sizes of the package binaries */
+        SIZE_PROBE = 2,
+
+        /** package icons and screenshots */
+        ICON = 3
+    };
+private:
+    /** a request waiting for a slot */
+    class Waiter
+    {
+    public:
+        QString host;
+        Priority priority;
+
+        Waiter(const QString& host, Priority priority): host(host),
+                priority(priority) {
+        }
+    };
+
+    /** minimum value for the adaptive limit */
+    static const int MIN_CONNECTIONS = 2;
+
+    /** the throughput is measured over intervals of this length in ms */
+    static const int WINDOW = 2000;
+
+    static QMutex mutex;
+
+    /** is signalled if a slot is released or a limit is changed */
+    static QWaitCondition slotReleased;
+
+    /** upper bound for the adaptive limit */
+    static int maxConnections;
+
+    /** current adaptive limit */
+    static int connectionLimit;
+
+    static int maxConnectionsPerHost;
+
+    /** bytes per second or 0 for unlimited */
+    static int64_t maxBandwidth;
+
+    /** number of used slots */
+    static int active;
+
+    /** number of used slots for SIZE_PROBE and ICON */
+    static int activeBackground;
+
+    /** host -> number of used slots */
+    static QHash<QString, int> activePerHost;
+
+    static QList<Waiter> waiters;
+
+    /** time since the first use */
+    static QElapsedTimer clock;
+
+    /** the next bytes may be read at this time (ms) if maxBandwidth > 0 */
+    static qint64 allowedAt;
+
+    /** start of the current measuring interval (ms) */
+    static qint64 windowStart;
+
+    /** number of bytes read in the current measuring interval */
+    static int64_t windowBytes;
+
+    /** true = a request had to wait in the current measuring interval */
+    static bool windowSaturated;
+
+    /** throughput in bytes per second in the last interval or -1 */
+    static double lastThroughput;
+
+    /**
+     * @param url URL
+     * @return key for the per-host limit
+     */
+    static QString getHost(const QUrl& url);
+
+    /**
+     * @param host host
+     * @param priority priority
+     * @return true if a request can use a slot now. The mutex should be
+     *     locked.
+     */
+    static bool isAvailable(const QString& host, Priority priority);
+
+    /**
+     * @brief adapts the limit at the end of a measuring interval. The mutex
+     *     should be locked.
+     * @param now current time in ms
+     */
+    static void adapt(qint64 now);
+public:
+    /**
+     * @brief waits for a free connection slot
+     * @param job job. The title is changed while waiting.
+     * @param url http: or https: URL
+     * @param priority priority class
+     * @return true if the slot was acquired, false if the job was cancelled
+     */
+    static bool acquire(Job* job, const QUrl& url, Priority priority);
+
+    /**
+     * @brief acquires a free connection slot without waiting. This is used by
+     *     the event-driven DownloadEngine.
+     * @param url http: or https: URL
+     * @param priority priority class
+     * @return true if the slot was acquired
+     */
+    static bool tryAcquire(const QUrl& url, Priority priority);
+
+    /**
+     * @brief frees a slot acquired by acquire() or tryAcquire()
+     * @param url the same URL as for acquire()
+     * @param priority the same priority as for acquire()
+     */
+    static void release(const QUrl& url, Priority priority);
+
+    /**
+     * @brief should be called for each block of data read from the network.
+     *     Waits if the bandwidth limit is exceeded.
+     * @param job job. Waiting stops if the job is cancelled.
+     * @param bytes number of read bytes
+     */
+    static void transferred(Job* job, int64_t bytes);
+
+    /**
+     * @brief should be called for each block of data read from the network
+     *     by a thread that cannot wait (see DownloadEngine)
+     * @param bytes number of read bytes
+     * @return the reading should be paused for this number of milliseconds
+     *     because of the bandwidth limit
+     */
+    static qint64 addTransferred(int64_t bytes);
+
+    /**
+     * @param n maximum number of connections for the whole process. The
+     *     adaptive limit will not exceed this value.
+     */
+    static void setMaxConnections(int n);
+
+    /**
+     * @param n maximum number of connections to one host
+     */
+    static void setMaxConnectionsPerHost(int n);
+
+    /**
+     * @return maximum number of connections to one host
+     */
+    static int getMaxConnectionsPerHost();
+
+    /**
+     * @param bytesPerSecond maximum download bandwidth or 0 for unlimited
+     */
+    static void setMaxBandwidth(int64_t bytesPerSecond);
+
+    /**
+     * @return current adaptive limit for the number of connections
+     */
+    static int getConnectionLimit();
+
+    /**
+     * @return number of used slots
+     */
+    static int getActiveConnections();
+};
+
+#endif // DOWNLOADSCHEDULER_H
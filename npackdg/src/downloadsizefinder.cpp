@@ -18,6 +18,7 @@
 
 #include "downloadsizefinder.h"
 #include "downloader.h"
+#include "downloadengine.h"
 #include "job.h"
 #include "concurrent.h"
 #include "wpmutils.h"
@@ -27,33 +28,41 @@ extern HWND defaultPasswordWindow;
 QThreadPool DownloadSizeFinder::threadPool;
 DownloadSizeFinder::_init DownloadSizeFinder::_initializer;
 
+bool DownloadSizeFinder::isFresh(const URLInfo &info)
+{
+    time_t age = time(nullptr) - info.sizeModified;
+    bool r;
+    if (info.size >= 0)
+        r = age <= 10 * 24 * 60 * 60;
+    else if (info.size == -2)
+        r = age <= 24 * 60 * 60;
+    else
+        r = false;
+    return r;
+}
+
 int64_t DownloadSizeFinder::downloadOrQueue(const QString &url)
 {
-    int64_t r;
+    int64_t r = -1;
 
     this->mutex.lock();
     URLInfo* v = this->sizes.value(url);
-    if (v) {
+    if (v && isFresh(*v))
         r = v->size;
 
-        // if the value is older than 10 days, it is considered obsolete
-        if (r >= 0 && time(nullptr) - v->sizeModified > 10 * 24 * 60 * 60) {
-            r = -1;
-        }
-    } else {
-        r = -1;
-    }
+    // a running lookup or request is not started again
+    bool queue = r == -1 && !inFlight.contains(url);
+    if (queue)
+        inFlight.insert(url);
     this->mutex.unlock();
 
-    if (r == -1) {
-        this->mutex.lock();
+    if (queue) {
         QFuture<URLInfo> future = run(&threadPool, this,
-                &DownloadSizeFinder::downloadRunnable, url);
+                &DownloadSizeFinder::lookupRunnable, url);
         QFutureWatcher<URLInfo>* w =
                 new QFutureWatcher<URLInfo>(this);
         connect(w, SIGNAL(finished()), this, SLOT(watcherFinished()));
         w->setFuture(future);
-        this->mutex.unlock();
     }
 
     return r;
@@ -66,10 +75,94 @@ void DownloadSizeFinder::watcherFinished()
 
     URLInfo r = w->result();
 
-    this->mutex.lock();
-    dbr->saveURLSize(r.address, r.size);
-    this->mutex.unlock();
+    // only the HTTP requests are processed by the DownloadEngine. Other
+    // threads are not blocked while the server is answering.
+    if (r.size == -1) {
+        probeQueue.append(r.address);
+        if (!probeTimer.isActive())
+            probeTimer.start();
+    } else {
+        found(r);
+    }
+
+    w->deleteLater();
+}
+
+void DownloadSizeFinder::startProbes()
+{
+    // host -> URLs
+    QMap<QString, QStringList> byHost;
+    for (int i = 0; i < probeQueue.count(); i++) {
+        const QString& url = probeQueue.at(i);
+        byHost[QUrl(url).host().toLower()].append(url);
+    }
+    probeQueue.clear();
+
+    QList<QStringList> groups = byHost.values();
+    for (int i = 0; i < groups.count(); i++) {
+        const QStringList& urls = groups.at(i);
+        for (int j = 0; j < urls.count(); j++) {
+            startProbe(urls.at(j), true);
+        }
+    }
+}
+
+void DownloadSizeFinder::startProbe(const QString &url, bool head)
+{
+    Probe p;
+    p.url = url;
+    p.head = head;
+    p.job = new Job(head ? QObject::tr("Using the HEAD HTTP method") :
+            QObject::tr("Using the GET HTTP method"));
+
+    Downloader::Request request = QUrl(url);
+    if (head)
+        request.httpMethod = "HEAD";
+    else
+        request.ignoreContent = true;
+    request.priority = DownloadScheduler::SIZE_PROBE;
+    request.parentWindow = defaultPasswordWindow;
+    request.useCache = true;
+    request.timeout = 15;
+
+    // the DownloadEngine re-uses the connections to the same host
+    request.keepConnection = true;
+
+    QFutureWatcher<Downloader::Response>* w =
+            new QFutureWatcher<Downloader::Response>(this);
+    probes.insert(w, p);
+    connect(w, SIGNAL(finished()), this, SLOT(probeFinished()));
+    w->setFuture(DownloadEngine::getDefault()->start(p.job, request));
+}
 
+void DownloadSizeFinder::probeFinished()
+{
+    QFutureWatcher<Downloader::Response>* w = static_cast<
+            QFutureWatcher<Downloader::Response>*>(sender());
+    Probe p = probes.take(w);
+
+    if (!p.job->getErrorMessage().isEmpty() && p.head) {
+        // some servers do not support HEAD
+        startProbe(p.url, false);
+    } else {
+        URLInfo r(p.url);
+        r.sizeModified = time(nullptr);
+        if (!p.job->getErrorMessage().isEmpty())
+            r.size = -2;
+        else
+            r.size = w->result().contentLength;
+        if (r.size < 0)
+            r.size = -2;
+
+        found(r);
+    }
+
+    delete p.job;
+    w->deleteLater();
+}
+
+void DownloadSizeFinder::found(const URLInfo &r)
+{
     this->mutex.lock();
     URLInfo* v = this->sizes.value(r.address);
     if (!v) {
@@ -78,36 +171,46 @@ void DownloadSizeFinder::watcherFinished()
     }
     v->size = r.size;
     v->sizeModified = r.sizeModified;
+    inFlight.remove(r.address);
     this->mutex.unlock();
 
-    emit this->downloadCompleted(r.address, r.size);
+    // the sizes are saved in batches
+    unsaved.append(r);
+    if (!saveTimer.isActive())
+        saveTimer.start();
 
-    w->deleteLater();
+    emit this->downloadCompleted(r.address, r.size);
 }
 
-URLInfo DownloadSizeFinder::downloadRunnable(
-        const QString& url)
+void DownloadSizeFinder::flush()
 {
-    QThread::currentThread()->setPriority(QThread::LowestPriority);
+    // the database is also used by lookupRunnable() in the thread pool
+    QString err;
+    this->mutex.lock();
+    if (!unsaved.isEmpty() && dbr)
+        err = dbr->saveURLSizes(unsaved);
+    this->mutex.unlock();
 
-    /*
-    makes the process too slow
-    bool b = SetThreadPriority(GetCurrentThread(),
-            THREAD_MODE_BACKGROUND_BEGIN);
-    */
+    if (!err.isEmpty())
+        qCWarning(npackd).noquote() << QObject::tr(
+                "Cannot save the download sizes: %1").arg(err);
 
-    CoInitialize(nullptr);
+    unsaved.clear();
+}
 
+URLInfo DownloadSizeFinder::lookupRunnable(
+        const QString& url)
+{
     URLInfo r(url);
 
     this->mutex.lock();
     if (!this->dbr) {
         dbr = new DBRepository();
         QString err = dbr->openDefault("defaultDownloadSizeFinder");
-        qCDebug(npackd) << "DownloadSizeFinder::downloadRunnable.openDefault" << err;
+        qCDebug(npackd) << "DownloadSizeFinder::lookupRunnable.openDefault" << err;
         if (err.isEmpty()) {
             sizes = dbr->findURLInfos(&err);
-            qCDebug(npackd) << "DownloadSizeFinder::downloadRunnable.sizes" << err;
+            qCDebug(npackd) << "DownloadSizeFinder::lookupRunnable.sizes" << err;
         }
     }
     this->mutex.unlock();
@@ -119,14 +222,17 @@ URLInfo DownloadSizeFinder::downloadRunnable(
     }
     this->mutex.unlock();
 
-    // if the value is older than 10 days, it is considered obsolete
-    if (r.size >= 0 && time(nullptr) - r.sizeModified > 10 * 24 * 60 * 60) {
+    // obsolete values and old errors are requested again
+    if (!isFresh(r)) {
         r.size = -1;
     }
 
-    if (r.size < 0) {
+    // the size of a local file is determined here, the HTTP requests are
+    // executed by the DownloadEngine
+    QUrl u(url);
+    if (r.size == -1 && u.scheme() != "http" && u.scheme() != "https") {
         Job* job = new Job();
-        r.size = Downloader::getContentLength(job, url, defaultPasswordWindow);
+        r.size = Downloader::getContentLength(job, u, defaultPasswordWindow);
         r.sizeModified = time(nullptr);
 
         if (!job->getErrorMessage().isEmpty() || r.size < 0) {
@@ -136,22 +242,34 @@ URLInfo DownloadSizeFinder::downloadRunnable(
         delete job;
     }
 
-    CoUninitialize();
-
-    /*
-    if (b)
-        SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
-    */
-
     return r;
 }
 
 DownloadSizeFinder::DownloadSizeFinder(): dbr(nullptr)
 {
+    probeTimer.setSingleShot(true);
+    probeTimer.setInterval(50);
+    connect(&probeTimer, SIGNAL(timeout()), this, SLOT(startProbes()));
+
+    saveTimer.setSingleShot(true);
+    saveTimer.setInterval(2000);
+    connect(&saveTimer, SIGNAL(timeout()), this, SLOT(flush()));
 }
 
 DownloadSizeFinder::~DownloadSizeFinder()
 {
+    QList<QFutureWatcher<Downloader::Response>*> ws = probes.keys();
+    for (int i = 0; i < ws.count(); i++) {
+        QFutureWatcher<Downloader::Response>* w = ws.at(i);
+        Probe p = probes.value(w);
+        p.job->cancel();
+        w->waitForFinished();
+        delete p.job;
+    }
+    probes.clear();
+
+    flush();
+
     qDeleteAll(this->sizes);
     this->sizes.clear();
     delete this->dbr;
@@ -14,9 +14,15 @@
 #include <QTemporaryDir>
 #include <QMap>
 #include <QThreadPool>
+#include <QHash>
+#include <QSet>
+#include <QTimer>
+#include <QFutureWatcher>
 
 #include "dbrepository.h"
 #include "urlinfo.h"
+#include "job.h"
+#include "downloader.h"
 
 /**
  * Loads files from the Internet.
@@ -31,16 +37,88 @@ class DownloadSizeFinder: public QObject
      */
     QMap<QString, URLInfo*> sizes;
 
+    /**
+     * @brief URLs with a running database lookup or HTTP request. The data in
+     *     this field should be accessed under the mutex.
+     */
+    QSet<QString> inFlight;
+
     QMutex mutex;
 
+    /**
+     * @brief database for the sizes or 0. It is opened by lookupRunnable()
+     *     in the thread pool and should only be accessed under the mutex.
+     */
     DBRepository* dbr;
 
     /**
-     * @brief downloads a file
-     * @param url this file should be downloaded
-     * @return result
+     * @brief URLs waiting for an HTTP request. Only accessed from the thread
+     *     of this object.
      */
-    URLInfo downloadRunnable(const QString &url);
+    QStringList probeQueue;
+
+    /** starts the requests from probeQueue */
+    QTimer probeTimer;
+
+    /**
+     * @brief found sizes that are not yet saved in the database. Only
+     *     accessed from the thread of this object.
+     */
+    QList<URLInfo> unsaved;
+
+    /** saves the sizes from "unsaved" */
+    QTimer saveTimer;
+
+    /** a running HTTP request for the size of a file */
+    class Probe
+    {
+    public:
+        QString url;
+
+        /** [ownership:this] */
+        Job* job;
+
+        /** true = HEAD, false = GET */
+        bool head;
+    };
+
+    /**
+     * @brief watcher -> running request. Only accessed from the thread of
+     *     this object.
+     */
+    QHash<QFutureWatcher<Downloader::Response>*, Probe> probes;
+
+    /**
+     * @brief searches for the size in the database. The size of file: URLs
+     *     is determined directly.
+     * @param url URL of a file
+     * @return result. URLInfo::size is -1 if the size should be requested
+     *     from the server.
+     */
+    URLInfo lookupRunnable(const QString &url);
+
+    /**
+     * @brief requests the size of a file from the server. This function does
+     *     not block.
+     * @param url URL of a file
+     * @param head true = use the HEAD method, false = use GET and ignore the
+     *     content
+     */
+    void startProbe(const QString& url, bool head);
+
+    /**
+     * @brief stores the found size and notifies the listeners. The size will
+     *     be saved in the database later.
+     * @param r found size
+     */
+    void found(const URLInfo& r);
+
+    /**
+     * @param info information about an URL
+     * @return true if the size does not need to be requested again. Sizes
+     *     are valid for 10 days, errors for one day.
+     */
+    static bool isFresh(const URLInfo& info);
 public:
     static QThreadPool threadPool;
 private:
@@ -61,7 +139,8 @@ public:
     virtual ~DownloadSizeFinder();
 
     /**
-     * @brief download a file. This function does not block.
+     * @brief download a file. This function does not block. Only one request
+     *     is executed for an URL at the same time.
      * @param url this file will be downloaded
      * @return size or -2 if an error occured or -1 if the size is unknown
      */
@@ -75,6 +154,19 @@ signals:
     void downloadCompleted(const QString& url, int64_t size);
 private slots:
     void watcherFinished();
+
+    void probeFinished();
+
+    /**
+     * @brief starts the HTTP requests for the queued URLs sorted by the host
+     *     so that the connections can be re-used
+     */
+    void startProbes();
+
+    /**
+     * @brief saves the found sizes in the database in one transaction
+     */
+    void flush();
 };
 
 #endif // DOWNLOADSIZEFINDER_H
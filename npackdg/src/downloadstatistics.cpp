@@ -0,0 +1,127 @@
+#include "downloadstatistics.h"
+
+#include <algorithm>
+#include <math.h>
+
+#include <QMutexLocker>
+#include <QLoggingCategory>
+
+#include "dbrepository.h"
+#include "wpmutils.h"
+
+QMutex DownloadStatistics::mutex;
+
+QList<TransferStats> DownloadStatistics::unsaved;
+
+QElapsedTimer DownloadStatistics::sinceFlush;
+
+const QList<double> DownloadStatistics::THROUGHPUT_BINS = QList<double>() <<
+        16 << 64 << 256 << 1024 << 4096 << 16384 << 65536;
+
+QString DownloadStatistics::getHost(const QUrl& url)
+{
+    QString r = url.host().toLower();
+    if (url.port() >= 0)
+        r.append(':').append(QString::number(url.port()));
+    return r;
+}
+
+void DownloadStatistics::record(Job* job, const Downloader::Request& request,
+        const Downloader::Response& response, qint64 totalTime)
+{
+    if ((request.url.scheme() != "http" && request.url.scheme() != "https") ||
+            job->isCancelled())
+        return;
+
+    TransferStats s(request.url.toString(QUrl::RemoveUserInfo));
+    s.host = getHost(request.url);
+    s.started = time(nullptr) - totalTime / 1000;
+    s.queueTime = response.queueTime;
+    s.dnsTime = response.dnsTime;
+    s.connectTime = response.connectTime;
+    s.ttfb = response.ttfb;
+    s.totalTime = totalTime;
+    if (response.ttfb >= 0)
+        s.transferTime = qMax(static_cast<qint64>(0), totalTime -
+                qMax(static_cast<qint64>(0), response.queueTime) -
+                response.ttfb);
+    s.bytes = response.bytes;
+    s.retries = response.retries;
+    s.cacheHit = response.fromCache || response.notModified;
+    s.error = job->getErrorMessage();
+
+    record(s);
+}
+
+void DownloadStatistics::record(const TransferStats& stats)
+{
+    QMutexLocker ml(&mutex);
+
+    if (!sinceFlush.isValid())
+        sinceFlush.start();
+
+    unsaved.append(stats);
+
+    if (unsaved.count() >= BATCH_SIZE || sinceFlush.elapsed() > BATCH_TIME)
+        flushNoLock();
+}
+
+void DownloadStatistics::flush()
+{
+    QMutexLocker ml(&mutex);
+
+    flushNoLock();
+}
+
+void DownloadStatistics::flushNoLock()
+{
+    sinceFlush.start();
+
+    if (unsaved.isEmpty())
+        return;
+
+    DBRepository* dbr = DBRepository::getDefault();
+    QString err = dbr->saveTransferStats(unsaved);
+    if (err.isEmpty())
+        err = dbr->deleteTransferStats(time(nullptr) - MAX_AGE);
+    if (!err.isEmpty())
+        qCDebug(npackd) << "DownloadStatistics: cannot save the statistics" <<
+                err;
+
+    // the entries are not collected forever if the database is not available
+    unsaved.clear();
+}
+
+double DownloadStatistics::percentile(QList<double>* values, double p)
+{
+    double r = -1;
+    if (values->count() > 0) {
+        std::sort(values->begin(), values->end());
+        int rank = static_cast<int>(ceil(p / 100 * values->count()));
+        if (rank < 1)
+            rank = 1;
+        if (rank > values->count())
+            rank = values->count();
+        r = values->at(rank - 1);
+    }
+    return r;
+}
+
+QList<int> DownloadStatistics::histogram(const QList<double>& values,
+        const QList<double>& bounds)
+{
+    QList<int> r;
+    for (int i = 0; i <= bounds.count(); i++) {
+        r.append(0);
+    }
+
+    for (int i = 0; i < values.count(); i++) {
+        double v = values.at(i);
+        int bin = 0;
+        while (bin < bounds.count() && v > bounds.at(bin))
+            bin++;
+        r[bin]++;
+    }
+
+    return r;
+}
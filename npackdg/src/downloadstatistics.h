@@ -0,0 +1,104 @@
+#ifndef DOWNLOADSTATISTICS_H
+#define DOWNLOADSTATISTICS_H
+
+#include <QList>
+#include <QUrl>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "job.h"
+#include "downloader.h"
+#include "transferstats.h"
+
+/**
+ * @brief records the metrics for every HTTP transfer (see TransferStats).
+ *
+ * The metrics are collected in the memory and written to the table
+ * TRANSFER_STATS of the default database in batches. Entries older than
+ * 30 days are removed. "ncl stats downloads" shows the percentiles and
+ * histograms for each host.
+ *
+ * @threadsafe
+ */
+class DownloadStatistics
+{
+private:
+    /** entries older than this number of seconds are removed */
+    static const int MAX_AGE = 30 * 24 * 60 * 60;
+
+    /** the collected entries are written after this number of entries */
+    static const int BATCH_SIZE = 100;
+
+    /** or after this number of milliseconds */
+    static const int BATCH_TIME = 10000;
+
+    static QMutex mutex;
+
+    /** collected entries that are not yet in the database */
+    static QList<TransferStats> unsaved;
+
+    /** time since the last flush() */
+    static QElapsedTimer sinceFlush;
+
+    /**
+     * @brief writes the collected entries to the database. The mutex should
+     *     be locked.
+     */
+    static void flushNoLock();
+public:
+    /**
+     * upper bounds (inclusive) of the histogram bins for the throughput in
+     * KiB/s. The last bin contains all bigger values.
+     */
+    static const QList<double> THROUGHPUT_BINS;
+
+    /**
+     * @brief records a finished transfer. Cancelled transfers and URLs other
+     *     than http: and https: are ignored.
+     * @param job the completed job of the transfer
+     * @param request the request
+     * @param response the response
+     * @param totalTime duration of the whole transfer in milliseconds
+     */
+    static void record(Job* job, const Downloader::Request& request,
+            const Downloader::Response& response, qint64 totalTime);
+
+    /**
+     * @brief records a finished transfer
+     * @param stats metrics
+     */
+    static void record(const TransferStats& stats);
+
+    /**
+     * @brief writes the collected entries to the database. This should be
+     *     called before the program exits.
+     */
+    static void flush();
+
+    /**
+     * @param url URL
+     * @return host name (and port) in lower case
+     */
+    static QString getHost(const QUrl& url);
+
+    /**
+     * @brief computes a percentile using the nearest-rank method
+     * @param values values. The list will be sorted.
+     * @param p percentile (0..100)
+     * @return the value or -1 if the list is empty
+     */
+    static double percentile(QList<double>* values, double p);
+
+    /**
+     * @brief counts the values in each bin
+     * @param values values
+     * @param bounds upper bounds (inclusive) of the bins in ascending order
+     * @return number of values for each bin. The size of the list is
+     *     bounds.count() + 1. The last bin counts the values bigger than
+     *     the last bound.
+     */
+    static QList<int> histogram(const QList<double>& values,
+            const QList<double>& bounds);
+};
+
+#endif // DOWNLOADSTATISTICS_H
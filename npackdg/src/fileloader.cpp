@@ -1,31 +1,43 @@
-#include <windows.h>
-
-#include <QtGlobal>
-#if defined(_MSC_VER) && (QT_VERSION >= QT_VERSION_CHECK(5, 10, 0))
-#ifdef min
-#undef min
-#endif
-#ifdef max
-#undef max
-#endif
-#endif
+#include <ctime>
 
 #include <QFile>
-#include <QtConcurrent/QtConcurrent>
 #include <QFuture>
 #include <QFutureWatcher>
+#include <QImage>
+#include <QCryptographicHash>
+#include <QLoggingCategory>
 
 #include "fileloader.h"
 #include "downloader.h"
+#include "downloadengine.h"
+#include "downloadcache.h"
+#include "dbrepository.h"
 #include "job.h"
-#include "downloadsizefinder.h"
-#include "concurrent.h"
+#include "wpmutils.h"
+
+/** cached images are re-validated after this number of seconds */
+static const time_t REVALIDATE_AFTER = 7 * 24 * 60 * 60;
 
 FileLoader::FileLoader(): id(0)
 {
 }
 
-QString FileLoader::downloadOrQueue(const QString &url, QString *err)
+FileLoader::~FileLoader()
+{
+    QList<QFutureWatcher<Downloader::Response>*> ws = downloads.keys();
+    for (int i = 0; i < ws.count(); i++) {
+        QFutureWatcher<Downloader::Response>* w = ws.at(i);
+        Download d = downloads.value(w);
+        d.job->cancel();
+        w->waitForFinished();
+        delete d.file;
+        delete d.job;
+    }
+    downloads.clear();
+}
+
+QString FileLoader::downloadOrQueue(const QString &url, QString *err,
+        int size)
 {
     QString r;
     *err = "";
@@ -33,119 +45,254 @@ QString FileLoader::downloadOrQueue(const QString &url, QString *err)
     this->mutex.lock();
     if (this->files.contains(url)) {
         DownloadFile file = this->files.value(url);
+        this->mutex.unlock();
+
         if (!file.error.isEmpty())
             *err = file.error;
-        else if (!file.file.isEmpty())
-            r = dir.path() + "\\" + file.file;
-        this->mutex.unlock();
+        else if (!file.sha256.isEmpty())
+            r = getVariant(file, size, err);
     } else {
+        DownloadFile file;
+        file.url = url;
+        this->files.insert(url, file);
         this->mutex.unlock();
 
-        QFuture<DownloadFile> future = run(
-                &DownloadSizeFinder::threadPool, this,
-                &FileLoader::downloadRunnable, url);
-        QFutureWatcher<DownloadFile>* w =
-                new QFutureWatcher<DownloadFile>(this);
+        QString dbErr;
+        IconCacheInfo info = DBRepository::getDefault()->findIconCacheInfo(
+                url, &dbErr);
+        if (!dbErr.isEmpty()) {
+            qCWarning(npackd).noquote() << QObject::tr(
+                    "Cannot read the cached metadata for %1: %2").
+                    arg(url, dbErr);
+            info = IconCacheInfo(url);
+        }
+        if (!info.sha256.isEmpty() && !DownloadCache::getIcons()->contains(
+                QCryptographicHash::Sha256, info.sha256))
+            info = IconCacheInfo(url);
+
+        if (!info.sha256.isEmpty()) {
+            // the cached copy is used immediately
+            file.sha256 = info.sha256;
+            file.mimeType = info.mimeType;
+
+            this->mutex.lock();
+            this->files.insert(url, file);
+            this->mutex.unlock();
+
+            if (time(nullptr) - info.modified > REVALIDATE_AFTER) {
+                QString startErr = start(info);
+                if (!startErr.isEmpty())
+                    qCWarning(npackd).noquote() << startErr;
+            }
+
+            r = getVariant(file, size, err);
+        } else {
+            *err = start(info);
+            if (!err->isEmpty()) {
+                file.error = *err;
+
+                this->mutex.lock();
+                this->files.insert(url, file);
+                this->mutex.unlock();
+            }
+        }
+    }
+
+    return r;
+}
+
+QString FileLoader::start(const IconCacheInfo& info)
+{
+    QString err;
+
+    Download d;
+    d.info = info;
+    d.file = new QFile(dir.path() + "\\" +
+            QString::number(id.fetchAndAddAcquire(1)));
+    if (d.file->open(QFile::ReadWrite)) {
+        d.job = new Job();
+
+        Downloader::Request request = QUrl(info.url);
+        request.file = d.file;
+        request.useCache = true;
+        request.keepConnection = false;
+        request.timeout = 15;
+        request.priority = DownloadScheduler::ICON;
+        request.hashSum = true;
+        request.alg = QCryptographicHash::Sha256;
+        if (!info.sha256.isEmpty()) {
+            request.ifNoneMatch = info.etag;
+            request.ifModifiedSince = info.lastModified;
+        }
+
+        // the icons are downloaded by the DownloadEngine without blocking
+        // a thread for each file
+        QFutureWatcher<Downloader::Response>* w =
+                new QFutureWatcher<Downloader::Response>(this);
+        downloads.insert(w, d);
         connect(w, SIGNAL(finished()), this,
                 SLOT(watcherFinished()));
-        w->setFuture(future);
+        w->setFuture(DownloadEngine::getDefault()->start(d.job, request));
+    } else {
+        err = QObject::tr("Cannot open the file %1").arg(
+                d.file->fileName());
+        delete d.file;
     }
 
-    return r;
+    return err;
 }
 
-void FileLoader::watcherFinished()
+QString FileLoader::getVariant(const DownloadFile& file, int size,
+        QString* err)
 {
-    QFutureWatcher<DownloadFile>* w = static_cast<
-            QFutureWatcher<DownloadFile>*>(sender());
-    DownloadFile r = w->result();
+    *err = "";
 
-    if (!r.file.isEmpty() || !r.error.isEmpty()) {
-        QString file = r.file;
-        if (!file.isEmpty())
-            file = dir.path() + "\\" + file;
+    // the scaled variants are also content-addressed: the key only depends
+    // on the original content and the size
+    QString key;
+    QString ext;
+    if (size > 0) {
+        key = QString::fromLatin1(QCryptographicHash::hash(
+                (file.sha256 + "/" + QString::number(size)).toLatin1(),
+                QCryptographicHash::Sha256).toHex());
+        ext = ".png";
+    } else {
+        key = file.sha256;
+        ext = getExtension(file.mimeType);
+    }
 
-        emit this->downloadCompleted(r.url, file, r.error);
+    QString r = dir.path() + "\\" + key + ext;
+    if (QFile::exists(r))
+        return r;
+
+    DownloadCache* cache = DownloadCache::getIcons();
+    if (cache->copyTo(QCryptographicHash::Sha256, key, r, true))
+        return r;
+
+    if (size == 0) {
+        *err = QObject::tr("The cached copy of the file %1 is not available").
+                arg(file.url);
+        return "";
     }
 
-    w->deleteLater();
+    QString original = cache->getFile(QCryptographicHash::Sha256,
+            file.sha256);
+    QImage img;
+    if (original.isEmpty() || !img.load(original)) {
+        *err = QObject::tr("Cannot load the image %1").arg(file.url);
+        return "";
+    }
+
+    img = img.scaled(size, size, Qt::KeepAspectRatio,
+            Qt::SmoothTransformation);
+    if (!img.save(r, "PNG")) {
+        *err = QObject::tr("Cannot save the file %1").arg(r);
+        return "";
+    }
+
+    QString addErr = cache->add(QCryptographicHash::Sha256, key, r, false);
+    if (!addErr.isEmpty())
+        qCWarning(npackd).noquote() << QObject::tr(
+                "Cannot store the image %1 in the cache: %2").
+                arg(file.url, addErr);
+
+    return r;
 }
 
-FileLoader::DownloadFile FileLoader::downloadRunnable(const QString& url)
+QString FileLoader::getExtension(const QString& mime)
 {
-    FileLoader::DownloadFile r;
-    r.url = url;
+    // supported extensions:
+    // "bmp", "cur", "dds", "gif", "icns", "ico", "jp2", "jpeg",
+    // "jpg", "mng", "pbm", "pgm", "png", "ppm", "tga", "tif",
+    // "tiff", "wbmp", "webp", "xbm", "xpm"
+    QString ext;
+    if (mime == "image/png")
+        ext = ".png";
+    else if (mime == "image/x-icon" || mime == "image/vnd.microsoft.icon")
+        ext = ".ico";
+    else if (mime == "image/jpeg")
+        ext = ".jpg";
+    else if (mime == "image/gif")
+        ext = ".gif";
+    else if (mime == "image/x-windows-bmp" || mime == "image/bmp")
+        ext = ".bmp";
+    else
+        ext = ".png";
 
-    this->mutex.lock();
-    if (this->files.contains(url)) {
-        r = this->files.value(url);
-        this->mutex.unlock();
+    return ext;
+}
+
+void FileLoader::watcherFinished()
+{
+    QFutureWatcher<Downloader::Response>* w = static_cast<
+            QFutureWatcher<Downloader::Response>*>(sender());
+    Download d = downloads.take(w);
+    Downloader::Response response = w->result();
+
+    DownloadFile r;
+    r.url = d.info.url;
+    r.sha256 = d.info.sha256;
+    r.mimeType = d.info.mimeType;
+
+    // false = the cached copy is still valid
+    bool changed = true;
+
+    d.file->close();
+    if (!d.job->getErrorMessage().isEmpty()) {
+        if (d.info.sha256.isEmpty())
+            r.error = d.job->getErrorMessage();
+        else
+            changed = false;
+    } else if (response.notModified) {
+        changed = false;
+
+        IconCacheInfo info = d.info;
+        info.modified = time(nullptr);
+        QString err = DBRepository::getDefault()->saveIconCacheInfo(info);
+        if (!err.isEmpty())
+            qCWarning(npackd).noquote() << err;
     } else {
-        this->files.insert(url, r);
-        this->mutex.unlock();
+        IconCacheInfo info(d.info.url);
+        info.etag = response.etag;
+        info.lastModified = response.lastModified;
+        info.sha256 = response.hashSum;
+        info.mimeType = response.mimeType;
+        info.modified = time(nullptr);
 
-        QThread::currentThread()->setPriority(QThread::LowestPriority);
-
-        bool b = SetThreadPriority(GetCurrentThread(),
-                THREAD_MODE_BACKGROUND_BEGIN);
-
-        CoInitialize(nullptr);
-
-        QString filename = QString::number(id.fetchAndAddAcquire(1));
-        QString fn = dir.path() + "\\" + filename;
-        QFile f(fn);
-        if (f.open(QFile::ReadWrite)) {
-            Job* job = new Job();
-            Downloader::Request request = QUrl(url);
-            request.file = &f;
-            request.useCache = true;
-            request.keepConnection = false;
-            request.timeout = 15;
-
-            Downloader::Response response = Downloader::download(job, request);
-            QString mime = response.mimeType;
-            f.close();
-
-            if (!job->getErrorMessage().isEmpty()) {
-                r.error = job->getErrorMessage();
-            } else {
-                // supported extensions:
-                // "bmp", "cur", "dds", "gif", "icns", "ico", "jp2", "jpeg",
-                // "jpg", "mng", "pbm", "pgm", "png", "ppm", "tga", "tif",
-                // "tiff", "wbmp", "webp", "xbm", "xpm"
-                QString ext;
-                if (mime == "image/png")
-                    ext = ".png";
-                else if (mime == "image/x-icon" || mime == "image/vnd.microsoft.icon")
-                    ext = ".ico";
-                else if (mime == "image/jpeg")
-                    ext = ".jpg";
-                else if (mime == "image/gif")
-                    ext = ".gif";
-                else if (mime == "image/x-windows-bmp" || mime == "image/bmp")
-                    ext = ".bmp";
-                else
-                    ext = ".png";
-
-                // qCDebug(npackd) << ext;
-                f.close();
-                f.rename(fn + ext);
-                r.file = filename + ext;
-            }
-            delete job;
+        QString err = DownloadCache::getIcons()->add(
+                QCryptographicHash::Sha256, info.sha256, d.file->fileName(),
+                true);
+        if (err.isEmpty()) {
+            r.sha256 = info.sha256;
+            r.mimeType = info.mimeType;
+            changed = info.sha256 != d.info.sha256;
+
+            err = DBRepository::getDefault()->saveIconCacheInfo(info);
+            if (!err.isEmpty())
+                qCWarning(npackd).noquote() << err;
+        } else if (d.info.sha256.isEmpty()) {
+            r.error = err;
         } else {
-            r.error = QObject::tr("Cannot open the file %1").arg(fn);
+            changed = false;
         }
+    }
 
+    if (changed) {
         this->mutex.lock();
         this->files.insert(r.url, r);
         this->mutex.unlock();
+    }
+
+    d.file->remove();
+    delete d.file;
+    delete d.job;
+    w->deleteLater();
 
-        CoUninitialize();
+    if (changed) {
+        QString file;
+        if (r.error.isEmpty())
+            file = getVariant(r, 0, &r.error);
 
-        if (b)
-            SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_END);
+        emit this->downloadCompleted(r.url, file, r.error);
     }
-
-    return r;
 }
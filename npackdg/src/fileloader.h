@@ -11,9 +11,22 @@
 #include <QMutex>
 #include <QTemporaryDir>
 #include <QMap>
+#include <QHash>
+#include <QFile>
+#include <QFutureWatcher>
+
+#include "job.h"
+#include "downloader.h"
+#include "iconcacheinfo.h"
 
 /**
  * Loads files from the Internet.
+ *
+ * The downloaded images are stored in DownloadCache::getIcons() and the HTTP
+ * metadata in the table ICON_CACHE. The cached copies are used immediately
+ * and re-validated in the background using conditional requests if they are
+ * older than 7 days. Scaled variants of the images are also stored in the
+ * cache so that they do not have to be computed again after a restart.
  */
 class FileLoader: public QObject
 {
@@ -22,13 +35,23 @@ class FileLoader: public QObject
     class DownloadFile
     {
     public:
-        QString url, file, error;
+        QString url;
+
+        /**
+         * SHA-256 of the content in DownloadCache::getIcons() or "" if the
+         * file is being downloaded
+         */
+        QString sha256;
+
+        /** MIME type of the content */
+        QString mimeType;
+
+        QString error;
     };
 
     /**
-     * @brief URL -> local relative file name in the temporary directory or
-     *     an error message if it starts with an asterisk (*). The data
-     *     in this field should be accessed under the mutex.
+     * @brief URL -> downloaded file. The data in this field should be
+     *     accessed under the mutex.
      */
     QMap<QString, DownloadFile> files;
 
@@ -38,30 +61,77 @@ class FileLoader: public QObject
 
     QTemporaryDir dir;
 
+    /** a running download */
+    class Download
+    {
+    public:
+        /**
+         * metadata for the cached copy. IconCacheInfo::sha256 is empty if
+         * the file is not in the cache.
+         */
+        IconCacheInfo info;
+
+        /** [ownership:this] */
+        QFile* file;
+
+        /** [ownership:this] */
+        Job* job;
+    };
+
     /**
-     * @brief downloads a file
-     * @param url this file should be downloaded
-     * @return result
+     * @brief watcher -> running download. Only accessed from the thread of
+     *     this object.
      */
-    DownloadFile downloadRunnable(const QString &url);
+    QHash<QFutureWatcher<Downloader::Response>*, Download> downloads;
+
+    /**
+     * @brief determines the file extension for an image
+     * @param mime MIME type
+     * @return extension including the dot
+     */
+    static QString getExtension(const QString& mime);
+
+    /**
+     * @brief starts a download
+     * @param info metadata for the cached copy or an object with an empty
+     *     IconCacheInfo::sha256 if there is no cached copy
+     * @return error message
+     */
+    QString start(const IconCacheInfo& info);
+
+    /**
+     * @brief returns a local file for the downloaded image
+     * @param file downloaded file
+     * @param size 0 = original image, >0 = the image is scaled down to fit
+     *     into a square with the specified size
+     * @param err error message will be stored here
+     * @return full file name in the temporary directory
+     */
+    QString getVariant(const DownloadFile& file, int size, QString* err);
 public:
     /**
      * The thread is not started.
      */
     FileLoader();
 
-    virtual ~FileLoader() {}
+    /**
+     * @brief waits for the running downloads
+     */
+    virtual ~FileLoader();
 
     /**
      * @brief download a file. This function does not block.
      * @param url this file will be downloaded
      * @param err error message or ""
+     * @param size 0 = original file, >0 = image scaled to fit into a square
+     *     with the specified size in pixels
      * @return local file name or "" if file is being downloaded
      */
-    QString downloadOrQueue(const QString& url, QString* err);
+    QString downloadOrQueue(const QString& url, QString* err, int size=0);
 signals:
     /**
-     * @brief a download was completed (with or without an error)
+     * @brief a download was completed (with or without an error) or a cached
+     *     image was replaced by a newer version
      * @param url the file from this URL was downloaded
      * @param filename full file name for the downloaded file or ""
      * @param err the error message or ""
@@ -0,0 +1,380 @@
+#include "hashengine.h"
+
+#include <windows.h>
+#include <bcrypt.h>
+
+#include <QFile>
+#include <QVector>
+#include <QThread>
+#include <QMutexLocker>
+#include <QLoggingCategory>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "wpmutils.h"
+
+#ifndef BCRYPT_SUCCESS
+#define BCRYPT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+/** size of the buffer for HashEngine::hashFileSync() */
+static const int BUFFER_SIZE = 1024 * 1024;
+
+/**
+ * size of one buffer for HashEngine::hashFile(). Large reads are much faster
+ * for files on network shares.
+ */
+static const int READ_BUFFER_SIZE = 4 * 1024 * 1024;
+
+/** number of read buffers */
+static const int BUFFERS = 3;
+
+QMutex HashEngine::mutex;
+
+void* HashEngine::providers[4] = {nullptr, nullptr, nullptr, nullptr};
+
+bool HashEngine::providerFailed[4] = {false, false, false, false};
+
+QThreadPool HashEngine::readThreadPool;
+
+QThreadPool HashEngine::hashThreadPool;
+
+/**
+ * @brief buffers filled by readBuffers() and hashed by HashEngine::hashFile()
+ */
+class HashReadTask
+{
+public:
+    /** the data is read from this device */
+    QIODevice* file;
+
+    /** read buffers aligned to the page size */
+    char* buffers[BUFFERS];
+
+    /** number of bytes in each buffer. 0 = end of data, -1 = error */
+    qint64 lengths[BUFFERS];
+
+    /** number of buffers that can be filled */
+    QSemaphore free;
+
+    /** number of filled buffers */
+    QSemaphore used;
+
+    /** the reading stops if this value is not 0 */
+    QAtomicInt stop;
+
+    /** error message */
+    QString err;
+
+    HashReadTask(): free(BUFFERS)
+    {
+        for (int i = 0; i < BUFFERS; i++) {
+            buffers[i] = static_cast<char*>(VirtualAlloc(nullptr,
+                    READ_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE,
+                    PAGE_READWRITE));
+            lengths[i] = 0;
+        }
+    }
+
+    ~HashReadTask()
+    {
+        for (int i = 0; i < BUFFERS; i++) {
+            if (buffers[i])
+                VirtualFree(buffers[i], 0, MEM_RELEASE);
+        }
+    }
+};
+
+/**
+ * @brief fills the buffers one after another until the end of the data
+ * @param t buffers
+ */
+static void readBuffers(HashReadTask* t)
+{
+    int i = 0;
+    while (true) {
+        t->free.acquire();
+
+        qint64 r = 0;
+        if (!t->buffers[i]) {
+            r = -1;
+            t->err = QObject::tr("Out of memory");
+        } else if (!t->stop.load()) {
+            r = t->file->read(t->buffers[i], READ_BUFFER_SIZE);
+            if (r < 0)
+                t->err = t->file->errorString();
+        }
+        t->lengths[i] = r;
+
+        t->used.release();
+
+        if (r <= 0)
+            break;
+
+        i = (i + 1) % BUFFERS;
+    }
+}
+
+HashEngine::Hash::Hash(QCryptographicHash::Algorithm alg): alg(alg),
+        handle(nullptr), fallback(nullptr)
+{
+    BCRYPT_ALG_HANDLE provider = getProvider(alg);
+    if (provider) {
+        BCRYPT_HASH_HANDLE h = nullptr;
+        if (BCRYPT_SUCCESS(BCryptCreateHash(provider, &h, nullptr, 0,
+                nullptr, 0, 0)))
+            handle = h;
+    }
+    if (!handle)
+        fallback = new QCryptographicHash(alg);
+}
+
+HashEngine::Hash::~Hash()
+{
+    if (handle)
+        BCryptDestroyHash(handle);
+    delete fallback;
+}
+
+void HashEngine::Hash::addData(const char* data, int length)
+{
+    if (handle)
+        BCryptHashData(handle,
+                reinterpret_cast<PUCHAR>(const_cast<char*>(data)),
+                static_cast<ULONG>(length), 0);
+    else
+        fallback->addData(data, length);
+}
+
+QByteArray HashEngine::Hash::result()
+{
+    QByteArray r;
+    if (handle) {
+        r.resize(QCryptographicHash::hashLength(alg));
+        if (!BCRYPT_SUCCESS(BCryptFinishHash(handle,
+                reinterpret_cast<PUCHAR>(r.data()),
+                static_cast<ULONG>(r.size()), 0)))
+            r.clear();
+    } else {
+        r = fallback->result();
+    }
+    return r;
+}
+
+bool HashEngine::Hash::isNative() const
+{
+    return handle != nullptr;
+}
+
+void* HashEngine::getProvider(QCryptographicHash::Algorithm alg)
+{
+    int index;
+    LPCWSTR id;
+    switch (alg) {
+        case QCryptographicHash::Sha1:
+            index = 0;
+            id = BCRYPT_SHA1_ALGORITHM;
+            break;
+        case QCryptographicHash::Sha256:
+            index = 1;
+            id = BCRYPT_SHA256_ALGORITHM;
+            break;
+        case QCryptographicHash::Sha384:
+            index = 2;
+            id = BCRYPT_SHA384_ALGORITHM;
+            break;
+        case QCryptographicHash::Sha512:
+            index = 3;
+            id = BCRYPT_SHA512_ALGORITHM;
+            break;
+        default:
+            return nullptr;
+    }
+
+    QMutexLocker ml(&mutex);
+
+    if (!providers[index] && !providerFailed[index]) {
+        BCRYPT_ALG_HANDLE h = nullptr;
+        NTSTATUS status = BCryptOpenAlgorithmProvider(&h, id, nullptr, 0);
+        if (BCRYPT_SUCCESS(status)) {
+            providers[index] = h;
+        } else {
+            providerFailed[index] = true;
+            qCDebug(npackd) << "HashEngine: BCryptOpenAlgorithmProvider failed" <<
+                    QString::fromWCharArray(id) << status;
+        }
+    }
+
+    return providers[index];
+}
+
+QString HashEngine::hashFile(Job* job, QIODevice* file,
+        QCryptographicHash::Algorithm alg, QIODevice* copy)
+{
+    QString initialTitle = job->getTitle();
+
+    qint64 size = file->isSequential() ? 0 : file->size() - file->pos();
+
+    Hash hash(alg);
+
+    if (readThreadPool.maxThreadCount() < 16)
+        readThreadPool.setMaxThreadCount(16);
+
+    HashReadTask t;
+    t.file = file;
+    QFuture<void> reader = QtConcurrent::run(&readThreadPool, readBuffers, &t);
+
+    // after a cancellation the buffers are not hashed, but still released
+    // so that the reading thread can stop
+    qint64 alreadyRead = 0;
+    int i = 0;
+    while (true) {
+        t.used.acquire();
+
+        qint64 r = t.lengths[i];
+        if (r <= 0)
+            break;
+
+        if (!t.stop.load()) {
+            hash.addData(t.buffers[i], static_cast<int>(r));
+
+            if (copy && copy->write(t.buffers[i], r) != r) {
+                job->setErrorMessage(copy->errorString());
+                t.stop.store(1);
+            }
+
+            alreadyRead += r;
+            if (size > 0)
+                job->setProgress(qMin(1.0,
+                        static_cast<double>(alreadyRead) / size));
+            job->setTitle(initialTitle + QStringLiteral(" / ") +
+                    QObject::tr("%L0 bytes").
+                    arg(alreadyRead));
+
+            if (job->isCancelled())
+                t.stop.store(1);
+        }
+
+        t.free.release();
+        i = (i + 1) % BUFFERS;
+    }
+
+    reader.waitForFinished();
+
+    if (!t.err.isEmpty())
+        job->setErrorMessage(t.err);
+
+    QString res;
+    if (job->shouldProceed()) {
+        QByteArray r = hash.result();
+        if (r.isEmpty())
+            job->setErrorMessage(QObject::tr("Error computing the hash sum"));
+        else
+            res = r.toHex().toLower();
+    }
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->complete();
+
+    return res;
+}
+
+QString HashEngine::hashFile(const QString& filename,
+        QCryptographicHash::Algorithm alg)
+{
+    QString res;
+
+    QFile file(filename);
+    if (file.open(QIODevice::ReadOnly)) {
+        Job job;
+        res = hashFile(&job, &file, alg);
+        file.close();
+    }
+
+    return res;
+}
+
+void HashEngine::hashFileSync(const QString& filename,
+        QCryptographicHash::Algorithm alg, QString* result,
+        QAtomicInt* cancelled, QSemaphore* done)
+{
+    QFile file(filename);
+    if (!cancelled->load() && file.open(QIODevice::ReadOnly)) {
+        Hash hash(alg);
+        char* buffer = new char[BUFFER_SIZE];
+
+        bool err = false;
+        while (true) {
+            qint64 r = file.read(buffer, BUFFER_SIZE);
+            if (r == 0)
+                break;
+            if (r < 0 || cancelled->load()) {
+                err = true;
+                break;
+            }
+            hash.addData(buffer, static_cast<int>(r));
+        }
+        file.close();
+
+        delete[] buffer;
+
+        if (!err)
+            *result = hash.result().toHex().toLower();
+    }
+
+    done->release();
+}
+
+QStringList HashEngine::hashFiles(Job* job, const QStringList& files,
+        QCryptographicHash::Algorithm alg, int threads)
+{
+    QString initialTitle = job->getTitle();
+
+    int n = files.count();
+
+    if (threads <= 0)
+        threads = qBound(1, QThread::idealThreadCount(), 16);
+
+    if (hashThreadPool.maxThreadCount() < 16)
+        hashThreadPool.setMaxThreadCount(16);
+
+    // the results are stored directly by the threads
+    QVector<QString> results(n);
+    QAtomicInt cancelled;
+    QSemaphore done;
+
+    // at most "threads" files are processed at the same time
+    int started = 0;
+    int finished = 0;
+    while (true) {
+        while (started < n && started - finished < threads &&
+                !cancelled.load()) {
+            QtConcurrent::run(&hashThreadPool, &HashEngine::hashFileSync,
+                    files.at(started), alg, &results[started], &cancelled,
+                    &done);
+            started++;
+        }
+
+        if (finished == started)
+            break;
+
+        while (!done.tryAcquire(1, 100)) {
+            if (job->isCancelled())
+                cancelled.store(1);
+        }
+        finished++;
+
+        job->setProgress(static_cast<double>(finished) / n);
+        if (finished % 100 == 0)
+            job->setTitle(initialTitle + QStringLiteral(" / ") +
+                    QString(QObject::tr("%L1 files")).arg(finished));
+    }
+
+    job->complete();
+
+    QStringList r;
+    if (!cancelled.load())
+        r = results.toList();
+    return r;
+}
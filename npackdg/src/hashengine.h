@@ -0,0 +1,146 @@
+#ifndef HASHENGINE_H
+#define HASHENGINE_H
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QIODevice>
+#include <QMutex>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <QCryptographicHash>
+
+#include "job.h"
+
+/**
+ * @brief computes hash sums for files.
+ *
+ * SHA-1, SHA-256, SHA-384 and SHA-512 are computed using Windows CNG
+ * (BCrypt). Current Windows versions use the SHA extensions of the processor
+ * (Intel SHA or ARMv8 cryptography extensions) for these algorithms if they
+ * are available. QCryptographicHash is used for other algorithms and if CNG
+ * cannot be used.
+ *
+ * @threadsafe
+ */
+class HashEngine
+{
+public:
+    /**
+     * @brief incremental computation of one hash sum. An object of this class
+     *     should only be used from one thread at a time.
+     */
+    class Hash
+    {
+    private:
+        QCryptographicHash::Algorithm alg;
+
+        /** BCRYPT_HASH_HANDLE or 0 */
+        void* handle;
+
+        /** [ownership:this] is used if handle == 0 */
+        QCryptographicHash* fallback;
+
+        Hash(const Hash& other);
+        Hash& operator=(const Hash& other);
+    public:
+        /**
+         * @param alg algorithm
+         */
+        explicit Hash(QCryptographicHash::Algorithm alg);
+
+        ~Hash();
+
+        /**
+         * @param data data
+         * @param length length of the data
+         */
+        void addData(const char* data, int length);
+
+        /**
+         * @return hash sum. This function should only be called once.
+         */
+        QByteArray result();
+
+        /**
+         * @return true if Windows CNG is used
+         */
+        bool isNative() const;
+    };
+private:
+    static QMutex mutex;
+
+    /** BCRYPT_ALG_HANDLE for the algorithms. 0 = not yet opened. */
+    static void* providers[4];
+
+    /** true = the provider could not be opened */
+    static bool providerFailed[4];
+
+    /** threads that read files for hashFile() */
+    static QThreadPool readThreadPool;
+
+    /** threads for hashFiles() */
+    static QThreadPool hashThreadPool;
+
+    /**
+     * @param alg algorithm
+     * @return BCRYPT_ALG_HANDLE or 0 if CNG cannot be used for this
+     *     algorithm. The handle is shared between all threads.
+     */
+    static void* getProvider(QCryptographicHash::Algorithm alg);
+
+    /**
+     * @brief computes the hash sum for a file on the current thread
+     * @param filename file name
+     * @param alg algorithm
+     * @param result the hash sum in lower case or "" will be stored here
+     * @param cancelled the file is not read if this value is not 0
+     * @param done will be released at the end
+     */
+    static void hashFileSync(const QString& filename,
+            QCryptographicHash::Algorithm alg, QString* result,
+            QAtomicInt* cancelled, QSemaphore* done);
+public:
+    /**
+     * @brief computes the hash sum for the remaining data of a device. The
+     *     data is read by another thread in 3 buffers so that reading and
+     *     hashing (and writing) overlap.
+     * @param job job. The progress is only reported if the size of the
+     *     device is known.
+     * @param file an open device. The data is read from the current position.
+     * @param alg algorithm
+     * @param copy if not 0, the data will also be written to this device
+     * @return hash sum in lower case or "" in case of an error or
+     *     cancellation
+     */
+    static QString hashFile(Job* job, QIODevice* file,
+            QCryptographicHash::Algorithm alg, QIODevice* copy=nullptr);
+
+    /**
+     * @brief computes the hash sum for a file
+     * @param filename file name
+     * @param alg algorithm
+     * @return hash sum in lower case or "" in case of an error
+     */
+    static QString hashFile(const QString& filename,
+            QCryptographicHash::Algorithm alg);
+
+    /**
+     * @brief computes the hash sums for many files in parallel. Every thread
+     *     reads and hashes one file at a time so that reading and hashing of
+     *     different files overlap.
+     * @param job job
+     * @param files file names
+     * @param alg algorithm
+     * @param threads maximum number of threads or 0 for the number of
+     *     processor cores
+     * @return hash sums in lower case in the same order as the files. "" is
+     *     returned for files that cannot be read. The list is empty if the
+     *     job was cancelled.
+     */
+    static QStringList hashFiles(Job* job, const QStringList& files,
+            QCryptographicHash::Algorithm alg, int threads=0);
+};
+
+#endif // HASHENGINE_H
@@ -0,0 +1,46 @@
+#include "hoststats.h"
+
+HostStats::HostStats(const QString &host): host(host), latency(-1),
+        throughput(-1), failures(0), modified(0)
+{
+}
+
+double HostStats::getScore() const
+{
+    double r;
+    if (modified == 0 || (latency < 0 && throughput < 0)) {
+        r = 1e9;
+    } else {
+        r = latency < 0 ? 0 : latency;
+        if (throughput > 0)
+            r += 8 * 1024 * 1024 / throughput;
+
+        // a failed download costs more than a slow one
+        r += failures * 60.0;
+    }
+    return r;
+}
+
+void HostStats::update(int64_t bytes, double seconds, bool ok, bool probe)
+{
+    if (ok) {
+        failures = 0;
+
+        // exponential moving averages
+        if (probe) {
+            latency = latency < 0 ? seconds : (latency + seconds) / 2;
+        }
+
+        // throughput measured with small requests is mostly latency
+        if (seconds > 0 && (!probe || throughput < 0) &&
+                (probe || bytes >= 1024 * 1024)) {
+            double t = bytes / seconds;
+            throughput = (throughput < 0 || probe) ? t :
+                    (throughput + t) / 2;
+        }
+    } else {
+        failures++;
+    }
+
+    modified = time(nullptr);
+}
@@ -0,0 +1,52 @@
+#ifndef HOSTSTATS_H
+#define HOSTSTATS_H
+
+#include <time.h>
+#include <stdint.h>
+
+#include <QString>
+
+/**
+ * @brief download statistics for a host. This information is used to choose
+ *     the fastest mirror.
+ */
+class HostStats
+{
+public:
+    /** host name (and port) in lower case */
+    QString host;
+
+    /** time in seconds for a small request or -1 if unknown */
+    double latency;
+
+    /** throughput in bytes per second or -1 if unknown */
+    double throughput;
+
+    /** number of failed downloads or probes since the last successful one */
+    int failures;
+
+    /** date/time of the last change or 0 if there is no information */
+    time_t modified;
+
+    /**
+     * @param host host name
+     */
+    explicit HostStats(const QString& host="");
+
+    /**
+     * @return estimated time in seconds for downloading 8 MiB. Lower values
+     *     are better. Hosts without information have a very high score.
+     */
+    double getScore() const;
+
+    /**
+     * @brief updates the statistics after a download or a probe
+     * @param bytes number of transferred bytes
+     * @param seconds duration of the transfer
+     * @param ok true = the transfer was successful
+     * @param probe true = this was a probe with a small request
+     */
+    void update(int64_t bytes, double seconds, bool ok, bool probe);
+};
+
+#endif // HOSTSTATS_H
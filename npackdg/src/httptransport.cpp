@@ -0,0 +1,5 @@
+#include "httptransport.h"
+
+HTTPTransport::~HTTPTransport()
+{
+}
@@ -0,0 +1,36 @@
+#ifndef HTTPTRANSPORT_H
+#define HTTPTRANSPORT_H
+
+#include <stdint.h>
+
+#include "job.h"
+#include "downloader.h"
+
+/**
+ * @brief performs HTTP requests for the Downloader.
+ *
+ * The Downloader handles the segmentation, the resuming of downloads and
+ * file: and data: URLs. A transport only executes one HTTP request and writes
+ * the received entity. See WinINetTransport and QtNetworkTransport.
+ *
+ * @threadsafe
+ */
+class HTTPTransport
+{
+public:
+    virtual ~HTTPTransport();
+
+    /**
+     * @brief executes one HTTP request. A slot from the DownloadScheduler
+     *     should be acquired for the connection.
+     * @param job job object
+     * @param request HTTP request. The fields Request::segments and
+     *     Request::tee for ranged requests are not used.
+     * @param response HTTP response
+     * @return "content-length" or -1 if unknown
+     */
+    virtual int64_t execute(Job* job, const Downloader::Request& request,
+            Downloader::Response* response) = 0;
+};
+
+#endif // HTTPTRANSPORT_H
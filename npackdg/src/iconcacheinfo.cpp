@@ -0,0 +1,5 @@
+#include "iconcacheinfo.h"
+
+IconCacheInfo::IconCacheInfo(const QString &url): url(url), modified(0)
+{
+}
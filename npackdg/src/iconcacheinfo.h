@@ -0,0 +1,42 @@
+#ifndef ICONCACHEINFO_H
+#define ICONCACHEINFO_H
+
+#include <time.h>
+
+#include <QString>
+
+/**
+ * @brief HTTP metadata for a downloaded icon or screenshot. The content is
+ *     stored in DownloadCache::getIcons() under its SHA-256 hash sum.
+ */
+class IconCacheInfo
+{
+public:
+    /** URL of the image */
+    QString url;
+
+    /** value of the "ETag" header or "" */
+    QString etag;
+
+    /** value of the "Last-Modified" header or "" */
+    QString lastModified;
+
+    /** SHA-256 of the content in lower case */
+    QString sha256;
+
+    /** MIME type of the content */
+    QString mimeType;
+
+    /**
+     * date/time of the last download or validation or 0 if there is no
+     * information
+     */
+    time_t modified;
+
+    /**
+     * @param url URL of the image
+     */
+    explicit IconCacheInfo(const QString& url="");
+};
+
+#endif // ICONCACHEINFO_H
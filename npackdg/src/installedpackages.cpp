@@ -30,6 +30,9 @@
 #include "hrtimer.h"
 #include "installedpackagesthirdpartypm.h"
 #include "dbrepository.h"
+#include "installedpackagesindex.h"
+
+QAtomicInt InstalledPackages::nextId(1);
 
 InstalledPackages InstalledPackages::def;
 
@@ -40,55 +43,115 @@ InstalledPackages* InstalledPackages::getDefault()
     return &def;
 }
 
-InstalledPackages::InstalledPackages() : mutex(QMutex::Recursive)
+InstalledPackages::InstalledPackages() : mutex(QMutex::Recursive),
+        id(nextId.fetchAndAddOrdered(1)), revision(0), baseId(0),
+        baseRevision(0)
 {
 }
 
 InstalledPackages::InstalledPackages(const InstalledPackages &other) :
-        QObject(), mutex(QMutex::Recursive)
+        QObject(), mutex(QMutex::Recursive),
+        id(nextId.fetchAndAddOrdered(1)), revision(0)
 {
-    *this = other;
+    other.mutex.lock();
+    this->data = other.data;
+    this->baseId = other.id;
+    this->baseRevision = other.revision;
+    other.mutex.unlock();
 }
 
-InstalledPackages &InstalledPackages::operator=(const InstalledPackages &other)
+void InstalledPackages::recordChange(const QString &key)
 {
-    qCDebug(npackd) << "Setting installed packages";
-    this->dump();
-
-    other.dump();
+    // internal method, mutex is not used
 
-    QList<InstalledPackageVersion*> myInfos = getAll();
-    for (int i = 0; i < myInfos.size(); i++) {
-        InstalledPackageVersion* myIpv = myInfos.at(i);
-        InstalledPackageVersion* otherIpv = other.find(
-                myIpv->package, myIpv->version);
-
-        if (!otherIpv) {
-            setPackageVersionPath(myIpv->package,
-                    myIpv->version, "", false);
-        } else if (*myIpv != *otherIpv) {
-            setOne(*otherIpv);
-        }
+    this->revision++;
+    this->changes.insert(key);
+}
 
-        delete otherIpv;
-    }
-    qDeleteAll(myInfos);
-    myInfos.clear();
+void InstalledPackages::recordAllChanged()
+{
+    // internal method, mutex is not used
 
-    QList<InstalledPackageVersion*> otherInfos = other.getAll();
-    for (int i = 0; i < otherInfos.size(); i++) {
-        InstalledPackageVersion* otherIpv = otherInfos.at(i);
-        InstalledPackageVersion* myIpv = find(
-                otherIpv->package, otherIpv->version);
+    this->revision++;
+    this->changes.clear();
+    this->baseId = 0;
+}
 
-        if (!myIpv) {
-            setOne(*otherIpv);
+InstalledPackages &InstalledPackages::operator=(const InstalledPackages &other)
+{
+    if (this == &other)
+        return *this;
+
+    other.mutex.lock();
+    QMap<QString, QSharedPointer<InstalledPackageVersion> > otherData =
+            other.data;
+    int otherBaseId = other.baseId;
+    int otherBaseRevision = other.baseRevision;
+    QSet<QString> otherChanges = other.changes;
+    other.mutex.unlock();
+
+    QList<InstalledPackageVersion*> changed;
+    this->mutex.lock();
+    if (otherBaseId == this->id && otherBaseRevision == this->revision) {
+        // the other object is a copy of this one with some changed entries
+        QSetIterator<QString> it(otherChanges);
+        while (it.hasNext()) {
+            const QString& key = it.next();
+            InstalledPackageVersion* my = this->data.value(key).data();
+            InstalledPackageVersion* their = otherData.value(key).data();
+            bool differs;
+            if (my && their)
+                differs = my != their && *my != *their;
+            else
+                differs = (my && my->installed()) ||
+                        (their && their->installed());
+            if (differs) {
+                changed.append(their ? their->clone() : my->clone());
+                this->changes.insert(key);
+            }
         }
+    } else {
+        // both maps are sorted by the key. Only the entries that are not
+        // shared between the objects need to be compared.
+        QMap<QString, QSharedPointer<InstalledPackageVersion> >::const_iterator
+                my = this->data.constBegin();
+        QMap<QString, QSharedPointer<InstalledPackageVersion> >::const_iterator
+                their = otherData.constBegin();
+        while (my != this->data.constEnd() || their != otherData.constEnd()) {
+            if (their == otherData.constEnd() ||
+                    (my != this->data.constEnd() && my.key() < their.key())) {
+                if (my.value()->installed()) {
+                    changed.append(my.value()->clone());
+                    this->changes.insert(my.key());
+                }
+                ++my;
+            } else if (my == this->data.constEnd() ||
+                    their.key() < my.key()) {
+                if (their.value()->installed()) {
+                    changed.append(their.value()->clone());
+                    this->changes.insert(their.key());
+                }
+                ++their;
+            } else {
+                if (my.value() != their.value() &&
+                        *my.value() != *their.value()) {
+                    changed.append(their.value()->clone());
+                    this->changes.insert(my.key());
+                }
+                ++my;
+                ++their;
+            }
+        }
+    }
+    this->data = otherData;
+    this->revision++;
+    this->mutex.unlock();
 
-        delete myIpv;
+    for (int i = 0; i < changed.size(); i++) {
+        InstalledPackageVersion* ipv = changed.at(i);
+        fireStatusChanged(ipv->package, ipv->version);
     }
-    qDeleteAll(otherInfos);
-    otherInfos.clear();
+    qDeleteAll(changed);
 
     return *this;
 }
@@ -96,18 +159,33 @@ InstalledPackages &InstalledPackages::operator=(const InstalledPackages &other)
 InstalledPackages::~InstalledPackages()
 {
     this->mutex.lock();
-    qDeleteAll(this->data);
     this->data.clear();
     this->mutex.unlock();
 }
 
+QList<InstalledPackageVersion*> InstalledPackages::values() const
+{
+    // internal method, mutex is not used
+
+    QList<InstalledPackageVersion*> r;
+    r.reserve(this->data.size());
+    QMapIterator<QString, QSharedPointer<InstalledPackageVersion> > it(
+            this->data);
+    while (it.hasNext()) {
+        it.next();
+        r.append(it.value().data());
+    }
+
+    return r;
+}
+
 InstalledPackageVersion* InstalledPackages::findNoCopy(const QString& package,
         const Version& version) const
 {
     // internal method, mutex is not used
 
     InstalledPackageVersion* ipv = this->data.value(
-            PackageVersion::getStringId(package, version));
+            PackageVersion::getStringId(package, version)).data();
 
     return ipv;
 }
@@ -117,8 +195,7 @@ InstalledPackageVersion* InstalledPackages::find(const QString& package,
 {
     this->mutex.lock();
 
-    InstalledPackageVersion* ipv = this->data.value(
-            PackageVersion::getStringId(package, version));
+    InstalledPackageVersion* ipv = this->findNoCopy(package, version);
     if (ipv)
         ipv = ipv->clone();
 
@@ -426,16 +503,13 @@ void InstalledPackages::processOneInstalled3rdParty(DBRepository *r,
         err = pv->saveFiles(QDir(d));
     }
 
-    InstalledPackageVersion* ipv2 = nullptr;
+    // the entries may be shared with copies of this object and are never
+    // changed in place
+    InstalledPackageVersion ipv2(ipv.package, ipv.version, d);
+    ipv2.detectionInfo = ipv.detectionInfo;
     if (err.isEmpty()) {
         // qCDebug(npackd) << "    4";
-        ipv2 = this->findOrCreate(ipv.package, ipv.version, &err);
-    }
-
-    if (err.isEmpty()) {
-        // qCDebug(npackd) << "    5";
-        ipv2->detectionInfo = ipv.detectionInfo;
-        ipv2->setPath(d);
+        err = setOne(ipv2);
     }
 
     // this is a consistent output place for all packages detected by
@@ -443,31 +517,14 @@ void InstalledPackages::processOneInstalled3rdParty(DBRepository *r,
     // debugging via "npackdcl -d"
     if (err.isEmpty()) {
         qCDebug(npackd) << "InstalledPackages::processOneInstalled3rdParty leave" <<
-                ipv2->package << ipv2->version.getVersionString() <<
-                ipv2->getDirectory() << ipv2->detectionInfo;
+                ipv2.package << ipv2.version.getVersionString() <<
+                ipv2.getDirectory() << ipv2.detectionInfo;
     } else {
         qCDebug(npackd) << "InstalledPackages::processOneInstalled3rdParty leave" <<
                 "error" << err;
     }
 }
 
-InstalledPackageVersion* InstalledPackages::findOrCreate(const QString& package,
-        const Version& version, QString* err)
-{
-    // internal method, mutex is not used
-
-    *err = "";
-
-    QString key = PackageVersion::getStringId(package, version);
-    InstalledPackageVersion* r = this->data.value(key);
-    if (!r) {
-        r = new InstalledPackageVersion(package, version, "");
-        this->data.insert(key, r);
-    }
-
-    return r;
-}
-
 QString InstalledPackages::setPackageVersionPath(const QString& package,
         const Version& version,
         const QString& directory, bool updateRegistry)
@@ -478,22 +535,45 @@ QString InstalledPackages::setPackageVersionPath(const QString& package,
 
     QString err;
 
-    InstalledPackageVersion* ipv = this->findNoCopy(package, version);
+    QString key = PackageVersion::getStringId(package, version);
+    QSharedPointer<InstalledPackageVersion> ipv = this->data.value(key);
+
+    // the stamp of the index before the change
+    qint64 before = -1;
+    if (updateRegistry) {
+        QString stampErr;
+        before = getRegistryStamp(&stampErr);
+        if (!stampErr.isEmpty())
+            before = -1;
+    }
+
     if (!ipv) {
-        ipv = new InstalledPackageVersion(package, version, directory);
-        this->data.insert(package + "/" + version.getVersionString(), ipv);
+        ipv.reset(new InstalledPackageVersion(package, version, directory));
+        this->data.insert(key, ipv);
+        recordChange(key);
         changed = true;
     } else {
         if (ipv->getDirectory() != directory) {
+            // the entry may be shared with a copy of this object
+            ipv.reset(ipv->clone());
             ipv->setPath(directory);
+            this->data.insert(key, ipv);
+            recordChange(key);
             changed = true;
         }
     }
     if (updateRegistry)
-        err = saveToRegistry(ipv);
+        err = saveToRegistry(ipv.data());
 
     this->mutex.unlock();
 
+    if (updateRegistry && err.isEmpty()) {
+        QString indexErr = updateIndexEntry(package, version, directory,
+                before);
+        if (!indexErr.isEmpty())
+            qCDebug(npackd) << "Cannot update the index" << indexErr;
+    }
+
     if (changed)
         fireStatusChanged(package, version);
 
@@ -506,7 +586,7 @@ InstalledPackageVersion *InstalledPackages::findOwner(
     this->mutex.lock();
 
     InstalledPackageVersion* f = nullptr;
-    QList<InstalledPackageVersion*> ipvs = this->data.values();
+    QList<InstalledPackageVersion*> ipvs = values();
     for (int i = 0; i < ipvs.count(); ++i) {
         InstalledPackageVersion* ipv = ipvs.at(i);
         QString dir = ipv->getDirectory();
@@ -529,7 +609,7 @@ QList<InstalledPackageVersion*> InstalledPackages::getAll() const
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    QList<InstalledPackageVersion*> all = values();
     QList<InstalledPackageVersion*> r;
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
@@ -547,7 +627,7 @@ QList<InstalledPackageVersion *> InstalledPackages::getByPackage(
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    QList<InstalledPackageVersion*> all = values();
     QList<InstalledPackageVersion*> r;
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
@@ -564,13 +644,12 @@ void InstalledPackages::remove(const QString &package)
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
-    for (int i = 0; i < all.count(); i++) {
-        InstalledPackageVersion* ipv = all.at(i);
-        if (ipv->package == package) {
-            data.remove(PackageVersion::getStringId(package, ipv->version));
-            delete ipv;
-        }
+    QMutableMapIterator<QString, QSharedPointer<InstalledPackageVersion> > it(
+            this->data);
+    while (it.hasNext()) {
+        it.next();
+        if (it.value()->package == package)
+            it.remove();
     }
 
     this->mutex.unlock();
@@ -581,7 +660,7 @@ InstalledPackageVersion* InstalledPackages::getNewestInstalled(
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    QList<InstalledPackageVersion*> all = values();
     InstalledPackageVersion* r = nullptr;
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
@@ -601,17 +680,21 @@ InstalledPackageVersion* InstalledPackages::getNewestInstalled(
 
 bool InstalledPackages::isInstalled(const Dependency& dep) const
 {
-    QList<InstalledPackageVersion*> installed = getAll();
+    this->mutex.lock();
+
+    QList<InstalledPackageVersion*> installed = values();
     bool res = false;
     for (int i = 0; i < installed.count(); i++) {
         InstalledPackageVersion* ipv = installed.at(i);
-        if (ipv->package == dep.package &&
+        if (ipv->installed() && ipv->package == dep.package &&
                 dep.test(ipv->version)) {
             res = true;
             break;
         }
     }
-    qDeleteAll(installed);
+
+    this->mutex.unlock();
+
     return res;
 }
 
@@ -619,7 +702,7 @@ QSet<QString> InstalledPackages::getPackages() const
 {
     this->mutex.lock();
 
-    QList<InstalledPackageVersion*> all = this->data.values();
+    QList<InstalledPackageVersion*> all = values();
     QSet<QString> r;
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
@@ -632,6 +715,26 @@ QSet<QString> InstalledPackages::getPackages() const
     return r;
 }
 
+QStringList InstalledPackages::getInstalledStringIds(
+        const QSet<QString> &packages) const
+{
+    this->mutex.lock();
+
+    QStringList r;
+    QMapIterator<QString, QSharedPointer<InstalledPackageVersion> > it(
+            this->data);
+    while (it.hasNext()) {
+        it.next();
+        InstalledPackageVersion* ipv = it.value().data();
+        if (ipv->installed() && packages.contains(ipv->package))
+            r.append(it.key());
+    }
+
+    this->mutex.unlock();
+
+    return r;
+}
+
 InstalledPackageVersion*
         InstalledPackages::findFirstWithMissingDependency() const
 {
@@ -640,7 +743,7 @@ InstalledPackageVersion*
     this->mutex.lock();
 
     DBRepository* dbr = DBRepository::getDefault();
-    QList<InstalledPackageVersion*> all = this->data.values();
+    QList<InstalledPackageVersion*> all = values();
     for (int i = 0; i < all.count(); i++) {
         InstalledPackageVersion* ipv = all.at(i);
         if (ipv->installed()) {
@@ -718,7 +821,7 @@ QStringList InstalledPackages::getAllInstalledPackagePaths() const
     this->mutex.lock();
 
     QStringList r;
-    QList<InstalledPackageVersion*> ipvs = this->data.values();
+    QList<InstalledPackageVersion*> ipvs = values();
     for (int i = 0; i < ipvs.count(); i++) {
         InstalledPackageVersion* ipv = ipvs.at(i);
         if (ipv->installed())
@@ -975,8 +1078,14 @@ QString InstalledPackages::save()
                     otherIpv->package, otherIpv->version);
 
             if (!myIpv || !myIpv->installed()) {
+                // the index is updated once at the end
                 err = setPackageVersionPath(otherIpv->package,
-                        otherIpv->version, "", true);
+                        otherIpv->version, "", false);
+                if (err.isEmpty()) {
+                    InstalledPackageVersion removed(otherIpv->package,
+                            otherIpv->version, "");
+                    err = saveToRegistry(&removed);
+                }
             }
 
             delete myIpv;
@@ -988,6 +1097,12 @@ QString InstalledPackages::save()
         otherInfos.clear();
     }
 
+    if (err.isEmpty()) {
+        QString indexErr = updateIndex();
+        if (!indexErr.isEmpty())
+            qCDebug(npackd) << "Cannot update the index" << indexErr;
+    }
+
     return err;
 }
 
@@ -997,10 +1112,12 @@ QString InstalledPackages::setOne(const InstalledPackageVersion& other)
     bool changed = false;
 
     this->mutex.lock();
-    InstalledPackageVersion* ipv =
-            this->findOrCreate(other.package, other.version, &err);
-    if (*ipv != other) {
-        *ipv = other;
+    QString key = PackageVersion::getStringId(other.package, other.version);
+    InstalledPackageVersion* ipv = this->data.value(key).data();
+    if (!ipv || *ipv != other) {
+        this->data.insert(key,
+                QSharedPointer<InstalledPackageVersion>(other.clone()));
+        recordChange(key);
         changed = true;
     }
     this->mutex.unlock();
@@ -1128,12 +1245,13 @@ QString InstalledPackages::readRegistryDatabase()
     }
 
     this->mutex.lock();
-    qDeleteAll(this->data);
     this->data.clear();
+    recordAllChanged();
     for (int i = 0; i < ipvs.count(); i++) {
         InstalledPackageVersion* ipv = ipvs.at(i);
         this->data.insert(PackageVersion::getStringId(ipv->package,
-                ipv->version), ipv->clone());
+                ipv->version),
+                QSharedPointer<InstalledPackageVersion>(ipv->clone()));
     }
     this->mutex.unlock();
 
@@ -1151,15 +1269,180 @@ QString InstalledPackages::readRegistryDatabase()
 void InstalledPackages::clear()
 {
     this->mutex.lock();
-    qDeleteAll(this->data);
     this->data.clear();
+    recordAllChanged();
     this->mutex.unlock();
 }
 
+QString InstalledPackages::getIndexFile()
+{
+    // "C:\ProgramData" can be changed by all users. The index for all users
+    // is stored in a directory that only administrators can change.
+    if (WPMUtils::adminMode)
+        return WPMUtils::getShellDir(CSIDL_COMMON_APPDATA) +
+                QStringLiteral("\\Npackd\\Index\\InstalledPackages.idx");
+    else
+        return WPMUtils::getShellDir(CSIDL_APPDATA) +
+                QStringLiteral("\\Npackd\\InstalledPackages.idx");
+}
+
+qint64 InstalledPackages::getRegistryStamp(QString* err)
+{
+    err->clear();
+
+    qint64 r = 0;
+
+    WindowsRegistry packagesWR;
+    LONG e;
+    *err = packagesWR.open(
+        WPMUtils::adminMode ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER,
+            "SOFTWARE\\Npackd\\Npackd\\Packages", false, KEY_READ, &e);
+    if (e == ERROR_FILE_NOT_FOUND || e == ERROR_PATH_NOT_FOUND) {
+        err->clear();
+    } else if (err->isEmpty()) {
+        r = packagesWR.getLastWriteTime(err);
+    }
+
+    return r;
+}
+
+QString InstalledPackages::updateIndex()
+{
+    QString err;
+
+    QString filename = getIndexFile();
+    QString dir = QFileInfo(filename).absolutePath();
+    if (WPMUtils::adminMode) {
+        err = WPMUtils::createSecureDirectory(dir);
+    } else {
+        QDir d;
+        d.mkpath(dir);
+    }
+
+    // readRegistryDatabase() removes invalid entries and changes the stamp.
+    // The second attempt normally sees a stable registry.
+    bool done = false;
+    for (int attempt = 0; attempt < 2 && err.isEmpty() && !done; attempt++) {
+        qint64 before = getRegistryStamp(&err);
+
+        InstalledPackages other;
+        if (err.isEmpty())
+            err = other.readRegistryDatabase();
+
+        qint64 after = 0;
+        if (err.isEmpty())
+            after = getRegistryStamp(&err);
+
+        if (err.isEmpty() && before == after) {
+            QList<InstalledPackageVersion*> ipvs = other.getAll();
+            err = InstalledPackagesIndex::write(filename, after, ipvs);
+            qDeleteAll(ipvs);
+            done = true;
+        }
+    }
+
+    // an outdated index is worse than none
+    if (!done)
+        QFile::remove(filename);
+
+    return err;
+}
+
+QString InstalledPackages::updateIndexEntry(const QString& package,
+        const Version& version, const QString& directory, qint64 before)
+{
+    QString filename = getIndexFile();
+    bool current = before >= 0 && (!WPMUtils::adminMode ||
+            WPMUtils::isAdminOwned(filename));
+
+    InstalledPackagesIndex index;
+    if (current)
+        current = index.open(filename).isEmpty() &&
+                index.getStamp() == before;
+
+    // a changed path does not require the enumeration of the registry
+    QList<InstalledPackageVersion*> ipvs;
+    if (current)
+        ipvs = index.getAll();
+
+    // a mapped file cannot be replaced
+    index.close();
+
+    if (!current)
+        return updateIndex();
+
+    QString err;
+
+    for (int i = 0; i < ipvs.count(); ) {
+        InstalledPackageVersion* ipv = ipvs.at(i);
+        if (ipv->package == package && ipv->version.compare(version) == 0) {
+            delete ipv;
+            ipvs.removeAt(i);
+        } else {
+            i++;
+        }
+    }
+    if (!directory.isEmpty())
+        ipvs.append(new InstalledPackageVersion(package, version, directory));
+
+    qint64 after = getRegistryStamp(&err);
+    if (err.isEmpty())
+        err = InstalledPackagesIndex::write(filename, after, ipvs);
+    qDeleteAll(ipvs);
+
+    // an outdated index is worse than none
+    if (!err.isEmpty())
+        QFile::remove(filename);
+
+    return err;
+}
+
 QString InstalledPackages::findPath_npackdcl(const Dependency& dep)
 {
     QString ret;
 
+    QString err;
+    qint64 stamp = getRegistryStamp(&err);
+
+    // a standard user could have created the file before the directory was
+    // secured
+    QString filename = getIndexFile();
+    if (err.isEmpty() && WPMUtils::adminMode &&
+            !WPMUtils::isAdminOwned(filename))
+        err = QObject::tr(
+                "The index file %1 is not owned by the administrators").
+                arg(filename);
+
+    InstalledPackagesIndex index;
+    if (err.isEmpty())
+        err = index.open(filename);
+
+    if (err.isEmpty() && index.getStamp() == stamp) {
+        // the versions are sorted in ascending order
+        QList<InstalledPackageVersion*> ipvs = index.find(dep.package);
+        for (int i = ipvs.count() - 1; i >= 0; i--) {
+            InstalledPackageVersion* ipv = ipvs.at(i);
+            if (dep.test(ipv->version) && QDir(ipv->directory).exists()) {
+                ret = ipv->directory;
+                break;
+            }
+        }
+        qDeleteAll(ipvs);
+    } else {
+        index.close();
+
+        // the index is re-created by the next change and not here. The
+        // full enumeration would make "ncl path" slower than the search.
+        ret = findPathInRegistry_npackdcl(dep);
+    }
+
+    return ret;
+}
+
+QString InstalledPackages::findPathInRegistry_npackdcl(const Dependency& dep)
+{
+    QString ret;
+
     QString err;
     WindowsRegistry packagesWR;
     LONG e;
@@ -1255,6 +1538,16 @@ QString InstalledPackages::saveToRegistry(InstalledPackageVersion *ipv)
 
             r = wr.set("Path", ipv->directory);
         }
+
+        // changing a value of a sub-key does not change the last write time
+        // of the "Packages" key used by the index
+        if (r.isEmpty()) {
+            WindowsRegistry packages;
+            r = packages.open(machineWR, keyName, KEY_ALL_ACCESS);
+            if (r.isEmpty())
+                r = packages.set("Modified",
+                        QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+        }
         // qCDebug(npackd) << "saveToRegistry 1 " << r;
     } else {
         // qCDebug(npackd) << "deleting " << pn;
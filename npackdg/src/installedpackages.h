@@ -4,10 +4,13 @@
 #include <windows.h>
 #include <memory>
 
+#include <QAtomicInt>
 #include <QMap>
 #include <QObject>
 #include <QSet>
+#include <QSharedPointer>
 #include <QString>
+#include <QStringList>
 
 #include "installedpackageversion.h"
 #include "version.h"
@@ -30,8 +33,56 @@ private:
 
     mutable QMutex mutex;
 
-    /** please use the mutex to access the data */
-    QMap<QString, InstalledPackageVersion*> data;
+    /**
+     * please use the mutex to access the data.
+     * PackageVersion::getStringId() -> information about a package version.
+     * The entries are shared between the copies of this object and are
+     * never modified. A changed entry is always replaced by a new object.
+     * Copying this object is therefore cheap.
+     */
+    QMap<QString, QSharedPointer<InstalledPackageVersion> > data;
+
+    /** source for "id" */
+    static QAtomicInt nextId;
+
+    /** unique number of this object */
+    int id;
+
+    /** incremented with each change of "data" */
+    int revision;
+
+    /**
+     * "id" and "revision" of the object this one was copied from or 0. If
+     * the other object has not changed since, assigning this object to it
+     * only needs to compare the entries in "changes".
+     */
+    int baseId;
+    int baseRevision;
+
+    /** keys of the entries changed since this object was copied */
+    QSet<QString> changes;
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief records a changed entry
+     * @param key PackageVersion::getStringId()
+     */
+    void recordChange(const QString& key);
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @brief records that all entries may have changed
+     */
+    void recordAllChanged();
+
+    /**
+     * THIS METHOD IS NOT THREAD-SAFE
+     *
+     * @return [ownership:this] all entries. The objects should not be modified.
+     */
+    QList<InstalledPackageVersion*> values() const;
 
     /**
      * @brief processOneInstalled3rdParty
@@ -42,18 +93,6 @@ private:
     void processOneInstalled3rdParty(DBRepository *r,
             const InstalledPackageVersion *found, const QString &detectionInfoPrefix);
 
-    /**
-     * THIS METHOD IS NOT THREAD-SAFE
-     *
-     * @brief finds the specified installed package version
-     * @param package full package name
-     * @param version package version
-     * @param err error message will be stored here
-     * @return found or newly created information
-     */
-    InstalledPackageVersion* findOrCreate(const QString& package,
-            const Version& version, QString* err);
-
     /**
      * @brief saves the information in the Windows registry
      * @param ipv information about an installed package version
@@ -67,9 +106,11 @@ private:
      * @brief finds the specified installed package version
      * @param package full package name
      * @param version package version
-     * @return found information or 0 if the specified package version is not
-     *     installed. The returned object may still represent a not installed
-     *     package version. Please check InstalledPackageVersion::getDirectory()
+     * @return [ownership:this] found information or 0 if the specified package
+     *     version is not installed. The returned object may still represent a
+     *     not installed package version. Please check
+     *     InstalledPackageVersion::getDirectory(). The returned object should
+     *     not be modified.
      */
     InstalledPackageVersion* findNoCopy(const QString& package,
             const Version& version) const;
@@ -117,6 +158,36 @@ private:
 
     void dump() const;
 
+    /**
+     * @brief searches for a dependency by enumerating the entries in the
+     *     Windows registry
+     * @param dep dependency
+     * @return installation directory or ""
+     */
+    static QString findPathInRegistry_npackdcl(const Dependency& dep);
+
+    /**
+     * @param err error message will be stored here
+     * @return the value for InstalledPackagesIndex::getStamp() that
+     *     corresponds to the current state of the Windows registry: the last
+     *     write time of the "Packages" key or 0 if it does not exist
+     */
+    static qint64 getRegistryStamp(QString* err);
+
+    /**
+     * @brief changes one entry in the index file after the Windows registry
+     *     was changed. Only an index that was up-to-date before the change is
+     *     changed. Otherwise the whole index is re-created from the registry.
+     * @param package full package name
+     * @param version package version
+     * @param directory new installation directory or "" if the version was
+     *     removed
+     * @param before getRegistryStamp() before the registry was changed
+     * @return error message
+     */
+    static QString updateIndexEntry(const QString& package,
+            const Version& version, const QString& directory, qint64 before);
+
     QString setOne(const InstalledPackageVersion &other);
 public:
     /** package name for the current application */
@@ -133,7 +204,10 @@ public:
     InstalledPackages();
 
     /**
-     * Copy.
+     * Copy. The information about package versions is shared between the
+     * objects and only copied if it is changed. Creating a copy is
+     * therefore cheap. The changed entries are tracked so that assigning
+     * the copy back to the original object only compares these entries.
      *
      * @param other another instance
      */
@@ -170,12 +244,31 @@ public:
 
     /**
      * @brief searches for a dependency in the list of installed packages. This
-     *     function uses the Windows registry directly and should be only used
-     *     from "npackdcl path". It should be fast.
+     *     function uses the index file or the Windows registry directly and
+     *     should be only used from "npackdcl path". It should be fast.
+     *     If the index file is outdated, the registry is searched directly
+     *     as before. The index is re-created by the next change of the
+     *     installed packages (save(), setPackageVersionPath()). In admin
+     *     mode only an index file owned by the administrators is used.
      * @param dep dependency
+     * @return installation directory of the newest matching version or ""
      */
     QString findPath_npackdcl(const Dependency& dep);
 
+    /**
+     * @return full path to the index file for findPath_npackdcl(). The file
+     *     depends on WPMUtils::adminMode. In admin mode the file is stored in
+     *     a directory that only the administrators can change.
+     */
+    static QString getIndexFile();
+
+    /**
+     * @brief re-creates the index file for findPath_npackdcl() from the
+     *     Windows registry
+     * @return error message
+     */
+    static QString updateIndex();
+
     /**
      * @brief registers an installed package version
      * @param package full package name
@@ -280,6 +373,14 @@ public:
      */
     QSet<QString> getPackages() const;
 
+    /**
+     * @brief returns the installed versions for the specified packages
+     * @param packages full package names
+     * @return PackageVersion::getStringId() for all installed versions of the
+     *     specified packages sorted alphabetically
+     */
+    QStringList getInstalledStringIds(const QSet<QString>& packages) const;
+
     /**
      * @return [owner:caller] the first found package version with a missing
      *     dependency or 0
@@ -0,0 +1,326 @@
+#include "installedpackagesindex.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QObject>
+#include <QMap>
+#include <QSaveFile>
+#include <QtEndian>
+
+/** a package in write() */
+class IndexPackage
+{
+public:
+    quint64 hash;
+    QString name;
+    QList<InstalledPackageVersion*> versions;
+};
+
+static bool indexPackageLessThan(const IndexPackage& a, const IndexPackage& b)
+{
+    if (a.hash != b.hash)
+        return a.hash < b.hash;
+    return a.name < b.name;
+}
+
+static bool versionLessThan(const InstalledPackageVersion* a,
+        const InstalledPackageVersion* b)
+{
+    return a->version.compare(b->version) < 0;
+}
+
+static void appendUInt32(QByteArray* ba, quint32 v)
+{
+    uchar buffer[4];
+    qToLittleEndian(v, buffer);
+    ba->append(reinterpret_cast<const char*>(buffer), 4);
+}
+
+static void appendUInt64(QByteArray* ba, quint64 v)
+{
+    uchar buffer[8];
+    qToLittleEndian(v, buffer);
+    ba->append(reinterpret_cast<const char*>(buffer), 8);
+}
+
+/**
+ * @brief appends a string to the string area
+ * @param strings string area
+ * @param start offset of the string area in the file
+ * @param s the string
+ * @param offset the offset of the string will be stored here
+ */
+static void appendString(QByteArray* strings, quint32 start, const QString& s,
+        quint32* offset)
+{
+    *offset = start + static_cast<quint32>(strings->size());
+    for (int i = 0; i < s.length(); i++) {
+        uchar buffer[2];
+        qToLittleEndian(s.at(i).unicode(), buffer);
+        strings->append(reinterpret_cast<const char*>(buffer), 2);
+    }
+}
+
+InstalledPackagesIndex::InstalledPackagesIndex(): data(nullptr), size(0),
+        packageCount(0), versionCount(0)
+{
+}
+
+InstalledPackagesIndex::~InstalledPackagesIndex()
+{
+    close();
+}
+
+quint64 InstalledPackagesIndex::hash(const QString &package)
+{
+    quint64 h = 14695981039346656037ULL;
+    for (int i = 0; i < package.length(); i++) {
+        ushort c = package.at(i).unicode();
+        h ^= c & 0xff;
+        h *= 1099511628211ULL;
+        h ^= c >> 8;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+QString InstalledPackagesIndex::write(const QString &filename, qint64 stamp,
+        const QList<InstalledPackageVersion*>& ipvs)
+{
+    QMap<QString, IndexPackage> byName;
+    int n = 0;
+    for (int i = 0; i < ipvs.count(); i++) {
+        InstalledPackageVersion* ipv = ipvs.at(i);
+        if (!ipv->directory.isEmpty()) {
+            IndexPackage& p = byName[ipv->package];
+            p.name = ipv->package;
+            p.hash = hash(ipv->package);
+            p.versions.append(ipv);
+            n++;
+        }
+    }
+
+    QList<IndexPackage> packages = byName.values();
+    std::sort(packages.begin(), packages.end(), indexPackageLessThan);
+
+    quint32 start = static_cast<quint32>(HEADER_SIZE +
+            packages.count() * PACKAGE_SIZE + n * VERSION_SIZE);
+
+    QByteArray header;
+    header.append("NPKI", 4);
+    appendUInt32(&header, 1);
+    appendUInt64(&header, static_cast<quint64>(stamp));
+    appendUInt32(&header, static_cast<quint32>(packages.count()));
+    appendUInt32(&header, static_cast<quint32>(n));
+
+    QByteArray packageTable, versionTable, strings;
+    quint32 first = 0;
+    for (int i = 0; i < packages.count(); i++) {
+        IndexPackage& p = packages[i];
+        std::sort(p.versions.begin(), p.versions.end(), versionLessThan);
+
+        quint32 offset;
+        appendString(&strings, start, p.name, &offset);
+        appendUInt64(&packageTable, p.hash);
+        appendUInt32(&packageTable, offset);
+        appendUInt32(&packageTable, static_cast<quint32>(p.name.length()));
+        appendUInt32(&packageTable, first);
+        appendUInt32(&packageTable, static_cast<quint32>(p.versions.count()));
+
+        for (int j = 0; j < p.versions.count(); j++) {
+            InstalledPackageVersion* ipv = p.versions.at(j);
+            QString version = ipv->version.getVersionString();
+
+            appendString(&strings, start, version, &offset);
+            appendUInt32(&versionTable, offset);
+            appendUInt32(&versionTable, static_cast<quint32>(version.length()));
+            appendString(&strings, start, ipv->directory, &offset);
+            appendUInt32(&versionTable, offset);
+            appendUInt32(&versionTable,
+                    static_cast<quint32>(ipv->directory.length()));
+        }
+
+        first += static_cast<quint32>(p.versions.count());
+    }
+
+    QString err;
+
+    // QSaveFile writes a temporary file and renames it at the end
+    QSaveFile f(filename);
+    if (!f.open(QIODevice::WriteOnly))
+        err = f.errorString();
+    if (err.isEmpty()) {
+        if (f.write(header) != header.size() ||
+                f.write(packageTable) != packageTable.size() ||
+                f.write(versionTable) != versionTable.size() ||
+                f.write(strings) != strings.size())
+            err = f.errorString();
+    }
+    if (err.isEmpty()) {
+        if (!f.commit())
+            err = f.errorString();
+    } else {
+        f.cancelWriting();
+    }
+
+    return err;
+}
+
+QString InstalledPackagesIndex::open(const QString &filename)
+{
+    close();
+
+    QString err;
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        err = file.errorString();
+
+    if (err.isEmpty()) {
+        size = file.size();
+        if (size < HEADER_SIZE)
+            err = QObject::tr("Invalid index file %1").arg(filename);
+    }
+
+    if (err.isEmpty()) {
+        data = file.map(0, size);
+        if (!data)
+            err = file.errorString();
+    }
+
+    if (err.isEmpty()) {
+        packageCount = qFromLittleEndian<quint32>(data + 16);
+        versionCount = qFromLittleEndian<quint32>(data + 20);
+        if (memcmp(data, "NPKI", 4) != 0 ||
+                qFromLittleEndian<quint32>(data + 4) != 1 ||
+                HEADER_SIZE + static_cast<qint64>(packageCount) * PACKAGE_SIZE +
+                static_cast<qint64>(versionCount) * VERSION_SIZE > size)
+            err = QObject::tr("Invalid index file %1").arg(filename);
+    }
+
+    if (!err.isEmpty())
+        close();
+
+    return err;
+}
+
+void InstalledPackagesIndex::close()
+{
+    if (data)
+        file.unmap(data);
+    data = nullptr;
+    file.close();
+    size = 0;
+    packageCount = 0;
+    versionCount = 0;
+}
+
+qint64 InstalledPackagesIndex::getStamp() const
+{
+    if (!data)
+        return -1;
+    return static_cast<qint64>(qFromLittleEndian<quint64>(data + 8));
+}
+
+int InstalledPackagesIndex::count() const
+{
+    return static_cast<int>(versionCount);
+}
+
+QString InstalledPackagesIndex::readString(quint32 offset, quint32 length,
+        bool* ok) const
+{
+    QString r;
+    if (static_cast<qint64>(offset) + static_cast<qint64>(length) * 2 > size) {
+        *ok = false;
+    } else {
+        r.resize(static_cast<int>(length));
+        for (quint32 i = 0; i < length; i++) {
+            r[static_cast<int>(i)] = QChar(qFromLittleEndian<quint16>(
+                    data + offset + i * 2));
+        }
+    }
+    return r;
+}
+
+QString InstalledPackagesIndex::getPackageName(quint32 index) const
+{
+    const uchar* p = data + HEADER_SIZE + index * PACKAGE_SIZE;
+    bool ok = true;
+    QString r = readString(qFromLittleEndian<quint32>(p + 8),
+            qFromLittleEndian<quint32>(p + 12), &ok);
+    return ok ? r : QString();
+}
+
+QList<InstalledPackageVersion*> InstalledPackagesIndex::find(
+        const QString &package) const
+{
+    QList<InstalledPackageVersion*> r;
+    if (!data)
+        return r;
+
+    quint64 h = hash(package);
+
+    // the first package with the hash
+    quint32 low = 0, high = packageCount;
+    while (low < high) {
+        quint32 mid = low + (high - low) / 2;
+        quint64 v = qFromLittleEndian<quint64>(
+                data + HEADER_SIZE + mid * PACKAGE_SIZE);
+        if (v < h)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // different packages may have the same hash
+    for (quint32 i = low; i < packageCount; i++) {
+        const uchar* p = data + HEADER_SIZE + i * PACKAGE_SIZE;
+        if (qFromLittleEndian<quint64>(p) != h)
+            break;
+        if (getPackageName(i) != package)
+            continue;
+
+        readVersions(i, package, &r);
+        break;
+    }
+
+    return r;
+}
+
+QList<InstalledPackageVersion*> InstalledPackagesIndex::getAll() const
+{
+    QList<InstalledPackageVersion*> r;
+
+    for (quint32 i = 0; i < packageCount; i++) {
+        QString package = getPackageName(i);
+        if (!package.isEmpty())
+            readVersions(i, package, &r);
+    }
+
+    return r;
+}
+
+void InstalledPackagesIndex::readVersions(quint32 index,
+        const QString& package, QList<InstalledPackageVersion*>* r) const
+{
+    const uchar* p = data + HEADER_SIZE + index * PACKAGE_SIZE;
+    quint32 first = qFromLittleEndian<quint32>(p + 16);
+    quint32 n = qFromLittleEndian<quint32>(p + 20);
+    if (static_cast<qint64>(first) + n > versionCount)
+        return;
+
+    const uchar* versions = data + HEADER_SIZE + packageCount * PACKAGE_SIZE;
+    for (quint32 j = first; j < first + n; j++) {
+        const uchar* e = versions + j * VERSION_SIZE;
+        bool ok = true;
+        QString version = readString(qFromLittleEndian<quint32>(e),
+                qFromLittleEndian<quint32>(e + 4), &ok);
+        QString path = readString(qFromLittleEndian<quint32>(e + 8),
+                qFromLittleEndian<quint32>(e + 12), &ok);
+        Version v;
+        if (ok && v.setVersion(version))
+            r->append(new InstalledPackageVersion(package, v, path));
+    }
+}
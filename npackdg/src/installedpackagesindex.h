@@ -0,0 +1,134 @@
+#ifndef INSTALLEDPACKAGESINDEX_H
+#define INSTALLEDPACKAGESINDEX_H
+
+#include <stdint.h>
+
+#include <QString>
+#include <QList>
+#include <QFile>
+
+#include "installedpackageversion.h"
+
+/**
+ * @brief a compact file with the installed package versions for fast look-ups
+ *     without enumerating the Windows registry (e.g. for "ncl path").
+ *
+ * The file is memory mapped. Packages are found by the 64-bit FNV-1a hash of
+ * the name using a binary search. The versions of a package are sorted in
+ * ascending order.
+ *
+ * Layout (all numbers are little-endian):
+ *     header: "NPKI", format version (uint32), stamp (int64),
+ *         number of packages (uint32), number of versions (uint32)
+ *     packages sorted by the hash and the name: hash (uint64),
+ *         name offset (uint32), name length (uint32), index of the first
+ *         version (uint32), number of versions (uint32)
+ *     versions: version offset (uint32), version length (uint32),
+ *         path offset (uint32), path length (uint32)
+ *     strings in UTF-16. Offsets are in bytes from the beginning of the
+ *         file, lengths are in UTF-16 code units.
+ *
+ * The file does not depend on the Windows registry. The stamp is used by the
+ * caller to detect an outdated index.
+ */
+class InstalledPackagesIndex
+{
+private:
+    static const int HEADER_SIZE = 24;
+    static const int PACKAGE_SIZE = 24;
+    static const int VERSION_SIZE = 16;
+
+    QFile file;
+
+    /** mapped file or 0 */
+    uchar* data;
+
+    qint64 size;
+
+    quint32 packageCount;
+
+    quint32 versionCount;
+
+    /**
+     * @param offset offset in bytes
+     * @param length number of UTF-16 code units
+     * @param ok will be set to false if the string is outside of the file
+     * @return the string
+     */
+    QString readString(quint32 offset, quint32 length, bool* ok) const;
+
+    /**
+     * @param index index of a package
+     * @return name of the package or "" if the file is damaged
+     */
+    QString getPackageName(quint32 index) const;
+
+    /**
+     * @param index index of a package
+     * @param package name of the package
+     * @param r [ownership:caller] the versions of the package will be
+     *     appended here
+     */
+    void readVersions(quint32 index, const QString& package,
+            QList<InstalledPackageVersion*>* r) const;
+public:
+    InstalledPackagesIndex();
+
+    ~InstalledPackagesIndex();
+
+    /**
+     * @brief computes the 64-bit FNV-1a hash sum for a package name. The value
+     *     is stored in the file and does not depend on the process.
+     * @param package full package name
+     * @return hash sum
+     */
+    static quint64 hash(const QString& package);
+
+    /**
+     * @brief writes an index atomically. A new file is created and renamed.
+     * @param filename the file
+     * @param stamp value for getStamp()
+     * @param ipvs installed package versions. Entries without a directory are
+     *     ignored.
+     * @return error message
+     */
+    static QString write(const QString& filename, qint64 stamp,
+            const QList<InstalledPackageVersion*>& ipvs);
+
+    /**
+     * @brief opens and maps an index. A previously opened file will be
+     *     closed.
+     * @param filename the file
+     * @return error message
+     */
+    QString open(const QString& filename);
+
+    /**
+     * @brief closes the file
+     */
+    void close();
+
+    /**
+     * @return the value stored by write() or -1 if no file is open
+     */
+    qint64 getStamp() const;
+
+    /**
+     * @return number of package versions
+     */
+    int count() const;
+
+    /**
+     * @brief searches for the installed versions of a package
+     * @param package full package name
+     * @return [ownership:caller] installed versions sorted in ascending order
+     */
+    QList<InstalledPackageVersion*> find(const QString& package) const;
+
+    /**
+     * @return [ownership:caller] all package versions
+     */
+    QList<InstalledPackageVersion*> getAll() const;
+};
+
+#endif // INSTALLEDPACKAGESINDEX_H
@@ -1,4 +1,8 @@
 #include "installoperation.h"
+
+#include <QHash>
+#include <QVector>
+
 #include "dbrepository.h"
 #include "abstractrepository.h"
 
@@ -26,27 +30,38 @@ QString InstallOperation::toString() const
             (install ? "install" : "uninstall");
 }
 
-void InstallOperation::simplify(QList<InstallOperation*> ops)
+void InstallOperation::simplify(QList<InstallOperation*>& ops)
 {
-    for (int i = 0; i < ops.size(); ) {
-        InstallOperation* op = ops.at(i);
+    // PackageVersion::getStringId() -> indexes of the uninstallations that
+    // are not yet paired with an installation
+    QHash<QString, QList<int> > uninstalls;
+    QVector<bool> removed(ops.size(), false);
+    bool changed = false;
 
-        int found = -1;
-        for (int j = i + 1; j < ops.size(); j++) {
-            InstallOperation* op2 = ops.at(j);
-            if (op->package == op2->package &&
-                    op->version == op2->version &&
-                    !op->install && op2->install) {
-                found = j;
-                break;
+    for (int i = 0; i < ops.size(); i++) {
+        InstallOperation* op = ops.at(i);
+        QString id = PackageVersion::getStringId(op->package, op->version);
+        if (!op->install) {
+            uninstalls[id].append(i);
+        } else {
+            QHash<QString, QList<int> >::iterator it = uninstalls.find(id);
+            if (it != uninstalls.end() && !it.value().isEmpty()) {
+                removed[it.value().takeFirst()] = true;
+                removed[i] = true;
+                changed = true;
             }
         }
+    }
 
-        if (found >= 0) {
-            delete ops.takeAt(i);
-            delete ops.takeAt(found);
-        } else {
-            i++;
+    if (changed) {
+        QList<InstallOperation*> r;
+        r.reserve(ops.size());
+        for (int i = 0; i < ops.size(); i++) {
+            if (removed.at(i))
+                delete ops.at(i);
+            else
+                r.append(ops.at(i));
         }
+        ops = r;
     }
 }
@@ -53,12 +53,14 @@ public:
     QString toString() const;
 
     /**
-     * Simplifies a list of operations.
+     * Simplifies a list of operations. An uninstallation of a package version
+     * followed later by an installation of the same package version is
+     * removed. The running time is linear.
      *
      * @param ops a list of operations. The list will be modified and
      *     unnecessary operations removed and the objects destroyed.
      */
-    static void simplify(QList<InstallOperation*> ops);
+    static void simplify(QList<InstallOperation*>& ops);
 };
 
 #endif // INSTALLOPERATION_H
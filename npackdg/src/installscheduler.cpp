@@ -0,0 +1,123 @@
+#include "installscheduler.h"
+
+#include "dependency.h"
+#include "wpmutils.h"
+
+bool InstallScheduler::conflicts(const QString &a, const QString &b)
+{
+    if (a.isEmpty() || b.isEmpty())
+        return false;
+
+    return WPMUtils::isUnderOrEquals(a, b) || WPMUtils::isUnderOrEquals(b, a);
+}
+
+InstallScheduler::InstallScheduler(const QList<InstallOperation *> &ops,
+        const QList<PackageVersion *> &pvs, int width): width(width),
+        running(0), exclusiveRunning(false)
+{
+    if (this->width < 1)
+        this->width = 1;
+
+    // the directory changed by each operation
+    QStringList dirs;
+    for (int i = 0; i < ops.count(); i++) {
+        InstallOperation* op = ops.at(i);
+        PackageVersion* pv = pvs.at(i);
+        QString dir;
+        if (op->install) {
+            dir = op->where;
+            if (dir.isEmpty())
+                dir = pv->getIdealInstallationDirectory();
+        } else {
+            dir = pv->getPath();
+        }
+        dirs.append(dir);
+    }
+
+    for (int j = 0; j < ops.count(); j++) {
+        PackageVersion* pvj = pvs.at(j);
+        QList<int> p;
+        for (int i = 0; i < j; i++) {
+            PackageVersion* pvi = pvs.at(i);
+
+            bool dep = this->width == 1 || pvi->exclusive || pvj->exclusive ||
+                    pvi->package == pvj->package ||
+                    conflicts(dirs.at(i), dirs.at(j));
+            for (int k = 0; !dep && k < pvj->dependencies.count(); k++) {
+                if (pvj->dependencies.at(k)->package == pvi->package)
+                    dep = true;
+            }
+            for (int k = 0; !dep && k < pvi->dependencies.count(); k++) {
+                if (pvi->dependencies.at(k)->package == pvj->package)
+                    dep = true;
+            }
+
+            if (dep)
+                p.append(i);
+        }
+        predecessors.append(p);
+        exclusive.append(pvj->exclusive);
+        started.append(false);
+        finished_.append(false);
+    }
+}
+
+int InstallScheduler::takeNext()
+{
+    int r = -1;
+    if (running < width && !exclusiveRunning) {
+        for (int i = 0; i < predecessors.count(); i++) {
+            if (started.at(i))
+                continue;
+
+            if (exclusive.at(i) && running > 0)
+                continue;
+
+            const QList<int>& p = predecessors.at(i);
+            bool ready = true;
+            for (int j = 0; j < p.count(); j++) {
+                if (!finished_.at(p.at(j))) {
+                    ready = false;
+                    break;
+                }
+            }
+
+            if (ready) {
+                r = i;
+                break;
+            }
+        }
+    }
+
+    if (r >= 0) {
+        started[r] = true;
+        running++;
+        if (exclusive.at(r))
+            exclusiveRunning = true;
+    }
+
+    return r;
+}
+
+void InstallScheduler::finished(int index)
+{
+    finished_[index] = true;
+    running--;
+    if (exclusive.at(index))
+        exclusiveRunning = false;
+}
+
+int InstallScheduler::getRunningCount() const
+{
+    return running;
+}
+
+bool InstallScheduler::allStarted() const
+{
+    return !started.contains(false);
+}
+
+QList<int> InstallScheduler::getPredecessors(int index) const
+{
+    return predecessors.at(index);
+}
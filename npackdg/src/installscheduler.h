@@ -0,0 +1,96 @@
+#ifndef INSTALLSCHEDULER_H
+#define INSTALLSCHEDULER_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "installoperation.h"
+#include "packageversion.h"
+
+/**
+ * @brief decides which installation operations can run in parallel.
+ *
+ * The operations form a directed acyclic graph. An operation depends on
+ * all previous operations in the list that
+ *
+ * - change the same package
+ * - change a package that it depends on or that depends on it
+ * - use the same directory or a directory inside the other one
+ *
+ * A package version with PackageVersion::exclusive = true runs alone. The
+ * operations are started in the order of the list if possible.
+ */
+class InstallScheduler
+{
+private:
+    /**
+     * indexes of the operations that must be finished before the operation
+     * with the same index can start
+     */
+    QList<QList<int> > predecessors;
+
+    /** true = the operation must run alone */
+    QList<bool> exclusive;
+
+    QList<bool> started;
+
+    QList<bool> finished_;
+
+    /** maximum number of operations running in parallel */
+    int width;
+
+    /** number of currently running operations */
+    int running;
+
+    /** true if an exclusive operation is running */
+    bool exclusiveRunning;
+
+    /**
+     * @param a first directory or ""
+     * @param b second directory or ""
+     * @return true if the directories are equal or one is inside the other
+     */
+    static bool conflicts(const QString& a, const QString& b);
+public:
+    /**
+     * @param ops operations in the planned order
+     * @param pvs package versions for the operations (the same indexes)
+     * @param width maximum number of operations running in parallel. 1 means
+     *     that the operations are executed one after another in the order of
+     *     the list.
+     */
+    InstallScheduler(const QList<InstallOperation*>& ops,
+            const QList<PackageVersion*>& pvs, int width);
+
+    /**
+     * @brief searches for an operation that can be started now and marks it as
+     *     started
+     * @return index of the operation or -1
+     */
+    int takeNext();
+
+    /**
+     * @brief should be called after an operation was finished
+     * @param index index of the operation
+     */
+    void finished(int index);
+
+    /**
+     * @return number of operations that were started, but not yet finished
+     */
+    int getRunningCount() const;
+
+    /**
+     * @return true if all operations were started
+     */
+    bool allStarted() const;
+
+    /**
+     * @param index index of an operation
+     * @return indexes of the operations that must be finished before this one
+     */
+    QList<int> getPredecessors(int index) const;
+};
+
+#endif // INSTALLSCHEDULER_H
@@ -62,6 +62,7 @@
 #include "exportrepositoryframe.h"
 #include "asyncdownloader.h"
 #include "uimessagehandler.h"
+#include "downloadstatistics.h"
 
 extern HWND defaultPasswordWindow;
 
@@ -163,6 +164,10 @@ MainWindow::MainWindow(QWidget *parent) :
     MainWindow::waitAppIcon = QIcon(":/images/wait.png");
     this->brokenIcon = QIcon(":/images/broken.png");
 
+    // decoded images. The scaled files are stored on the disk by FileLoader.
+    this->icons.setMaxCost(2000);
+    this->screenshots.setMaxCost(50);
+
     this->mainFrame = new MainFrame(this);
 
     updateActions();
@@ -544,6 +549,10 @@ void MainWindow::repositoryStatusChanged(const QString& package,
 void MainWindow::downloadCompleted(const QString& url,
         const QString& /*filename*/, const QString& /*error*/)
 {
+    // the image may have been replaced by a newer version
+    icons.remove(url);
+    screenshots.remove(url);
+
     updateIcon(url);
 }
 
@@ -623,6 +632,8 @@ MainWindow::~MainWindow()
     DownloadSizeFinder::threadPool.clear();
     DownloadSizeFinder::threadPool.waitForDone(-1);
 
+    DownloadStatistics::flush();
+
     delete ui;
 }
 
@@ -634,7 +645,7 @@ QIcon MainWindow::downloadIcon(const QString &url)
         r = *inCache;
     } else {
         QString err;
-        QString file = fileLoader.downloadOrQueue(url, &err);
+        QString file = fileLoader.downloadOrQueue(url, &err, 32);
         if (!err.isEmpty()) {
             r = MainWindow::genericAppIcon;
         } else if (!file.isEmpty()) {
@@ -647,9 +658,6 @@ QIcon MainWindow::downloadIcon(const QString &url)
             */
 
             if (!pm.isNull()) {
-                pm = pm.scaled(32, 32, Qt::KeepAspectRatio,
-                        Qt::SmoothTransformation);
-
                 inCache = new QIcon(pm);
                 inCache->detach();
 
@@ -672,11 +680,12 @@ QIcon MainWindow::downloadIcon(const QString &url)
 QIcon MainWindow::downloadScreenshot(const QString &url)
 {
     QIcon r;
-    if (screenshots.contains(url)) {
-        r = screenshots[url];
+    QIcon* inCache = screenshots.object(url);
+    if (inCache) {
+        r = *inCache;
     } else {
         QString err;
-        QString filename = fileLoader.downloadOrQueue(url, &err);
+        QString filename = fileLoader.downloadOrQueue(url, &err, 200);
 
         if (!err.isEmpty()) {
             r = MainWindow::brokenIcon;
@@ -691,15 +700,13 @@ QIcon MainWindow::downloadScreenshot(const QString &url)
             */
 
             if (!pm.isNull()) {
-                pm = pm.scaled(200, 200, Qt::KeepAspectRatio,
-                        Qt::SmoothTransformation);
                 r.addPixmap(pm);
                 r.detach();
 
-                screenshots.insert(url, r);
+                screenshots.insert(url, new QIcon(r));
             } else {
                 r = MainWindow::brokenIcon;
-                screenshots.insert(url, r);
+                screenshots.insert(url, new QIcon(r));
             }
         } else {
             r = MainWindow::waitAppIcon;
@@ -62,7 +62,8 @@ private:
     UINT taskbarMessageId;
     ITaskbarList3* taskbarInterface;
 
-    QMap<QString, QIcon> screenshots;
+    /** URL -> screenshot scaled down to 200x200 */
+    QCache<QString, QIcon> screenshots;
 
     /**
      * @brief URL -> download size
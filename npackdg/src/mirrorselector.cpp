@@ -0,0 +1,197 @@
+#include "mirrorselector.h"
+
+#include <QFile>
+#include <QTemporaryFile>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QLoggingCategory>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include "downloader.h"
+#include "dbrepository.h"
+#include "wpmutils.h"
+
+QMutex MirrorSelector::mutex;
+
+QList<HostStats> MirrorSelector::hosts;
+
+QThreadPool MirrorSelector::probeThreadPool;
+
+QString MirrorSelector::getHost(const QUrl& url)
+{
+    QString r = url.host().toLower();
+    if (url.scheme() == "file")
+        r.prepend("file:");
+    else if (url.port() >= 0)
+        r.append(':').append(QString::number(url.port()));
+    return r;
+}
+
+HostStats MirrorSelector::findStats(const QString& host)
+{
+    for (int i = 0; i < hosts.count(); i++) {
+        if (hosts.at(i).host == host)
+            return hosts.at(i);
+    }
+
+    QString err;
+    HostStats r = DBRepository::getDefault()->findHostStats(host, &err);
+    if (!err.isEmpty()) {
+        qCDebug(npackd) << "MirrorSelector: cannot read the statistics for" <<
+                host << err;
+        r = HostStats(host);
+    }
+    hosts.append(r);
+
+    return r;
+}
+
+void MirrorSelector::saveStats(const HostStats& stats)
+{
+    for (int i = 0; i < hosts.count(); i++) {
+        if (hosts.at(i).host == stats.host) {
+            hosts[i] = stats;
+            break;
+        }
+    }
+
+    QString err = DBRepository::getDefault()->saveHostStats(stats);
+    if (!err.isEmpty())
+        qCDebug(npackd) << "MirrorSelector: cannot save the statistics for" <<
+                stats.host << err;
+}
+
+HostStats MirrorSelector::getStats(const QUrl& url)
+{
+    QMutexLocker ml(&mutex);
+
+    return findStats(getHost(url));
+}
+
+void MirrorSelector::probe(Job* job, const QUrl& url, QSemaphore* done)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int64_t bytes = 0;
+    if (url.scheme() == "file") {
+        // the whole file would be copied by the Downloader
+        QFile f(url.toLocalFile());
+        if (f.open(QIODevice::ReadOnly)) {
+            bytes = f.read(PROBE_SIZE).size();
+            f.close();
+        } else {
+            job->setErrorMessage(QObject::tr("Error opening file: %1").
+                    arg(f.fileName()));
+        }
+        job->complete();
+    } else {
+        // the data is stored so that the number of received bytes is known
+        QTemporaryFile f;
+        if (f.open()) {
+            Downloader::Request request(url);
+            request.file = &f;
+            request.interactive = false;
+            request.useCache = false;
+            request.keepConnection = false;
+            request.timeout = 10;
+            request.rangeFrom = 0;
+            request.rangeTo = PROBE_SIZE - 1;
+            Downloader::download(job, request);
+            bytes = f.size();
+            f.close();
+        } else {
+            job->setErrorMessage(f.errorString());
+            job->complete();
+        }
+    }
+
+    double seconds = timer.elapsed() / 1000.0;
+
+    if (!job->isCancelled()) {
+        QMutexLocker ml(&mutex);
+
+        HostStats s = findStats(getHost(url));
+        s.update(bytes, seconds, job->getErrorMessage().isEmpty(), true);
+        saveStats(s);
+
+        qCDebug(npackd) << "MirrorSelector::probe" << url << seconds <<
+                job->getErrorMessage();
+    }
+
+    done->release();
+}
+
+QList<QUrl> MirrorSelector::order(Job* job, const QList<QUrl>& urls)
+{
+    // one probe per host without current statistics
+    time_t now = time(nullptr);
+    QList<QUrl> probes;
+    QStringList probed;
+    for (int i = 0; i < urls.count(); i++) {
+        QString host = getHost(urls.at(i));
+        if (!probed.contains(host)) {
+            probed.append(host);
+            HostStats s = getStats(urls.at(i));
+            if (s.modified == 0 || now - s.modified > MAX_AGE)
+                probes.append(urls.at(i));
+        }
+    }
+
+    // all probes run at the same time and the slow ones are limited by the
+    // timeout
+    if (!probes.isEmpty()) {
+        if (probeThreadPool.maxThreadCount() < 8)
+            probeThreadPool.setMaxThreadCount(8);
+
+        QSemaphore done;
+        QList<Job*> subs;
+        for (int i = 0; i < probes.count(); i++) {
+            Job* sub = job->newSubJob(0.9 / probes.count(),
+                    QString(QObject::tr("Probing %1")).arg(
+                    getHost(probes.at(i))), true, false);
+            subs.append(sub);
+            QtConcurrent::run(&probeThreadPool, &MirrorSelector::probe, sub,
+                    probes.at(i), &done);
+        }
+
+        while (!done.tryAcquire(probes.count(), 100)) {
+            if (job->isCancelled()) {
+                for (int j = 0; j < subs.count(); j++) {
+                    subs.at(j)->cancel();
+                }
+            }
+        }
+    }
+
+    // stable insertion sort by the score
+    QList<QUrl> r;
+    QList<double> scores;
+    for (int i = 0; i < urls.count(); i++) {
+        double score = getStats(urls.at(i)).getScore();
+        int j = 0;
+        while (j < scores.count() && scores.at(j) <= score)
+            j++;
+        r.insert(j, urls.at(i));
+        scores.insert(j, score);
+    }
+
+    qCDebug(npackd) << "MirrorSelector::order" << r << scores;
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->complete();
+
+    return r;
+}
+
+void MirrorSelector::record(const QUrl& url, int64_t bytes, double seconds,
+        bool ok)
+{
+    QMutexLocker ml(&mutex);
+
+    HostStats s = findStats(getHost(url));
+    s.update(bytes, seconds, ok, false);
+    saveStats(s);
+}
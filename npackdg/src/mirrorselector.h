@@ -0,0 +1,97 @@
+#ifndef MIRRORSELECTOR_H
+#define MIRRORSELECTOR_H
+
+#include <QList>
+#include <QUrl>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThreadPool>
+
+#include "job.h"
+#include "hoststats.h"
+
+/**
+ * @brief chooses the fastest mirror for a download.
+ *
+ * The latency and the throughput are stored for each host in the local
+ * database (see HostStats). Hosts without current information are probed in
+ * parallel with a small ranged request. The statistics are updated after
+ * each download.
+ *
+ * @threadsafe
+ */
+class MirrorSelector
+{
+private:
+    /** number of bytes requested by a probe */
+    static const int PROBE_SIZE = 64 * 1024;
+
+    /** statistics older than this number of seconds are probed again */
+    static const int MAX_AGE = 24 * 60 * 60;
+
+    static QMutex mutex;
+
+    /**
+     * statistics for the hosts that were used since the start of the program.
+     * This information is also used if the database is not available.
+     */
+    static QList<HostStats> hosts;
+
+    /** threads for the probes */
+    static QThreadPool probeThreadPool;
+
+    /**
+     * @param url URL
+     * @return key for the statistics
+     */
+    static QString getHost(const QUrl& url);
+
+    /**
+     * @param host host name
+     * @return statistics from the memory or the database. The mutex should
+     *     be locked.
+     */
+    static HostStats findStats(const QString& host);
+
+    /**
+     * @brief stores the statistics in the memory and the database. The mutex
+     *     should be locked.
+     * @param stats statistics
+     */
+    static void saveStats(const HostStats& stats);
+
+    /**
+     * @brief downloads the first bytes from an URL and updates the statistics
+     * @param job job
+     * @param url URL
+     * @param done will be released at the end
+     */
+    static void probe(Job* job, const QUrl& url, QSemaphore* done);
+public:
+    /**
+     * @brief sorts the URLs from the fastest to the slowest. Hosts without
+     *     current statistics are probed in parallel.
+     * @param job job
+     * @param urls http:, https: or file: URLs
+     * @return the same URLs in a different order
+     */
+    static QList<QUrl> order(Job* job, const QList<QUrl>& urls);
+
+    /**
+     * @brief updates the statistics after a download
+     * @param url the downloaded URL
+     * @param bytes number of transferred bytes
+     * @param seconds duration of the download
+     * @param ok true = the download was successful
+     */
+    static void record(const QUrl& url, int64_t bytes, double seconds,
+            bool ok);
+
+    /**
+     * @param url URL
+     * @return current statistics for the host of the URL
+     */
+    static HostStats getStats(const QUrl& url);
+};
+
+#endif // MIRRORSELECTOR_H
@@ -3,6 +3,13 @@
 #include "mysqlquery.h"
 #include "wpmutils.h"
 
+QAtomicInt MySQLQuery::execCount;
+
+int MySQLQuery::getExecCount()
+{
+    return execCount.load();
+}
+
 MySQLQuery::MySQLQuery(QSqlDatabase db) : QSqlQuery(db)
 {
 }
@@ -11,6 +18,8 @@ bool MySQLQuery::exec(const QString &query)
 {
     qCDebug(npackd) << query;
 
+    execCount.ref();
+
     bool e = npackd().isDebugEnabled();
 
     DWORD start = 0;
@@ -30,6 +39,8 @@ bool MySQLQuery::exec()
 {
     qCDebug(npackd) << this->lastQuery();
 
+    execCount.ref();
+
     bool e = npackd().isDebugEnabled();
 
     DWORD start = 0;
@@ -3,12 +3,22 @@
 
 #include <QSqlQuery>
 #include <QSqlDatabase>
+#include <QAtomicInt>
 
 /**
  * @brief SQL query
  */
 class MySQLQuery: public QSqlQuery {
+private:
+    /** number of executed queries */
+    static QAtomicInt execCount;
 public:
+    /**
+     * @return number of queries executed by all objects of this class since
+     *     the program start
+     */
+    static int getExecCount();
+
     explicit MySQLQuery(QSqlDatabase db);
     bool exec(const QString& query);
     bool exec();
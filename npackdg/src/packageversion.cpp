@@ -19,6 +19,7 @@
 #include <QTemporaryDir>
 #include <QJsonArray>
 #include <QBuffer>
+#include <QElapsedTimer>
 
 #include <zlib.h>
 
@@ -35,10 +36,15 @@
 #include "windowsregistry.h"
 #include "installedpackages.h"
 #include "installedpackageversion.h"
+#include "deltaupdate.h"
 #include "dbrepository.h"
 #include "repositoryxmlhandler.h"
+#include "dependencysolver.h"
+#include "downloadcache.h"
+#include "zipstreamextractor.h"
+#include "mirrorselector.h"
 
-QSemaphore PackageVersion::httpConnections(3);
+int PackageVersion::downloadSegments = 4;
 QSet<QString> PackageVersion::lockedPackageVersions;
 QMutex PackageVersion::lockedPackageVersionsMutex(QMutex::Recursive);
 
@@ -194,6 +200,11 @@ bool isFileSafeOfficeAntiVirus(const QString& filename, QString* err)
 }
 */
 
+void PackageVersion::setDownloadSegments(int n)
+{
+    downloadSegments = n < 1 ? 1 : n;
+}
+
 int PackageVersion::indexOf(const QList<PackageVersion*> pvs, PackageVersion* f)
 {
     int r = -1;
@@ -239,6 +250,7 @@ PackageVersion::PackageVersion(const QString& package)
 {
     this->package = package;
     this->type = 0;
+    this->exclusive = false;
     this->hashSumType = QCryptographicHash::Sha1;
 }
 
@@ -247,6 +259,7 @@ version(version)
 {
     this->package = package;
     this->type = 0;
+    this->exclusive = false;
     this->hashSumType = QCryptographicHash::Sha1;
 }
 
@@ -254,6 +267,7 @@ PackageVersion::PackageVersion()
 {
     this->package = "unknown";
     this->type = 0;
+    this->exclusive = false;
     this->hashSumType = QCryptographicHash::Sha1;
 }
 
@@ -652,107 +666,8 @@ QString PackageVersion::planInstallation(InstalledPackages &installed,
         QList<InstallOperation*>& ops, QList<PackageVersion*>& avoid,
         const QString& where)
 {
-    QString res;
-
-    avoid.append(this->clone());
-
-    DBRepository* rep = DBRepository::getDefault();
-
-    for (int i = 0; i < this->dependencies.count(); i++) {
-        Dependency* d = this->dependencies.at(i);
-        bool depok = installed.isInstalled(*d);
-        if (!depok) {
-            // we cannot just use Dependency->findBestMatchToInstall here as
-            // it is possible that the highest match cannot be installed because
-            // of unsatisfied dependencies. Example: the newest version depends
-            // on Windows Vista, but the current operating system is XP.
-
-            /* old code:
-            QString err;
-            _ScopedPointer<PackageVersion> pv(d->findBestMatchToInstall(avoid,
-                    &err));
-            if (!err.isEmpty()) {
-                res = QString(QObject::tr("Error searching for the best dependency match: %1")).
-                           arg(err);
-                break;
-            }
-
-            if (!pv) {
-                res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                           arg(d->toString());
-                break;
-            } else {
-                res = pv->planInstallation(installed, ops, avoid);
-                if (!res.isEmpty())
-                    break;
-            }
-            */
-
-            QString err;
-            QList<PackageVersion*> pvs = rep->findAllMatchesToInstall(
-                    *d, avoid, &err);
-            if (!err.isEmpty()) {
-                res = QString(QObject::tr("Error searching for the dependency matches: %1")).
-                           arg(err);
-                qDeleteAll(pvs);
-                break;
-            }
-            if (pvs.count() == 0) {
-                res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                           arg(rep->toString(*d));
-                break;
-            } else {
-                bool found = false;
-                for (int j = 0; j < pvs.count(); j++) {
-                    PackageVersion* pv = pvs.at(j);
-                    InstalledPackages installed2(installed);
-                    int opsCount = ops.count();
-                    int avoidCount = avoid.count();
-
-                    res = pv->planInstallation(installed2, ops, avoid);
-                    if (!res.isEmpty()) {
-                        // rollback
-                        while (ops.count() > opsCount) {
-                            delete ops.takeLast();
-                        }
-                        while (avoid.count() > avoidCount) {
-                            delete avoid.takeLast();
-                        }
-                    } else {
-                        found = true;
-                        installed = installed2;
-                        break;
-                    }
-                }
-                if (!found) {
-                    res = QString(QObject::tr("Unsatisfied dependency: %1")).
-                               arg(rep->toString(*d));
-                }
-            }
-            qDeleteAll(pvs);
-        }
-    }
-
-    if (res.isEmpty()) {
-        if (!installed.isInstalled(this->package, this->version)) {
-            InstallOperation* io = new InstallOperation();
-            io->install = true;
-            io->package = this->package;
-            io->version = this->version;
-            io->where = where;
-            ops.append(io);
-
-            QString where2 = where;
-            if (where2.isEmpty()) {
-                where2 = this->getIdealInstallationDirectory();
-                where2 = WPMUtils::findNonExistingFile(where2, "");
-            }
-            installed.setPackageVersionPath(this->package, this->version,
-                    where2, false);
-        }
-    }
-
-    return res;
+    DependencySolver solver(DBRepository::getDefault());
+    return solver.planInstallation(this, installed, ops, avoid, where);
 }
 
 QString PackageVersion::getFileExtension()
@@ -1380,7 +1295,7 @@ QString PackageVersion::getPreferredInstallationDirectory()
 
 QString PackageVersion::download_(Job* job, const QString& where,
         bool interactive, const QString user, const QString password,
-        const QString proxyUser, const QString proxyPassword)
+        const QString proxyUser, const QString proxyPassword, bool binaryOnly)
 {
     if (!this->download.isValid()) {
         job->setErrorMessage(QObject::tr("No download URL"));
@@ -1420,35 +1335,131 @@ QString PackageVersion::download_(Job* job, const QString& where,
     }
     job->setTitle(initialTitle);
 
-    bool httpConnectionAcquired = false;
+    // qCDebug(npackd) << "install.3";
+    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
+
+    DownloadCache* cache = DownloadCache::getDefault();
+
+    // a hard link is only used for .zip files as they are deleted after
+    // unpacking. Other binaries may be changed by the installation script.
+    bool link = this->type == 0 || binaryOnly;
+    bool cached = false;
+    if (job->shouldProceed() && !this->sha1.isEmpty()) {
+        cached = cache->copyTo(this->hashSumType, this->sha1, f->fileName(),
+                link);
+        if (cached) {
+            qCDebug(npackd) << "Using the cached download for" <<
+                    this->toString();
+            job->setProgress(0.9);
+        }
+    }
 
-    if (job->shouldProceed()) {
-        job->setTitle(initialTitle + " / " +
-                QObject::tr("Waiting for a free HTTP connection"));
+    // the HTTP connections are limited by the DownloadScheduler
+    if (job->shouldProceed() && !cached)
+        job->setProgress(0.05);
 
-        time_t start = time(nullptr);
-        while (!job->isCancelled()) {
-            httpConnectionAcquired = httpConnections.tryAcquire(1, 10000);
-            if (httpConnectionAcquired) {
-                job->setProgress(0.05);
+    bool downloadOK = cached;
+    QString dsha1;
+    if (cached)
+        dsha1 = this->sha1;
+
+    // the fastest mirror is used first
+    QList<QUrl> urls;
+    urls.append(this->download);
+    urls.append(this->mirrors);
+    if (job->shouldProceed() && !cached && urls.count() > 1) {
+        Job* sub = job->newSubJob(0.02, QObject::tr("Choosing a mirror"),
+                true, false);
+        urls = MirrorSelector::order(sub, urls);
+    }
+
+    // only the changed files are downloaded if another version is installed.
+    // The whole .zip file is downloaded if this fails. Nothing is added to
+    // the DownloadCache as the .zip file is not available.
+    bool delta = false;
+    QStringList changedFiles;
+    if (job->shouldProceed() && !cached && !binaryOnly && this->type == 0 &&
+            this->deltaManifest.isValid()) {
+        InstalledPackageVersion* ipv = InstalledPackages::getDefault()->
+                getNewestInstalled(this->package);
+        if (ipv && ipv->version != this->version &&
+                !ipv->getDirectory().isEmpty()) {
+            Job* sub = job->newSubJob(0.93,
+                    QObject::tr("Downloading the changed files"), false, false);
+
+            Downloader::Request request(urls.at(0));
+            request.user = user;
+            request.password = password;
+            request.proxyUser = proxyUser;
+            request.proxyPassword = proxyPassword;
+            request.interactive = interactive;
+            int64_t downloaded = 0;
+            DeltaUpdate::apply(sub, this->deltaManifest,
+                    this->deltaManifestSha256, request, ipv->getDirectory(),
+                    npackdDir + "\\DeltaStaging", f->fileName(),
+                    d.absolutePath(), &downloaded, &changedFiles);
+            if (sub->getErrorMessage().isEmpty() && !sub->isCancelled()) {
+                qCDebug(npackd) << "Delta update for" << this->toString() <<
+                        "downloaded" << downloaded << "bytes";
+                delta = true;
+            } else if (!sub->isCancelled()) {
+                qCWarning(npackd).noquote() << QObject::tr(
+                        "Cannot update %1 using the changed files only, downloading the whole file: %2").
+                        arg(this->toString(), sub->getErrorMessage());
+            }
+        }
+        delete ipv;
+    }
+
+    if (delta) {
+        // the downloaded files are checked instead of the .zip file
+        Job* sub = job->newSubJob(0.01, QObject::tr("Checking for viruses"));
+        for (int i = 0; i < changedFiles.count(); i++) {
+            QString file = d.absolutePath() + "\\" + changedFiles.at(i);
+            file.replace('/', '\\');
+            if (!isFileSafe(file, this->download.toString())) {
+                job->setErrorMessage(QObject::tr(
+                        "Antivirus check failed. The file %1 is not safe.").
+                        arg(changedFiles.at(i)));
                 break;
             }
-
-            time_t seconds = time(nullptr) - start;
-            job->setTitle(initialTitle + " / " + QString(
-                    QObject::tr("Waiting for a free HTTP connection (%1 minutes)")).
-                    arg(seconds / 60));
         }
+        sub->completeWithProgress();
+
+        if (job->shouldProceed())
+            job->setProgress(0.98);
+
+        QString errMsg;
+        if (job->shouldProceed())
+            errMsg = this->saveFiles(d);
+        if (!errMsg.isEmpty())
+            job->setErrorMessage(errMsg);
+        else if (job->shouldProceed())
+            job->setProgress(1);
+
+        delete f;
+
+        job->complete();
+        return "";
     }
-    job->setTitle(initialTitle);
 
-    // qCDebug(npackd) << "install.3";
-    QFile* f = new QFile(npackdDir + "\\__NpackdPackageDownload");
+    // ETag or Last-Modified for resuming the download
+    QString validator;
 
-    bool downloadOK = false;
-    QString dsha1;
+    // the URL of the successful download
+    QUrl source;
 
-    if (job->shouldProceed()) {
+    // true = the first download used several connections
+    bool segmented = false;
+
+    // .zip files are extracted in a staging directory during the download.
+    // The files are only used if the hash sum is correct.
+    ZipStreamExtractor* extractor = nullptr;
+    bool streamed = false;
+    if (this->type == 0 && !cached && !binaryOnly)
+        extractor = new ZipStreamExtractor(npackdDir + "\\Staging");
+
+    if (job->shouldProceed() && !cached) {
         if (!f->open(QIODevice::ReadWrite)) {
             job->setErrorMessage(QString(QObject::tr("Cannot open the file: %0")).
                     arg(f->fileName()));
@@ -1456,35 +1467,97 @@ QString PackageVersion::download_(Job* job, const QString& where,
             Job* djob = job->newSubJob(0.8,
                     QObject::tr("Downloading & computing hash sum"));
 
-            Downloader::Request request(this->download);
+            QElapsedTimer timer;
+            timer.start();
+
+            // a known size avoids the HEAD request for the segmented
+            // download
+            QString err;
+            int64_t size = DBRepository::getDefault()->findURLSize(
+                    urls.at(0).toString(), &err);
+
+            Downloader::Request request(urls.at(0));
             request.file = f;
             if (!this->sha1.isEmpty())
                 request.hashSum = true;
+            // the segments arrive out of order and cannot be extracted
+            // during the download. A .zip file is downloaded over one
+            // connection so that the extraction overlaps the download.
+            request.segments = extractor ? 1 : downloadSegments;
+            if (err.isEmpty() && size >= 0)
+                request.size = size;
             request.user = user;
             request.password = password;
             request.proxyUser = proxyUser;
             request.proxyPassword = proxyPassword;
             request.alg = this->hashSumType;
             request.interactive = interactive;
+            request.tee = extractor;
             Downloader::Response response = Downloader::download(djob, request);
             dsha1 = response.hashSum;
+            validator = response.validator;
+            streamed = response.teed;
             downloadOK = !djob->isCancelled() &&
                     djob->getErrorMessage().isEmpty();
+            if (downloadOK) {
+                source = urls.at(0);
+                segmented = request.segments > 1;
+            }
+            if (!djob->isCancelled())
+                MirrorSelector::record(urls.at(0), f->size(),
+                        timer.elapsed() / 1000.0, downloadOK);
             f->close();
         }
     }
 
     if (job->shouldProceed()) {
         if (!downloadOK) {
-            if (!f->open(QIODevice::ReadWrite)) {
-                job->setErrorMessage(QObject::tr("Cannot open the file: %0").
-                        arg(f->fileName()));
-            } else {
-                double rest = 0.9 - job->getProgress();
-                Job* djob = job->newSubJob(rest,
-                        QObject::tr("Downloading & computing hash sum (2nd try)"));
-                Downloader::Request request(this->download);
+            // the other mirrors are tried one after another. Without mirrors
+            // the same URL is tried again.
+            QList<QUrl> retries = urls.mid(1);
+            if (retries.isEmpty())
+                retries.append(urls.at(0));
+            QUrl previous = urls.at(0);
+
+            for (int i = 0; i < retries.count(); i++) {
+                const QUrl& url = retries.at(i);
+
+                if (!f->open(QIODevice::ReadWrite)) {
+                    job->setErrorMessage(QObject::tr("Cannot open the file: %0").
+                            arg(f->fileName()));
+                    break;
+                }
+
+                // the already downloaded data is re-used if possible. Data
+                // from another mirror can only be used if the hash sum is
+                // checked at the end.
+                bool sameURL = url == previous;
+                bool resume = !sameURL && !this->sha1.isEmpty();
+                if (!sameURL)
+                    validator.clear();
+                if (validator.isEmpty() && !resume)
+                    f->resize(0);
+
+                QString title;
+                if (f->size() == 0 && sameURL)
+                    title = QObject::tr("Downloading & computing hash sum (2nd try)");
+                else if (f->size() == 0)
+                    title = QString(QObject::tr("Downloading from %1 & computing hash sum")).
+                            arg(url.host());
+                else
+                    title = QObject::tr("Resuming the download & computing hash sum");
+
+                double rest = (0.9 - job->getProgress()) / (retries.count() - i);
+                Job* djob = job->newSubJob(rest, title);
+
+                QElapsedTimer timer;
+                timer.start();
+                int64_t size = f->size();
+
+                Downloader::Request request(url);
                 request.file = f;
+                request.ifRange = validator;
+                request.resume = resume;
                 if (!this->sha1.isEmpty())
                     request.hashSum = true;
                 request.user = user;
@@ -1496,19 +1569,73 @@ QString PackageVersion::download_(Job* job, const QString& where,
                 Downloader::Response response =
                         Downloader::download(djob, request);
                 dsha1 = response.hashSum;
-                if (!djob->getErrorMessage().isEmpty())
+                validator = response.validator;
+                previous = url;
+                downloadOK = !djob->isCancelled() &&
+                        djob->getErrorMessage().isEmpty();
+                if (downloadOK)
+                    source = url;
+                if (!djob->isCancelled())
+                    MirrorSelector::record(url, f->size() - size,
+                            timer.elapsed() / 1000.0, downloadOK);
+                f->close();
+
+                if (downloadOK || !job->shouldProceed())
+                    break;
+
+                if (i == retries.count() - 1)
                     job->setErrorMessage(QObject::tr("Error downloading %1: %2").
-                        arg(this->download.toString()).arg(
+                        arg(url.toString()).arg(
                         djob->getErrorMessage()));
-                f->close();
+                else
+                    qCWarning(npackd).noquote() << QString(QObject::tr(
+                            "Error downloading %1: %2")).
+                            arg(url.toString()).arg(
+                            djob->getErrorMessage());
             }
         } else {
             job->setProgress(0.9);
         }
     }
 
-    if (httpConnectionAcquired)
-        httpConnections.release();
+    // the stored size is outdated if the file behind the URL has changed.
+    // The segments are then misaligned and the file is downloaded again over
+    // one connection.
+    if (job->shouldProceed() && segmented && !this->sha1.isEmpty() &&
+            dsha1.toLower() != this->sha1.toLower()) {
+        qCDebug(npackd) << "Hash sum mismatch after a segmented download" <<
+                source;
+
+        QString err = DBRepository::getDefault()->deleteURLSize(
+                source.toString());
+        if (!err.isEmpty())
+            qCDebug(npackd) << "Cannot delete the size of" << source << err;
+
+        if (!f->open(QIODevice::ReadWrite)) {
+            job->setErrorMessage(QObject::tr("Cannot open the file: %0").
+                    arg(f->fileName()));
+        } else {
+            f->resize(0);
+
+            Job* djob = job->newSubJob(0.005,
+                    QObject::tr("Downloading & computing hash sum (2nd try)"));
+            Downloader::Request request(source);
+            request.file = f;
+            request.hashSum = true;
+            request.user = user;
+            request.password = password;
+            request.proxyUser = proxyUser;
+            request.proxyPassword = proxyPassword;
+            request.alg = this->hashSumType;
+            request.interactive = interactive;
+            Downloader::Response response = Downloader::download(djob, request);
+            dsha1 = response.hashSum;
+            if (!djob->isCancelled() && !djob->getErrorMessage().isEmpty())
+                job->setErrorMessage(QObject::tr("Error downloading %1: %2").
+                        arg(source.toString()).arg(djob->getErrorMessage()));
+            f->close();
+        }
+    }
 
     if (job->shouldProceed()) {
         if (!this->sha1.isEmpty()) {
@@ -1524,6 +1651,14 @@ QString PackageVersion::download_(Job* job, const QString& where,
         }
     }
 
+    // the size is stored for the next segmented download of the same URL
+    if (job->shouldProceed() && source.isValid()) {
+        QString err = DBRepository::getDefault()->saveURLSize(
+                source.toString(), f->size());
+        if (!err.isEmpty())
+            qCDebug(npackd) << "Cannot save the size of" << source << err;
+    }
+
     if (job->shouldProceed()) {
         Job* sub = job->newSubJob(0.01,
                 QObject::tr("Checking for viruses"));
@@ -1534,6 +1669,15 @@ QString PackageVersion::download_(Job* job, const QString& where,
         sub->completeWithProgress();
     }
 
+    if (job->shouldProceed() && !cached && !this->sha1.isEmpty()) {
+        // the cache is only an optimization and errors are ignored
+        QString err = cache->add(this->hashSumType, this->sha1,
+                f->fileName(), link);
+        if (!err.isEmpty())
+            qCWarning(npackd).noquote() << QObject::tr(
+                    "Cannot add the file to the download cache: %1").arg(err);
+    }
+
     /* this should actually be used by MS Office. MS Essentials and
      * Avira Free Antivirus do not use it
     if (job->shouldProceed(QObject::tr("Checking for viruses 2"))) {
@@ -1550,10 +1694,27 @@ QString PackageVersion::download_(Job* job, const QString& where,
     */
 
     QString binary;
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !binaryOnly) {
         if (this->type == 0) {
+            if (streamed) {
+                job->setTitle(initialTitle + " / " +
+                        QObject::tr("Moving the extracted files"));
+                QString err = extractor->finish();
+                if (err.isEmpty())
+                    err = extractor->commit(d.absolutePath());
+                if (!err.isEmpty()) {
+                    qCDebug(npackd) << "Cannot use the files extracted "
+                            "during the download:" << err;
+                    streamed = false;
+                }
+                job->setTitle(initialTitle);
+            }
+
             Job* djob = job->newSubJob(0.06, QObject::tr("Extracting files"));
-            WPMUtils::unzip(djob, f->fileName(), d.absolutePath() + "\\");
+            if (streamed)
+                djob->completeWithProgress();
+            else
+                WPMUtils::unzip(djob, f->fileName(), d.absolutePath() + "\\");
             if (!djob->getErrorMessage().isEmpty())
                 job->setErrorMessage(QString(
                         QObject::tr("Error unzipping file into directory %0: %1")).
@@ -1583,7 +1744,7 @@ QString PackageVersion::download_(Job* job, const QString& where,
     }
     job->setTitle(initialTitle);
 
-    if (job->shouldProceed()) {
+    if (job->shouldProceed() && !binaryOnly) {
         QString errMsg = this->saveFiles(d);
         if (!errMsg.isEmpty()) {
             job->setErrorMessage(errMsg);
@@ -1597,6 +1758,11 @@ QString PackageVersion::download_(Job* job, const QString& where,
 
     delete f;
 
+    if (extractor) {
+        extractor->discard();
+        delete extractor;
+    }
+
     if (job->shouldProceed()) {
         job->setProgress(1);
     }
@@ -1992,9 +2158,13 @@ PackageVersion* PackageVersion::clone() const
     }
 
     r->type = this->type;
+    r->exclusive = this->exclusive;
     r->sha1 = this->sha1;
     r->hashSumType = this->hashSumType;
     r->download = this->download;
+    r->mirrors = this->mirrors;
+    r->deltaManifest = this->deltaManifest;
+    r->deltaManifestSha256 = this->deltaManifestSha256;
 
     return r;
 }
@@ -2038,6 +2208,8 @@ void PackageVersion::toXML(QXmlStreamWriter *w) const
     w->writeAttribute("package", this->package);
     if (this->type == 1)
         w->writeAttribute("type", "one-file");
+    if (this->exclusive)
+        w->writeAttribute("exclusive", "true");
     for (int i = 0; i < this->importantFiles.count(); i++) {
         w->writeStartElement("important-file");
         w->writeAttribute("path", this->importantFiles.at(i));
@@ -2061,12 +2233,22 @@ void PackageVersion::toXML(QXmlStreamWriter *w) const
         w->writeTextElement("url", this->download.toString(
                 QUrl::FullyEncoded));
     }
+    for (int i = 0; i < this->mirrors.count(); i++) {
+        w->writeTextElement("mirror", this->mirrors.at(i).toString(
+                QUrl::FullyEncoded));
+    }
     if (!this->sha1.isEmpty()) {
         if (this->hashSumType == QCryptographicHash::Sha1)
             w->writeTextElement("sha1", this->sha1);
         else
             w->writeTextElement("hash-sum", this->sha1);
     }
+    if (this->deltaManifest.isValid()) {
+        w->writeStartElement("delta-manifest");
+        w->writeAttribute("sha256", this->deltaManifestSha256);
+        w->writeCharacters(this->deltaManifest.toString(QUrl::FullyEncoded));
+        w->writeEndElement();
+    }
     for (int i = 0; i < this->dependencies.count(); i++) {
         Dependency* d = this->dependencies.at(i);
         w->writeStartElement("dependency");
@@ -2091,6 +2273,8 @@ void PackageVersion::toJSON(QJsonObject& w) const
     w["package"] = this->package;
     if (this->type == 1)
         w["type"] = "one-file";
+    if (this->exclusive)
+        w["exclusive"] = true;
 
     if (!importantFiles.isEmpty()) {
         QJsonArray a;
@@ -2127,6 +2311,19 @@ void PackageVersion::toJSON(QJsonObject& w) const
     if (this->download.isValid()) {
         w["url"] = this->download.toString(QUrl::FullyEncoded);
     }
+    if (mirrors.count() > 0) {
+        QJsonArray mirror;
+        for (int i = 0; i < this->mirrors.count(); i++) {
+            mirror.append(this->mirrors.at(i).toString(QUrl::FullyEncoded));
+        }
+        w["mirrors"] = mirror;
+    }
+    if (this->deltaManifest.isValid()) {
+        QJsonObject manifest;
+        manifest["url"] = this->deltaManifest.toString(QUrl::FullyEncoded);
+        manifest["sha256"] = this->deltaManifestSha256;
+        w["deltaManifest"] = manifest;
+    }
     if (!this->sha1.isEmpty()) {
         if (this->hashSumType == QCryptographicHash::Sha1)
             w["sha1"] = this->sha1;
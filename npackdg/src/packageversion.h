@@ -9,7 +9,6 @@
 #include <QDir>
 #include <QUrl>
 #include <QStringList>
-#include <QSemaphore>
 #include <QXmlStreamWriter>
 #include <QCryptographicHash>
 #include <QJsonObject>
@@ -39,7 +38,8 @@ class InstalledPackages;
 class PackageVersion
 {
 private:    
-    static QSemaphore httpConnections;
+    /** maximum number of connections for downloading one binary */
+    static int downloadSegments;
 
     /**
      * Set of PackageVersion::getStringId() for the locked package versions.
@@ -124,6 +124,16 @@ public:
      */
     static QString getStringId(const QString& package, const Version& version);
 
+    /**
+     * @brief changes the maximum number of connections used for downloading
+     *     one large binary. .zip files that are extracted during the
+     *     download only use one connection. See
+     *     Downloader::Request::segments.
+     * @param n maximum number of connections (at least 1). The default value
+     *     is 4.
+     */
+    static void setDownloadSegments(int n);
+
     /**
      * @brief searches for the specified object in the specified list. Objects
      *     will be compared only by package and version.
@@ -215,6 +225,12 @@ public:
     /** 0 = zip file, 1 = one file */
     int type;
 
+    /**
+     * true = the installation and uninstallation of this package version
+     * cannot run in parallel with other operations
+     */
+    bool exclusive;
+
     /**
      * SHA-1 or SHA-256 hash sum for the installation file or empty if not
      * defined
@@ -229,6 +245,21 @@ public:
      */
     QUrl download;
 
+    /**
+     * other URLs for the same binary (e.g. internal mirrors). The hash sum
+     * should be the same for all of them.
+     */
+    QList<QUrl> mirrors;
+
+    /**
+     * manifest for delta updates of .zip packages or an empty URL. See
+     * DeltaUpdate.
+     */
+    QUrl deltaManifest;
+
+    /** SHA-256 of the file deltaManifest in lower case */
+    QString deltaManifestSha256;
+
     /**
      * unknown/1.0
      */
@@ -315,6 +346,7 @@ public:
 
     /**
      * Plans installation of this package and all the dependencies recursively.
+     * This method uses DependencySolver.
      *
      * @param installed [ownership:caller] list of installed packages.
      *     This list should be
@@ -398,6 +430,15 @@ public:
     /**
      * Downloads the package binary, checks its hash sum, checks the binary for
      * viruses, unpacks it in case of a .zip file, stores the text files.
+     * Binaries with a hash sum are taken from the DownloadCache if available
+     * and added to it after a successful download. If there are mirrors, the
+     * fastest one is used and the others are tried if the download fails.
+     * An interrupted download is resumed using HTTP ranges if the server
+     * supports them. .zip files are extracted during the download over one
+     * connection if possible. Other binaries are downloaded in segments (see
+     * setDownloadSegments). If another version of a .zip package is
+     * installed and a delta manifest is available, only the changed files
+     * are downloaded (see DeltaUpdate).
      *
      * @param job job for this method
      * @param where a non-existing directory for the package
@@ -406,13 +447,17 @@ public:
      * @param password password for the HTTP authentication or ""
      * @param proxyUser user name for the HTTP proxy authentication or ""
      * @param proxyPassword password for the HTTP proxy authentication or ""
+     * @param binaryOnly true = only download the binary into the
+     *     DownloadCache. Nothing is extracted or stored in "where" and the
+     *     delta update is not used.
      * @return the full name of the downloaded file or "" for packages of
-     *     type "zip"
+     *     type "zip" or if binaryOnly is true
      */
     QString download_(Job* job, const QString& where,
             bool interactive, const QString user,
             const QString password,
-            const QString proxyUser, const QString proxyPassword);
+            const QString proxyUser, const QString proxyPassword,
+            bool binaryOnly=false);
 
     /**
      * Uninstalls this package version.
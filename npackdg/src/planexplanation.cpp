@@ -0,0 +1,93 @@
+#include "planexplanation.h"
+
+#include "mysqlquery.h"
+
+PlanExplanation::PlanExplanation(): phaseQueries(0), candidates(0),
+        rollbacks(0)
+{
+}
+
+void PlanExplanation::startPhase(const QString &name)
+{
+    endPhase();
+
+    phase = name;
+    phaseQueries = MySQLQuery::getExecCount();
+    phaseTimer.start();
+}
+
+void PlanExplanation::endPhase()
+{
+    if (!phase.isEmpty()) {
+        QJsonObject p;
+        p["name"] = phase;
+        p["ms"] = static_cast<double>(phaseTimer.elapsed());
+        p["queries"] = MySQLQuery::getExecCount() - phaseQueries;
+        phases.append(p);
+        phase.clear();
+    }
+}
+
+void PlanExplanation::begin(const QString &type, const QString &package,
+        const Version &version)
+{
+    QJsonObject n;
+    n["type"] = type;
+    n["package"] = package;
+    n["version"] = version.getVersionString();
+    stack.append(n);
+}
+
+void PlanExplanation::begin(const QString &type, const QString &text)
+{
+    QJsonObject n;
+    n["type"] = type;
+    n["text"] = text;
+    stack.append(n);
+}
+
+void PlanExplanation::set(const QString &name, const QJsonValue &value)
+{
+    if (!stack.isEmpty())
+        stack.last()[name] = value;
+}
+
+void PlanExplanation::end(const QString &result, const QString &err)
+{
+    if (stack.isEmpty())
+        return;
+
+    QJsonObject n = stack.takeLast();
+    n["result"] = result;
+    if (!err.isEmpty())
+        n["error"] = err;
+
+    if (stack.isEmpty()) {
+        decisions.append(n);
+    } else {
+        QJsonObject& parent = stack.last();
+        QJsonArray children = parent.value("children").toArray();
+        children.append(n);
+        parent["children"] = children;
+    }
+}
+
+void PlanExplanation::candidateTried()
+{
+    candidates++;
+}
+
+void PlanExplanation::rolledBack()
+{
+    rollbacks++;
+}
+
+QJsonObject PlanExplanation::toJSON() const
+{
+    QJsonObject r;
+    r["phases"] = phases;
+    r["candidates"] = candidates;
+    r["rollbacks"] = rollbacks;
+    r["decisions"] = decisions;
+    return r;
+}
@@ -0,0 +1,110 @@
+#ifndef PLANEXPLANATION_H
+#define PLANEXPLANATION_H
+
+#include <QString>
+#include <QList>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QElapsedTimer>
+
+#include "version.h"
+
+/**
+ * @brief collects the decisions made while planning installation operations.
+ *
+ * The planning functions accept an optional pointer to an object of this class.
+ * The decisions are stored as a tree of JSON objects: each node
+ * may contain a "children" array. The planning time is divided into
+ * phases. For each phase the wall time and the number of executed SQL queries
+ * are recorded.
+ */
+class PlanExplanation
+{
+private:
+    /** finished top-level nodes */
+    QJsonArray decisions;
+
+    /** nodes that were started, but not yet finished */
+    QList<QJsonObject> stack;
+
+    /** finished phases */
+    QJsonArray phases;
+
+    /** name of the current phase or "" */
+    QString phase;
+
+    /** measures the current phase */
+    QElapsedTimer phaseTimer;
+
+    /** MySQLQuery::getExecCount() at the start of the current phase */
+    int phaseQueries;
+
+    /** number of tried candidates */
+    int candidates;
+
+    /** number of rollbacks */
+    int rollbacks;
+public:
+    PlanExplanation();
+
+    /**
+     * @brief starts a new phase. The current phase is finished.
+     * @param name name of the phase
+     */
+    void startPhase(const QString& name);
+
+    /**
+     * @brief finishes the current phase
+     */
+    void endPhase();
+
+    /**
+     * @brief starts a new node in the tree. The node becomes a child of the
+     *     current node.
+     * @param type type of the node (e.g. "install")
+     * @param package full package name
+     * @param version version number
+     */
+    void begin(const QString& type, const QString& package,
+            const Version& version);
+
+    /**
+     * @brief starts a new node in the tree. The node becomes a child of the
+     *     current node.
+     * @param type type of the node (e.g. "dependency")
+     * @param text description
+     */
+    void begin(const QString& type, const QString& text);
+
+    /**
+     * @brief changes a property of the current node
+     * @param name name of the property
+     * @param value new value
+     */
+    void set(const QString& name, const QJsonValue& value);
+
+    /**
+     * @brief finishes the current node
+     * @param result result of the decision (e.g. "ok")
+     * @param err error message or ""
+     */
+    void end(const QString& result, const QString& err="");
+
+    /**
+     * @brief should be called for each tried candidate
+     */
+    void candidateTried();
+
+    /**
+     * @brief should be called for each rollback
+     */
+    void rolledBack();
+
+    /**
+     * @return the whole explanation. The current phase is not included.
+     */
+    QJsonObject toJSON() const;
+};
+
+#endif // PLANEXPLANATION_H
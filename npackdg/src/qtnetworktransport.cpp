@@ -0,0 +1,420 @@
+#include "qtnetworktransport.h"
+
+#include <QEventLoop>
+#include <QRegExp>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QNetworkRequest>
+#include <QNetworkProxyFactory>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+#include "downloadscheduler.h"
+
+QtNetworkTransport::~QtNetworkTransport()
+{
+    if (managers.hasLocalData())
+        managers.setLocalData(nullptr);
+}
+
+QNetworkAccessManager *QtNetworkTransport::getManager()
+{
+    if (!managers.hasLocalData()) {
+        // the same proxy as for WinINet (Internet settings in the control
+        // panel)
+        QNetworkProxyFactory::setUseSystemConfiguration(true);
+
+        QNetworkAccessManager* m = new QNetworkAccessManager();
+
+        // the slots only read the data of the current thread
+        connect(m, SIGNAL(authenticationRequired(QNetworkReply*,QAuthenticator*)),
+                this, SLOT(authenticate(QNetworkReply*,QAuthenticator*)),
+                Qt::DirectConnection);
+        connect(m, SIGNAL(proxyAuthenticationRequired(QNetworkProxy,QAuthenticator*)),
+                this, SLOT(authenticateProxy(QNetworkProxy,QAuthenticator*)),
+                Qt::DirectConnection);
+
+        managers.setLocalData(m);
+    }
+
+    return managers.localData();
+}
+
+void QtNetworkTransport::authenticate(QNetworkReply * /*reply*/,
+        QAuthenticator *authenticator)
+{
+    // the same credentials are not tried again
+    const Credentials& c = credentials.localData();
+    if (!c.user.isEmpty() && authenticator->user() != c.user) {
+        authenticator->setUser(c.user);
+        authenticator->setPassword(c.password);
+    }
+}
+
+void QtNetworkTransport::authenticateProxy(const QNetworkProxy & /*proxy*/,
+        QAuthenticator *authenticator)
+{
+    const Credentials& c = credentials.localData();
+    if (!c.proxyUser.isEmpty() && authenticator->user() != c.proxyUser) {
+        authenticator->setUser(c.proxyUser);
+        authenticator->setPassword(c.proxyPassword);
+    }
+}
+
+bool QtNetworkTransport::isConditional(const Downloader::Request &request,
+        int64_t offset)
+{
+    return request.rangeFrom < 0 && offset == 0 &&
+            request.httpMethod == "GET" &&
+            (!request.ifNoneMatch.isEmpty() ||
+            !request.ifModifiedSince.isEmpty());
+}
+
+QNetworkRequest QtNetworkTransport::createRequest(
+        const Downloader::Request &request, int64_t offset)
+{
+    QNetworkRequest r(request.url);
+
+    QString agent("Npackd/");
+    agent.append(NPACKD_VERSION);
+    r.setRawHeader("User-Agent", agent.toLatin1());
+
+    r.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+    r.setAttribute(QNetworkRequest::RedirectPolicyAttribute,
+            QNetworkRequest::NoLessSafeRedirectPolicy);
+    if (!request.useInternet)
+        r.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                QNetworkRequest::AlwaysCache);
+    else if (!request.useCache)
+        r.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                QNetworkRequest::AlwaysNetwork);
+
+    if (!request.keepConnection)
+        r.setRawHeader("Connection", "close");
+
+    if (request.rangeFrom >= 0 || offset > 0) {
+        QString range = QString("bytes=%1-").arg(offset);
+        if (request.rangeFrom >= 0 && request.rangeTo >= 0)
+            range.append(QString::number(request.rangeTo));
+        r.setRawHeader("Range", range.toLatin1());
+
+        // the data should not be compressed for ranges
+        r.setRawHeader("Accept-Encoding", "identity");
+
+        if (request.rangeFrom < 0 && !request.ifRange.isEmpty())
+            r.setRawHeader("If-Range", request.ifRange.toLatin1());
+    } else if (isConditional(request, offset)) {
+        if (!request.ifNoneMatch.isEmpty())
+            r.setRawHeader("If-None-Match", request.ifNoneMatch.toLatin1());
+        if (!request.ifModifiedSince.isEmpty())
+            r.setRawHeader("If-Modified-Since",
+                    request.ifModifiedSince.toLatin1());
+    }
+
+    QStringList headers = request.headers.split(QRegExp("\r?\n"),
+            QString::SkipEmptyParts);
+    for (int i = 0; i < headers.count(); i++) {
+        const QString& h = headers.at(i);
+        int index = h.indexOf(':');
+        if (index > 0)
+            r.setRawHeader(h.left(index).trimmed().toLatin1(),
+                    h.mid(index + 1).trimmed().toLatin1());
+    }
+
+    return r;
+}
+
+void QtNetworkTransport::prepareFile(Job *job, QFile *file, int64_t offset,
+        HashEngine::Hash *hash)
+{
+    if (!file->seek(0)) {
+        job->setErrorMessage(file->errorString());
+    } else if (hash) {
+        // continue the hash sum over the already available data
+        int64_t rest = offset;
+        while (rest > 0) {
+            QByteArray data = file->read(qMin(rest,
+                    static_cast<int64_t>(512 * 1024)));
+            if (data.isEmpty()) {
+                job->setErrorMessage(QObject::tr(
+                        "Error reading the file %1: %2").arg(
+                        file->fileName(), file->errorString()));
+                break;
+            }
+            hash->addData(data.constData(), data.size());
+            rest -= data.size();
+        }
+    }
+
+    if (job->shouldProceed() && !file->seek(offset))
+        job->setErrorMessage(file->errorString());
+}
+
+int64_t QtNetworkTransport::execute(Job *job,
+        const Downloader::Request &request, Downloader::Response *response)
+{
+    QString initialTitle = job->getTitle();
+
+    QFile* file = request.file;
+
+    // the hash sum of a range would not be useful
+    QString* sha1 = request.rangeFrom >= 0 ? nullptr : &response->hashSum;
+    if (sha1)
+        sha1->clear();
+
+    QElapsedTimer queue;
+    queue.start();
+
+    // every connection needs a slot from the scheduler
+    if (!DownloadScheduler::acquire(job, request.url, request.priority)) {
+        job->complete();
+        return -1;
+    }
+
+    response->queueTime = queue.elapsed();
+
+    job->setTitle(initialTitle + " / " + QObject::tr("Connecting"));
+
+    // number of bytes that are already available or the position of the
+    // requested range
+    int64_t offset = 0;
+    if (request.rangeFrom >= 0)
+        offset = request.rangeFrom;
+    else if (file && (!request.ifRange.isEmpty() || request.resume) &&
+            request.httpMethod == "GET")
+        offset = file->size();
+    bool ranged = request.rangeFrom >= 0 || offset > 0;
+
+    Credentials c;
+    c.user = request.user;
+    c.password = request.password;
+    c.proxyUser = request.proxyUser;
+    c.proxyPassword = request.proxyPassword;
+    credentials.setLocalData(c);
+
+    QNetworkAccessManager* manager = getManager();
+    QNetworkRequest nr = createRequest(request, offset);
+    QElapsedTimer sent;
+    sent.start();
+    QNetworkReply* reply;
+    if (request.httpMethod == "HEAD")
+        reply = manager->head(nr);
+    else
+        reply = manager->sendCustomRequest(nr, request.httpMethod.toLatin1(),
+                request.postData);
+
+    // the loop is left for new data and every 100 ms to check for a
+    // cancellation
+    QEventLoop loop;
+    QTimer timer;
+    connect(reply, SIGNAL(readyRead()), &loop, SLOT(quit()));
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+    timer.start(100);
+
+    // created after the headers as the hash sum starts from the beginning
+    // if the download cannot be resumed
+    HashEngine::Hash* hash = nullptr;
+
+    bool headers = false;
+    int64_t contentLength = -1;
+    int64_t alreadyRead = 0;
+    QElapsedTimer idle;
+    idle.start();
+    while (true) {
+        if (!reply->isFinished() && reply->bytesAvailable() == 0)
+            loop.exec();
+
+        if (job->isCancelled())
+            break;
+
+        // the status of a followed redirect is not used
+        int status = reply->attribute(
+                QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (!headers && (reply->isFinished() ||
+                (status != 0 && status / 100 != 3))) {
+            headers = true;
+            response->ttfb = sent.elapsed();
+            response->fromCache = reply->attribute(
+                    QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+
+            qCDebug(npackd) << "QtNetworkTransport::execute" << request.url <<
+                    status << reply->attribute(
+                    QNetworkRequest::HTTP2WasUsedAttribute).toBool();
+
+            if (status == 304 && isConditional(request, offset)) {
+                response->notModified = true;
+            } else if (reply->error() != QNetworkReply::NoError &&
+                    status / 100 == 2) {
+                job->setErrorMessage(reply->errorString());
+            } else if (status / 100 != 2) {
+                if (status == 0)
+                    job->setErrorMessage(reply->errorString());
+                else
+                    job->setErrorMessage(QString(
+                            QObject::tr("HTTP status code %1")).arg(status));
+            } else if (request.rangeFrom >= 0) {
+                if (status != 206)
+                    job->setErrorMessage(QObject::tr(
+                            "The server does not support byte ranges"));
+            } else if (offset > 0) {
+                if (status == 206) {
+                    response->resumed = true;
+                } else {
+                    // the entity has changed or ranges are not supported
+                    qCDebug(npackd) << "QtNetworkTransport::execute "
+                            "cannot resume" << request.url << status;
+                    offset = 0;
+                    ranged = false;
+                    if (!file->resize(0) || !file->seek(0))
+                        job->setErrorMessage(file->errorString());
+                }
+            }
+
+            // the ranges of a segmented download are computed from the size
+            if (job->shouldProceed() && request.rangeFrom >= 0 &&
+                    request.size >= 0) {
+                QString err = Downloader::checkContentRange(request,
+                        QString::fromLatin1(reply->rawHeader("Content-Range")));
+                if (!err.isEmpty())
+                    job->setErrorMessage(err);
+            }
+
+            if (job->shouldProceed()) {
+                response->mimeType = reply->header(
+                        QNetworkRequest::ContentTypeHeader).toString();
+                if (response->mimeType.isEmpty())
+                    response->mimeType = "application/octet-stream";
+                response->contentDisposition = QString::fromLatin1(
+                        reply->rawHeader("Content-Disposition"));
+                response->acceptRanges = QString::fromLatin1(
+                        reply->rawHeader("Accept-Ranges")).trimmed().
+                        toLower() == "bytes";
+
+                // ETag or Last-Modified for resuming the download. Weak ETags
+                // cannot be used for ranges.
+                QString etag = QString::fromLatin1(reply->rawHeader("ETag"));
+                if (!etag.isEmpty()) {
+                    if (!etag.startsWith("W/"))
+                        response->validator = etag;
+                } else {
+                    response->validator = QString::fromLatin1(
+                            reply->rawHeader("Last-Modified"));
+                }
+
+                response->etag = etag;
+                response->lastModified = QString::fromLatin1(
+                        reply->rawHeader("Last-Modified"));
+
+                QVariant cl = reply->header(
+                        QNetworkRequest::ContentLengthHeader);
+                if (cl.isValid())
+                    contentLength = cl.toLongLong();
+
+                hash = new HashEngine::Hash(request.alg);
+                alreadyRead = offset;
+                if (file && offset > 0)
+                    prepareFile(job, file, offset, sha1 ? hash : nullptr);
+            }
+
+            if (job->shouldProceed()) {
+                job->setProgress(0.03);
+                job->setTitle(initialTitle + " / " +
+                        QObject::tr("Downloading"));
+            }
+
+            if (!job->shouldProceed() || request.ignoreContent ||
+                    response->notModified)
+                break;
+        }
+
+        while (headers && job->shouldProceed() &&
+                reply->bytesAvailable() > 0) {
+            QByteArray data = reply->read(512 * 1024);
+            if (data.isEmpty())
+                break;
+
+            DownloadScheduler::transferred(job, data.size());
+
+            if (sha1)
+                hash->addData(data.constData(), data.size());
+
+            if (file && file->write(data) != data.size()) {
+                job->setErrorMessage(QObject::tr(
+                        "Error writing the file %1: %2").arg(
+                        file->fileName(), file->errorString()));
+                break;
+            }
+
+            if (request.tee && (!ranged || request.rangeFrom >= 0))
+                request.tee->write(data);
+
+            alreadyRead += data.size();
+            int64_t total = contentLength + (ranged &&
+                    request.rangeFrom < 0 ? offset : 0);
+            if (total > 0) {
+                job->setProgress(0.04 + 0.95 * qMin(1.0,
+                        static_cast<double>(alreadyRead) / total));
+                job->setTitle(initialTitle + " / " +
+                        QString(QObject::tr("%L0 of %L1 bytes")).
+                        arg(alreadyRead).arg(total));
+            } else {
+                job->setTitle(initialTitle + " / " +
+                        QString(QObject::tr("%L0 bytes")).arg(alreadyRead));
+            }
+
+            idle.restart();
+        }
+
+        if (!job->shouldProceed())
+            break;
+
+        if (reply->isFinished() && reply->bytesAvailable() == 0) {
+            if (reply->error() != QNetworkReply::NoError)
+                job->setErrorMessage(reply->errorString());
+            break;
+        }
+
+        if (idle.elapsed() > static_cast<qint64>(request.timeout) * 1000) {
+            job->setErrorMessage(QObject::tr("Timeout"));
+            break;
+        }
+    }
+
+    timer.stop();
+    if (!reply->isFinished())
+        reply->abort();
+
+    if (job->shouldProceed() && sha1 && hash && !response->notModified) {
+        QByteArray r = hash->result();
+        if (r.isEmpty())
+            job->setErrorMessage(QObject::tr("Error computing the hash sum"));
+        else
+            *sha1 = r.toHex().toLower();
+    }
+
+    if (job->shouldProceed() && request.tee &&
+            (!ranged || request.rangeFrom >= 0) &&
+            !response->notModified && !request.ignoreContent && request.httpMethod != "HEAD")
+        response->teed = true;
+
+    // the data is written after the offset
+    if (headers)
+        response->bytes = qMax(static_cast<int64_t>(0), alreadyRead - offset);
+
+    delete hash;
+    delete reply;
+
+    credentials.setLocalData(Credentials());
+
+    DownloadScheduler::release(request.url, request.priority);
+
+    job->setTitle(initialTitle);
+
+    if (job->shouldProceed())
+        job->setProgress(1);
+
+    job->complete();
+
+    return contentLength;
+}
@@ -0,0 +1,101 @@
+#ifndef QTNETWORKTRANSPORT_H
+#define QTNETWORKTRANSPORT_H
+
+#include <QObject>
+#include <QThreadStorage>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkProxy>
+#include <QAuthenticator>
+
+#include "httptransport.h"
+#include "hashengine.h"
+
+/**
+ * @brief HTTP requests using QNetworkAccessManager.
+ *
+ * Every thread uses its own QNetworkAccessManager so that the connections to
+ * a host are kept open and re-used by the following requests from the same
+ * thread. HTTP/2 is used if the server supports it. Content-Encoding is
+ * handled by Qt.
+ *
+ * This transport does not depend on WinINet and can be used for tests and
+ * benchmarks against a local server. The user is never asked for passwords:
+ * only the credentials from the request are used. The WinINet cache is not
+ * available. The proxy from the system configuration is used like in WinINet.
+ *
+ * @threadsafe
+ */
+class QtNetworkTransport: public QObject, public HTTPTransport
+{
+    Q_OBJECT
+private:
+    /** credentials for the request executed by a thread */
+    class Credentials
+    {
+    public:
+        QString user;
+        QString password;
+        QString proxyUser;
+        QString proxyPassword;
+    };
+
+    /**
+     * [ownership:this] one manager for each thread. The managers are deleted
+     * when the threads exit.
+     */
+    QThreadStorage<QNetworkAccessManager*> managers;
+
+    /** credentials for the current request of each thread */
+    QThreadStorage<Credentials> credentials;
+
+    /**
+     * @return the manager for the current thread
+     */
+    QNetworkAccessManager* getManager();
+
+    /**
+     * @brief prepares the file for the data after "offset"
+     * @param job job
+     * @param file the file
+     * @param offset number of bytes already available in the file
+     * @param hash the available data will be added here or 0
+     */
+    static void prepareFile(Job* job, QFile* file, int64_t offset,
+            HashEngine::Hash* hash);
+private slots:
+    void authenticate(QNetworkReply* reply, QAuthenticator* authenticator);
+
+    void authenticateProxy(const QNetworkProxy& proxy,
+            QAuthenticator* authenticator);
+public:
+    /**
+     * @brief deletes the manager of the current thread. The managers of the
+     *     other threads are deleted when the threads exit. The object should
+     *     not be used by other threads any more.
+     */
+    ~QtNetworkTransport() override;
+
+    /**
+     * @brief creates the request for QNetworkAccessManager. This is also
+     *     used by the DownloadEngine.
+     * @param request HTTP request
+     * @param offset first byte that should be requested
+     * @return request for QNetworkAccessManager
+     */
+    static QNetworkRequest createRequest(const Downloader::Request& request,
+            int64_t offset);
+
+    /**
+     * @param request HTTP request
+     * @param offset first byte that should be requested
+     * @return true if "If-None-Match" or "If-Modified-Since" will be sent
+     */
+    static bool isConditional(const Downloader::Request& request,
+            int64_t offset);
+
+    int64_t execute(Job* job, const Downloader::Request& request,
+            Downloader::Response* response) override;
+};
+
+#endif // QTNETWORKTRANSPORT_H
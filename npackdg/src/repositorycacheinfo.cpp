@@ -0,0 +1,11 @@
+#include "repositorycacheinfo.h"
+
+RepositoryCacheInfo::RepositoryCacheInfo(const QString &url): url(url),
+        modified(0)
+{
+}
+
+bool RepositoryCacheInfo::isValid() const
+{
+    return !sha256.isEmpty() && (!etag.isEmpty() || !lastModified.isEmpty());
+}
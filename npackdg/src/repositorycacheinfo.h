@@ -0,0 +1,43 @@
+#ifndef REPOSITORYCACHEINFO_H
+#define REPOSITORYCACHEINFO_H
+
+#include <time.h>
+
+#include <QString>
+
+/**
+ * @brief HTTP metadata for a downloaded repository. This information is used
+ *     for conditional requests ("If-None-Match", "If-Modified-Since"). The
+ *     content of the repository is stored in the DownloadCache under its
+ *     SHA-256 hash sum.
+ */
+class RepositoryCacheInfo
+{
+public:
+    /** URL of the repository */
+    QString url;
+
+    /** value of the "ETag" header or "" */
+    QString etag;
+
+    /** value of the "Last-Modified" header or "" */
+    QString lastModified;
+
+    /** SHA-256 of the content in lower case */
+    QString sha256;
+
+    /** date/time of the last change or 0 if there is no information */
+    time_t modified;
+
+    /**
+     * @param url URL of the repository
+     */
+    explicit RepositoryCacheInfo(const QString& url="");
+
+    /**
+     * @return true if a conditional request can be sent for this repository
+     */
+    bool isValid() const;
+};
+
+#endif // REPOSITORYCACHEINFO_H
@@ -21,6 +21,8 @@ int RepositoryXMLHandler::findWhere()
                 r = TAG_LICENSE;
             else if (tag1 == QStringLiteral("spec-version"))
                 r = TAG_SPEC_VERSION;
+            else if (tag1 == QStringLiteral("mirror"))
+                r = TAG_MIRROR;
             break;
         case 3:
             tag1 = tags.at(1);
@@ -38,6 +40,10 @@ int RepositoryXMLHandler::findWhere()
                     r = TAG_VERSION_DETECT_FILE;
                 else if (tag2 == QStringLiteral("url"))
                     r = TAG_VERSION_URL;
+                else if (tag2 == QStringLiteral("mirror"))
+                    r = TAG_VERSION_MIRROR;
+                else if (tag2 == QStringLiteral("delta-manifest"))
+                    r = TAG_VERSION_DELTA_MANIFEST;
                 else if (tag2 == QStringLiteral("sha1"))
                     r = TAG_VERSION_SHA1;
                 else if (tag2 == QStringLiteral("hash-sum"))
@@ -161,6 +167,29 @@ bool RepositoryXMLHandler::startElement(const QString &/*namespaceURI*/,
                         arg(pv->toString()).arg(type);
             }
         }
+
+        if (error.isEmpty()) {
+            QString exclusive = atts.value(QStringLiteral("exclusive"));
+            if (exclusive.isEmpty() || exclusive == QStringLiteral("false"))
+                pv->exclusive = false;
+            else if (exclusive == QStringLiteral("true"))
+                pv->exclusive = true;
+            else {
+                error = QObject::tr("Wrong value for the attribute 'exclusive' for %1: %2").
+                        arg(pv->toString()).arg(exclusive);
+            }
+        }
+    } else if (where == TAG_MIRROR) {
+        mirrorPrefix = atts.value(QStringLiteral("prefix")).trimmed();
+        if (mirrorPrefix.isEmpty())
+            error = QObject::tr("Empty 'prefix' attribute value for <mirror>");
+    } else if (where == TAG_VERSION_DELTA_MANIFEST) {
+        pv->deltaManifestSha256 = atts.value(QStringLiteral("sha256")).
+                trimmed().toLower();
+        error = WPMUtils::validateSHA256(pv->deltaManifestSha256);
+        if (!error.isEmpty())
+            error = QObject::tr("Invalid SHA-256 for <delta-manifest> for %1: %2").
+                    arg(pv->toString()).arg(error);
     } else if (where == TAG_VERSION_IMPORTANT_FILE) {
         QString p = atts.value(QStringLiteral("path"));
         if (p.isEmpty())
@@ -276,6 +305,16 @@ bool RepositoryXMLHandler::endElement(const QString &/*namespaceURI*/,
 {
     int where = findWhere();
     if (where == TAG_VERSION) {
+        QString download = pv->download.toString(QUrl::FullyEncoded);
+        for (int i = 0; i < mirrors.count(); i++) {
+            const QPair<QString, QString>& m = mirrors.at(i);
+            if (pv->download.isValid() && download.startsWith(m.first)) {
+                QUrl mirror(m.second + download.mid(m.first.length()));
+                if (!pv->mirrors.contains(mirror))
+                    pv->mirrors.append(mirror);
+            }
+        }
+
         error = rep->savePackageVersion(pv, false);
 
         if (!error.isEmpty())
@@ -294,6 +333,27 @@ bool RepositoryXMLHandler::endElement(const QString &/*namespaceURI*/,
         if (error.isEmpty()) {
             pv->download.setUrl(url);
         }
+    } else if (where == TAG_VERSION_MIRROR) {
+        QString url = chars;
+        error = WPMUtils::checkURL(this->url, &url, false);
+
+        if (error.isEmpty()) {
+            QUrl mirror(url);
+            if (!pv->mirrors.contains(mirror))
+                pv->mirrors.append(mirror);
+        }
+    } else if (where == TAG_VERSION_DELTA_MANIFEST) {
+        QString url = chars;
+        error = WPMUtils::checkURL(this->url, &url, false);
+
+        if (error.isEmpty())
+            pv->deltaManifest.setUrl(url);
+    } else if (where == TAG_MIRROR) {
+        QString url = chars;
+        error = WPMUtils::checkURL(this->url, &url, false);
+
+        if (error.isEmpty())
+            mirrors.append(qMakePair(mirrorPrefix, url));
     } else if (where == TAG_VERSION_SHA1) {
         pv->sha1 = chars.trimmed().toLower();
         pv->hashSumType = QCryptographicHash::Sha1;
@@ -4,6 +4,8 @@
 #include <QXmlDefaultHandler>
 #include <QString>
 #include <QXmlAttributes>
+#include <QList>
+#include <QPair>
 
 #include "license.h"
 #include "package.h"
@@ -45,7 +47,10 @@ class RepositoryXMLHandler: public QXmlDefaultHandler
         TAG_LICENSE_TITLE,
         TAG_LICENSE_URL,
         TAG_LICENSE_DESCRIPTION,
-        TAG_SPEC_VERSION
+        TAG_SPEC_VERSION,
+        TAG_VERSION_MIRROR,
+        TAG_MIRROR,
+        TAG_VERSION_DELTA_MANIFEST
     };
 
     AbstractRepository* rep;
@@ -62,6 +67,15 @@ class RepositoryXMLHandler: public QXmlDefaultHandler
 
     QUrl url;
 
+    /** value of the attribute "prefix" for the current <mirror> */
+    QString mirrorPrefix;
+
+    /**
+     * mirrors for the whole repository: URL prefix -> replacement. These
+     * tags should be placed before the <version> tags.
+     */
+    QList<QPair<QString, QString> > mirrors;
+
     int findWhere();
 public:
     /**
@@ -0,0 +1,122 @@
+#include "reversedependencies.h"
+
+#include "dependencysolver.h"
+#include "installedpackages.h"
+#include "installedpackageversion.h"
+
+ReverseDependencies::ReverseDependencies()
+{
+}
+
+bool ReverseDependencies::isInstalled(const Dependency &dep) const
+{
+    bool r = false;
+    const QList<Version> vs = installedVersions.value(dep.package);
+    for (int i = 0; i < vs.count(); i++) {
+        if (dep.test(vs.at(i))) {
+            r = true;
+            break;
+        }
+    }
+    return r;
+}
+
+bool ReverseDependencies::hasMissingDependency(const PackageVersion &pv) const
+{
+    bool r = false;
+    for (int i = 0; i < pv.dependencies.count(); i++) {
+        if (!isInstalled(*pv.dependencies.at(i))) {
+            r = true;
+            break;
+        }
+    }
+    return r;
+}
+
+void ReverseDependencies::add(PackageVersion *pv)
+{
+    QString id = pv->getStringId();
+    versions.insert(id, pv);
+    for (int j = 0; j < pv->dependencies.count(); j++) {
+        QStringList& d = dependents[pv->dependencies.at(j)->package];
+        if (!d.contains(id))
+            d.append(id);
+    }
+    if (hasMissingDependency(*pv))
+        broken.insert(id, pv);
+}
+
+void ReverseDependencies::build(DependencySolver &solver,
+        const InstalledPackages &installed)
+{
+    QList<InstalledPackageVersion*> ipvs = installed.getAll();
+    for (int i = 0; i < ipvs.count(); i++) {
+        InstalledPackageVersion* ipv = ipvs.at(i);
+        this->installedVersions[ipv->package].append(ipv->version);
+    }
+
+    for (int i = 0; i < ipvs.count(); i++) {
+        InstalledPackageVersion* ipv = ipvs.at(i);
+
+        // errors are ignored here as in
+        // InstalledPackages::findFirstWithMissingDependency
+        QString err;
+        PackageVersion* pv = solver.findPackageVersion(
+                ipv->package, ipv->version, &err);
+        if (err.isEmpty() && pv)
+            add(pv);
+    }
+    qDeleteAll(ipvs);
+}
+
+void ReverseDependencies::installed(DependencySolver &solver,
+        const QString &package, const Version &version)
+{
+    QList<Version>& vs = installedVersions[package];
+    if (vs.contains(version))
+        return;
+    vs.append(version);
+
+    const QStringList d = dependents.value(package);
+    for (int i = 0; i < d.count(); i++) {
+        PackageVersion* pv = broken.value(d.at(i));
+        if (pv && !hasMissingDependency(*pv))
+            broken.remove(d.at(i));
+    }
+
+    QString err;
+    PackageVersion* pv = solver.findPackageVersion(package, version, &err);
+    if (err.isEmpty() && pv)
+        add(pv);
+}
+
+void ReverseDependencies::uninstalled(const QString &package,
+        const Version &version)
+{
+    QList<Version>& vs = installedVersions[package];
+    for (int i = 0; i < vs.count(); ) {
+        if (vs.at(i) == version)
+            vs.removeAt(i);
+        else
+            i++;
+    }
+
+    broken.remove(PackageVersion::getStringId(package, version));
+
+    const QStringList d = dependents.value(package);
+    for (int i = 0; i < d.count(); i++) {
+        PackageVersion* pv = versions.value(d.at(i));
+        if (pv && !broken.contains(d.at(i)) &&
+                installedVersions.value(pv->package).contains(pv->version) &&
+                hasMissingDependency(*pv))
+            broken.insert(d.at(i), pv);
+    }
+}
+
+PackageVersion *ReverseDependencies::findFirstWithMissingDependency() const
+{
+    PackageVersion* r = nullptr;
+    if (!broken.isEmpty())
+        r = broken.constBegin().value();
+    return r;
+}
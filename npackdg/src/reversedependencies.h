@@ -0,0 +1,107 @@
+#ifndef REVERSEDEPENDENCIES_H
+#define REVERSEDEPENDENCIES_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QMap>
+
+#include "packageversion.h"
+#include "dependency.h"
+#include "version.h"
+
+class DependencySolver;
+class InstalledPackages;
+
+/**
+ * @brief index of the installed package versions and the packages that
+ *     depend on them.
+ *
+ * The index is created once for a planning session and updated
+ * incrementally if a package version is added to or removed from the list of
+ * installed packages. This avoids reading all installed package versions from
+ * the repository after each planned change. Copies are cheap and can be used
+ * together with copies of InstalledPackages for trying a change.
+ */
+class ReverseDependencies
+{
+private:
+    /**
+     * PackageVersion::getStringId() -> definition of an installed package
+     * version from the repository. The objects are owned by the
+     * DependencySolver passed to build().
+     */
+    QHash<QString, PackageVersion*> versions;
+
+    /**
+     * full package name -> PackageVersion::getStringId() for the installed
+     * package versions that depend on this package
+     */
+    QHash<QString, QStringList> dependents;
+
+    /** full package name -> installed versions */
+    QHash<QString, QList<Version> > installedVersions;
+
+    /**
+     * PackageVersion::getStringId() -> installed package version with at
+     * least one missing dependency. Sorted in the same order as the entries
+     * in InstalledPackages.
+     */
+    QMap<QString, PackageVersion*> broken;
+
+    /**
+     * @param dep a dependency
+     * @return true if an installed package version satisfies the dependency
+     */
+    bool isInstalled(const Dependency& dep) const;
+
+    /**
+     * @param pv a package version
+     * @return true if at least one dependency is not installed
+     */
+    bool hasMissingDependency(const PackageVersion& pv) const;
+
+    /**
+     * @brief adds the definition of an installed package version
+     * @param pv [ownership:caller] package version
+     */
+    void add(PackageVersion* pv);
+public:
+    ReverseDependencies();
+
+    /**
+     * @brief builds the index. Package versions that cannot be found in the
+     *     repository are considered to have no dependencies.
+     * @param solver [ownership:caller] cached data from the repository. The
+     *     object should not be destroyed before this index.
+     * @param installed [ownership:caller] installed package versions
+     */
+    void build(DependencySolver& solver, const InstalledPackages& installed);
+
+    /**
+     * @brief should be called after a package version is added to the
+     *     list of installed package versions
+     * @param solver [ownership:caller] the same object as for build()
+     * @param package full package name
+     * @param version version number
+     */
+    void installed(DependencySolver& solver, const QString& package,
+            const Version& version);
+
+    /**
+     * @brief should be called after a package version is removed from the
+     *     list of installed package versions
+     * @param package full package name
+     * @param version version number
+     */
+    void uninstalled(const QString& package, const Version& version);
+
+    /**
+     * @return [ownership:this] the same package version as
+     *     InstalledPackages::findFirstWithMissingDependency() or 0
+     */
+    PackageVersion* findFirstWithMissingDependency() const;
+};
+
+#endif // REVERSEDEPENDENCIES_H
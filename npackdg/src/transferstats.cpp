@@ -0,0 +1,19 @@
+#include "transferstats.h"
+
+TransferStats::TransferStats(const QString &url): url(url), started(0),
+        queueTime(-1), dnsTime(-1), connectTime(-1), ttfb(-1),
+        transferTime(-1), totalTime(-1), bytes(0), retries(0),
+        cacheHit(false)
+{
+}
+
+double TransferStats::getThroughput() const
+{
+    double r = -1;
+
+    // the data from a cache says nothing about the network
+    if (transferTime > 0 && bytes > 0 && error.isEmpty() && !cacheHit)
+        r = bytes * 1000.0 / transferTime;
+
+    return r;
+}
@@ -0,0 +1,71 @@
+#ifndef TRANSFERSTATS_H
+#define TRANSFERSTATS_H
+
+#include <time.h>
+#include <stdint.h>
+
+#include <QString>
+
+/**
+ * @brief metrics for one HTTP transfer. The times are in milliseconds and -1
+ *     means that the value is unknown (e.g. there is no DNS lookup for a
+ *     re-used connection).
+ */
+class TransferStats
+{
+public:
+    /** URL */
+    QString url;
+
+    /** host name (and port) in lower case */
+    QString host;
+
+    /** date/time of the start of the transfer */
+    time_t started;
+
+    /** waiting for a connection slot from the DownloadScheduler */
+    qint64 queueTime;
+
+    /** DNS lookup */
+    qint64 dnsTime;
+
+    /** TCP and TLS connection */
+    qint64 connectTime;
+
+    /** from sending the request until the response headers were received */
+    qint64 ttfb;
+
+    /** from the response headers until the end of the data */
+    qint64 transferTime;
+
+    /** whole duration including the waiting */
+    qint64 totalTime;
+
+    /** number of received bytes of the entity */
+    int64_t bytes;
+
+    /** number of times the request was sent again (e.g. authentication) */
+    int retries;
+
+    /**
+     * true = the entity was read from the local HTTP cache or the server
+     * answered "304 Not Modified"
+     */
+    bool cacheHit;
+
+    /** error message or "" */
+    QString error;
+
+    /**
+     * @param url URL
+     */
+    explicit TransferStats(const QString& url="");
+
+    /**
+     * @return achieved throughput in bytes per second while the data was
+     *     received or -1 if unknown
+     */
+    double getThroughput() const;
+};
+
+#endif // TRANSFERSTATS_H
@@ -287,6 +287,27 @@ QStringList WindowsRegistry::list(QString* err) const
     return res;
 }
 
+qint64 WindowsRegistry::getLastWriteTime(QString *err) const
+{
+    err->clear();
+
+    if (this->hkey == nullptr) {
+        err->append(QObject::tr("No key is open"));
+        return 0;
+    }
+
+    FILETIME ft;
+    LONG r = RegQueryInfoKey(this->hkey, nullptr, nullptr, nullptr, nullptr,
+            nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &ft);
+    if (r != ERROR_SUCCESS) {
+        WPMUtils::formatMessage(r, err);
+        return 0;
+    }
+
+    return static_cast<qint64>((static_cast<quint64>(ft.dwHighDateTime) << 32) |
+            ft.dwLowDateTime);
+}
+
 QStringList WindowsRegistry::listValues(QString *err) const
 {
     err->clear();
@@ -197,6 +197,16 @@ public:
      */
     QStringList listValues(QString* err) const;
 
+    /**
+     * @brief returns the time of the last change of this key. A key is
+     *     changed if a value is set or removed or a sub-key is created or
+     *     deleted.
+     * @param err the error message will be stored here
+     * @return last write time in 100-nanosecond intervals since January 1,
+     *     1601 (UTC)
+     */
+    qint64 getLastWriteTime(QString* err) const;
+
     /**
      * @brief loads QStringList from this key
      * @param err error message
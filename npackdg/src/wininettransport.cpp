@@ -0,0 +1,7 @@
+#include "wininettransport.h"
+
+int64_t WinINetTransport::execute(Job *job,
+        const Downloader::Request &request, Downloader::Response *response)
+{
+    return Downloader::downloadWin(job, request, response);
+}
@@ -0,0 +1,20 @@
+#ifndef WININETTRANSPORT_H
+#define WININETTRANSPORT_H
+
+#include "httptransport.h"
+
+/**
+ * @brief HTTP requests using WinINet. This is the default transport. The
+ *     proxy settings and the cache of Internet Explorer are used and the
+ *     user is asked for passwords if necessary.
+ *
+ * @threadsafe
+ */
+class WinINetTransport: public HTTPTransport
+{
+public:
+    int64_t execute(Job* job, const Downloader::Request& request,
+            Downloader::Response* response) override;
+};
+
+#endif // WININETTRANSPORT_H
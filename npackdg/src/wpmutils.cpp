@@ -19,6 +19,7 @@
 #include <taskschd.h>
 #include <comdef.h>
 #include <sddl.h>
+#include <aclapi.h>
 
 //#define CCH_RM_MAX_APP_NAME 255
 //#define CCH_RM_MAX_SVC_NAME 63
@@ -37,6 +38,10 @@
 #include <QUrl>
 #include <QLoggingCategory>
 #include <QDirIterator>
+#include <QSet>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <quazip.h>
 #include <quazipfile.h>
@@ -50,6 +55,7 @@
 #include "version.h"
 #include "windowsregistry.h"
 #include "abstractrepository.h"
+#include "hashengine.h"
 
 bool WPMUtils::adminMode = true;
 
@@ -63,6 +69,8 @@ const char* WPMUtils::CRLF = "\r\n";
 
 QString WPMUtils::taskName;
 
+QThreadPool WPMUtils::unzipThreadPool;
+
 HRTimer WPMUtils::timer(2);
 
 Q_LOGGING_CATEGORY(npackd, "npackd")
@@ -2878,32 +2886,7 @@ QString WPMUtils::sha1(const QString& filename)
 QString WPMUtils::hashSum(const QString& filename,
         QCryptographicHash::Algorithm alg)
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly))
-         return "";
-
-    QCryptographicHash hash(alg);
-
-    const int SIZE = 512 * 1024;
-    char* buffer = new char[SIZE];
-
-    bool err = false;
-    while (!file.atEnd()) {
-        qint64 r = file.read(buffer, SIZE);
-        if (r < 0) {
-            err = true;
-            break;
-        }
-        hash.addData(buffer, r);
-    }
-    file.close();
-
-    delete[] buffer;
-
-    if (err)
-        return "";
-    else
-        return hash.result().toHex().toLower();
+    return HashEngine::hashFile(filename, alg);
 }
 
 QString WPMUtils::getShellFileOperationErrorMessage(DWORD res)
@@ -3498,89 +3481,81 @@ DWORD WPMUtils::getProgramCloseType(const CommandLine& cl, QString* err)
 QString WPMUtils::fileCheckSum(Job* job,
         QFile* file, QCryptographicHash::Algorithm alg)
 {
-    QString initialTitle = job->getTitle();
-
-    // download/compute SHA1 loop
-    QCryptographicHash hash(alg);
-    const int bufferSize = 512 * 1024;
-    char* buffer = new char[bufferSize];
-
-    QString sha1;
-
-    qint64 alreadyRead = 0;
-    qint64 bufferLength;
-    do {
-        bufferLength = file->read(buffer, bufferSize);
-
-        if (bufferLength == 0)
-            break;
+    return HashEngine::hashFile(job, file, alg);
+}
 
-        if (bufferLength < 0) {
-            job->setErrorMessage(file->errorString());
-            break;
-        }
+/**
+ * @brief extraction of a range of entries in WPMUtils::unzip
+ */
+class UnzipTask
+{
+public:
+    /** job for this range */
+    Job* job;
 
-        // update SHA1 if necessary
-        hash.addData((char*) buffer, bufferLength);
+    /** .zip file */
+    QString zipfile;
 
-        alreadyRead += bufferLength;
-        job->setProgress(0.5);
-        job->setTitle(initialTitle + QStringLiteral(" / ") +
-                QObject::tr("%L0 bytes").
-                arg(alreadyRead));
-    } while (bufferLength != 0 && !job->isCancelled());
+    /** output directory ending with a separator */
+    QString odir;
 
-    if (job->shouldProceed()) {
-        sha1 = hash.result().toHex().toLower();
-        job->setProgress(1);
-    }
+    /** index of the first entry */
+    int from;
 
-    delete[] buffer;
+    /** index of the entry after the last one */
+    int to;
 
-    job->complete();
+    /** will be incremented for every extracted entry */
+    QAtomicInt* count;
 
-    return sha1;
-}
+    /** will be released at the end or 0 */
+    QSemaphore* done;
+};
 
-void WPMUtils::unzip(Job* job, const QString zipfile, const QString outputdir)
+/**
+ * @brief extracts a range of entries from a ZIP file. Every call opens its
+ *     own QuaZip object so that it can run in parallel with others. All
+ *     directories should already exist.
+ * @param t range
+ */
+static void unzipRange(UnzipTask* t)
 {
-    QString initialTitle = job->getTitle();
+    Job* job = t->job;
+    const QString& zipfile = t->zipfile;
+    const QString& odir = t->odir;
+    int from = t->from;
+    int to = t->to;
 
     QuaZip zip(zipfile);
     if (!zip.open(QuaZip::mdUnzip)) {
         job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
                        arg(zipfile).arg(zip.getZipError()));
-    } else {
-        job->setProgress(0.01);
     }
 
     if (job->shouldProceed()) {
-        QString odir = outputdir;
-        if (!odir.endsWith('\\') && !odir.endsWith('/'))
-            odir.append('\\');
+        // going to the next entry only reads the central directory
+        bool more = zip.goToFirstFile();
+        for (int i = 0; more && i < from; i++) {
+            more = zip.goToNextFile();
+        }
 
-        job->setTitle(initialTitle + QStringLiteral(" / ") +
-                QObject::tr("Extracting"));
         QuaZipFile file(&zip);
-        int n = zip.getEntriesCount();
         int blockSize = 1024 * 1024;
         char* block = new char[blockSize];
-        int i = 0;
-        for (bool more = zip.goToFirstFile(); more; more = zip.goToNextFile()) {
+        for (int i = from; more && i < to; i++) {
             QString name = zip.getCurrentFileName();
-            if (!file.open(QIODevice::ReadOnly)) {
-                job->setErrorMessage(QString(
-                        QObject::tr("Error unzipping the file %1: Error %2 in %3")).
-                        arg(zipfile).arg(file.getZipError()).
-                        arg(name));
-                break;
-            }
-            name.prepend(odir);
-            QFile meminfo(name);
-            QFileInfo infofile(meminfo);
-            QDir dira(infofile.absolutePath());
-            if (dira.mkpath(infofile.absolutePath())) {
-                if (meminfo.open(QIODevice::ReadWrite)) {
+
+            // directories were already created
+            if (!name.endsWith('/') && !name.endsWith('\\')) {
+                if (!file.open(QIODevice::ReadOnly)) {
+                    job->setErrorMessage(QString(
+                            QObject::tr("Error unzipping the file %1: Error %2 in %3")).
+                            arg(zipfile).arg(file.getZipError()).
+                            arg(name));
+                    break;
+                }
+                QFile meminfo(odir + name);
+                if (meminfo.open(QIODevice::WriteOnly)) {
                     while (true) {
                         qint64 read = file.read(block, blockSize);
                         if (read <= 0)
@@ -3589,20 +3564,16 @@ void WPMUtils::unzip(Job* job, const QString zipfile, const QString outputdir)
                     }
                     meminfo.close();
                 }
-            } else {
-                job->setErrorMessage(QString(QObject::tr("Cannot create directory %1")).arg(
-                        infofile.absolutePath()));
-                file.close();
+                file.close(); // do not forget to close!
             }
-            file.close(); // do not forget to close!
-            i++;
-            job->setProgress(0.01 + 0.99 * i / n);
-            if (i % 100 == 0)
-                job->setTitle(initialTitle + QStringLiteral(" / ") +
-                        QString(QObject::tr("%L1 files")).arg(i));
+
+            t->count->ref();
+            job->setProgress(static_cast<double>(i - from + 1) / (to - from));
 
             if (!job->shouldProceed())
                 break;
+
+            more = zip.goToNextFile();
         }
         zip.close();
 
@@ -3610,6 +3581,168 @@ void WPMUtils::unzip(Job* job, const QString zipfile, const QString outputdir)
     }
 
     job->complete();
+
+    if (t->done)
+        t->done->release();
+}
+
+void WPMUtils::unzip(Job* job, const QString zipfile, const QString outputdir,
+        int threads)
+{
+    QString initialTitle = job->getTitle();
+
+    QString odir = outputdir;
+    if (!odir.endsWith('\\') && !odir.endsWith('/'))
+        odir.append('\\');
+
+    // the central directory is only read once
+    QList<QuaZipFileInfo64> entries;
+    QuaZip zip(zipfile);
+    if (!zip.open(QuaZip::mdUnzip)) {
+        job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
+                       arg(zipfile).arg(zip.getZipError()));
+    } else {
+        entries = zip.getFileInfoList64();
+        if (zip.getZipError() != UNZ_OK)
+            job->setErrorMessage(QString(QObject::tr("Cannot open the ZIP file %1: %2")).
+                           arg(zipfile).arg(zip.getZipError()));
+        zip.close();
+        job->setProgress(0.01);
+    }
+
+    // all directories are created in one pass so that the threads do not
+    // compete for the same parent directories
+    if (job->shouldProceed()) {
+        job->setTitle(initialTitle + QStringLiteral(" / ") +
+                QObject::tr("Creating directories"));
+
+        QSet<QString> dirs;
+        for (int i = 0; i < entries.count(); i++) {
+            QString name = entries.at(i).name;
+            if (name.endsWith('/') || name.endsWith('\\'))
+                dirs.insert(QDir::cleanPath(odir + name));
+            else
+                dirs.insert(QFileInfo(odir + name).absolutePath());
+        }
+
+        QDir d;
+        QSetIterator<QString> it(dirs);
+        while (it.hasNext()) {
+            QString dir = it.next();
+            if (!d.mkpath(dir)) {
+                job->setErrorMessage(QString(QObject::tr("Cannot create directory %1")).arg(
+                        dir));
+                break;
+            }
+        }
+        job->setProgress(0.02);
+    }
+
+    if (job->shouldProceed() && entries.count() > 0) {
+        job->setTitle(initialTitle + QStringLiteral(" / ") +
+                QObject::tr("Extracting"));
+
+        int n = entries.count();
+
+        // creating a file costs about as much as extracting 16 KiB. Each
+        // thread should extract at least 64 entries.
+        if (threads <= 0)
+            threads = qBound(1, QThread::idealThreadCount(), 8);
+        threads = qBound(1, threads, qMax(1, n / 64));
+
+        QList<qint64> costs;
+        qint64 total = 0;
+        for (int i = 0; i < n; i++) {
+            qint64 c = entries.at(i).compressedSize + 16 * 1024;
+            costs.append(c);
+            total += c;
+        }
+
+        // contiguous ranges with the same cost. Every thread skips the entries
+        // before its range in the central directory.
+        QList<int> bounds;
+        bounds.append(0);
+        qint64 sum = 0;
+        for (int i = 0; i < n && bounds.count() < threads; i++) {
+            sum += costs.at(i);
+            if (sum >= total * bounds.count() / threads)
+                bounds.append(i + 1);
+        }
+        if (bounds.last() != n)
+            bounds.append(n);
+
+        qCDebug(npackd) << "WPMUtils::unzip" << zipfile << n <<
+                (bounds.count() - 1);
+
+        QAtomicInt count;
+        if (bounds.count() == 2) {
+            UnzipTask t;
+            t.job = job->newSubJob(0.98, "", true, true);
+            t.zipfile = zipfile;
+            t.odir = odir;
+            t.from = 0;
+            t.to = n;
+            t.count = &count;
+            t.done = nullptr;
+            unzipRange(&t);
+        } else {
+            if (unzipThreadPool.maxThreadCount() < 8)
+                unzipThreadPool.setMaxThreadCount(8);
+
+            QSemaphore done;
+            QList<UnzipTask*> tasks;
+            QList<Job*> subs;
+            for (int i = 0; i < bounds.count() - 1; i++) {
+                UnzipTask* t = new UnzipTask();
+                t->zipfile = zipfile;
+                t->odir = odir;
+                t->from = bounds.at(i);
+                t->to = bounds.at(i + 1);
+                t->job = job->newSubJob(0.98 * (t->to - t->from) / n, "",
+                        true, false);
+                t->count = &count;
+                t->done = &done;
+                tasks.append(t);
+                subs.append(t->job);
+                QtConcurrent::run(&unzipThreadPool, unzipRange, t);
+            }
+
+            // the first failed range cancels the others
+            QString err;
+            for (int i = 0; i < subs.count(); i++) {
+                while (!done.tryAcquire(1, 100)) {
+                    if (job->isCancelled()) {
+                        for (int j = 0; j < subs.count(); j++) {
+                            subs.at(j)->cancel();
+                        }
+                    }
+                    job->setTitle(initialTitle + QStringLiteral(" / ") +
+                            QString(QObject::tr("%L1 files")).arg(
+                            count.load()));
+                }
+
+                if (err.isEmpty()) {
+                    for (int j = 0; j < subs.count(); j++) {
+                        Job* s = subs.at(j);
+                        if (!s->getErrorMessage().isEmpty()) {
+                            err = s->getErrorMessage();
+                            for (int k = 0; k < subs.count(); k++) {
+                                subs.at(k)->cancel();
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (!err.isEmpty())
+                job->setErrorMessage(err);
+
+            qDeleteAll(tasks);
+        }
+    }
+
+    job->complete();
 }
 
 void WPMUtils::executeBatchFile(Job* job, const QString& where,
@@ -4573,3 +4706,73 @@ bool WPMUtils::hasAdminPrivileges()
 
     return fReturn;
 }
+
+QString WPMUtils::createSecureDirectory(const QString &dir)
+{
+    QString err;
+
+    QDir d;
+    if (!d.mkpath(dir))
+        err = QObject::tr("Cannot create directory: %0").arg(dir);
+
+    // owner: administrators. SYSTEM and administrators have full access,
+    // users can only read. Inherited entries are not used so that the
+    // permissions of the parent directory (e.g. "C:\ProgramData") do not
+    // apply.
+    PSECURITY_DESCRIPTOR psd = nullptr;
+    if (err.isEmpty()) {
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                L"O:BAD:P(A;OICI;FA;;;SY)(A;OICI;FA;;;BA)(A;OICI;0x1200a9;;;BU)",
+                SDDL_REVISION_1, &psd, nullptr))
+            formatMessage(GetLastError(), &err);
+    }
+
+    if (err.isEmpty()) {
+        BOOL present = FALSE;
+        BOOL defaulted = FALSE;
+        PACL dacl = nullptr;
+        PSID owner = nullptr;
+        if (!GetSecurityDescriptorDacl(psd, &present, &dacl, &defaulted) ||
+                !GetSecurityDescriptorOwner(psd, &owner, &defaulted)) {
+            formatMessage(GetLastError(), &err);
+        } else {
+            QString native = QDir::toNativeSeparators(dir);
+            DWORD r = SetNamedSecurityInfoW(toLPWSTR(native), SE_FILE_OBJECT,
+                    OWNER_SECURITY_INFORMATION | DACL_SECURITY_INFORMATION |
+                    PROTECTED_DACL_SECURITY_INFORMATION,
+                    owner, nullptr, dacl, nullptr);
+            if (r != ERROR_SUCCESS)
+                formatMessage(r, &err);
+        }
+    }
+
+    if (psd)
+        LocalFree(psd);
+
+    if (!err.isEmpty())
+        err = QObject::tr("Cannot change the permissions for %1: %2").
+                arg(dir, err);
+
+    return err;
+}
+
+bool WPMUtils::isAdminOwned(const QString &file)
+{
+    bool r = false;
+
+    PSID owner = nullptr;
+    PSECURITY_DESCRIPTOR psd = nullptr;
+    QString native = QDir::toNativeSeparators(file);
+    DWORD e = GetNamedSecurityInfoW(toLPWSTR(native), SE_FILE_OBJECT,
+            OWNER_SECURITY_INFORMATION, &owner, nullptr, nullptr, nullptr,
+            &psd);
+    if (e == ERROR_SUCCESS && owner) {
+        r = IsWellKnownSid(owner, WinBuiltinAdministratorsSid) ||
+                IsWellKnownSid(owner, WinLocalSystemSid);
+    }
+
+    if (psd)
+        LocalFree(psd);
+
+    return r;
+}
@@ -85,6 +85,9 @@ private:
     static void closeHandles(const QList<HANDLE> handles);
 
     static QString getTaskName();
+
+    /** threads for WPMUtils::unzip */
+    static QThreadPool unzipThreadPool;
 public:
     /** true = install programs globally, false = locally */
     static bool adminMode;
@@ -656,12 +659,17 @@ public:
             QCryptographicHash::Algorithm alg);
 
     /**
-     * @brief unzips a file
+     * @brief unzips a file. The central directory is read once and all
+     *     directories are created before the entries are extracted. Archives
+     *     with many entries are extracted by several threads in parallel.
      * @param job job
      * @param zipfile .zip file
      * @param outputdir output directory
+     * @param threads maximum number of threads or 0 for the number of
+     *     processor cores
      */
-    static void unzip(Job* job, const QString zipfile, const QString outputdir);
+    static void unzip(Job* job, const QString zipfile, const QString outputdir,
+            int threads=0);
 
     /**
      * @param job job to monitor the progress. The error message will be set
@@ -813,6 +821,24 @@ public:
 	*/
     static bool hasAdminPrivileges();
 
+    /**
+     * @brief creates a directory that can only be changed by the
+     *     administrators. The permissions of an existing directory are
+     *     replaced.
+     * @param dir the directory
+     * @return error message or ""
+     */
+    static QString createSecureDirectory(const QString& dir);
+
+    /**
+     * @brief checks whether a file or directory is owned by the
+     *     administrators or the local system account
+     * @param file the file or directory
+     * @return true if the owner is BUILTIN\Administrators or SYSTEM. false
+     *     if the file does not exist or the owner cannot be determined.
+     */
+    static bool isAdminOwned(const QString& file);
+
     /**
      * @brief parses the command line and returns the list of chosen package
      *     versions
@@ -0,0 +1,487 @@
+#include "zipstreamextractor.h"
+
+#include <zlib.h>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QTextCodec>
+#include <QLoggingCategory>
+
+#include "wpmutils.h"
+
+/** size of the output buffer for inflate() */
+static const int INFLATE_BUFFER_SIZE = 256 * 1024;
+
+ZipStreamExtractor::ZipStreamExtractor(const QString &outputDir):
+        outputDir(outputDir), state(LOCAL_HEADER), pos(0), centralCount(0),
+        flags(0), method(0), crc(0), compressedSize(0), zip64(false),
+        compressedRead(0), computedCrc(0), out(nullptr), zs(nullptr),
+        inflateBuffer(nullptr)
+{
+    open(QIODevice::WriteOnly);
+
+    if (!QDir().mkpath(outputDir))
+        fail(QObject::tr("Cannot create directory: %0").arg(outputDir));
+}
+
+ZipStreamExtractor::~ZipStreamExtractor()
+{
+    if (zs) {
+        inflateEnd(zs);
+        delete zs;
+    }
+    delete[] inflateBuffer;
+    delete out;
+}
+
+bool ZipStreamExtractor::isSequential() const
+{
+    return true;
+}
+
+void ZipStreamExtractor::fail(const QString &msg)
+{
+    if (state != FAILED) {
+        qCDebug(npackd) << "ZipStreamExtractor::fail" << msg;
+        err = msg;
+        state = FAILED;
+        buffer.clear();
+        pos = 0;
+        if (out) {
+            out->close();
+            delete out;
+            out = nullptr;
+        }
+    }
+}
+
+quint16 ZipStreamExtractor::readUInt16(int offset) const
+{
+    const uchar* p = reinterpret_cast<const uchar*>(buffer.constData()) +
+            pos + offset;
+    return static_cast<quint16>(p[0] | (p[1] << 8));
+}
+
+quint32 ZipStreamExtractor::readUInt32(int offset) const
+{
+    return readUInt16(offset) |
+            (static_cast<quint32>(readUInt16(offset + 2)) << 16);
+}
+
+quint64 ZipStreamExtractor::readUInt64(int offset) const
+{
+    return readUInt32(offset) |
+            (static_cast<quint64>(readUInt32(offset + 4)) << 32);
+}
+
+QString ZipStreamExtractor::decodeName(const QByteArray &raw, quint16 flags)
+{
+    // bit 11: the name is encoded in UTF-8. QuaZip uses the locale encoding
+    // otherwise.
+    if (flags & 0x800)
+        return QString::fromUtf8(raw);
+    else
+        return QTextCodec::codecForLocale()->toUnicode(raw);
+}
+
+qint64 ZipStreamExtractor::readData(char * /*data*/, qint64 /*maxSize*/)
+{
+    return -1;
+}
+
+qint64 ZipStreamExtractor::writeData(const char *data, qint64 len)
+{
+    if (state == FAILED || state == DONE)
+        return len;
+
+    buffer.append(data, static_cast<int>(len));
+
+    while (true) {
+        bool progress;
+        if (state == LOCAL_HEADER)
+            progress = parseLocalHeader();
+        else if (state == FILE_DATA)
+            progress = processFileData();
+        else if (state == DATA_DESCRIPTOR)
+            progress = parseDataDescriptor();
+        else if (state == CENTRAL_DIRECTORY)
+            progress = parseCentralDirectory();
+        else
+            progress = false;
+
+        if (!progress)
+            break;
+    }
+
+    // only the unprocessed part of a header remains
+    if (state == FAILED || state == DONE) {
+        buffer.clear();
+        pos = 0;
+    } else if (pos > 0) {
+        buffer.remove(0, pos);
+        pos = 0;
+    }
+
+    return len;
+}
+
+bool ZipStreamExtractor::parseLocalHeader()
+{
+    int available = buffer.size() - pos;
+    if (available < 4)
+        return false;
+
+    quint32 signature = readUInt32(0);
+    if (signature == 0x02014b50) {
+        state = CENTRAL_DIRECTORY;
+        return true;
+    }
+
+    if (signature != 0x04034b50) {
+        fail(QObject::tr("Unsupported ZIP record 0x%1").arg(signature, 8, 16,
+                QChar('0')));
+        return false;
+    }
+
+    if (available < 30)
+        return false;
+
+    int nameLength = readUInt16(26);
+    int extraLength = readUInt16(28);
+    if (available < 30 + nameLength + extraLength)
+        return false;
+
+    flags = readUInt16(6);
+    method = readUInt16(8);
+    crc = readUInt32(14);
+    compressedSize = readUInt32(18);
+    qint64 uncompressedSize = readUInt32(22);
+    name = decodeName(buffer.mid(pos + 30, nameLength), flags);
+
+    // ZIP64 extended information
+    zip64 = false;
+    int e = 30 + nameLength;
+    int end = e + extraLength;
+    while (e + 4 <= end) {
+        int id = readUInt16(e);
+        int size = readUInt16(e + 2);
+        if (id == 0x0001) {
+            zip64 = true;
+            int f = e + 4;
+            if (uncompressedSize == 0xffffffffLL && f + 8 <= end) {
+                uncompressedSize = static_cast<qint64>(readUInt64(f));
+                f += 8;
+            }
+            if (compressedSize == 0xffffffffLL && f + 8 <= end)
+                compressedSize = static_cast<qint64>(readUInt64(f));
+        }
+        e += 4 + size;
+    }
+
+    pos += 30 + nameLength + extraLength;
+
+    if (flags & 1) {
+        fail(QObject::tr("Encrypted ZIP entries are not supported"));
+        return false;
+    }
+
+    if (method != 0 && method != 8) {
+        fail(QObject::tr("Unsupported compression method %1").arg(method));
+        return false;
+    }
+
+    // bit 3: the sizes follow the data. The end of the data can only be
+    // found for "deflated" entries.
+    if ((flags & 8) && method == 0) {
+        fail(QObject::tr("Stored ZIP entries with a data descriptor are not supported"));
+        return false;
+    }
+
+    QString n = name;
+    n.replace('\\', '/');
+    if (n.isEmpty() || n.startsWith('/') || n.contains(':') ||
+            n.split('/').contains("..")) {
+        fail(QObject::tr("Invalid file name in the ZIP file: %1").arg(name));
+        return false;
+    }
+
+    QString path = outputDir + '/' + n;
+    QString dir = n.endsWith('/') ? path : QFileInfo(path).absolutePath();
+    if (!createdDirs.contains(dir)) {
+        if (!QDir().mkpath(dir)) {
+            fail(QObject::tr("Cannot create directory %1").arg(dir));
+            return false;
+        }
+        createdDirs.insert(dir);
+    }
+
+    compressedRead = 0;
+    computedCrc = static_cast<quint32>(::crc32(0L, Z_NULL, 0));
+
+    if (!n.endsWith('/')) {
+        out = new QFile(path);
+        if (!out->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fail(QObject::tr("Cannot open the file: %0").arg(path));
+            return false;
+        }
+    }
+
+    if (method == 8) {
+        if (!zs)
+            zs = new z_stream;
+        if (!inflateBuffer)
+            inflateBuffer = new char[INFLATE_BUFFER_SIZE];
+        zs->zalloc = nullptr;
+        zs->zfree = nullptr;
+        zs->opaque = nullptr;
+        zs->next_in = nullptr;
+        zs->avail_in = 0;
+
+        // negative window bits: raw deflate data without a header
+        int r = inflateInit2(zs, -MAX_WBITS);
+        if (r != Z_OK) {
+            delete zs;
+            zs = nullptr;
+            fail(QObject::tr("zlib error %1").arg(r));
+            return false;
+        }
+    }
+
+    state = FILE_DATA;
+
+    return true;
+}
+
+bool ZipStreamExtractor::processFileData()
+{
+    bool sizeKnown = !(flags & 8);
+    qint64 available = buffer.size() - pos;
+    if (sizeKnown)
+        available = qMin(available, compressedSize - compressedRead);
+
+    if (method == 0) {
+        if (available > 0) {
+            writeOutput(buffer.constData() + pos, static_cast<int>(available));
+            pos += static_cast<int>(available);
+            compressedRead += available;
+        }
+
+        if (state == FILE_DATA && compressedRead == compressedSize) {
+            finishEntry(crc);
+            return true;
+        }
+
+        return false;
+    }
+
+    // deflated
+    if (available == 0) {
+        if (sizeKnown && compressedRead == compressedSize)
+            fail(QObject::tr("Incomplete compressed data for %1").arg(name));
+        return false;
+    }
+
+    zs->next_in = reinterpret_cast<Bytef*>(buffer.data() + pos);
+    zs->avail_in = static_cast<uInt>(available);
+
+    int r = Z_OK;
+    while (state == FILE_DATA) {
+        zs->next_out = reinterpret_cast<Bytef*>(inflateBuffer);
+        zs->avail_out = INFLATE_BUFFER_SIZE;
+        r = inflate(zs, Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+            fail(QObject::tr("zlib error %1").arg(r));
+            break;
+        }
+
+        writeOutput(inflateBuffer,
+                INFLATE_BUFFER_SIZE - static_cast<int>(zs->avail_out));
+
+        if (r == Z_STREAM_END || r == Z_BUF_ERROR ||
+                (zs->avail_in == 0 && zs->avail_out != 0))
+            break;
+    }
+
+    if (state != FILE_DATA)
+        return false;
+
+    int consumed = static_cast<int>(available) - static_cast<int>(zs->avail_in);
+    pos += consumed;
+    compressedRead += consumed;
+
+    if (r == Z_STREAM_END) {
+        inflateEnd(zs);
+        delete zs;
+        zs = nullptr;
+
+        if (sizeKnown && compressedRead != compressedSize) {
+            fail(QObject::tr("Invalid compressed size for %1").arg(name));
+            return false;
+        }
+
+        finishEntry(crc);
+        return true;
+    }
+
+    return consumed > 0;
+}
+
+void ZipStreamExtractor::writeOutput(const char *data, int len)
+{
+    if (len > 0) {
+        computedCrc = static_cast<quint32>(::crc32(computedCrc,
+                reinterpret_cast<const Bytef*>(data), static_cast<uInt>(len)));
+        if (out && out->write(data, len) != len)
+            fail(QObject::tr("Error writing the file %1: %2").arg(
+                    out->fileName(), out->errorString()));
+    }
+}
+
+void ZipStreamExtractor::finishEntry(quint32 expectedCrc)
+{
+    if (out) {
+        out->close();
+        delete out;
+        out = nullptr;
+    }
+
+    if (flags & 8) {
+        // the CRC-32 follows in the data descriptor
+        state = DATA_DESCRIPTOR;
+    } else if (expectedCrc != computedCrc) {
+        fail(QObject::tr("CRC-32 error in %1").arg(name));
+    } else {
+        extracted.insert(name, computedCrc);
+        state = LOCAL_HEADER;
+    }
+}
+
+bool ZipStreamExtractor::parseDataDescriptor()
+{
+    int available = buffer.size() - pos;
+    if (available < 4)
+        return false;
+
+    // the signature is optional
+    int start = readUInt32(0) == 0x08074b50 ? 4 : 0;
+    int size = start + 4 + (zip64 ? 16 : 8);
+    if (available < size)
+        return false;
+
+    quint32 expectedCrc = readUInt32(start);
+    pos += size;
+
+    if (expectedCrc != computedCrc) {
+        fail(QObject::tr("CRC-32 error in %1").arg(name));
+        return false;
+    }
+
+    extracted.insert(name, computedCrc);
+    state = LOCAL_HEADER;
+
+    return true;
+}
+
+bool ZipStreamExtractor::parseCentralDirectory()
+{
+    int available = buffer.size() - pos;
+    if (available < 4)
+        return false;
+
+    if (readUInt32(0) != 0x02014b50) {
+        // end of the central directory
+        if (centralCount != extracted.count())
+            fail(QObject::tr("The central directory contains %1 entries, but %2 were extracted").
+                    arg(centralCount).arg(extracted.count()));
+        else
+            state = DONE;
+        return false;
+    }
+
+    if (available < 46)
+        return false;
+
+    int nameLength = readUInt16(28);
+    int extraLength = readUInt16(30);
+    int commentLength = readUInt16(32);
+    int size = 46 + nameLength + extraLength + commentLength;
+    if (available < size)
+        return false;
+
+    quint16 f = readUInt16(8);
+    quint32 c = readUInt32(16);
+    QString n = decodeName(buffer.mid(pos + 46, nameLength), f);
+    pos += size;
+    centralCount++;
+
+    if (!extracted.contains(n) || extracted.value(n) != c) {
+        fail(QObject::tr("The entry %1 from the central directory was not extracted").
+                arg(n));
+        return false;
+    }
+
+    return true;
+}
+
+QString ZipStreamExtractor::finish()
+{
+    if (state != DONE && state != FAILED)
+        fail(QObject::tr("Incomplete ZIP file"));
+
+    return err;
+}
+
+QString ZipStreamExtractor::finishRecords()
+{
+    if (state == LOCAL_HEADER && buffer.size() == pos)
+        state = DONE;
+    else if (state != FAILED)
+        fail(QObject::tr("Incomplete ZIP file"));
+
+    return err;
+}
+
+QString ZipStreamExtractor::moveContent(const QString &from,
+        const QString &to)
+{
+    QString r;
+
+    QDir d(from);
+    QFileInfoList entries = d.entryInfoList(QDir::NoDotAndDotDot |
+            QDir::AllEntries | QDir::System | QDir::Hidden);
+    for (int i = 0; i < entries.count(); i++) {
+        const QFileInfo& fi = entries.at(i);
+        QString target = to + '/' + fi.fileName();
+        QFileInfo tfi(target);
+        if (fi.isDir() && tfi.isDir()) {
+            r = moveContent(fi.absoluteFilePath(), target);
+        } else {
+            if (tfi.exists() && !tfi.isDir())
+                QFile::remove(target);
+            if (!d.rename(fi.fileName(), target))
+                r = QObject::tr("Cannot rename %0 to %1").arg(
+                        fi.absoluteFilePath(), target);
+        }
+
+        if (!r.isEmpty())
+            break;
+    }
+
+    return r;
+}
+
+QString ZipStreamExtractor::commit(const QString &target)
+{
+    QString r;
+    if (state != DONE)
+        r = QObject::tr("The ZIP file was not completely extracted");
+    else
+        r = moveContent(outputDir, target);
+
+    return r;
+}
+
+void ZipStreamExtractor::discard()
+{
+    QDir(outputDir).removeRecursively();
+}
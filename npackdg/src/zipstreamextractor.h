@@ -0,0 +1,174 @@
+#ifndef ZIPSTREAMEXTRACTOR_H
+#define ZIPSTREAMEXTRACTOR_H
+
+#include <QIODevice>
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QFile>
+
+struct z_stream_s;
+
+/**
+ * @brief extracts a ZIP file while it is being written to this device (e.g.
+ *     downloaded).
+ *
+ * The local file headers are processed in the order of the data. The entries
+ * are extracted in a staging directory. The central directory at the end of
+ * the file is compared with the extracted entries: an entry that is only
+ * listed in the central directory or an entry with a different CRC-32 makes
+ * the result invalid. Only "stored" and "deflated" entries without encryption
+ * are supported.
+ *
+ * Errors do not stop the writing to this device. The data is ignored after
+ * the first error and finish() returns the error message. The caller should
+ * use WPMUtils::unzip for the complete file in this case.
+ */
+class ZipStreamExtractor: public QIODevice
+{
+private:
+    enum State {
+        LOCAL_HEADER, FILE_DATA, DATA_DESCRIPTOR, CENTRAL_DIRECTORY, DONE,
+        FAILED
+    };
+
+    /** staging directory */
+    QString outputDir;
+
+    State state;
+
+    /** error message */
+    QString err;
+
+    /** data that is not yet processed starts at "pos" */
+    QByteArray buffer;
+
+    int pos;
+
+    /** already created directories */
+    QSet<QString> createdDirs;
+
+    /** name -> CRC-32 for the extracted entries */
+    QHash<QString, quint32> extracted;
+
+    /** number of entries in the central directory */
+    int centralCount;
+
+    // the current entry
+    QString name;
+    quint16 flags;
+    quint16 method;
+    quint32 crc;
+    qint64 compressedSize;
+    bool zip64;
+    qint64 compressedRead;
+    quint32 computedCrc;
+
+    /** [ownership:this] output file or 0 */
+    QFile* out;
+
+    /** [ownership:this] zlib state for "deflated" entries or 0 */
+    z_stream_s* zs;
+
+    /** [ownership:this] output buffer for inflate() */
+    char* inflateBuffer;
+
+    void fail(const QString& msg);
+
+    quint16 readUInt16(int offset) const;
+
+    quint32 readUInt32(int offset) const;
+
+    quint64 readUInt64(int offset) const;
+
+    /**
+     * @param raw file name from the ZIP file
+     * @param flags general purpose flags of the entry
+     * @return decoded file name
+     */
+    static QString decodeName(const QByteArray& raw, quint16 flags);
+
+    /**
+     * @return false if more data is necessary
+     */
+    bool parseLocalHeader();
+
+    /**
+     * @return false if more data is necessary
+     */
+    bool processFileData();
+
+    /**
+     * @return false if more data is necessary
+     */
+    bool parseDataDescriptor();
+
+    /**
+     * @return false if more data is necessary
+     */
+    bool parseCentralDirectory();
+
+    /**
+     * @brief writes extracted data of the current entry
+     * @param data data
+     * @param len length of the data
+     */
+    void writeOutput(const char* data, int len);
+
+    /**
+     * @brief closes the current entry and compares the CRC-32
+     * @param expectedCrc CRC-32 from the ZIP file
+     */
+    void finishEntry(quint32 expectedCrc);
+
+    /**
+     * @brief moves the content of a directory
+     * @param from source directory
+     * @param to target directory. Existing directories will be merged.
+     * @return error message or ""
+     */
+    static QString moveContent(const QString& from, const QString& to);
+protected:
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char* data, qint64 len) override;
+public:
+    /**
+     * @param outputDir staging directory. It will be created if necessary.
+     */
+    explicit ZipStreamExtractor(const QString& outputDir);
+
+    ~ZipStreamExtractor() override;
+
+    bool isSequential() const override;
+
+    /**
+     * @brief should be called after all data was written
+     * @return error message or "" if all entries from the central directory
+     *     were extracted
+     */
+    QString finish();
+
+    /**
+     * @brief should be called instead of finish() if only complete local
+     *     file records without the central directory were written (e.g. the
+     *     changed entries for a delta update)
+     * @return error message or ""
+     */
+    QString finishRecords();
+
+    /**
+     * @brief moves the extracted files from the staging directory. finish()
+     *     should be called before and return no error.
+     * @param target target directory
+     * @return error message or ""
+     */
+    QString commit(const QString& target);
+
+    /**
+     * @brief deletes the staging directory
+     */
+    void discard();
+};
+
+#endif // ZIPSTREAMEXTRACTOR_H